@@ -88,6 +88,20 @@ void TestBlendshapes() {
 
   base_mesh.WriteGltfSeparate(data_dir, "blendshape");
   base_mesh.WriteGlb(data_dir, "blendshape.glb");
+
+  // Round trip with a target without normals, which omits its NORMAL
+  if (!blendshapes.empty()) {
+    blendshapes[0].normals.clear();
+    base_mesh.set_blendshapes(blendshapes);
+    base_mesh.WriteGlb(data_dir, "blendshape_no_normal.glb");
+    ugu::Mesh loaded;
+    bool ok = loaded.LoadGltf(data_dir + "blendshape_no_normal.glb") &&
+              loaded.blendshapes().size() == blendshapes.size();
+    for (size_t i = 0; ok && i < blendshapes.size(); i++) {
+      ok = loaded.blendshapes()[i].vertices == blendshapes[i].vertices;
+    }
+    std::cout << "blendshape round trip: " << (ok ? "OK" : "NG") << std::endl;
+  }
 }
 
 void TestIO() {
@@ -42,6 +42,9 @@ int main(int argc, char* argv[]) {
   // voxel resolution is 10mm
   option.resolution = 10.0f;
 
+  // exact Euclidean distance for silhouette SDF
+  option.sdf_dist_type = ugu::DistanceTransformType::kL2;
+
   carver.set_option(option);
 
   carver.Init();
@@ -6,10 +6,13 @@
 #include <stdio.h>
 
 #include <fstream>
+#include <random>
 
 #include "ugu/image.h"
+#include "ugu/image_codec.h"
 #include "ugu/image_io.h"
 #include "ugu/image_proc.h"
+#include "ugu/timer.h"
 #include "ugu/util/image_util.h"
 
 // test by bunny data with 6 views
@@ -51,6 +54,17 @@ int main(int argc, char* argv[]) {
     ugu::imwrite("../data/color_transfer/result_00.jpg", res);
   }
 
+  {
+    ugu::Image3b target =
+        ugu::Imread<ugu::Image3b>("../data/color_transfer/target_00.jpg");
+    ugu::ImagePyramid<ugu::Vec3b> pyramid = ugu::BuildPyramid(target, 4);
+    for (int i = 0; i < pyramid.level_num(); i++) {
+      ugu::imwrite("../data/color_transfer/target_00_pyramid_" +
+                       std::to_string(i) + ".jpg",
+                   pyramid.level(i));
+    }
+  }
+
   {
     ugu::ImageBase source =
         ugu::imread("../data/poisson_blending/source.png");
@@ -61,5 +75,52 @@ int main(int argc, char* argv[]) {
 
   }
 
+  {
+    // Throughput of the lossless codec and PNG on a noisy 16-bit depth
+    const int w = 640, h = 480;
+    ugu::Image1w depth = ugu::Image1w::zeros(h, w);
+    std::mt19937 engine(0);
+    std::uniform_int_distribution<int> noise(-2, 2);
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        depth.at<uint16_t>(y, x) =
+            static_cast<uint16_t>(1000 + 2 * y + x * x / w + noise(engine));
+      }
+    }
+    const double raw_bytes =
+        static_cast<double>(depth.total() * depth.elemSize());
+    const double mb = raw_bytes / (1024.0 * 1024.0);
+    // Average of 10 runs
+    auto average_msec = [](auto func) {
+      ugu::Timer<> timer;
+      for (int i = 0; i < 10; i++) {
+        timer.Start();
+        func();
+        timer.End();
+      }
+      return timer.average_msec();
+    };
+
+    std::vector<uint8_t> encoded;
+    ugu::Image1w decoded = ugu::Image1w::zeros(h, w);
+    const double enc_ms =
+        average_msec([&] { ugu::EncodeLossless(depth, &encoded); });
+    const double dec_ms = average_msec([&] {
+      ugu::DecodeLossless(encoded.data(), encoded.size(), decoded);
+    });
+    ugu::LOGI("Lossless: %.1f%% of raw, encode %.1f MB/s, decode %.1f MB/s\n",
+              100.0 * static_cast<double>(encoded.size()) / raw_bytes,
+              mb / enc_ms * 1000.0, mb / dec_ms * 1000.0);
+
+    // PNG includes file I/O
+    const std::string png_path = "../data/codec_depth.png";
+    const double png_enc_ms =
+        average_msec([&] { ugu::imwrite(png_path, depth); });
+    const double png_dec_ms = average_msec(
+        [&] { decoded = ugu::Imread<ugu::Image1w>(png_path, -1); });
+    ugu::LOGI("PNG: encode %.1f MB/s, decode %.1f MB/s\n",
+              mb / png_enc_ms * 1000.0, mb / png_dec_ms * 1000.0);
+  }
+
   return 0;
 }
@@ -11,6 +11,7 @@
 #include "ugu/external/external.h"
 #include "ugu/image_io.h"
 #include "ugu/inpaint/inpaint.h"
+#include "ugu/texturing/keyframe_loader.h"
 #include "ugu/texturing/texture_mapper.h"
 #include "ugu/texturing/vertex_colorizer.h"
 #include "ugu/texturing/visibility_tester.h"
@@ -77,9 +78,11 @@ int main(int argc, char* argv[]) {
     std::string color_path =
         data_dir + ugu::zfill(poses[i].first) + "_color.png";
     keyframes[i]->color_path = color_path;
-    keyframes[i]->color = ugu::Imread<ugu::Image3b>(keyframes[i]->color_path);
   }
 
+  // Images are loaded in background and tested as soon as they are ready
+  ugu::KeyframeLoader loader(keyframes);
+
   tester.set_data(input_mesh->vertices(), input_mesh->normals(),
                   input_mesh->vertex_indices());
   tester.PrepareData();
@@ -87,7 +90,7 @@ int main(int argc, char* argv[]) {
   info.vertex_info_list.resize(input_mesh->vertices().size());
   info.face_info_list.resize(input_mesh->vertex_indices().size());
 
-  tester.Test(keyframes, &info);
+  tester.Test(loader, &info);
 
   {
     std::ofstream ofs("./keyframe_info.json");
@@ -17,6 +17,8 @@
 #include "ugu/util/rgbd_util.h"
 #include "ugu/voxel/extract_voxel.h"
 #include "ugu/voxel/marching_cubes.h"
+#include "ugu/voxel/rgbd_fusion.h"
+#include "ugu/voxel/sparse_voxel.h"
 #include "ugu/voxel/voxel.h"
 
 namespace {
@@ -125,12 +127,15 @@ int main(int argc, char* argv[]) {
   }
 
   {
-    ugu::VoxelGrid voxel_grid;
+    // 8 bytes per voxel instead of sizeof(ugu::Voxel)
+    ugu::TsdfVoxelGrid voxel_grid;
     float resolution = 10.f;
     Eigen::Vector3f offset = Eigen::Vector3f::Ones() * resolution * 2;
     voxel_grid.Init(combined->stats().bb_max + offset,
                     combined->stats().bb_min - offset, resolution);
     ugu::VoxelUpdateOption option = ugu::GenFuseDepthDefaultOption(resolution);
+    // Live preview re-meshes only the bricks updated by each frame
+    ugu::IncrementalMarchingCubes preview;
     for (size_t i = 0; i < view_num; i++) {
 #if 0
       ugu::Mesh pc;
@@ -140,6 +145,13 @@ int main(int argc, char* argv[]) {
 #endif
 
       ugu::FuseDepth(*cameras[i], depths[i], option, voxel_grid);
+
+      timer.Start();
+      preview.Update(voxel_grid);
+      timer.End();
+      ugu::LOGI("Preview of frame %d: %d chunks updated in %f ms, %d faces\n",
+                static_cast<int>(i), preview.updated_chunk_num(),
+                timer.elapsed_msec(), preview.face_num());
     }
 
     ugu::MarchingCubes(voxel_grid, depth_fused.get());
@@ -148,6 +160,107 @@ int main(int argc, char* argv[]) {
     depth_fused->WriteObj(data_dir, "depthfuse");
   }
 
+  {
+    // Blocks are allocated only around the surface
+    ugu::SparseVoxelGrid voxel_grid;
+    float resolution = 2.f;
+    voxel_grid.Init(resolution);
+    ugu::VoxelUpdateOption option = ugu::GenFuseDepthDefaultOption(resolution);
+    timer.Start();
+    for (size_t i = 0; i < view_num; i++) {
+      ugu::FuseDepth(*cameras[i], depths[i], option, voxel_grid, colors[i]);
+    }
+    timer.End();
+    ugu::LOGI("SparseVoxelGrid FuseDepth %f ms, %d blocks, %f MB\n",
+              timer.elapsed_msec(), static_cast<int>(voxel_grid.block_num()),
+              voxel_grid.memory_bytes() / 1024.0 / 1024.0);
+
+    ugu::Mesh sparse_fused;
+    ugu::MarchingCubes(voxel_grid, &sparse_fused, 0.0, true);
+    sparse_fused.WritePly(data_dir + "depthfuse_sparse.ply");
+  }
+
+  {
+    // Same as above keeping at most 2000 blocks in memory
+    ugu::SparseVoxelGrid voxel_grid;
+    float resolution = 2.f;
+    voxel_grid.Init(resolution);
+    voxel_grid.EnablePaging(data_dir + "depthfuse_paged.swap", 2000);
+    ugu::VoxelUpdateOption option = ugu::GenFuseDepthDefaultOption(resolution);
+    timer.Start();
+    for (size_t i = 0; i < view_num; i++) {
+      ugu::FuseDepth(*cameras[i], depths[i], option, voxel_grid, colors[i]);
+    }
+    timer.End();
+    const ugu::SparseVoxelGrid::PagingStats& stats = voxel_grid.paging_stats();
+    ugu::LOGI(
+        "Paged FuseDepth %f ms, %d resident and %d paged blocks, %d in and %d "
+        "out, %f MB\n",
+        timer.elapsed_msec(), static_cast<int>(voxel_grid.block_num()),
+        static_cast<int>(voxel_grid.paged_block_num()),
+        static_cast<int>(stats.page_in_num),
+        static_cast<int>(stats.page_out_num),
+        voxel_grid.memory_bytes() / 1024.0 / 1024.0);
+
+    ugu::Mesh paged_fused;
+    ugu::MarchingCubes(voxel_grid, &paged_fused, 0.0, true);
+    paged_fused.WritePly(data_dir + "depthfuse_paged.ply");
+  }
+
+  {
+    // Streaming fusion with poses estimated by ICP
+    constexpr int stream_num = 20;
+    const float step_rad = ugu::radians(1.f);
+    ugu::PinholeCamera camera(160, 120, fov_y_deg);
+    std::vector<Eigen::Affine3d> gt_c2ws;
+    std::vector<ugu::Image1f> stream_depths;
+    std::vector<ugu::Image3b> stream_colors;
+    for (int i = 0; i < stream_num; i++) {
+      Eigen::Matrix3f R;
+      const float rad = step_rad * static_cast<float>(i);
+      Eigen::Vector3f pos(cam_radius * std::cos(rad), cam_height,
+                          cam_radius * std::sin(rad));
+      ugu::c2w(pos, object->stats().center, up, &R);
+      gt_c2ws.push_back((Eigen::Translation3f(pos) * R).cast<double>());
+      auto render_camera = std::make_shared<ugu::PinholeCamera>(camera);
+      render_camera->set_c2w(gt_c2ws.back());
+      renderer->set_camera(render_camera);
+      ugu::Image1f depth;
+      ugu::Image3b color;
+      renderer->Render(&color, &depth, nullptr, nullptr, nullptr);
+      stream_depths.push_back(depth);
+      stream_colors.push_back(color);
+    }
+
+    ugu::RgbdFusionOption option = ugu::GenRgbdFusionDefaultOption(2.f);
+    ugu::RgbdFusion fusion(camera, option, gt_c2ws[0]);
+    timer.Start();
+    for (int i = 0; i < stream_num; i++) {
+      fusion.Push(stream_depths[i], stream_colors[i]);
+    }
+    fusion.Flush();
+    timer.End();
+    double max_err = 0.0;
+    for (const auto& result : fusion.results()) {
+      max_err = std::max(max_err, (result.c2w.translation() -
+                                   gt_c2ws[result.id].translation())
+                                      .norm());
+    }
+    ugu::LOGI("RgbdFusion %f ms/frame, max translation error %f\n",
+              timer.elapsed_msec() / stream_num, max_err);
+
+    ugu::Image1f model_depth;
+    ugu::Image3f model_normal;
+    fusion.GetModelMaps(&model_depth, &model_normal);
+    ugu::Image3b vis_normal;
+    ugu::Normal2Color(model_normal, &vis_normal);
+    ugu::imwrite(data_dir + "stream_model_normal.png", vis_normal);
+
+    ugu::Mesh stream_fused;
+    ugu::MarchingCubes(fusion.volume(), &stream_fused, 0.0, true);
+    stream_fused.WritePly(data_dir + "depthfuse_stream.ply");
+  }
+
 #if 0
   // Merge naive
   {
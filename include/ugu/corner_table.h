@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "ugu/common.h"
+
+namespace ugu {
+
+// Array-based corner table of a triangle mesh.
+// Corner c is the (c % 3)-th vertex of face c / 3. The edge facing corner c
+// runs from Vertex(Next(c)) to Vertex(Prev(c)) and Opposite(c) is the corner
+// facing the reversed edge in the neighboring face.
+// Corners around each vertex are stored in CSR sorted by face index, so that
+// every query is O(1) or O(valence) without hashing.
+class CornerTable {
+ public:
+  // Opposite() of an edge without a neighboring face
+  static constexpr int kBoundary = -1;
+  // Opposite() of an edge shared by more than two faces or with
+  // inconsistent orientation
+  static constexpr int kNonManifold = -2;
+
+  // Pointer range of the CSR
+  class Range {
+   public:
+    Range(const int* begin, const int* end) : begin_(begin), end_(end) {}
+    const int* begin() const { return begin_; }
+    const int* end() const { return end_; }
+    size_t size() const { return static_cast<size_t>(end_ - begin_); }
+    bool empty() const { return begin_ == end_; }
+    int operator[](size_t i) const { return begin_[i]; }
+
+   private:
+    const int* begin_;
+    const int* end_;
+  };
+
+  CornerTable() = default;
+  CornerTable(int num_vertices, const std::vector<Eigen::Vector3i>& indices);
+
+  // Built in parallel. The vertex -> corner CSR is O(#corners) and twins are
+  // searched in one-rings, so O(#corners * valence) in total.
+  void Init(int num_vertices, const std::vector<Eigen::Vector3i>& indices);
+  void Clear();
+  bool Empty() const { return corner_vertices_.empty(); }
+
+  int NumVertices() const { return static_cast<int>(offsets_.size()) - 1; }
+  int NumFaces() const { return NumCorners() / 3; }
+  int NumCorners() const { return static_cast<int>(corner_vertices_.size()); }
+
+  static int Face(int c) { return c / 3; }
+  static int Corner(int f, int k) { return f * 3 + k; }
+  static int Next(int c) { return c % 3 == 2 ? c - 2 : c + 1; }
+  static int Prev(int c) { return c % 3 == 0 ? c + 2 : c - 1; }
+
+  int Vertex(int c) const { return corner_vertices_[c]; }
+  int Opposite(int c) const { return opposites_[c]; }
+  bool IsBoundary(int c) const { return opposites_[c] == kBoundary; }
+  // Next corner around Vertex(c), or a negative value at a boundary or
+  // non-manifold edge
+  int Swing(int c) const {
+    const int o = opposites_[Next(c)];
+    return o < 0 ? o : Next(o);
+  }
+
+  // Corners of a vertex sorted by face index
+  Range VertexCorners(int v) const {
+    return Range(vertex_corners_.data() + offsets_[v],
+                 vertex_corners_.data() + offsets_[v + 1]);
+  }
+  int Valence(int v) const { return offsets_[v + 1] - offsets_[v]; }
+
+  // Faces sharing an edge with face_id in the order of edges (0, 1), (1, 2),
+  // (2, 0). Boundary and non-manifold edges are skipped.
+  void GetAdjacentFaces(int face_id, std::vector<int>* adjacent_face_ids) const;
+  // Faces sharing a vertex with face_id excluding itself, sorted
+  void GetAdjacentFacesByVertex(int face_id,
+                                std::vector<int>* adjacent_face_ids) const;
+  // Faces of a vertex sorted by face index
+  void GetVertexFaces(int v, std::vector<int>* face_ids) const;
+  // One-ring vertices, sorted
+  void GetVertexNeighbors(int v, std::vector<int>* neighbor_vids) const;
+
+  // Reversed edges of boundary corners, i.e. the half-edges missing in the
+  // mesh. Ordered by face and then by the edges (0, 1), (1, 2), (2, 0) as
+  // FaceAdjacency::GetBoundaryEdges().
+  std::vector<std::pair<int, int>> GetBoundaryEdges() const;
+  // Corners facing non-manifold edges
+  int NumNonManifoldCorners() const;
+
+ private:
+  std::vector<int> corner_vertices_;
+  std::vector<int> opposites_;
+  std::vector<int> offsets_ = {0};
+  std::vector<int> vertex_corners_;
+};
+
+}  // namespace ugu
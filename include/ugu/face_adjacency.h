@@ -31,6 +31,9 @@ namespace ugu {
 
 using Adjacency = std::vector<std::set<int>>;
 
+// Editable face adjacency (RemoveFace(), OverwriteFace()). For static meshes,
+// CornerTable in ugu/corner_table.h answers the same queries without the
+// O(log n) lookups of the sparse matrix.
 class FaceAdjacency {
  private:
   // https://qiita.com/shinjiogaki/items/d16abb018a843c09b8c8
@@ -152,7 +155,7 @@ class FaceAdjacency {
 
   Adjacency GenerateAdjacentFacesByVertex(
       const Adjacency& vertex_adjacency,
-      std::unordered_map<int, std::vector<int>> v2f) const {
+      const std::unordered_map<int, std::vector<int>>& v2f) const {
     Adjacency res(vertex_indices_.size());
 
     for (int face_id = 0; face_id < static_cast<int>(vertex_indices_.size());
@@ -168,8 +171,11 @@ class FaceAdjacency {
       std::set<int>& connecting = res[face_id];
       const auto& face = vertex_indices_[face_id];
       for (const auto& vid : connecting_vids) {
-        const auto& fids = v2f[vid];
-        for (const auto& fid : fids) {
+        const auto fids = v2f.find(vid);
+        if (fids == v2f.end()) {
+          continue;
+        }
+        for (const auto& fid : fids->second) {
           const auto& face_ = vertex_indices_[fid];
           bool ok = false;
           for (int i = 0; i < 3; i++) {
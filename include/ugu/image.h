@@ -351,9 +351,11 @@ class ImageBase {
   int cv_ch = -1;
   int bit_depth_ = -1;
   const std::type_info* cpp_type;
-  std::shared_ptr<std::vector<uint8_t> > data_{nullptr};
+  // Owner of the pixel memory pointed by data. Usually std::vector<uint8_t>
+  // but may be an external buffer (e.g. allocated by a decoder)
+  std::shared_ptr<void> data_{nullptr};
 
-  void Init(int rows_, int cols_, int type) {
+  void InitHeader(int rows_, int cols_, int type) {
     if (rows_ < 0 || cols_ < 0) {
       throw std::runtime_error("Type error");
     }
@@ -366,15 +368,20 @@ class ImageBase {
     cv_ch = CV_GETCN(type);
     bit_depth_ = GetBitsFromCvType(cv_type) / 8;
     cpp_type = &GetTypeidFromCvType(cv_type);
-    data_ = std::make_shared<std::vector<uint8_t> >();
-    data_->resize(static_cast<size_t>(rows) * static_cast<size_t>(cols) *
-                  cv_ch * bit_depth_);
-    data = reinterpret_cast<uint8_t*>(data_->data());
 
     step[0] = size_t(cols * bit_depth_ * cv_ch);
     step[1] = 1;
   }
 
+  void Init(int rows_, int cols_, int type) {
+    InitHeader(rows_, cols_, type);
+    auto buf = std::make_shared<std::vector<uint8_t> >(
+        static_cast<size_t>(rows) * static_cast<size_t>(cols) * cv_ch *
+        bit_depth_);
+    data = buf->data();
+    data_ = buf;
+  }
+
  public:
   int rows{-1};
   int cols{-1};
@@ -382,6 +389,13 @@ class ImageBase {
   uint8_t* data{nullptr};
 
   ImageBase(int rows, int cols, int type) { Init(rows, cols, type); }
+  // Wrap external memory without copy. owner keeps the memory alive.
+  ImageBase(int rows, int cols, int type, void* external_data,
+            std::shared_ptr<void> owner) {
+    InitHeader(rows, cols, type);
+    data = reinterpret_cast<uint8_t*>(external_data);
+    data_ = std::move(owner);
+  }
   ImageBase() { Init(0, 0, 0); };
   template <typename _Tp, int m, int n>
   ImageBase(const Matx<_Tp, m, n>& rhs) {
@@ -505,7 +519,7 @@ class ImageBase {
 #if 0
     zero = 0;
 #else
-    std::memset(zero.data_->data(), 0, SizeInBytes(zero));
+    std::memset(zero.data, 0, SizeInBytes(zero));
 #endif
     return zero;
   }
@@ -514,7 +528,7 @@ class ImageBase {
     if (dst.cols != cols || dst.rows != rows) {
       dst = zeros(rows, cols, cv_type);
     }
-    std::memcpy(dst.data_->data(), data_->data(), SizeInBytes(*this));
+    std::memcpy(dst.data, data, SizeInBytes(*this));
   }
 
   ImageBase clone() const {
@@ -572,12 +586,12 @@ class ImageBase {
     ImageBase tmp_double =
         ImageBase(rows, cols, MakeCvType(&typeid(double), channels()));
     // Convert to double
-#define UGU_COPY_DOUBLE(type)                                                \
-  for (size_t i = 0; i < m.total() * m.channels(); i++) {                    \
-    *(reinterpret_cast<double*>(tmp_double.data_->data()) + i) =             \
-        static_cast<double>(*(reinterpret_cast<type*>(data_->data()) + i)) * \
-            alpha +                                                          \
-        beta;                                                                \
+#define UGU_COPY_DOUBLE(type)                                       \
+  for (size_t i = 0; i < m.total() * m.channels(); i++) {           \
+    *(reinterpret_cast<double*>(tmp_double.data) + i) =             \
+        static_cast<double>(*(reinterpret_cast<type*>(data) + i)) * \
+            alpha +                                                 \
+        beta;                                                       \
   }
     auto copy_to_double_func = [&]() {
       if (*cpp_type == typeid(uint8_t)) {
@@ -602,10 +616,10 @@ class ImageBase {
     copy_to_double_func();
 
     // Double to target
-#define UGU_COPY_TARGET(type)                                              \
-  for (size_t i = 0; i < m.total() * m.channels(); i++) {                  \
-    *(reinterpret_cast<type*>(m.data_->data()) + i) = saturate_cast<type>( \
-        *(reinterpret_cast<double*>(tmp_double.data_->data()) + i));       \
+#define UGU_COPY_TARGET(type)                                     \
+  for (size_t i = 0; i < m.total() * m.channels(); i++) {         \
+    *(reinterpret_cast<type*>(m.data) + i) = saturate_cast<type>( \
+        *(reinterpret_cast<double*>(tmp_double.data) + i));       \
   }
     auto copy_to_target_func = [&]() {
       if (GetTypeidFromCvType(m.type()) == typeid(uint8_t)) {
@@ -654,25 +668,25 @@ class ImageBase {
 
   ImageBase& operator=(const double& rhs) {
     if (rhs == 0.0) {
-      std::memset(data_->data(), 0, SizeInBytes(*this));
+      std::memset(data, 0, SizeInBytes(*this));
       return *this;
     }
 
 #if 0
-#define UGU_FILL_CAST(type)                                                 \
-  for (size_t i = 0; i < total() * channels(); i++) {                       \
-    *(reinterpret_cast<type*>(data_->data()) + i) = static_cast<type>(rhs); \
+#define UGU_FILL_CAST(type)                                        \
+  for (size_t i = 0; i < total() * channels(); i++) {              \
+    *(reinterpret_cast<type*>(data) + i) = static_cast<type>(rhs); \
   }
 #else
-#define UGU_FILL_CAST(type)                             \
-  for (int y = 0; y < rows; y++) {                      \
-    for (int x = 0; x < cols; x++) {                    \
-      for (int c = 0; c < channels(); c++) {            \
-        int index = (x + y * cols) * channels() + c;    \
-        reinterpret_cast<type*>(data_->data())[index] = \
-            static_cast<type>(rhs);                     \
-      }                                                 \
-    }                                                   \
+#define UGU_FILL_CAST(type)                          \
+  for (int y = 0; y < rows; y++) {                   \
+    for (int x = 0; x < cols; x++) {                 \
+      for (int c = 0; c < channels(); c++) {         \
+        int index = (x + y * cols) * channels() + c; \
+        reinterpret_cast<type*>(data)[index] =       \
+            static_cast<type>(rhs);                  \
+      }                                              \
+    }                                                \
   }
 #endif
 
@@ -865,7 +879,7 @@ class Image : public ImageBase {
 #if 0
     zero = 0.0
 #else
-    std::memset(zero.data_->data(), 0, SizeInBytes(zero));
+    std::memset(zero.data, 0, SizeInBytes(zero));
 #endif
     return zero;
   }
@@ -910,7 +924,7 @@ class Image : public ImageBase {
   Image<T>& operator=(const TT& rhs) {
 #pragma omp parallel for
     for (int64_t i = 0; i < static_cast<int64_t>(total()); i++) {
-      *(reinterpret_cast<T*>(data_->data()) + i) = rhs;
+      *(reinterpret_cast<T*>(data) + i) = rhs;
     }
     return *this;
   }
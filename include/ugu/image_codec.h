@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "ugu/image.h"
+
+namespace ugu {
+
+// Fast lossless codec for depth (Image1w), float maps (Image1f, Image3f) and
+// other images. Rows are split into independent chunks and each chunk is
+// 1) predicted by the left pixel of the same channel (the upper pixel at the
+//    beginning of a row) as integers of the channel width,
+// 2) split into byte planes so that the mostly constant high bytes of the
+//    residuals line up,
+// 3) compressed by an LZ77 byte coder.
+// Chunks are encoded/decoded in parallel.
+// Having no entropy coder, it trades the ratio for speed. On one core with a
+// 640x480 16-bit depth, against libpng at zlib level 1 (ex06 times PNG):
+//   smooth:      0.5% of raw, 712/376 MB/s encode/decode (PNG 8%, 90/187)
+//   noise +-2:  63% of raw, 135/222 MB/s encode/decode (PNG 30%, 33/71)
+bool EncodeLossless(const ImageBase& img, std::vector<uint8_t>* encoded,
+                    int num_threads = -1);
+// img must be allocated with the shape and type of the encoded image
+bool DecodeLossless(const uint8_t* encoded, size_t size, ImageBase& img,
+                    int num_threads = -1);
+
+}  // namespace ugu
@@ -23,6 +23,7 @@ namespace ugu {
 
 using ImreadModes = cv::ImreadModes;
 
+using cv::imdecode;
 using cv::imread;
 using cv::imwrite;
 
@@ -50,8 +51,28 @@ bool imwrite(const std::string& filename, const ImageBase& img,
              const std::vector<int>& params = std::vector<int>());
 ImageBase imread(const std::string& filename,
                  int flags = ImreadModes::IMREAD_COLOR);
+// Decode an encoded image (e.g. .png, .jpg) in memory
+ImageBase imdecode(const std::vector<uint8_t>& buf, int flags);
 #endif
 
+// Decode an encoded image in memory without copying it (e.g. a mapped file)
+ImageBase imdecode(const uint8_t* buf, size_t size, int flags);
+
+enum class ImageBinaryCompression : uint32_t {
+  kNone = 0,
+  kLossless = 1  // EncodeLossless() in image_codec.h
+};
+
+// Self-describing binary image (.ugi): a 64 byte header with shape, type and
+// compression followed by the pixels
+bool WriteImageBinary(
+    const std::string& path, const ImageBase& img,
+    ImageBinaryCompression compression = ImageBinaryCompression::kNone);
+// use_mmap=true: the returned image is a view on the mapped file without copy
+// (a copy with OpenCV) if not compressed. Writes to the view are not reflected
+// to the file.
+ImageBase LoadImageBinary(const std::string& path, bool use_mmap = true);
+
 template <typename T>
 T Imread(const std::string& filename, int flags = ImreadModes::IMREAD_COLOR) {
   ImageBase loaded = imread(filename, flags);
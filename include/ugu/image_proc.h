@@ -5,6 +5,10 @@
 
 #pragma once
 
+#include <map>
+#include <utility>
+#include <vector>
+
 #include "ugu/image.h"
 #include "ugu/point.h"
 #include "ugu/rect.h"
@@ -571,25 +575,35 @@ Image<T> ResizeNearest(const Image<T>& src, int out_w, int out_h) {
   float ratio_h = static_cast<float>(src.rows) / static_cast<float>(out_h);
   float ratio_w = static_cast<float>(src.cols) / static_cast<float>(out_w);
 
-  dst.forEach([&](T& val, const int* yx) {
-    int src_x = static_cast<int>(ratio_w * yx[1]);
-    int src_y = static_cast<int>(ratio_h * yx[0]);
-    val = src.template at<T>(src_y, src_x);
-  });
+  std::vector<int> src_xs(out_w);
+  for (int x = 0; x < out_w; x++) {
+    src_xs[x] = std::min(static_cast<int>(ratio_w * x), src.cols - 1);
+  }
+
+  auto row_func = [&](int y) {
+    const int src_y = std::min(static_cast<int>(ratio_h * y), src.rows - 1);
+    const T* src_row = &src.template at<T>(src_y, 0);
+    T* dst_row = &dst.template at<T>(y, 0);
+    for (int x = 0; x < out_w; x++) {
+      dst_row[x] = src_row[src_xs[x]];
+    }
+  };
+  parallel_for(0, out_h, row_func);
 
   return dst;
 }
 
+// Separable resampling with precomputed filter coefficient tables.
+// INTER_LINEAR, INTER_CUBIC, INTER_AREA and INTER_LANCZOS4 are supported.
+bool ResizeSeparable(const ImageBase& src, ImageBase& dst, int out_w,
+                     int out_h, int interpolation);
+
 template <typename T>
 void resize(const Image<T>& src, Image<T>& dst, Size dsize, double fx = 0.0,
             double fy = 0.0,
             int interpolation = InterpolationFlags::INTER_LINEAR) {
-#ifdef UGU_USE_STB
-  (void)interpolation;
-
   int w = src.cols;
   int h = src.rows;
-  int n = src.channels();
 
   int out_w, out_h;
   if (dsize.height <= 0 || dsize.width <= 0) {
@@ -610,29 +624,7 @@ void resize(const Image<T>& src, Image<T>& dst, Size dsize, double fx = 0.0,
     return;
   }
 
-  dst = Image<T>::zeros(out_h, out_w);
-
-  const std::type_info* cpp_type_src = &GetTypeidFromCvType(src.type());
-  assert(*cpp_type_src == typeid(float) || *cpp_type_src == typeid(uint8_t));
-
-  if (*cpp_type_src == typeid(float)) {
-    stbir_resize_float(reinterpret_cast<float*>(src.data), w, h, 0,
-                       reinterpret_cast<float*>(dst.data), out_w, out_h, 0, n);
-  } else {
-    stbir_resize_uint8(src.data, w, h, 0, dst.data, out_w, out_h, 0, n);
-  }
-
-  return;
-#else
-  (void)src;
-  (void)dst;
-  (void)dsize;
-  (void)fx;
-  (void)fy;
-  (void)interpolation;
-  LOGE("can't resize image with this configuration\n");
-  return;
-#endif
+  ResizeSeparable(src, dst, out_w, out_h, interpolation);
 }
 
 template <typename T>
@@ -755,4 +747,90 @@ void line(Image<T>& img, Point pt1, Point pt2, const T& color,
 
 #endif
 
+// Image pyramid built from finer to coarser levels at once. Level 0 is the
+// source. Levels and any other sizes requested later are cached so that
+// coarse-to-fine algorithms do not resize the same image repeatedly.
+template <typename T>
+class ImagePyramid {
+ public:
+  ImagePyramid() = default;
+  ~ImagePyramid() = default;
+
+  bool Build(const Image<T>& src, int level_num, double scale = 0.5,
+             int interpolation = InterpolationFlags::INTER_AREA) {
+    levels_.clear();
+    cache_.clear();
+    interpolation_ = interpolation;
+    if (src.empty() || level_num < 1 || scale <= 0.0 || 1.0 <= scale) {
+      LOGE("Wrong pyramid parameters\n");
+      return false;
+    }
+
+    levels_.push_back(src.clone());
+    for (int i = 1; i < level_num; i++) {
+      const Image<T>& prev = levels_.back();
+      int w = static_cast<int>(std::round(prev.cols * scale));
+      int h = static_cast<int>(std::round(prev.rows * scale));
+      if (w < 1 || h < 1) {
+        break;
+      }
+      Image<T> cur;
+      resize(prev, cur, Size(w, h), 0.0, 0.0, interpolation_);
+      levels_.push_back(cur);
+    }
+    return true;
+  }
+
+  int level_num() const { return static_cast<int>(levels_.size()); }
+
+  const Image<T>& level(int i) const { return levels_[i]; }
+
+  const std::vector<Image<T>>& levels() const { return levels_; }
+
+  // Returns the image of the given size. Resized from the coarsest level
+  // which is not smaller than the size, only at the first request.
+  const Image<T>& Get(int width, int height) {
+    for (const auto& l : levels_) {
+      if (l.cols == width && l.rows == height) {
+        return l;
+      }
+    }
+
+    const auto key = std::make_pair(width, height);
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+      return it->second;
+    }
+
+    const Image<T>* base = &levels_.front();
+    for (const auto& l : levels_) {
+      if (width <= l.cols && height <= l.rows) {
+        base = &l;
+      }
+    }
+    Image<T> resized;
+    resize(*base, resized, Size(width, height), 0.0, 0.0, interpolation_);
+    return cache_.emplace(key, resized).first->second;
+  }
+
+  void Clear() {
+    levels_.clear();
+    cache_.clear();
+  }
+
+ private:
+  std::vector<Image<T>> levels_;
+  std::map<std::pair<int, int>, Image<T>> cache_;
+  int interpolation_{InterpolationFlags::INTER_AREA};
+};
+
+template <typename T>
+ImagePyramid<T> BuildPyramid(
+    const Image<T>& src, int level_num, double scale = 0.5,
+    int interpolation = InterpolationFlags::INTER_AREA) {
+  ImagePyramid<T> pyramid;
+  pyramid.Build(src, level_num, scale, interpolation);
+  return pyramid;
+}
+
 }  // namespace ugu
@@ -13,6 +13,7 @@
 
 #include "ugu/common.h"
 #include "ugu/image.h"
+#include "ugu/util/cow_vector.h"
 
 namespace ugu {
 
@@ -80,28 +81,28 @@ using MeshPtr = std::shared_ptr<Mesh>;
 
 class Mesh {
  protected:
-  std::vector<Eigen::Vector3f> vertices_;
-  std::vector<Eigen::Vector3f> vertex_colors_;   // optional, RGB order
-  std::vector<Eigen::Vector3i> vertex_indices_;  // face
+  CowVector<Eigen::Vector3f> vertices_;
+  CowVector<Eigen::Vector3f> vertex_colors_;   // optional, RGB order
+  CowVector<Eigen::Vector3i> vertex_indices_;  // face
 
-  std::vector<Eigen::Vector3f> normals_;       // normal per vertex
-  std::vector<Eigen::Vector3f> face_normals_;  // normal per face
-  std::vector<Eigen::Vector3i> normal_indices_;
+  CowVector<Eigen::Vector3f> normals_;       // normal per vertex
+  CowVector<Eigen::Vector3f> face_normals_;  // normal per face
+  CowVector<Eigen::Vector3i> normal_indices_;
 
-  std::vector<Eigen::Vector2f> uv_;
-  std::vector<Eigen::Vector3i> uv_indices_;
+  CowVector<Eigen::Vector2f> uv_;
+  CowVector<Eigen::Vector3i> uv_indices_;
 
-  std::vector<ObjMaterial> materials_;
+  CowVector<ObjMaterial> materials_;
 
   // material_ids_[i]: face index i's material id.
   // This is used to access materials_.
-  std::vector<int> material_ids_;
+  CowVector<int> material_ids_;
 
   // face_indices_per_material_[i]: the vector of material i's face indices.
-  std::vector<std::vector<int>> face_indices_per_material_;
+  CowVector<std::vector<int>> face_indices_per_material_;
   MeshStats stats_;
 
-  std::vector<Blendshape> blendshapes_;
+  CowVector<Blendshape> blendshapes_;
 
   // To keep key (sec.) order, use map
   std::map<float, AnimKeyframe> keyframes_;
@@ -149,28 +150,52 @@ class Mesh {
   const std::vector<Blendshape>& blendshapes() const;
   const std::map<float, AnimKeyframe>& keyframes() const;
   const AnimInterp& anim_interp() const;
+  // Bytes of the attribute buffers including textures. A buffer shared by n
+  // copies counts 1/n, so the sum over the copies is the memory in use.
+  size_t memory_bytes() const;
 
+  // Attributes are shared among copies of Mesh until modified. Overloads
+  // taking rvalues move the vectors without copy.
   bool set_vertices(const std::vector<Eigen::Vector3f>& vertices);
+  bool set_vertices(std::vector<Eigen::Vector3f>&& vertices);
   bool set_vertex_colors(const std::vector<Eigen::Vector3f>& vertex_colors);
+  bool set_vertex_colors(std::vector<Eigen::Vector3f>&& vertex_colors);
   bool set_vertex_indices(const std::vector<Eigen::Vector3i>& vertex_indices);
+  bool set_vertex_indices(std::vector<Eigen::Vector3i>&& vertex_indices);
   bool set_normals(const std::vector<Eigen::Vector3f>& normals);
+  bool set_normals(std::vector<Eigen::Vector3f>&& normals);
   bool set_face_normals(const std::vector<Eigen::Vector3f>& face_normals);
+  bool set_face_normals(std::vector<Eigen::Vector3f>&& face_normals);
   bool set_normal_indices(const std::vector<Eigen::Vector3i>& normal_indices);
+  bool set_normal_indices(std::vector<Eigen::Vector3i>&& normal_indices);
   bool set_uv(const std::vector<Eigen::Vector2f>& uv);
+  bool set_uv(std::vector<Eigen::Vector2f>&& uv);
   bool set_uv_indices(const std::vector<Eigen::Vector3i>& uv_indices);
+  bool set_uv_indices(std::vector<Eigen::Vector3i>&& uv_indices);
   bool set_material_ids(const std::vector<int>& material_ids);
+  bool set_material_ids(std::vector<int>&& material_ids);
   bool set_materials(const std::vector<ObjMaterial>& materials);
+  bool set_materials(std::vector<ObjMaterial>&& materials);
   bool set_single_material(const ObjMaterial& material);
   bool set_default_material();
   bool set_face_indices_per_material(
       const std::vector<std::vector<int>>& face_indices_per_material);
+  bool set_face_indices_per_material(
+      std::vector<std::vector<int>>&& face_indices_per_material);
   bool set_blendshapes(const std::vector<Blendshape>& blendshapes);
+  bool set_blendshapes(std::vector<Blendshape>&& blendshapes);
   bool set_keyframes(const std::map<float, AnimKeyframe>& keyframes);
+  bool set_keyframes(std::map<float, AnimKeyframe>&& keyframes);
   bool set_anim_interp(const AnimInterp& anim_interp);
 
   bool LoadObj(const std::string& obj_path, const std::string& mtl_dir = "");
   bool LoadPly(const std::string& ply_path);
-  bool WritePly(const std::string& ply_path) const;
+  // binary=true: binary little endian
+  bool WritePly(const std::string& ply_path, bool binary = true) const;
+  // Native binary container (.ugm). See mesh_binary.h
+  bool LoadBinary(const std::string& path);
+  // compress=true: lossless compression of large arrays
+  bool WriteBinary(const std::string& path, bool compress = false) const;
   // not const since this will update texture name and path
   bool WriteObj(const std::string& obj_dir, const std::string& obj_basename,
                 const std::string& mtl_basename = "", bool write_obj = true,
@@ -181,6 +206,8 @@ class Mesh {
                          bool is_unlit = false);
   bool WriteGlb(const std::string& glb_dir, const std::string& glb_name,
                 bool is_unlit = false);
+  // Meshes of all nodes are merged in the world coordinate
+  bool LoadGltf(const std::string& path);
 
   int RemoveVertices(const std::vector<bool>& valid_vertex_table);
   int RemoveUnreferencedVertices();
@@ -204,6 +231,8 @@ bool WriteGltfSeparate(Scene& scene, const std::string& gltf_dir,
                        const std::string& gltf_basename, bool is_unlit = false);
 bool WriteGlb(Scene& scene, const std::string& glb_dir,
               const std::string& glb_name, bool is_unlit = false);
+// .gltf or .glb. A mesh per node instance.
+bool LoadGltf(const std::string& path, Scene* scene);
 
 std::tuple<int, std::vector<int>, std::vector<Eigen::Vector3f>,
            std::vector<Eigen::Vector3f>, std::vector<Eigen::Vector2f>,
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ugu/image.h"
+#include "ugu/util/io_util.h"
+
+namespace ugu {
+
+// Native binary mesh container (.ugm)
+//
+// | header (64 bytes) | array table (64 bytes per array) | arrays |
+//
+// Every array starts at a 64 byte aligned offset so that uncompressed arrays
+// can be used directly from a mapped file.
+
+enum class MeshBinaryArray : uint32_t {
+  kVertices = 0,
+  kVertexColors = 1,
+  kVertexIndices = 2,
+  kNormals = 3,
+  kFaceNormals = 4,
+  kNormalIndices = 5,
+  kUv = 6,
+  kUvIndices = 7,
+  kMaterialIds = 8,
+  kFaceIndicesPerMaterial = 9,  // index: material
+  kMaterials = 10,              // serialized parameters
+  kDiffuseTexture = 11,         // index: material
+  kWithAlphaTexture = 12,       // index: material
+  kBlendshapes = 13,            // serialized parameters
+  kBlendshapeVertices = 14,     // index: blendshape
+  kBlendshapeNormals = 15,      // index: blendshape
+  kKeyframes = 16               // serialized keyframes
+};
+
+enum class MeshBinaryCompression : uint32_t {
+  kNone = 0,
+  kLossless = 1  // EncodeLossless() in image_codec.h
+};
+
+// Entry of the array table. Each array is a rows x cols image of cv_type.
+// 1D arrays have cols == 1.
+struct MeshBinaryArrayInfo {
+  uint32_t type;
+  uint32_t index;
+  int32_t cv_type;
+  uint32_t compression;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t offset;       // From the beginning of the file
+  uint64_t stored_size;  // Bytes in the file
+  uint64_t raw_size;     // Bytes after decompression
+  uint8_t reserved[8];
+};
+
+class MeshBinaryWriter {
+ public:
+  explicit MeshBinaryWriter(
+      MeshBinaryCompression compression = MeshBinaryCompression::kNone);
+
+  // data is not copied and must be alive until Write()
+  void Add(MeshBinaryArray type, uint32_t index, int cv_type, size_t rows,
+           size_t cols, const void* data);
+  template <typename T>
+  void Add(MeshBinaryArray type, const std::vector<T>& array, int cv_type,
+           uint32_t index = 0) {
+    if (!array.empty()) {
+      Add(type, index, cv_type, array.size(), 1, array.data());
+    }
+  }
+  void Add(MeshBinaryArray type, const ImageBase& image, uint32_t index = 0);
+
+  bool Write(const std::string& path) const;
+
+ private:
+  struct Item {
+    MeshBinaryArrayInfo info;
+    const void* data;
+  };
+  MeshBinaryCompression compression_;
+  std::vector<Item> items_;
+  std::vector<ImageBase> images_;  // Keep continuous copies alive
+};
+
+// Maps a .ugm file and hands out arrays without parsing
+class MeshBinaryView {
+ public:
+  bool Open(const std::string& path);
+  void Close();
+  bool is_open() const { return file_ != nullptr; }
+
+  const std::vector<MeshBinaryArrayInfo>& arrays() const { return arrays_; }
+  // nullptr if not found
+  const MeshBinaryArrayInfo* Find(MeshBinaryArray type,
+                                  uint32_t index = 0) const;
+
+  // Pointer into the mapped file. nullptr if not found or compressed.
+  const void* Map(MeshBinaryArray type, uint32_t index = 0) const;
+
+  // Copies (or decodes) raw_size bytes to dst
+  bool Read(MeshBinaryArray type, uint32_t index, void* dst) const;
+  template <typename T>
+  bool Read(MeshBinaryArray type, std::vector<T>* array,
+            uint32_t index = 0) const {
+    const MeshBinaryArrayInfo* info = Find(type, index);
+    if (info == nullptr || info->raw_size % sizeof(T) != 0) {
+      array->clear();
+      return false;
+    }
+    array->resize(info->raw_size / sizeof(T));
+    return Read(type, index, array->data());
+  }
+
+  // Uncompressed images refer to the mapped file without copy
+  ImageBase ReadImage(MeshBinaryArray type, uint32_t index = 0) const;
+
+ private:
+  MappedFilePtr file_;
+  std::vector<MeshBinaryArrayInfo> arrays_;
+};
+
+}  // namespace ugu
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "ugu/camera.h"
+#include "ugu/mesh.h"
+
+namespace ugu {
+
+// Structure-of-arrays storage of 3D vectors (x..., y..., z...).
+// Components are aligned for the vectorized kernels below.
+class Vec3fSoA {
+ public:
+  Vec3fSoA() = default;
+  explicit Vec3fSoA(size_t size);
+  explicit Vec3fSoA(const std::vector<Eigen::Vector3f>& aos);
+
+  void resize(size_t size);
+  void clear();
+  size_t size() const { return x_.size(); }
+  bool empty() const { return x_.empty(); }
+
+  float* x() { return x_.data(); }
+  float* y() { return y_.data(); }
+  float* z() { return z_.data(); }
+  const float* x() const { return x_.data(); }
+  const float* y() const { return y_.data(); }
+  const float* z() const { return z_.data(); }
+
+  Eigen::Vector3f operator[](size_t i) const {
+    return Eigen::Vector3f(x_[i], y_[i], z_[i]);
+  }
+  void set(size_t i, const Eigen::Vector3f& v) {
+    x_[i] = v[0];
+    y_[i] = v[1];
+    z_[i] = v[2];
+  }
+
+  // Conversion from/to the AoS layout of Mesh
+  void FromAoS(const std::vector<Eigen::Vector3f>& aos);
+  void ToAoS(std::vector<Eigen::Vector3f>* aos) const;
+
+ private:
+  using Array = std::vector<float, Eigen::aligned_allocator<float>>;
+  Array x_, y_, z_;
+};
+
+// SoA counterparts of the Mesh kernels. Results match the AoS versions up to
+// floating point rounding.
+void TransformSoA(const Eigen::Affine3f& T, Vec3fSoA* points);
+void RotateSoA(const Eigen::Matrix3f& R, Vec3fSoA* directions);
+void CalcFaceNormalSoA(const Vec3fSoA& vertices,
+                       const std::vector<Eigen::Vector3i>& indices,
+                       Vec3fSoA* face_normals);
+void CalcNormalSoA(const Vec3fSoA& vertices,
+                   const std::vector<Eigen::Vector3i>& indices,
+                   Vec3fSoA* normals);
+MeshStats CalcStatsSoA(const Vec3fSoA& points);
+
+// World -> camera -> image of a pinhole camera. image z is camera depth.
+void ProjectPinholeSoA(const Vec3fSoA& points_w, const Eigen::Matrix3f& w2c_R,
+                       const Eigen::Vector3f& w2c_t,
+                       const Eigen::Vector2f& focal_length,
+                       const Eigen::Vector2f& principal_point,
+                       Vec3fSoA* points_c, Vec3fSoA* points_i);
+
+}  // namespace ugu
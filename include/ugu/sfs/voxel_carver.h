@@ -12,6 +12,7 @@
 #include "ugu/common.h"
 #include "ugu/image.h"
 #include "ugu/mesh.h"
+#include "ugu/util/image_util.h"
 #include "ugu/voxel/voxel.h"
 
 namespace ugu {
@@ -21,12 +22,20 @@ struct VoxelCarverOption {
   Eigen::Vector3f bb_min;
   float resolution{0.1f};  // default is 10cm if input is m-scale
   bool sdf_minmax_normalize{true};
+  DistanceTransformType sdf_dist_type{DistanceTransformType::kL1};
   VoxelUpdateOption update_option;
+  // Carve() of multiple views with VoxelUpdate::kMax on a newly initialized
+  // grid evaluates octree nodes of up to 2^max_octree_depth voxels per side at
+  // once while they are entirely inside or outside the visual hull. sdf away
+  // from the surface is then taken at the node center. 0 (default) evaluates
+  // every voxel.
+  int max_octree_depth{0};
 };
 
 class VoxelCarver {
   VoxelCarverOption option_;
   std::unique_ptr<VoxelGrid> voxel_grid_;
+  bool carved_{false};
 
  public:
   VoxelCarver();
@@ -39,7 +48,12 @@ class VoxelCarver {
              Image1f* sdf);
   bool Carve(const Camera& camera, const Image1b& silhouette, Image1f* sdf);
   bool Carve(const Camera& camera, const Image1b& silhouette);
-  bool Carve(const std::vector<Camera>& cameras,
+  // Carves each block of voxels by all views in one pass. See
+  // VoxelCarverOption::max_octree_depth for a newly initialized grid. Nodes
+  // crossing the silhouette boundaries in any view are subdivided down to
+  // voxels, so the iso-surface at 0 is the same as Carve() of each view while
+  // sdf of voxels away from it is taken at the node center.
+  bool Carve(const std::vector<CameraPtr>& cameras,
              const std::vector<Image1b>& silhouettes);
   void ExtractVoxel(Mesh* mesh, bool inside_empty = false);
   void ExtractIsoSurface(Mesh* mesh, double iso_level = 0.0);
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ugu/texturing/visibility_tester.h"
+
+namespace ugu {
+
+struct KeyframeLoaderOption {
+  // <= 0: UGU_THREADS_NUM or hardware concurrency
+  int num_threads = -1;
+  // Max number of keyframes loaded ahead of the consumer
+  int prefetch_num = 8;
+  // Scale applied to 16bit depth images to get float depth
+  float depth_scale = 1.f;
+};
+
+// Asynchronously loads color/depth/mask of keyframes from their paths.
+// Reading and decoding run on worker threads and keyframes are handed to the
+// consumer in order by Next() as soon as they are ready.
+class KeyframeLoader {
+ public:
+  KeyframeLoader(const std::vector<KeyframePtr>& keyframes,
+                 const KeyframeLoaderOption& option = KeyframeLoaderOption());
+  ~KeyframeLoader();
+  KeyframeLoader(const KeyframeLoader&) = delete;
+  KeyframeLoader& operator=(const KeyframeLoader&) = delete;
+
+  // Blocks until the next keyframe is loaded. Returns nullptr at the end.
+  // Keyframes failed to load are skipped.
+  KeyframePtr Next();
+  void Stop();
+
+  size_t size() const;
+
+ private:
+  enum class State { kPending, kLoading, kLoaded, kFailed };
+
+  void Work();
+  bool Load(Keyframe& keyframe) const;
+
+  std::vector<KeyframePtr> keyframes_;
+  KeyframeLoaderOption option_;
+  std::vector<State> states_;
+  size_t issued_{0};
+  size_t consumed_{0};
+  bool stop_{false};
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace ugu
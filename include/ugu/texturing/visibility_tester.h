@@ -193,6 +193,7 @@ struct VisibilityInfo {
 };
 
 struct Keyframe;
+class KeyframeLoader;
 using KeyframePtr = std::shared_ptr<Keyframe>;
 
 struct Keyframe {
@@ -262,6 +263,9 @@ class VisibilityTester {
   bool Test(std::vector<std::shared_ptr<Keyframe>> keyframes,
             VisibilityInfo* info, bool facewise = true,
             std::function<void(VertexInfo&)> vert_custom_func = nullptr);
+  // Test keyframes in order as soon as the loader provides them
+  bool Test(KeyframeLoader& loader, VisibilityInfo* info, bool facewise = true,
+            std::function<void(VertexInfo&)> vert_custom_func = nullptr);
 };
 
 }  // namespace ugu
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ugu {
+
+// Copy-on-write std::vector. Copies share the buffer until one of them is
+// modified. Only read access is implicit; writes go through the modifiers
+// below or mut(), which detaches a shared buffer first.
+// Not thread-safe for concurrent mut() on the same object: call mut() once
+// before parallel writes.
+template <typename T>
+class CowVector {
+ public:
+  using Vector = std::vector<T>;
+  using value_type = T;
+  using size_type = typename Vector::size_type;
+  using const_iterator = typename Vector::const_iterator;
+
+  CowVector() = default;
+  CowVector(const Vector& v) : data_(std::make_shared<Vector>(v)) {}
+  CowVector(Vector&& v) : data_(std::make_shared<Vector>(std::move(v))) {}
+
+  CowVector& operator=(const Vector& v) {
+    data_ = std::make_shared<Vector>(v);
+    return *this;
+  }
+  CowVector& operator=(Vector&& v) {
+    data_ = std::make_shared<Vector>(std::move(v));
+    return *this;
+  }
+
+  const Vector& get() const { return data_ != nullptr ? *data_ : Empty(); }
+  operator const Vector&() const { return get(); }
+
+  // Unique buffer for writing
+  Vector& mut() {
+    if (data_ == nullptr) {
+      data_ = std::make_shared<Vector>();
+    } else if (data_.use_count() > 1) {
+      data_ = std::make_shared<Vector>(*data_);
+    }
+    return *data_;
+  }
+
+  // true if the buffer is referred by other copies
+  bool shared() const { return data_ != nullptr && data_.use_count() > 1; }
+  // Number of copies referring the buffer, 0 if not allocated
+  size_t use_count() const {
+    return data_ != nullptr ? static_cast<size_t>(data_.use_count()) : 0;
+  }
+
+  size_type size() const { return get().size(); }
+  bool empty() const { return get().empty(); }
+  const T& operator[](size_type i) const { return get()[i]; }
+  const T& front() const { return get().front(); }
+  const T& back() const { return get().back(); }
+  const T* data() const { return get().data(); }
+  const_iterator begin() const { return get().begin(); }
+  const_iterator end() const { return get().end(); }
+
+  void clear() { data_ = nullptr; }
+  void reserve(size_type n) { mut().reserve(n); }
+  void resize(size_type n) { mut().resize(n); }
+  void resize(size_type n, const T& v) { mut().resize(n, v); }
+  void push_back(const T& v) { mut().push_back(v); }
+  void push_back(T&& v) { mut().push_back(std::move(v)); }
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    return mut().emplace_back(std::forward<Args>(args)...);
+  }
+  void set(size_type i, const T& v) { mut()[i] = v; }
+
+ private:
+  static const Vector& Empty() {
+    static const Vector empty;
+    return empty;
+  }
+  std::shared_ptr<Vector> data_;
+};
+
+}  // namespace ugu
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "ugu/util/thread_util.h"
+
+namespace ugu {
+
+// Groups items [0, item_num) by key(i) in [0, key_num) into CSR in
+// O(item_num + key_num * #blocks). values gets value(i) of the items of key k
+// in [offsets[k], offsets[k + 1]), ascending in i regardless of the number of
+// threads. Each block of items counts its keys, an exclusive prefix sum over
+// (key, block) gives each block its own cursors, and the blocks scatter in
+// parallel without atomics.
+template <typename KeyFunc, typename ValueFunc>
+void MakeCsr(size_t key_num, size_t item_num, KeyFunc key, ValueFunc value,
+             std::vector<int>* offsets, std::vector<int>* values,
+             size_t min_block_size = 1 << 16) {
+  // One block per thread bounds the histograms to key_num * #threads
+  const size_t block_num = std::max<size_t>(
+      1, std::min<size_t>(GetNumThreads(), item_num / min_block_size));
+  const size_t block_size = (item_num + block_num - 1) / block_num;
+  auto block_range = [&](size_t b, size_t* st, size_t* ed) {
+    *st = std::min(item_num, b * block_size);
+    *ed = std::min(item_num, (b + 1) * block_size);
+  };
+
+  // counts[b * key_num + k]: items of key k in block b
+  std::vector<int> counts(block_num * key_num, 0);
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    int* count = counts.data() + b * key_num;
+    size_t st, ed;
+    block_range(b, &st, &ed);
+    for (size_t i = st; i < ed; i++) {
+      count[key(i)]++;
+    }
+  });
+
+  // Totals per key, their prefix sum, then the cursor of each block
+  offsets->assign(key_num + 1, 0);
+  parallel_for_blocks(0, key_num, min_block_size, [&](size_t st, size_t ed) {
+    for (size_t k = st; k < ed; k++) {
+      int sum = 0;
+      for (size_t b = 0; b < block_num; b++) {
+        sum += counts[b * key_num + k];
+      }
+      (*offsets)[k + 1] = sum;
+    }
+  });
+  for (size_t k = 0; k < key_num; k++) {
+    (*offsets)[k + 1] += (*offsets)[k];
+  }
+  parallel_for_blocks(0, key_num, min_block_size, [&](size_t st, size_t ed) {
+    for (size_t k = st; k < ed; k++) {
+      int cursor = (*offsets)[k];
+      for (size_t b = 0; b < block_num; b++) {
+        const int n = counts[b * key_num + k];
+        counts[b * key_num + k] = cursor;
+        cursor += n;
+      }
+    }
+  });
+
+  values->resize(offsets->back());
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    int* cursor = counts.data() + b * key_num;
+    size_t st, ed;
+    block_range(b, &st, &ed);
+    for (size_t i = st; i < ed; i++) {
+      (*values)[cursor[key(i)]++] = value(i);
+    }
+  });
+}
+
+}  // namespace ugu
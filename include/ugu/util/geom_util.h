@@ -32,6 +32,36 @@ std::tuple<std::vector<std::set<int32_t>>, std::set<int32_t>, std::set<int32_t>,
 ClusterByConnectivity(const std::vector<Eigen::Vector3i>& indices, int32_t vnum,
                       bool vertex_based_adjacency = false);
 
+// Connected components in CSR. Members of component i are
+// ids[offsets[i]], ..., ids[offsets[i + 1] - 1] in ascending order.
+// Components are ordered by their smallest member.
+struct ConnectedComponents {
+  std::vector<int32_t> labels;  // Component of each element. -1 for none.
+  std::vector<int32_t> offsets = {0};
+  std::vector<int32_t> ids;
+  size_t size() const { return offsets.size() - 1; }
+};
+
+// Computed by parallel union-find. Unreferenced vertices have label -1.
+ConnectedComponents FindVertexComponents(
+    const std::vector<Eigen::Vector3i>& indices, int32_t vnum);
+// Faces sharing an edge, or a vertex if vertex_based_adjacency
+ConnectedComponents FindFaceComponents(
+    const std::vector<Eigen::Vector3i>& indices, int32_t vnum,
+    bool vertex_based_adjacency = false);
+
+// Boundary loops in CSR sorted by length in descending order. Loop i is
+// vids[offsets[i]], ..., vids[offsets[i + 1] - 1] and its last vertex connects
+// to the first one. Same loops and order as FindBoundaryLoops().
+struct BoundaryLoops {
+  std::vector<int32_t> offsets = {0};
+  std::vector<int32_t> vids;
+  size_t size() const { return offsets.size() - 1; }
+};
+
+bool ExtractBoundaryLoops(const std::vector<Eigen::Vector3i>& indices,
+                          int32_t vnum, BoundaryLoops* loops);
+
 // make cube with 24 vertices
 MeshPtr MakeCube(const Eigen::Vector3f& length, const Eigen::Matrix3f& R,
                  const Eigen::Vector3f& t);
@@ -58,17 +58,29 @@ struct InvalidSdf {
   static const float kVal;
 };
 
+enum class DistanceTransformType {
+  kL1 = 0,  // City block distance by two-pass scan
+  kL2 = 1   // Exact Euclidean distance by Felzenszwalb and Huttenlocher
+};
+
 void DistanceTransformL1(const Image1b& mask, Image1f* dist);
 void DistanceTransformL1(const Image1b& mask, const Eigen::Vector2i& roi_min,
                          const Eigen::Vector2i& roi_max, Image1f* dist);
-void MakeSignedDistanceField(const Image1b& mask, Image1f* dist,
-                             bool minmax_normalize, bool use_truncation,
-                             float truncation_band);
-void MakeSignedDistanceField(const Image1b& mask,
-                             const Eigen::Vector2i& roi_min,
-                             const Eigen::Vector2i& roi_max, Image1f* dist,
-                             bool minmax_normalize, bool use_truncation,
-                             float truncation_band);
+void DistanceTransformL2(const Image1b& mask, Image1f* dist);
+void DistanceTransformL2(const Image1b& mask, const Eigen::Vector2i& roi_min,
+                         const Eigen::Vector2i& roi_max, Image1f* dist);
+void DistanceTransform(const Image1b& mask, const Eigen::Vector2i& roi_min,
+                       const Eigen::Vector2i& roi_max, Image1f* dist,
+                       DistanceTransformType type);
+void MakeSignedDistanceField(
+    const Image1b& mask, Image1f* dist, bool minmax_normalize,
+    bool use_truncation, float truncation_band,
+    DistanceTransformType dist_type = DistanceTransformType::kL1);
+void MakeSignedDistanceField(
+    const Image1b& mask, const Eigen::Vector2i& roi_min,
+    const Eigen::Vector2i& roi_max, Image1f* dist, bool minmax_normalize,
+    bool use_truncation, float truncation_band,
+    DistanceTransformType dist_type = DistanceTransformType::kL1);
 void SignedDistance2Color(const Image1f& sdf, Image3b* vis_sdf,
                           float min_negative_d, float max_positive_d);
 
@@ -126,6 +138,9 @@ bool Remap(const Image3f& src, const Image3f& map, const Image1b& mask,
 
 bool AlignChannels(const Image4b& src, Image3b& dst);
 
+// Bytes per pixel of an OpenCV type. 0 for unsupported depth or channels.
+size_t ElemSizeFromCvType(int cv_type);
+
 void Split(const Image3b& src, std::vector<Image1b>& planes);
 void Split(const Image4b& src, std::vector<Image1b>& planes);
 void Split(const Image4b& src, Image3b& color, Image1b& mask);
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <fstream>
+#include <memory>
 
 #include "ugu/image.h"
 #include "ugu/util/string_util.h"
@@ -16,6 +17,9 @@ void WriteFaceIdAsText(const Image1i& face_id, const std::string& path);
 
 inline bool LoadBinaryBase(const std::string& path, std::vector<char>* data) {
   std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
 
   ifs.seekg(0, std::ios::end);
   long long int size = ifs.tellg();
@@ -24,11 +28,14 @@ inline bool LoadBinaryBase(const std::string& path, std::vector<char>* data) {
   data->resize(size);
   ifs.read(data->data(), size);
 
-  return true;
+  return !ifs.bad();
 }
 
 inline bool LoadBinaryBase(const std::string& path, char* data) {
   std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
 
   ifs.seekg(0, std::ios::end);
   long long int size = ifs.tellg();
@@ -36,19 +43,26 @@ inline bool LoadBinaryBase(const std::string& path, char* data) {
 
   ifs.read(data, size);
 
-  return true;
+  return !ifs.bad();
 }
 
 template <typename T>
 bool LoadBinary(const std::string& path, std::vector<T>* data) {
-  std::vector<char> internal_data;
-  LoadBinaryBase(path, &internal_data);
-  size_t elem_num = internal_data.size() / sizeof(T);
-  data->resize(elem_num);
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
 
-  std::memcpy(data->data(), internal_data.data(), internal_data.size());
+  ifs.seekg(0, std::ios::end);
+  long long int size = ifs.tellg();
+  ifs.seekg(0);
 
-  return true;
+  // Read directly into the destination without an intermediate buffer
+  size_t elem_num = static_cast<size_t>(size) / sizeof(T);
+  data->resize(elem_num);
+  ifs.read(reinterpret_cast<char*>(data->data()), elem_num * sizeof(T));
+
+  return !ifs.bad();
 }
 
 std::string LoadTxt(const std::string& path);
@@ -148,18 +162,52 @@ inline bool WriteBinary(const std::string& path, ImageBase& image) {
 }
 
 inline bool LoadBinary(const std::string& path, ImageBase& image) {
-  std::vector<char> internal_data;
-  LoadBinaryBase(path, &internal_data);
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
+
+  ifs.seekg(0, std::ios::end);
+  long long int size = ifs.tellg();
+  ifs.seekg(0);
 
   size_t size_in_bytes = image.total() * image.elemSize();
 
-  if (size_in_bytes != internal_data.size()) {
+  if (size_in_bytes != static_cast<size_t>(size)) {
     return false;
   }
 
-  std::memcpy(image.data, internal_data.data(), size_in_bytes);
+  // Read directly into the image
+  ifs.read(reinterpret_cast<char*>(image.data), size_in_bytes);
 
-  return true;
+  return !ifs.bad();
 }
 
+// Read-only view of a whole file mapped into memory.
+// Pages are mapped copy-on-write so writing to data() never modifies the file.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::string& path);
+  void Close();
+
+  bool is_open() const { return data_ != nullptr || (opened_ && size_ == 0); }
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  uint8_t* data_{nullptr};
+  size_t size_{0};
+  bool opened_{false};
+#ifdef _WIN32
+  void* file_{nullptr};
+  void* mapping_{nullptr};
+#endif
+};
+using MappedFilePtr = std::shared_ptr<MappedFile>;
+
 }  // namespace ugu
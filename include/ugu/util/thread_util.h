@@ -14,9 +14,18 @@ namespace ugu {
 // Used only if > 0
 inline uint32_t UGU_THREADS_NUM = 0;
 
+// UGU_THREADS_NUM if set, otherwise the number of hardware threads
+uint32_t GetNumThreads();
+
 void parallel_for(int st, int ed, std::function<void(int)> func,
                   int num_theads = -1, int inc = 1);
 void parallel_for(size_t st, size_t ed, std::function<void(size_t)> func,
                   int num_theads = -1, size_t inc = 1);
 
+// Calls func(begin, end) for each block of block_size indices in parallel.
+// Runs on the calling thread if there is only one block.
+void parallel_for_blocks(size_t st, size_t ed, size_t block_size,
+                         std::function<void(size_t, size_t)> func,
+                         int num_theads = -1);
+
 }  // namespace ugu
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include "ugu/mesh.h"
+#include "ugu/voxel/voxel.h"
+
+namespace ugu {
+
+struct DualContouringOption {
+  double iso_level{0.0};
+  bool with_color{false};
+  // Eigenvalues of a QEF less than this ratio to the largest one are
+  // truncated so that vertices of flat regions stay near the mass point
+  float qef_svd_th{0.1f};
+  // Cells are merged into octree nodes of up to 2^max_octree_depth cells per
+  // side. 0 keeps the uniform grid.
+  int max_octree_depth{0};
+  // A node is merged if the RMS distance from its vertex to the tangent
+  // planes is less than max_qef_error and the length of the mean of its unit
+  // normals is not less than min_normal_coherence. The latter keeps sharp
+  // features and thin parts at the grid resolution.
+  float max_qef_error{0.f};
+  float min_normal_coherence{0.9f};
+};
+
+// Octree up to 8^3 cells with max_qef_error of 10% of resolution
+DualContouringOption GenDualContouringDefaultOption(float resolution);
+
+// Dual Contouring of Hermite Data
+// https://www.cs.rice.edu/~jwarren/papers/dualcontour.pdf
+// A vertex is placed in each cell crossing the surface by minimizing the QEF
+// of the edge intersections with normals from the SDF gradient, so that sharp
+// features are kept and slivers of MarchingCubes() are avoided. Quads around
+// the crossing edges are split along the shorter diagonal. Cells are the
+// same as MarchingCubes() and the orientation of faces agrees with it.
+// As the original, edges may be non-manifold where a cell has two sheets.
+bool DualContouring(
+    const VoxelGrid& voxel_grid, Mesh* mesh,
+    const DualContouringOption& option = DualContouringOption());
+
+}  // namespace ugu
@@ -8,12 +8,72 @@
 
 #pragma once
 
+#include <vector>
+
 #include "ugu/mesh.h"
+#include "ugu/voxel/sparse_voxel.h"
 #include "ugu/voxel/voxel.h"
 
 namespace ugu {
 
+// Extracted in parallel over z slabs. The result is the same as the serial
+// scan regardless of the number of threads.
 void MarchingCubes(const VoxelGrid& voxel_grid, Mesh* mesh,
                    double iso_level = 0.0, bool with_color = false);
 
+void MarchingCubes(const TsdfVoxelGrid& voxel_grid, Mesh* mesh,
+                   double iso_level = 0.0, bool with_color = false);
+
+// Extracted in parallel over blocks. Vertices are shared without hashing by
+// assigning each edge to its lower voxel. If blocks are paged out, they are
+// read chunk by chunk without being paged in.
+void MarchingCubes(const SparseVoxelGrid& voxel_grid, Mesh* mesh,
+                   double iso_level = 0.0, bool with_color = false);
+
+// Mesh of a dense volume kept in chunks per brick of DirtyBricks. Update()
+// re-extracts only the chunks around the dirty bricks, so its cost follows
+// the newly fused surface. Chunks share the vertices on their borders and
+// GetMesh() stitches them into the same surface as MarchingCubes().
+class IncrementalMarchingCubes {
+ public:
+  explicit IncrementalMarchingCubes(double iso_level = 0.0,
+                                    bool with_color = false);
+  ~IncrementalMarchingCubes();
+
+  // Clears the dirty flags of voxel_grid. All chunks are extracted at first
+  // and after the grid size changes.
+  bool Update(VoxelGrid& voxel_grid);
+  bool Update(TsdfVoxelGrid& voxel_grid);
+  void Clear();
+
+  void GetMesh(Mesh* mesh) const;
+
+  // The number of chunks extracted by the last Update()
+  int updated_chunk_num() const;
+  int vertex_num() const;
+  int face_num() const;
+
+ private:
+  struct Chunk {
+    std::vector<Eigen::Vector3f> vertices;
+    std::vector<Eigen::Vector3f> vertex_colors;
+    // Vertex id on each edge owned by a voxel (3 axes per voxel), -1 if none
+    std::vector<int> edge_vertex;
+    // Edges of the corners encoded by their owner chunk in the 8 upper
+    // neighbors and the edge id in it
+    std::vector<Eigen::Vector3i> faces;
+  };
+
+  template <typename Sampler>
+  void UpdateImpl(const Sampler& sampler, const Eigen::Vector3i& voxel_num,
+                  DirtyBricks& dirty_bricks);
+
+  double iso_level_;
+  bool with_color_;
+  Eigen::Vector3i voxel_num_{0, 0, 0};
+  Eigen::Vector3i brick_num_{0, 0, 0};
+  std::vector<Chunk> chunks_;
+  int updated_chunk_num_{0};
+};
+
 }  // namespace ugu
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <array>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ugu/eigen_util.h"
+#include "ugu/voxel/voxel.h"
+
+namespace ugu {
+
+// Sparse TSDF volume of 8^3 voxel blocks in a spatial hash
+// Real-time 3D reconstruction at scale using voxel hashing
+// https://niessnerlab.org/papers/2013/4hashing/niessner2013hashing.pdf
+// Blocks are allocated only around observed surfaces, so the volume is
+// unbounded. The center of voxel index i is at i * resolution.
+// With EnablePaging(), at most max_resident_blocks blocks are kept in memory
+// and the least recently used ones are evicted to a swap file. A block is used
+// when allocate_block() returns it, and paged in again there, i.e. when fusion
+// observes it.
+class SparseVoxelGrid {
+ public:
+  static constexpr int kBlockSize = 8;
+  static constexpr int kBlockVoxelNum = kBlockSize * kBlockSize * kBlockSize;
+
+  struct Block {
+    Eigen::Vector3i index{0, 0, 0};  // block index
+    std::array<TsdfVoxel, kBlockVoxelNum> voxels;
+  };
+
+  struct PagingStats {
+    size_t page_in_num{0};   // blocks read back from the swap file
+    size_t page_out_num{0};  // blocks written to the swap file
+  };
+
+  SparseVoxelGrid();
+  ~SparseVoxelGrid();
+  bool Init(float resolution);
+  float resolution() const;
+  bool initialized() const;
+  void Clear();
+
+  Eigen::Vector3f get_pos(const Eigen::Vector3i& index) const;
+  // Index of the nearest voxel
+  Eigen::Vector3i get_index(const Eigen::Vector3f& p) const;
+  static Eigen::Vector3i get_block_index(const Eigen::Vector3i& index);
+  // Linear index of a voxel in its block
+  static int get_local_id(const Eigen::Vector3i& index);
+
+  size_t block_num() const;
+  Block& get_block(int block_id);
+  const Block& get_block(int block_id) const;
+  // -1 if the block is not allocated
+  int find_block(const Eigen::Vector3i& block_index) const;
+  // Returns the existing block if already allocated. A block in the swap
+  // file is paged in. -1 if paging in fails, and the block stays in the file.
+  int allocate_block(const Eigen::Vector3i& block_index);
+
+  // nullptr if the block is not allocated
+  const TsdfVoxel* get(const Eigen::Vector3i& index) const;
+  TsdfVoxel* get_ptr(const Eigen::Vector3i& index);
+
+  size_t memory_bytes() const;
+
+  // The swap file is truncated and removed on destruction. Paged out blocks
+  // are invisible to find_block(), get() and Raycast(). 0 disables paging.
+  bool EnablePaging(const std::string& swap_path, size_t max_resident_blocks);
+  bool paging() const;
+  // Evicts the least recently used blocks over max_resident_blocks. Blocks
+  // used since the last call are kept. Block ids are invalidated. On failure
+  // nothing is evicted.
+  bool Evict();
+  size_t paged_block_num() const;
+  std::vector<Eigen::Vector3i> paged_block_indices() const;
+  // Copies a resident or paged out block without paging it in. Returns false
+  // if the block is not allocated or reading the swap file fails. Safe to
+  // call concurrently.
+  bool read_block(const Eigen::Vector3i& block_index, Block* block) const;
+  const PagingStats& paging_stats() const;
+  void ResetPagingStats();
+
+ private:
+  float resolution_{-1.0f};
+  float inv_resolution_{-1.0f};
+  std::vector<Block> blocks_;
+  std::unordered_map<Eigen::Vector3i, int> block_table_;
+
+  // Paging
+  std::string swap_path_;
+  size_t max_resident_blocks_{0};
+  // Not MappedFile since it is a read-only view of a fixed size while the
+  // swap file is rewritten and grows
+  mutable std::fstream swap_file_;
+  // Guards the position of swap_file_ shared by const readers
+  mutable std::mutex swap_mtx_;
+  // Evict() count when each resident block was used last
+  std::vector<uint64_t> last_used_;
+  uint64_t epoch_{0};
+  // Slot in the swap file of each paged out block
+  std::unordered_map<Eigen::Vector3i, int64_t> paged_table_;
+  std::vector<int64_t> free_slots_;
+  int64_t slot_num_{0};
+  PagingStats paging_stats_;
+
+  bool ReadSlot(int64_t slot, Block* block) const;
+  bool WriteSlot(int64_t slot, const Block& block);
+};
+
+// The truncation band of option is always applied since blocks are allocated
+// only within it. With paging, blocks over the limit are evicted at the end
+// as well as in FusePoints().
+bool FuseDepth(const Camera& camera, const Image1f& depth,
+               const VoxelUpdateOption& option, SparseVoxelGrid& voxel_grid,
+               const Image3b& color = Image3b());
+
+bool FusePoints(const std::vector<Eigen::Vector3f>& points,
+                const std::vector<Eigen::Vector3f>& normals,
+                const VoxelUpdateOption& option, SparseVoxelGrid& voxel_grid,
+                const std::vector<Eigen::Vector3f>& colors = {},
+                int sample_num = 1);
+
+// Renders the zero crossing of the TSDF seen from camera as KinectFusion.
+// depth is z in the camera coordinate and normal is the TSDF gradient in the
+// camera coordinate. Pixels without the surface are zero.
+// truncation_band must be the one used in fusion. Rays march only within
+// the depth range of the allocated blocks projected to each image tile.
+bool Raycast(const SparseVoxelGrid& voxel_grid, const Camera& camera,
+             float truncation_band, float min_depth, float max_depth,
+             Image1f* depth, Image3f* normal = nullptr,
+             Image3b* color = nullptr);
+
+}  // namespace ugu
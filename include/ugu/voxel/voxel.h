@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 
 #include "ugu/camera.h"
@@ -45,6 +48,10 @@ struct VoxelUpdateOption {
   float voxel_update_weight{1.0f};  // only valid if kWeightedAverage is set
   bool use_truncation{false};
   float truncation_band{0.1f};  // only positive value is valid
+  // If false, only voxels within truncation_band around the surface are
+  // updated and FuseDepth() visits only the bricks around the surface.
+  // Otherwise free space in front of the surface is also updated.
+  bool update_free_space{true};
 
   VoxelUpdateOption() = default;
   VoxelUpdateOption(const VoxelUpdateOption& option) = default;
@@ -78,6 +85,30 @@ struct Voxel {
   ~Voxel();
 };
 
+// Flags of the bricks of kBrickSize^3 voxels modified since the last Clear().
+// Dense grids mark them in fusion so that meshes are updated incrementally.
+class DirtyBricks {
+ public:
+  static constexpr int kBrickSize = 8;
+
+  void Init(const Eigen::Vector3i& voxel_num);
+  const Eigen::Vector3i& brick_num() const;
+  // Marks the brick of a voxel index
+  void Mark(int x, int y, int z);
+  void MarkBrick(const Eigen::Vector3i& brick);
+  // Marks the bricks dirty in other of the same brick_num()
+  void Merge(const DirtyBricks& other);
+  void MarkAll();
+  bool dirty(const Eigen::Vector3i& brick) const;
+  // Dirty brick indices in the order of z, y and x
+  std::vector<Eigen::Vector3i> Get() const;
+  void Clear();
+
+ private:
+  Eigen::Vector3i brick_num_{0, 0, 0};
+  std::vector<uint8_t> flags_;
+};
+
 class VoxelGrid {
   std::vector<Voxel> voxels_;
   Eigen::Vector3f bb_max_;
@@ -91,6 +122,8 @@ class VoxelGrid {
   std::vector<float> y_pos_list;
   std::vector<float> z_pos_list;
 
+  DirtyBricks dirty_bricks_;
+
  public:
   VoxelGrid();
   ~VoxelGrid();
@@ -104,7 +137,76 @@ class VoxelGrid {
   void ResetOnSurface();
   bool initialized() const;
   Eigen::Vector3i get_index(const Eigen::Vector3f& p) const;
+  // Marks all bricks dirty
   void Clear();
+  // Fusion marks the updated bricks. Mark them after modifying voxels through
+  // get_ptr() to keep incremental meshes in sync.
+  DirtyBricks& dirty_bricks();
+  const DirtyBricks& dirty_bricks() const;
+};
+
+// 8 bytes voxel of truncated SDF.
+// sdf is normalized by the truncation band to [-1, 1] and quantized to int16.
+struct TsdfVoxel {
+  static constexpr float kSdfScale = 32767.f;
+
+  int16_t sdf{0};
+  uint16_t weight{0};  // The number of updates. 0 means unobserved.
+  std::array<uint8_t, 3> col{{0, 0, 0}};
+  uint8_t reserved{0};
+
+  float get_sdf() const { return static_cast<float>(sdf) / kSdfScale; }
+  void set_sdf(float v) {
+    sdf = static_cast<int16_t>(
+        std::round(std::clamp(v, -1.f, 1.f) * kSdfScale));
+  }
+  Eigen::Vector3f get_col() const {
+    return {static_cast<float>(col[0]), static_cast<float>(col[1]),
+            static_cast<float>(col[2])};
+  }
+  void set_col(const Eigen::Vector3f& c) {
+    for (int i = 0; i < 3; i++) {
+      col[i] = static_cast<uint8_t>(std::clamp(c[i] + 0.5f, 0.f, 255.f));
+    }
+  }
+};
+
+// Dense grid of TsdfVoxel with the same layout as VoxelGrid.
+// Positions are computed from the grid coordinates instead of being stored.
+class TsdfVoxelGrid {
+  std::vector<TsdfVoxel> voxels_;
+  Eigen::Vector3f bb_max_;
+  Eigen::Vector3f bb_min_;
+  float resolution_{-1.0f};
+  Eigen::Vector3i voxel_num_{0, 0, 0};
+  int xy_slice_num_{0};
+
+  // index to pos
+  std::vector<float> x_pos_list;
+  std::vector<float> y_pos_list;
+  std::vector<float> z_pos_list;
+
+  DirtyBricks dirty_bricks_;
+
+ public:
+  TsdfVoxelGrid();
+  ~TsdfVoxelGrid();
+  bool Init(const Eigen::Vector3f& bb_max, const Eigen::Vector3f& bb_min,
+            float resolution);
+  const Eigen::Vector3i& voxel_num() const;
+  const TsdfVoxel& get(int x, int y, int z) const;
+  TsdfVoxel* get_ptr(int x, int y, int z);
+  std::vector<TsdfVoxel>& get_all();
+  Eigen::Vector3f get_pos(int x, int y, int z) const;
+  float resolution() const;
+  bool initialized() const;
+  Eigen::Vector3i get_index(const Eigen::Vector3f& p) const;
+  // Marks all bricks dirty
+  void Clear();
+  // Fusion marks the updated bricks. Mark them after modifying voxels through
+  // get_ptr() to keep incremental meshes in sync.
+  DirtyBricks& dirty_bricks();
+  const DirtyBricks& dirty_bricks() const;
 };
 
 VoxelUpdateOption GenFuseDepthDefaultOption(float resolution);
@@ -128,23 +230,120 @@ bool FusePoints(const std::vector<Eigen::Vector3f>& points,
                 const std::vector<Eigen::Vector3f>& colors = {},
                 int sample_num = 1);
 
-float SdfInterpolationNn(const Eigen::Vector2f& image_p,
-                         const ugu::Image1f& sdf,
-                         const Eigen::Vector2i& roi_min,
-                         const Eigen::Vector2i& roi_max);
+// The truncation band of option is always applied since sdf is normalized by
+// it
+bool FuseDepth(const Camera& camera, const Image1f& depth,
+               const VoxelUpdateOption& option, TsdfVoxelGrid& voxel_grid,
+               const Image3b& color = Image3b());
+
+bool FusePoints(const std::vector<Eigen::Vector3f>& points,
+                const std::vector<Eigen::Vector3f>& normals,
+                const VoxelUpdateOption& option, TsdfVoxelGrid& voxel_grid,
+                const std::vector<Eigen::Vector3f>& colors = {},
+                int sample_num = 1);
+
+inline float SdfInterpolationNn(const Eigen::Vector2f& image_p,
+                                const ugu::Image1f& sdf,
+                                const Eigen::Vector2i& roi_min,
+                                const Eigen::Vector2i& roi_max) {
+  Eigen::Vector2i image_p_i(static_cast<int>(std::round(image_p.x())),
+                            static_cast<int>(std::round(image_p.y())));
+
+  // really need these?
+  if (image_p_i.x() < roi_min.x()) {
+    image_p_i.x() = roi_min.x();
+  }
+  if (image_p_i.y() < roi_min.y()) {
+    image_p_i.y() = roi_min.y();
+  }
+  if (roi_max.x() < image_p_i.x()) {
+    image_p_i.x() = roi_max.x();
+  }
+  if (roi_max.y() < image_p_i.y()) {
+    image_p_i.y() = roi_max.y();
+  }
+
+  return sdf.at<float>(image_p_i.y(), image_p_i.x());
+}
+
+inline float SdfInterpolationBiliner(const Eigen::Vector2f& image_p,
+                                     const ugu::Image1f& sdf,
+                                     const Eigen::Vector2i& roi_min,
+                                     const Eigen::Vector2i& roi_max) {
+  std::array<int, 2> pos_min = {{0, 0}};
+  std::array<int, 2> pos_max = {{0, 0}};
+  pos_min[0] = static_cast<int>(std::floor(image_p[0]));
+  pos_min[1] = static_cast<int>(std::floor(image_p[1]));
+  pos_max[0] = pos_min[0] + 1;
+  pos_max[1] = pos_min[1] + 1;
 
-float SdfInterpolationBiliner(const Eigen::Vector2f& image_p,
-                              const ugu::Image1f& sdf,
-                              const Eigen::Vector2i& roi_min,
-                              const Eigen::Vector2i& roi_max);
+  // really need these?
+  if (pos_min[0] < roi_min.x()) {
+    pos_min[0] = roi_min.x();
+  }
+  if (pos_min[1] < roi_min.y()) {
+    pos_min[1] = roi_min.y();
+  }
+  if (roi_max.x() < pos_max[0]) {
+    pos_max[0] = roi_max.x();
+  }
+  if (roi_max.y() < pos_max[1]) {
+    pos_max[1] = roi_max.y();
+  }
 
-void UpdateVoxelMax(ugu::Voxel* voxel, const ugu::VoxelUpdateOption& option,
-                    float sdf, bool with_color = false,
-                    const Eigen::Vector3f& col = Eigen::Vector3f::Zero());
+  float local_u = image_p[0] - pos_min[0];
+  float local_v = image_p[1] - pos_min[1];
 
-void UpdateVoxelWeightedAverage(
+  // bilinear interpolation of sdf
+  float dist =
+      (1.0f - local_u) * (1.0f - local_v) *
+          sdf.at<float>(pos_min[1], pos_min[0]) +
+      local_u * (1.0f - local_v) * sdf.at<float>(pos_max[1], pos_min[0]) +
+      (1.0f - local_u) * local_v * sdf.at<float>(pos_min[1], pos_max[0]) +
+      local_u * local_v * sdf.at<float>(pos_max[1], pos_max[0]);
+
+  return dist;
+}
+
+inline void UpdateVoxelMax(
     ugu::Voxel* voxel, const ugu::VoxelUpdateOption& option, float sdf,
     bool with_color = false,
-    const Eigen::Vector3f& col = Eigen::Vector3f::Zero());
+    const Eigen::Vector3f& col = Eigen::Vector3f::Zero()) {
+  (void)option;
+  if (sdf > voxel->sdf) {
+    voxel->sdf = sdf;
+    if (with_color) {
+      voxel->col = col;
+    }
+    voxel->update_num++;
+  }
+}
+
+inline void UpdateVoxelWeightedAverage(
+    ugu::Voxel* voxel, const ugu::VoxelUpdateOption& option, float sdf,
+    bool with_color = false,
+    const Eigen::Vector3f& col = Eigen::Vector3f::Zero()) {
+  const float& w = option.voxel_update_weight;
+  const float inv_denom = 1.0f / (w * (voxel->update_num + 1));
+  voxel->sdf = (w * voxel->update_num * voxel->sdf + w * sdf) * inv_denom;
+
+  if (with_color) {
+    voxel->col = (w * voxel->update_num * voxel->col + w * col) * inv_denom;
+  }
+
+  voxel->update_num++;
+}
+
+// Projective truncated SDF of a point in the camera coordinate normalized by
+// truncation_band as FuseDepth(). Returns false if the point is not observed
+// by depth or is farther than truncation_band behind the surface.
+bool ProjectiveTsdf(const Camera& camera, const Image1f& depth,
+                    float truncation_band, const Eigen::Vector3f& pos_c,
+                    float* tsdf, Eigen::Vector2i* pixel);
+
+// Initializes an unobserved voxel or updates it by option.voxel_update
+void UpdateTsdfVoxel(TsdfVoxel* voxel, const VoxelUpdateOption& option,
+                     float sdf, bool with_color = false,
+                     const Eigen::Vector3f& col = Eigen::Vector3f::Zero());
 
 }  // namespace ugu
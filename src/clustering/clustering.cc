@@ -11,7 +11,7 @@
 
 #include "ugu/accel/kdtree.h"
 #include "ugu/common.h"
-#include "ugu/face_adjacency.h"
+#include "ugu/corner_table.h"
 #include "ugu/util/geom_util.h"
 #include "ugu/util/math_util.h"
 
@@ -846,15 +846,16 @@ bool DisconnectPlaneAndOthers(const std::vector<Eigen::Vector3f>& vertices,
                            normals, angle_th);
 
   if (keep_boundary_both) {
-    FaceAdjacency fa;
-    fa.Init(static_cast<int>(vertices.size()), indices);
-    Adjacency va = fa.GenerateVertexAdjacency();
+    const CornerTable corner_table(static_cast<int>(vertices.size()), indices);
+    std::vector<int> neighbor_vids;
     std::set<size_t> others_vid_set, org_others_vid_set;
     for (const auto& other_vid : others_vids) {
       others_vid_set.insert(other_vid);
       org_others_vid_set.insert(other_vid);
       // Add one ring neighbor vid to include boundary vid in both
-      for (const int& neighbor_vid : va[other_vid]) {
+      corner_table.GetVertexNeighbors(static_cast<int>(other_vid),
+                                      &neighbor_vids);
+      for (const int& neighbor_vid : neighbor_vids) {
         others_vid_set.insert(static_cast<size_t>(neighbor_vid));
       }
     }
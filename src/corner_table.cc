@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/corner_table.h"
+
+#include <algorithm>
+
+#include "ugu/util/csr_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+// Corners per task
+constexpr size_t kCornerBlock = 1 << 15;
+
+}  // namespace
+
+namespace ugu {
+
+CornerTable::CornerTable(int num_vertices,
+                         const std::vector<Eigen::Vector3i>& indices) {
+  Init(num_vertices, indices);
+}
+
+void CornerTable::Clear() {
+  corner_vertices_.clear();
+  opposites_.clear();
+  offsets_.assign(1, 0);
+  vertex_corners_.clear();
+}
+
+void CornerTable::Init(int num_vertices,
+                       const std::vector<Eigen::Vector3i>& indices) {
+  Clear();
+  const size_t corner_num = indices.size() * 3;
+  corner_vertices_.resize(corner_num);
+  parallel_for_blocks(0, indices.size(), kCornerBlock / 3,
+                      [&](size_t st, size_t ed) {
+                        for (size_t i = st; i < ed; i++) {
+                          for (int k = 0; k < 3; k++) {
+                            corner_vertices_[i * 3 + k] = indices[i][k];
+                          }
+                        }
+                      });
+
+  // Vertex -> corners in CSR, sorted by corner
+  MakeCsr(
+      static_cast<size_t>(num_vertices), corner_num,
+      [&](size_t c) { return corner_vertices_[c]; },
+      [](size_t c) { return static_cast<int>(c); }, &offsets_,
+      &vertex_corners_, kCornerBlock);
+  // Next vertices of the corners along the CSR, so that the twin search
+  // below scans contiguous memory even for unordered faces
+  std::vector<int> ring_nexts(vertex_corners_.size());
+  parallel_for_blocks(0, ring_nexts.size(), kCornerBlock,
+                      [&](size_t st, size_t ed) {
+                        for (size_t k = st; k < ed; k++) {
+                          ring_nexts[k] =
+                              corner_vertices_[Next(vertex_corners_[k])];
+                        }
+                      });
+
+  // The edge a -> b facing corner c meets its twin b -> a in the corners of b
+  std::vector<int> twins(corner_num);
+  parallel_for_blocks(0, corner_num, kCornerBlock, [&](size_t st, size_t ed) {
+    for (size_t i = st; i < ed; i++) {
+      const int c = static_cast<int>(i);
+      const int a = corner_vertices_[Next(c)];
+      const int b = corner_vertices_[Prev(c)];
+      int twin = kBoundary;
+      for (int k = offsets_[b]; k < offsets_[b + 1]; k++) {
+        if (ring_nexts[k] == a) {
+          twin = twin == kBoundary ? Prev(vertex_corners_[k]) : kNonManifold;
+        }
+      }
+      twins[c] = a == b && twin != kBoundary ? kNonManifold : twin;
+    }
+  });
+  // A duplicated a -> b makes the twin point to another corner
+  opposites_.resize(corner_num);
+  parallel_for_blocks(0, corner_num, kCornerBlock, [&](size_t st, size_t ed) {
+    for (size_t c = st; c < ed; c++) {
+      const int twin = twins[c];
+      opposites_[c] = 0 <= twin && twins[twin] != static_cast<int>(c)
+                          ? kNonManifold
+                          : twin;
+    }
+  });
+}
+
+void CornerTable::GetAdjacentFaces(int face_id,
+                                   std::vector<int>* adjacent_face_ids) const {
+  adjacent_face_ids->clear();
+  for (const int k : {2, 0, 1}) {
+    const int o = opposites_[Corner(face_id, k)];
+    if (0 <= o) {
+      adjacent_face_ids->push_back(Face(o));
+    }
+  }
+}
+
+void CornerTable::GetAdjacentFacesByVertex(
+    int face_id, std::vector<int>* adjacent_face_ids) const {
+  adjacent_face_ids->clear();
+  for (int k = 0; k < 3; k++) {
+    for (const int c : VertexCorners(Vertex(Corner(face_id, k)))) {
+      if (Face(c) != face_id) {
+        adjacent_face_ids->push_back(Face(c));
+      }
+    }
+  }
+  std::sort(adjacent_face_ids->begin(), adjacent_face_ids->end());
+  adjacent_face_ids->erase(
+      std::unique(adjacent_face_ids->begin(), adjacent_face_ids->end()),
+      adjacent_face_ids->end());
+}
+
+void CornerTable::GetVertexFaces(int v, std::vector<int>* face_ids) const {
+  face_ids->clear();
+  for (const int c : VertexCorners(v)) {
+    face_ids->push_back(Face(c));
+  }
+}
+
+void CornerTable::GetVertexNeighbors(int v,
+                                     std::vector<int>* neighbor_vids) const {
+  neighbor_vids->clear();
+  for (const int c : VertexCorners(v)) {
+    neighbor_vids->push_back(Vertex(Next(c)));
+    neighbor_vids->push_back(Vertex(Prev(c)));
+  }
+  std::sort(neighbor_vids->begin(), neighbor_vids->end());
+  neighbor_vids->erase(
+      std::unique(neighbor_vids->begin(), neighbor_vids->end()),
+      neighbor_vids->end());
+}
+
+std::vector<std::pair<int, int>> CornerTable::GetBoundaryEdges() const {
+  // Count per block first to keep the face order in parallel
+  const size_t face_num = static_cast<size_t>(NumFaces());
+  const size_t block_face_num = kCornerBlock / 3;
+  const size_t block_num = (face_num + block_face_num - 1) / block_face_num;
+  std::vector<size_t> block_offsets(block_num + 1, 0);
+  auto for_each_boundary = [&](size_t block, auto func) {
+    const size_t st = block * block_face_num;
+    const size_t ed = std::min(face_num, st + block_face_num);
+    for (size_t f = st; f < ed; f++) {
+      for (const int k : {2, 0, 1}) {
+        const int c = Corner(static_cast<int>(f), k);
+        if (IsBoundary(c)) {
+          func(c);
+        }
+      }
+    }
+  };
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    for_each_boundary(b, [&](int) { block_offsets[b + 1]++; });
+  });
+  for (size_t b = 0; b < block_num; b++) {
+    block_offsets[b + 1] += block_offsets[b];
+  }
+
+  std::vector<std::pair<int, int>> boundary_edges(block_offsets.back());
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    size_t i = block_offsets[b];
+    for_each_boundary(b, [&](int c) {
+      boundary_edges[i++] = {Vertex(Prev(c)), Vertex(Next(c))};
+    });
+  });
+  return boundary_edges;
+}
+
+int CornerTable::NumNonManifoldCorners() const {
+  return static_cast<int>(
+      std::count(opposites_.begin(), opposites_.end(), kNonManifold));
+}
+
+}  // namespace ugu
@@ -17,10 +17,11 @@
 #include <stdexcept>
 #include <unordered_set>
 
-#include "ugu/face_adjacency.h"
+#include "ugu/corner_table.h"
 #include "ugu/util/geom_util.h"
 #include "ugu/util/math_util.h"
 #include "ugu/util/raster_util.h"
+#include "ugu/util/thread_util.h"
 
 namespace {
 
@@ -34,6 +35,17 @@ QSlimEdge MakeQSlimEdge(int32_t v0, int32_t v1) {
   return QSlimEdge(v1, v0);
 }
 
+// Faces of each vertex, sorted
+using Vertex2Faces = std::vector<std::vector<int>>;
+
+Vertex2Faces MakeVertex2Faces(const ugu::CornerTable& corner_table) {
+  Vertex2Faces v2f(corner_table.NumVertices());
+  ugu::parallel_for(size_t(0), v2f.size(), [&](size_t i) {
+    corner_table.GetVertexFaces(static_cast<int>(i), &v2f[i]);
+  });
+  return v2f;
+}
+
 using VertexAttr = Eigen::VectorXd;
 using VertexAttrList = std::vector<VertexAttr>;
 using VertexAttrListPtr = std::shared_ptr<VertexAttrList>;
@@ -279,13 +291,11 @@ struct DecimatedMesh {
 
   std::vector<std::vector<int32_t>> vid2uvid;
   std::vector<int32_t> uvid2vid;
-  std::unordered_map<int, std::vector<int>> v2f, uv_v2f;
+  Vertex2Faces v2f, uv_v2f;
 
   // std::set<QSlimEdge> valid_pairs;
   // std::unordered_set<int32_t> invalid_vids;
 
-  ugu::FaceAdjacency face_adjacency, uv_face_adjacency;
-
   std::unordered_set<int> unified_boundary_vertex_ids;
   std::unordered_set<int> unified_boundary_uv_ids;
 
@@ -319,9 +329,8 @@ struct DecimatedMesh {
     use_uv = !uv.empty() && !uv_indices.empty() &&
              uv_indices.size() == vertex_indices.size();
 
-    face_adjacency.Init(mesh->vertices().size(), mesh->vertex_indices());
-    v2f = ugu::GenerateVertex2FaceMap(mesh->vertex_indices(),
-                                      mesh->vertices().size());
+    v2f = MakeVertex2Faces(ugu::CornerTable(
+        static_cast<int>(vertices.size()), vertex_indices));
 
     auto [boundary_edges_list, boundary_vertex_ids_list] =
         ugu::FindBoundaryLoops(mesh->vertex_indices(),
@@ -352,16 +361,22 @@ struct DecimatedMesh {
         vid2uvid[i].erase(res, vid2uvid[i].end());
       }
 
-      uv_face_adjacency.Init(mesh->uv().size(), mesh->uv_indices());
-      uv_v2f =
-          ugu::GenerateVertex2FaceMap(mesh->uv_indices(), mesh->uv().size());
-
-      auto [uv_boundary_edges, uv_boundary_vertex_ids] =
-          uv_face_adjacency.GetBoundaryEdges();
-      unified_boundary_uv_ids = std::move(uv_boundary_vertex_ids);
+      const ugu::CornerTable uv_corner_table(static_cast<int>(uv.size()),
+                                             uv_indices);
+      uv_v2f = MakeVertex2Faces(uv_corner_table);
+      for (const auto& e : uv_corner_table.GetBoundaryEdges()) {
+        unified_boundary_uv_ids.insert(e.first);
+        unified_boundary_uv_ids.insert(e.second);
+      }
     }
   }
 
+  // Faces of a uv vertex. Empty without uv.
+  const std::vector<int>& UvFaces(int32_t uvid) const {
+    static const std::vector<int> empty;
+    return use_uv ? uv_v2f[uvid] : empty;
+  }
+
   int32_t VertexNum() const {
     return std::count(valid_vertices.begin(), valid_vertices.end(), true) +
            ignore_vids.size();
@@ -1108,7 +1123,7 @@ struct QSlimHandler {
   }
 
   void InitializeQuadrics(const DecimatedMesh& mesh,
-                          const std::unordered_map<int, std::vector<int>>& v2f,
+                          const Vertex2Faces& v2f,
                           const std::vector<std::vector<int32_t>>& vid2uvid,
                           ugu::QSlimType type) {
     this->type = type;
@@ -1147,7 +1162,7 @@ std::pair<std::set<QSlimEdge>, std::unordered_set<int32_t>> PrepareValidEdges(
     const std::unordered_set<int>& unified_boundary_vertex_ids,
     const std::unordered_set<int>& unified_boundary_uv_ids,
     const std::vector<int32_t>& uvid2vid,
-    const std::unordered_map<int, std::vector<int>>& v2f,
+    const Vertex2Faces& v2f,
     bool keep_geom_boundary, bool keep_uv_boundary) {
   std::set<QSlimEdge> valid_edges;
   std::unordered_set<int32_t> invalid_vids;
@@ -1276,10 +1291,10 @@ std::pair<bool, std::vector<QSlimEdgeInfo>> CollapseEdgeAndUpdateQuadrics(
     const std::vector<int32_t>& uniq1_list = handler.vid2unique[e.first];
     const std::vector<int32_t>& uniq2_list = handler.vid2unique[e.second];
     for (const auto& uniq1 : uniq1_list) {
-      const auto& uvf1 = mesh.uv_v2f[handler.unique_vertices[uniq1].uvid];
+      const auto& uvf1 = mesh.UvFaces(handler.unique_vertices[uniq1].uvid);
 
       for (const auto& uniq2 : uniq2_list) {
-        const auto& uvf2 = mesh.uv_v2f[handler.unique_vertices[uniq1].uvid];
+        const auto& uvf2 = mesh.UvFaces(handler.unique_vertices[uniq1].uvid);
         if (mesh.use_uv) {
           std::vector<int32_t> intersection;
           std::set_intersection(uvf1.begin(), uvf1.end(), uvf2.begin(),
@@ -1423,11 +1438,11 @@ bool QSlim(MeshPtr mesh, QSlimType type, int32_t target_face_num,
     const std::vector<int32_t>& uniq2_list = handler.vid2unique[p.second];
     for (const auto& uniq1 : uniq1_list) {
       const auto& uvf1 =
-          decimated_mesh.uv_v2f[handler.unique_vertices[uniq1].uvid];
+          decimated_mesh.UvFaces(handler.unique_vertices[uniq1].uvid);
 
       for (const auto& uniq2 : uniq2_list) {
         const auto& uvf2 =
-            decimated_mesh.uv_v2f[handler.unique_vertices[uniq1].uvid];
+            decimated_mesh.UvFaces(handler.unique_vertices[uniq1].uvid);
         if (decimated_mesh.use_uv) {
           std::vector<int32_t> intersection;
           std::set_intersection(uvf1.begin(), uvf1.end(), uvf2.begin(),
@@ -8,7 +8,8 @@
 
 #include <queue>
 
-#include "ugu/face_adjacency.h"
+#include "ugu/corner_table.h"
+#include "ugu/util/thread_util.h"
 
 namespace {
 
@@ -31,7 +32,10 @@ bool operator<(const DijkstraVertexInfo& l, const DijkstraVertexInfo& r) {
 using DijkstraHeap =
     std::priority_queue<DijkstraVertexInfo, std::vector<DijkstraVertexInfo>>;
 
-void DijkstraUpdate(DijkstraHeap& q, ugu::Adjacency& vertex_adjacency,
+// Sorted one-ring vertices
+using VertexNeighbors = std::vector<std::vector<int>>;
+
+void DijkstraUpdate(DijkstraHeap& q, const VertexNeighbors& vertex_adjacency,
                     Eigen::SparseMatrix<float>& edge_dists,
                     std::vector<double>& dists,
                     std::vector<int>& min_path_edges) {
@@ -53,9 +57,8 @@ void DijkstraUpdate(DijkstraHeap& q, ugu::Adjacency& vertex_adjacency,
 // Kimmel, Ron, and James A. Sethian. "Computing geodesic paths on manifolds."
 // Proceedings of the national academy of Sciences 95.15 (1998): 8431-8435.
 // https://www.pnas.org/content/pnas/95/15/8431.full.pdf
-void FmmUpdate(DijkstraHeap& q, ugu::Adjacency& vertex_adjacency,
-               const std::unordered_map<int, std::vector<int>>& v2f,
-               const std::vector<Eigen::Vector3i>& faces,
+void FmmUpdate(DijkstraHeap& q, const VertexNeighbors& vertex_adjacency,
+               const ugu::CornerTable& corner_table,
                Eigen::SparseMatrix<float>& edge_dists,
                std::vector<double>& dists, std::vector<int>& min_path_edges) {
   auto min_v = q.top();
@@ -67,22 +70,15 @@ void FmmUpdate(DijkstraHeap& q, ugu::Adjacency& vertex_adjacency,
   constexpr double F2 = F * F;
   const auto& connected_v_list = vertex_adjacency[min_v.id];
   for (const auto& v : connected_v_list) {
-    // Get face id
-    std::vector<int> fids = v2f.at(v);
     std::vector<int> vid2_candidates;
-    // Get 3rd vertex
-    for (const auto& id : fids) {
-      const auto& face = faces[id];
-      for (int c = 0; c < 3; c++) {
-        if (face[c] == min_v.id) {
-          // Better code to search 3rd vertex...
-          for (int cc = 0; cc < 3; cc++) {
-            if (face[cc] != min_v.id && face[cc] != v) {
-              vid2_candidates.push_back(face[cc]);
-              break;
-            }
-          }
-        }
+    // Get 3rd vertex of the faces sharing the edge
+    for (const int c : corner_table.VertexCorners(v)) {
+      const int next = corner_table.Vertex(ugu::CornerTable::Next(c));
+      const int prev = corner_table.Vertex(ugu::CornerTable::Prev(c));
+      if (next == min_v.id) {
+        vid2_candidates.push_back(prev);
+      } else if (prev == min_v.id) {
+        vid2_candidates.push_back(next);
       }
     }
 
@@ -200,10 +196,13 @@ bool ComputeGeodesicDistanceDijkstraBase(const ugu::Mesh& mesh,
   min_path_edges.clear();
   min_path_edges.resize(num_vertices, -1);
 
-  ugu::FaceAdjacency face_adjacency;
-  face_adjacency.Init(static_cast<int>(num_vertices), mesh.vertex_indices());
+  const ugu::CornerTable corner_table(static_cast<int>(num_vertices),
+                                      mesh.vertex_indices());
 
-  ugu::Adjacency vertex_adjacency = face_adjacency.GenerateVertexAdjacency();
+  VertexNeighbors vertex_adjacency(num_vertices);
+  ugu::parallel_for(size_t(0), num_vertices, [&](size_t i) {
+    corner_table.GetVertexNeighbors(static_cast<int>(i), &vertex_adjacency[i]);
+  });
 
   // Compute edge distances
   edge_dists = Eigen::SparseMatrix<float>(num_vertices, num_vertices);
@@ -239,18 +238,10 @@ bool ComputeGeodesicDistanceDijkstraBase(const ugu::Mesh& mesh,
   for (const auto& src_vid : src_vids) {
     q.push({src_vid, 0.0});
   }
-  std::unordered_map<int, std::vector<int>> v2f;
-
-  const auto& faces = mesh.vertex_indices();
-
-  if (is_fmm) {
-    v2f = ugu::GenerateVertex2FaceMap(faces, mesh.vertices().size());
-  }
-
   // Main process
   while (!q.empty()) {
     if (is_fmm) {
-      FmmUpdate(q, vertex_adjacency, v2f, faces, edge_dists, dists,
+      FmmUpdate(q, vertex_adjacency, corner_table, edge_dists, dists,
                 min_path_edges);
     } else {
       DijkstraUpdate(q, vertex_adjacency, edge_dists, dists, min_path_edges);
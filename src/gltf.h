@@ -3,6 +3,7 @@
 
 #ifdef UGU_USE_JSON
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <unordered_map>
@@ -48,6 +49,18 @@ void GetVertexMinMax(const std::vector<Eigen::Vector3f>& vertices,
   }
 }
 
+// A piece of the binary buffer. Only the layout is made before writing and
+// the contents are streamed to the file.
+struct BinSegment {
+  enum class Source { kMemory, kOwned, kFlipV, kFile };
+  Source source = Source::kOwned;
+  // kMemory: bytes, kFlipV: Eigen::Vector2f array. Must be alive until written
+  const void* data = nullptr;
+  std::vector<std::uint8_t> owned;
+  std::string path;
+  std::uint32_t size = 0;
+};
+
 struct Asset {
   std::string generator = "unknown";
   std::string version = "2.0";
@@ -127,7 +140,9 @@ struct Primitive {
   std::uint32_t material = 0;
 
   bool with_blendshapes = false;
-  int blendshape_num = 0;
+  // Whether each target has NORMAL. Targets without normals omit it since a
+  // morph target attribute must have the same count as POSITION.
+  std::vector<bool> blendshape_with_normals;
 };
 void to_json(json& j, const Primitive& obj) {
   j = json{{"attributes", obj.attributes},
@@ -136,10 +151,13 @@ void to_json(json& j, const Primitive& obj) {
 
   if (obj.with_blendshapes) {
     std::vector<std::unordered_map<std::string, std::uint32_t>> targets;
-    int offset = 4;
-    for (int i = 0; i < obj.blendshape_num; i++) {
+    std::uint32_t offset = 4;
+    for (bool with_normals : obj.blendshape_with_normals) {
       std::unordered_map<std::string, std::uint32_t> target = {
-          {"POSITION", offset + i * 2}, {"NORMAL", offset + i * 2 + 1}};
+          {"POSITION", offset++}};
+      if (with_normals) {
+        target["NORMAL"] = offset++;
+      }
       targets.push_back(target);
     }
     j["targets"] = targets;
@@ -177,7 +195,7 @@ struct Image {
   bool glb_processed = false;
   std::uint32_t bufferView = 0;
   std::string mimeType = "image/jpeg";
-  std::vector<std::uint8_t> data;
+  BinSegment bin;
 };
 void to_json(json& j, const Image& obj) {
   if (obj.is_glb) {
@@ -324,40 +342,117 @@ void to_json(json& j, const Model& obj) {
   }
 }
 
-struct Chunk {
-  std::uint32_t type;
-  std::vector<std::uint8_t> data;
-};
+BinSegment MemorySegment(const void* data, size_t size) {
+  BinSegment seg;
+  seg.source = BinSegment::Source::kMemory;
+  seg.data = data;
+  seg.size = static_cast<std::uint32_t>(size);
+  return seg;
+}
+
+BinSegment OwnedSegment(std::vector<std::uint8_t>&& bytes) {
+  BinSegment seg;
+  seg.source = BinSegment::Source::kOwned;
+  seg.size = static_cast<std::uint32_t>(bytes.size());
+  seg.owned = std::move(bytes);
+  return seg;
+}
+
+template <typename T>
+BinSegment OwnedSegment(const std::vector<T>& array) {
+  std::vector<std::uint8_t> bytes(array.size() * sizeof(T));
+  std::memcpy(bytes.data(), array.data(), bytes.size());
+  return OwnedSegment(std::move(bytes));
+}
 
-std::vector<std::uint8_t> ChunkToBin(const Chunk& chunk) {
-  size_t chunk_size = 4 + 4 + chunk.data.size();
-  int padding_num = 0;
-  if (chunk_size % 4 != 0) {
-    padding_num = 4 - (chunk_size % 4);
+// Texture coordinates with flipped v
+BinSegment FlipVSegment(const std::vector<Eigen::Vector2f>& uvs) {
+  BinSegment seg;
+  seg.source = BinSegment::Source::kFlipV;
+  seg.data = uvs.data();
+  seg.size = static_cast<std::uint32_t>(uvs.size() * sizeof(float) * 2);
+  return seg;
+}
+
+// Invalid if the file does not exist
+bool FileSegment(const std::string& path, BinSegment* seg) {
+  std::ifstream ifs(path, std::ios::in | std::ios::binary);
+  if (!ifs.is_open()) {
+    return false;
   }
-  std::vector<std::uint8_t> combined(chunk_size);
-  // IMPORTANT: add padding_num
-  std::uint32_t length =
-      static_cast<std::uint32_t>(chunk.data.size() + padding_num);
-  std::memcpy(combined.data(), &length, 4);
-  std::memcpy(combined.data() + 4, &chunk.type, 4);
-  std::memcpy(combined.data() + 8, chunk.data.data(), length);
-
-  std::uint8_t padchar = 255;  // invalid
-  if (chunk.type == 0x4E4F534A) {
-    // json case
-    padchar = 0x20;  //' ';
-  } else if (chunk.type == 0x004E4942) {
-    // bin case
-    padchar = 0x00;
+  ifs.seekg(0, std::ios::end);
+  seg->source = BinSegment::Source::kFile;
+  seg->path = path;
+  seg->size = static_cast<std::uint32_t>(ifs.tellg());
+  return true;
+}
+
+struct BinLayout {
+  std::vector<BinSegment> segments;
+  std::uint32_t size = 0;
+
+  // Returns the byte offset of the segment
+  std::uint32_t Add(BinSegment&& seg) {
+    std::uint32_t offset = size;
+    size += seg.size;
+    segments.push_back(std::move(seg));
+    return offset;
   }
+};
 
-  for (int i = 0; i < padding_num; i++) {
-    combined.push_back(padchar);
+bool WriteBinSegment(std::ostream& os, const BinSegment& seg) {
+  switch (seg.source) {
+    case BinSegment::Source::kMemory:
+      os.write(reinterpret_cast<const char*>(seg.data), seg.size);
+      break;
+    case BinSegment::Source::kOwned:
+      os.write(reinterpret_cast<const char*>(seg.owned.data()), seg.size);
+      break;
+    case BinSegment::Source::kFlipV: {
+      constexpr size_t kBlock = 1 << 14;
+      const auto* uvs = reinterpret_cast<const Eigen::Vector2f*>(seg.data);
+      const size_t num = seg.size / (sizeof(float) * 2);
+      std::vector<Eigen::Vector2f> buf;
+      for (size_t st = 0; st < num; st += kBlock) {
+        const size_t ed = std::min(num, st + kBlock);
+        buf.assign(uvs + st, uvs + ed);
+        for (auto& uv : buf) {
+          uv[1] = 1.f - uv[1];
+        }
+        os.write(reinterpret_cast<const char*>(buf.data()),
+                 buf.size() * sizeof(float) * 2);
+      }
+      break;
+    }
+    case BinSegment::Source::kFile: {
+      std::ifstream ifs(seg.path, std::ios::in | std::ios::binary);
+      std::vector<char> buf(1 << 20);
+      std::uint32_t remain = seg.size;
+      while (remain > 0 && ifs) {
+        const std::uint32_t len =
+            std::min(remain, static_cast<std::uint32_t>(buf.size()));
+        ifs.read(buf.data(), len);
+        os.write(buf.data(), ifs.gcount());
+        remain -= static_cast<std::uint32_t>(ifs.gcount());
+      }
+      if (remain > 0) {
+        LOGE("Failed to read %s\n", seg.path.c_str());
+        return false;
+      }
+      break;
+    }
   }
+  return !os.bad();
+}
 
-  return combined;
-};
+bool WriteBinLayout(std::ostream& os, const BinLayout& layout) {
+  for (const auto& seg : layout.segments) {
+    if (!WriteBinSegment(os, seg)) {
+      return false;
+    }
+  }
+  return true;
+}
 
 json MakeGltfJson(const Model& model) { return json(model); }
 
@@ -371,143 +466,202 @@ bool WriteGltfJsonToFile(const Model& model, const std::string& path) {
   return true;
 }
 
+// Header, JSON chunk and BIN chunk. The binary is streamed from the layout.
+bool WriteGlb(const Model& model, const BinLayout& layout,
+              const std::string& path) {
+  constexpr std::uint32_t kMagic = 0x46546C67;      // "glTF"
+  constexpr std::uint32_t kVersion = 2;
+  constexpr std::uint32_t kJsonChunk = 0x4E4F534A;  // "JSON"
+  constexpr std::uint32_t kBinChunk = 0x004E4942;   // "BIN"
+  constexpr std::uint32_t kHeaderSize = 12;
+  constexpr std::uint32_t kChunkHeaderSize = 8;
+
+  auto padding = [](std::uint32_t size) { return (4 - size % 4) % 4; };
+
+  std::string json_string = WriteGltfJsonToString(model);
+  json_string.append(padding(static_cast<std::uint32_t>(json_string.size())),
+                     ' ');
+  const std::uint32_t json_length =
+      static_cast<std::uint32_t>(json_string.size());
+  const std::uint32_t bin_padding = padding(layout.size);
+  const std::uint32_t bin_length = layout.size + bin_padding;
+  const std::uint32_t length = kHeaderSize + kChunkHeaderSize + json_length +
+                               kChunkHeaderSize + bin_length;
+
+  std::ofstream ofs(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!ofs.is_open()) {
+    LOGE("Failed to open %s\n", path.c_str());
+    return false;
+  }
+  auto write_u32 = [&](std::uint32_t v) {
+    ofs.write(reinterpret_cast<const char*>(&v), sizeof(v));
+  };
+  write_u32(kMagic);
+  write_u32(kVersion);
+  write_u32(length);
+
+  write_u32(json_length);
+  write_u32(kJsonChunk);
+  ofs.write(json_string.data(), json_length);
+
+  write_u32(bin_length);
+  write_u32(kBinChunk);
+  if (!WriteBinLayout(ofs, layout)) {
+    return false;
+  }
+  const char zeros[4] = {0, 0, 0, 0};
+  ofs.write(zeros, bin_padding);
+
+  return !ofs.bad();
+}
+
+// Adds an accessor and its buffer view
+void AddAccessor(Accessor acc, BinSegment&& seg, Model& model,
+                 BinLayout& layout) {
+  BufferView bv;
+  bv.buffer = 0;
+  bv.byteLength = seg.size;
+  bv.byteOffset = layout.Add(std::move(seg));
+  acc.bufferView = static_cast<std::uint32_t>(model.bufferViews.size());
+  model.bufferViews.push_back(bv);
+  model.accessors.push_back(acc);
+}
+
+void AddAnimationChannel(const std::vector<float>& input,
+                         const std::vector<Eigen::Vector3f>& output,
+                         int node, const std::string& path, Model& model,
+                         BinLayout& layout) {
+  Accessor input_acc, output_acc;
+
+  input_acc.componentType = 5126;
+  input_acc.count = static_cast<std::uint32_t>(input.size());
+  input_acc.type = "SCALAR";
+  input_acc.write_minmax = true;
+  auto min_max_t = std::minmax_element(input.begin(), input.end());
+  input_acc.max.resize(1);
+  input_acc.min.resize(1);
+  input_acc.max[0] = *min_max_t.second;
+  input_acc.min[0] = *min_max_t.first;
+  AddAccessor(input_acc, OwnedSegment(input), model, layout);
+
+  output_acc.componentType = 5126;
+  output_acc.count = static_cast<std::uint32_t>(output.size());
+  output_acc.type = "VEC3";
+  AddAccessor(output_acc, OwnedSegment(output), model, layout);
+
+  gltf::Channel channel;
+  channel.sampler = static_cast<int>(model.animations[0].samplers.size());
+  channel.target.node = node;
+  channel.target.path = path;
+
+  gltf::Sampler sampler;
+  sampler.input = static_cast<int>(model.accessors.size() - 2);
+  sampler.output = static_cast<int>(model.accessors.size() - 1);
+  sampler.interpolation = "STEP";
+  model.animations[0].channels.push_back(channel);
+  model.animations[0].samplers.push_back(sampler);
+}
+
+// Image data should be last of buffer
+// Otherwise you may get ""ACCESSOR_TOTAL_OFFSET_ALIGNMENT" Accessor's
+// total byteOffset XXXX isn't a multiple of componentType length 4."
+// for other (e.g. vertices) bufferViews
+void AddGlbImages(Model& model, BinLayout& layout) {
+  model.buffers[0].is_glb = true;
+  for (auto& image : model.images) {
+    if (image.glb_processed) {
+      continue;
+    }
+
+    image.is_glb = true;
+    image.glb_processed = true;
+
+    // Does not need accessor for image
+    // BufferView and mimeType are enough for decoding
+    BufferView bv;
+    bv.buffer = 0;
+    bv.byteLength = image.bin.size;
+    bv.byteOffset = layout.Add(std::move(image.bin));
+    image.bufferView = static_cast<std::uint32_t>(model.bufferViews.size());
+    model.bufferViews.push_back(bv);
+  }
+  model.buffers[0].byteLength = layout.size;
+}
+
+// Arrays are referred, not copied. They must be alive until the layout is
+// written.
 void MakeGltfBinAndUpdateModel(
     const std::vector<Eigen::Vector3f>& vertices,
     const Eigen::Vector3f& vert_max, const Eigen::Vector3f& vert_min,
     const std::vector<Eigen::Vector3f>& normals,
     const std::vector<Eigen::Vector2f>& uvs,
     const std::vector<Eigen::Vector3i>& indices, const std::string& bin_name,
-    bool is_glb,
-    const std::vector<std::vector<Eigen::Vector3f>>& blendshape_vertices,
-    const std::vector<std::vector<Eigen::Vector3f>>& blendshape_normals,
-    //  bool with_alpha,
-    std::map<float, AnimKeyframe> keyframes, AnimInterp anim_interp,
-    Model& model, std::vector<std::uint8_t>& combined_bytes,
-    bool process_glb_images = true) {
+    bool is_glb, const std::vector<Blendshape>& blendshapes,
+    const std::map<float, AnimKeyframe>& keyframes, AnimInterp anim_interp,
+    Model& model, BinLayout& layout, bool process_glb_images = true) {
   (void)anim_interp;
 
-  uint32_t org_total_size = static_cast<uint32_t>(combined_bytes.size());
-  uint32_t total_size = org_total_size;
-  uint32_t org_num_accs = static_cast<uint32_t>(model.accessors.size());
-  uint32_t org_num_bv = static_cast<uint32_t>(model.bufferViews.size());
-  model.accessors.resize(org_num_accs + 4);
-  model.bufferViews.resize(org_num_bv + 4);
-
-  auto& vert_acc = model.accessors[org_num_accs + 0];
-  vert_acc.bufferView = org_num_bv + 0;
+  Accessor vert_acc;
   vert_acc.componentType = 5126;
-  vert_acc.count = static_cast<int>(vertices.size());
+  vert_acc.count = static_cast<std::uint32_t>(vertices.size());
   vert_acc.write_minmax = true;
   vert_acc.max = {vert_max[0], vert_max[1], vert_max[2]};
   vert_acc.min = {vert_min[0], vert_min[1], vert_min[2]};
   vert_acc.type = "VEC3";
-  size_t vert_size = vertices.size() * sizeof(float) * 3;
-  std::vector<std::uint8_t> vert_bytes(vert_size);
-  std::memcpy(vert_bytes.data(), vertices.data(), vert_size);
-  auto& vert_bview = model.bufferViews[org_num_bv + 0];
-  vert_bview.buffer = 0;
-  vert_bview.byteLength = static_cast<std::uint32_t>(vert_size);
-  vert_bview.byteOffset = static_cast<std::uint32_t>(total_size);
-  total_size += static_cast<uint32_t>(vert_size);
-
-  auto& nor_acc = model.accessors[org_num_accs + 1];
-  nor_acc.bufferView = org_num_bv + 1;
+  AddAccessor(vert_acc,
+              MemorySegment(vertices.data(), vertices.size() * sizeof(float) * 3),
+              model, layout);
+
+  Accessor nor_acc;
   nor_acc.componentType = 5126;
-  nor_acc.count = static_cast<int>(normals.size());
+  nor_acc.count = static_cast<std::uint32_t>(normals.size());
   nor_acc.type = "VEC3";
-  size_t nor_size = normals.size() * sizeof(float) * 3;
-  std::vector<std::uint8_t> nor_bytes(nor_size);
-  std::memcpy(nor_bytes.data(), normals.data(), nor_size);
-  auto& nor_bview = model.bufferViews[org_num_bv + 1];
-  nor_bview.buffer = 0;
-  nor_bview.byteLength = static_cast<std::uint32_t>(nor_size);
-  nor_bview.byteOffset = static_cast<std::uint32_t>(total_size);
-  total_size += static_cast<uint32_t>(nor_size);
-
-  auto& uv_acc = model.accessors[org_num_accs + 2];
-  uv_acc.bufferView = org_num_bv + 2;
+  AddAccessor(nor_acc,
+              MemorySegment(normals.data(), normals.size() * sizeof(float) * 3),
+              model, layout);
+
+  Accessor uv_acc;
   uv_acc.componentType = 5126;
-  uv_acc.count = static_cast<int>(uvs.size());
+  uv_acc.count = static_cast<std::uint32_t>(uvs.size());
   uv_acc.type = "VEC2";
-  size_t uv_size = uvs.size() * sizeof(float) * 2;
-  std::vector<std::uint8_t> uv_bytes(uv_size);
-  std::memcpy(uv_bytes.data(), uvs.data(), uv_size);
-  auto& uv_bview = model.bufferViews[org_num_bv + 2];
-  uv_bview.buffer = 0;
-  uv_bview.byteLength = static_cast<std::uint32_t>(uv_size);
-  uv_bview.byteOffset = static_cast<std::uint32_t>(total_size);
-  total_size += static_cast<uint32_t>(uv_size);
-
-  auto& index_acc = model.accessors[org_num_accs + 3];
-  index_acc.bufferView = org_num_bv + 3;
+  // Flip v
+  AddAccessor(uv_acc, FlipVSegment(uvs), model, layout);
+
+  Accessor index_acc;
   index_acc.componentType = 5125;
-  index_acc.count = static_cast<int>(indices.size() * 3);
+  index_acc.count = static_cast<std::uint32_t>(indices.size() * 3);
   index_acc.type = "SCALAR";
-  size_t index_size = indices.size() * sizeof(int) * 3;
-  std::vector<std::uint8_t> index_bytes(index_size);
-  std::memcpy(index_bytes.data(), indices.data(), index_size);
-  auto& index_bview = model.bufferViews[org_num_bv + 3];
-  index_bview.buffer = 0;
-  index_bview.byteLength = static_cast<std::uint32_t>(index_size);
-  index_bview.byteOffset = static_cast<std::uint32_t>(total_size);
-  total_size += static_cast<uint32_t>(index_size);
-
-  std::vector<std::vector<std::uint8_t>> bytes_list = {vert_bytes, nor_bytes,
-                                                       uv_bytes, index_bytes};
-
-  // model.buffers.resize(1);
-
-  uint32_t num_bv = org_num_bv + 3 + 1;
-  if (!blendshape_vertices.empty() &&
-      blendshape_vertices.size() == blendshape_normals.size()) {
-    for (size_t i = 0; i < blendshape_vertices.size(); i++) {
-      const auto& v = blendshape_vertices[i];
-      const auto& n = blendshape_normals[i];
-
-      Accessor p_acc, n_acc;
-      p_acc.componentType = 5126;
-      p_acc.count = static_cast<std::uint32_t>(v.size());
-      p_acc.type = "VEC3";
-      p_acc.bufferView = num_bv;
-      num_bv++;
-      p_acc.write_minmax = true;
-      Eigen::Vector3f v_min, v_max;
-      GetVertexMinMax(v, v_min, v_max);
-      for (int k = 0; k < 3; k++) {
-        p_acc.min[k] = v_min[k];
-        p_acc.max[k] = v_max[k];
-      }
+  AddAccessor(index_acc,
+              MemorySegment(indices.data(), indices.size() * sizeof(int) * 3),
+              model, layout);
+
+  for (const auto& b : blendshapes) {
+    Accessor p_acc, n_acc;
+    p_acc.componentType = 5126;
+    p_acc.count = static_cast<std::uint32_t>(b.vertices.size());
+    p_acc.type = "VEC3";
+    p_acc.write_minmax = true;
+    Eigen::Vector3f v_min, v_max;
+    GetVertexMinMax(b.vertices, v_min, v_max);
+    for (int k = 0; k < 3; k++) {
+      p_acc.min[k] = v_min[k];
+      p_acc.max[k] = v_max[k];
+    }
+    AddAccessor(p_acc,
+                MemorySegment(b.vertices.data(),
+                              b.vertices.size() * sizeof(float) * 3),
+                model, layout);
 
-      n_acc.componentType = 5126;
-      n_acc.count = static_cast<std::uint32_t>(n.size());
-      n_acc.type = "VEC3";
-      n_acc.bufferView = num_bv;
-      num_bv++;
-
-      model.accessors.push_back(p_acc);
-      model.accessors.push_back(n_acc);
-
-      BufferView v_bv, n_bv;
-      v_bv.buffer = 0;
-      size_t v_size = v.size() * sizeof(float) * 3;
-      std::vector<std::uint8_t> v_bytes(v_size);
-      std::memcpy(v_bytes.data(), v.data(), v_size);
-      v_bv.byteLength = static_cast<std::uint32_t>(v_size);
-      v_bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += v_bv.byteLength;
-      model.bufferViews.push_back(v_bv);
-      bytes_list.push_back(v_bytes);
-
-      n_bv.buffer = 0;
-      size_t n_size = n.size() * sizeof(float) * 3;
-      std::vector<std::uint8_t> n_bytes(n_size);
-      std::memcpy(n_bytes.data(), n.data(), n_size);
-      n_bv.byteLength = static_cast<std::uint32_t>(n_size);
-      n_bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += n_bv.byteLength;
-      model.bufferViews.push_back(n_bv);
-      bytes_list.push_back(n_bytes);
+    if (b.normals.empty()) {
+      continue;
     }
+    n_acc.componentType = 5126;
+    n_acc.count = static_cast<std::uint32_t>(b.normals.size());
+    n_acc.type = "VEC3";
+    AddAccessor(n_acc,
+                MemorySegment(b.normals.data(),
+                              b.normals.size() * sizeof(float) * 3),
+                model, layout);
   }
 
   if (!keyframes.empty()) {
@@ -519,224 +673,44 @@ void MakeGltfBinAndUpdateModel(
     /* DANGER static */
     static int anim_node_count = 0;
 
-    // SCALE
-    {
-      std::vector<float> input;
-      std::vector<Eigen::Vector3f> output;
-
-      for (const auto& kf : keyframes) {
-        input.push_back(kf.first);
-        Eigen::Vector3f uni_scale(kf.second.s, kf.second.s, kf.second.s);
-        output.push_back(uni_scale);
-      }
-
-      Accessor input_acc, output_acc;
-      BufferView input_bv, output_bv;
-
-      input_acc.componentType = 5126;
-      input_acc.count = static_cast<std::uint32_t>(keyframes.size());
-      input_acc.type = "SCALAR";
-      input_acc.bufferView = num_bv;
-      num_bv++;
-      input_acc.write_minmax = true;
-      auto min_max_t = std::minmax_element(input.begin(), input.end());
-      input_acc.max.resize(1);
-      input_acc.min.resize(1);
-      input_acc.max[0] = *min_max_t.second;
-      input_acc.min[0] = *min_max_t.first;
-      model.accessors.push_back(input_acc);
-
-      // TODO: scale case only
-      output_acc.componentType = 5126;
-      output_acc.count = static_cast<std::uint32_t>(keyframes.size());
-      output_acc.type = "VEC3";
-      output_acc.bufferView = num_bv;
-      num_bv++;
-      model.accessors.push_back(output_acc);
-
-      input_bv.buffer = 0;
-      size_t input_bv_size = input.size() * sizeof(float) * 1;
-      std::vector<std::uint8_t> input_bv_bytes(input_bv_size);
-      std::memcpy(input_bv_bytes.data(), input.data(), input_bv_size);
-      input_bv.byteLength = static_cast<std::uint32_t>(input_bv_size);
-      input_bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += input_bv.byteLength;
-      model.bufferViews.push_back(input_bv);
-      bytes_list.push_back(input_bv_bytes);
-
-      output_bv.buffer = 0;
-      size_t output_bv_size = output.size() * sizeof(float) * 3;
-      std::vector<std::uint8_t> output_bv_bytes(output_bv_size);
-      std::memcpy(output_bv_bytes.data(), output.data(), output_bv_size);
-      output_bv.byteLength = static_cast<std::uint32_t>(output_bv_size);
-      output_bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += output_bv.byteLength;
-      model.bufferViews.push_back(output_bv);
-      bytes_list.push_back(output_bv_bytes);
-
-      gltf::Channel channel;
-      channel.sampler = static_cast<int>(model.animations[0].samplers.size());
-
-      channel.target.node = anim_node_count;
-      // anim_node_count++;
-      channel.target.path = "scale";
-
-      gltf::Sampler sampler;
-      sampler.input = static_cast<int>(model.accessors.size() - 2);
-      sampler.output = static_cast<int>(model.accessors.size() - 1);
-      sampler.interpolation = "STEP";
-      model.animations[0].channels.push_back(channel);
-      model.animations[0].samplers.push_back(sampler);
+    std::vector<float> input;
+    std::vector<Eigen::Vector3f> scales, translations;
+    for (const auto& kf : keyframes) {
+      input.push_back(kf.first);
+      scales.push_back(Eigen::Vector3f::Constant(kf.second.s));
+      translations.push_back(kf.second.t);
     }
 
-    // Translation
-    {
-      std::vector<float> input;
-      std::vector<Eigen::Vector3f> output;
-
-      for (const auto& kf : keyframes) {
-        input.push_back(kf.first);
-        output.push_back(kf.second.t);
-      }
-
-      Accessor input_acc, output_acc;
-      BufferView input_bv, output_bv;
-
-      input_acc.componentType = 5126;
-      input_acc.count = static_cast<std::uint32_t>(keyframes.size());
-      input_acc.type = "SCALAR";
-      input_acc.bufferView = num_bv;
-      num_bv++;
-      input_acc.write_minmax = true;
-      auto min_max_t = std::minmax_element(input.begin(), input.end());
-      input_acc.max.resize(1);
-      input_acc.min.resize(1);
-      input_acc.max[0] = *min_max_t.second;
-      input_acc.min[0] = *min_max_t.first;
-      model.accessors.push_back(input_acc);
-
-      // TODO: scale case only
-      output_acc.componentType = 5126;
-      output_acc.count = static_cast<std::uint32_t>(keyframes.size());
-      output_acc.type = "VEC3";
-      output_acc.bufferView = num_bv;
-      num_bv++;
-      model.accessors.push_back(output_acc);
-
-      input_bv.buffer = 0;
-      size_t input_bv_size = input.size() * sizeof(float) * 1;
-      std::vector<std::uint8_t> input_bv_bytes(input_bv_size);
-      std::memcpy(input_bv_bytes.data(), input.data(), input_bv_size);
-      input_bv.byteLength = static_cast<std::uint32_t>(input_bv_size);
-      input_bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += input_bv.byteLength;
-      model.bufferViews.push_back(input_bv);
-      bytes_list.push_back(input_bv_bytes);
-
-      output_bv.buffer = 0;
-      size_t output_bv_size = output.size() * sizeof(float) * 3;
-      std::vector<std::uint8_t> output_bv_bytes(output_bv_size);
-      std::memcpy(output_bv_bytes.data(), output.data(), output_bv_size);
-      output_bv.byteLength = static_cast<std::uint32_t>(output_bv_size);
-      output_bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += output_bv.byteLength;
-      model.bufferViews.push_back(output_bv);
-      bytes_list.push_back(output_bv_bytes);
-
-      gltf::Channel channel;
-      channel.sampler = static_cast<int>(model.animations[0].samplers.size());
-
-      channel.target.node = anim_node_count;
-      channel.target.path = "translation";
-
-      gltf::Sampler sampler;
-      sampler.input = static_cast<int>(model.accessors.size() - 2);
-      sampler.output = static_cast<int>(model.accessors.size() - 1);
-      sampler.interpolation = "STEP";
-      model.animations[0].channels.push_back(channel);
-      model.animations[0].samplers.push_back(sampler);
-    }
+    // TODO: scale and translation only
+    AddAnimationChannel(input, scales, anim_node_count, "scale", model,
+                        layout);
+    AddAnimationChannel(input, translations, anim_node_count, "translation",
+                        model, layout);
 
     anim_node_count++;
   }
 
   if (is_glb) {
     model.buffers[0].is_glb = true;
-
     if (process_glb_images) {
-      for (auto& image : model.images) {
-        if (image.glb_processed) {
-          continue;
-        }
-
-        image.is_glb = true;
-        image.glb_processed = true;
-        image.bufferView = num_bv;
-
-        // Does not need accessor for image
-        // BufferView and mimeType are enough for decoding
-        BufferView bv;
-        bv.buffer = 0;
-        // Image data should be last of buffer
-        // Otherwise you may get ""ACCESSOR_TOTAL_OFFSET_ALIGNMENT" Accessor's
-        // total byteOffset XXXX isn't a multiple of componentType length 4."
-        // for other (e.g. vertices) bufferViews
-        bv.byteLength = static_cast<int>(image.data.size());
-        bv.byteOffset = static_cast<std::uint32_t>(total_size);
-        total_size += bv.byteLength;
-        model.bufferViews.push_back(bv);
-
-        bytes_list.push_back(image.data);
-
-        num_bv++;
-      }
+      AddGlbImages(model, layout);
     }
-
   } else {
     model.buffers[0].is_glb = false;
     model.buffers[0].uri = bin_name;
   }
 
-  model.buffers[0].byteLength = static_cast<std::uint32_t>(total_size);
-
-  combined_bytes.resize(total_size);
-  size_t offset = org_total_size;
-  for (auto& bytes : bytes_list) {
-    combined_bytes.insert(combined_bytes.begin() + offset, bytes.begin(),
-                          bytes.end());
-    offset += bytes.size();
-  }
-
-  // model.materials.back().with_alpha = with_alpha;
-
-  // return combined_bytes;
+  model.buffers[0].byteLength = layout.size;
 }
 
 void MakeGltfBinAndUpdateModel(const ugu::Mesh& mesh,
                                const std::string& bin_name, bool is_glb,
-                               Model& model,
-                               std::vector<std::uint8_t>& combined_bytes,
+                               Model& model, BinLayout& layout,
                                bool process_glb_images = true) {
-  // Flip v
-  auto gltf_uvs = mesh.uv();
-  for (auto& uv : gltf_uvs) {
-    uv[1] = 1.f - uv[1];
-  }
-
-  std::vector<std::vector<Eigen::Vector3f>> blendshape_vertices,
-      blendshape_normals;
-  for (const auto& b : mesh.blendshapes()) {
-    blendshape_vertices.push_back(b.vertices);
-    blendshape_normals.push_back(b.normals);
-  }
-
-  /// bool with_alpha = !mesh.materials()[0].with_alpha_tex.empty();
-
   MakeGltfBinAndUpdateModel(
       mesh.vertices(), mesh.stats().bb_max, mesh.stats().bb_min, mesh.normals(),
-      gltf_uvs, mesh.vertex_indices(), bin_name, is_glb, blendshape_vertices,
-      blendshape_normals, mesh.keyframes(), mesh.anim_interp(), model,
-      combined_bytes, process_glb_images);
+      mesh.uv(), mesh.vertex_indices(), bin_name, is_glb, mesh.blendshapes(),
+      mesh.keyframes(), mesh.anim_interp(), model, layout, process_glb_images);
 }
 
 }  // namespace gltf
@@ -744,4 +718,4 @@ void MakeGltfBinAndUpdateModel(const ugu::Mesh& mesh,
 
 #endif
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,1084 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/image_io.h"
+#include "ugu/mesh.h"
+
+#ifdef UGU_USE_JSON
+
+#include <array>
+#include <cstring>
+#include <functional>
+
+#ifdef _WIN32
+#pragma warning(push, 0)
+#endif
+#include "nlohmann/json.hpp"
+#ifdef _WIN32
+#pragma warning(pop)
+#endif
+
+#include "ugu/util/io_util.h"
+#include "ugu/util/string_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+using json = nlohmann::json;
+
+constexpr std::uint32_t kGlbMagic = 0x46546C67;      // "glTF"
+constexpr std::uint32_t kGlbJsonChunk = 0x4E4F534A;  // "JSON"
+constexpr std::uint32_t kGlbBinChunk = 0x004E4942;   // "BIN"
+// Elements per task of attribute conversion
+constexpr size_t kBlockSize = 1 << 16;
+
+struct Bytes {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Member of j or an empty one. json::value() would return a copy.
+const json& ArrayMember(const json& j, const char* key) {
+  static const json empty = json::array();
+  auto it = j.find(key);
+  return it != j.end() && it->is_array() ? *it : empty;
+}
+
+const json& ObjectMember(const json& j, const char* key) {
+  static const json empty = json::object();
+  auto it = j.find(key);
+  return it != j.end() && it->is_object() ? *it : empty;
+}
+
+// Buffers are mapped (.glb, external .bin) or decoded (data uri)
+struct GltfDocument {
+  json j;
+  std::string dir;
+  MappedFilePtr file;
+  std::vector<MappedFilePtr> external_files;
+  std::vector<std::vector<uint8_t>> decoded;
+  std::vector<Bytes> buffers;
+};
+
+bool DecodeBase64(const std::string& src, size_t begin,
+                  std::vector<uint8_t>* dst) {
+  static const std::array<int8_t, 256> table = [] {
+    std::array<int8_t, 256> t;
+    t.fill(-1);
+    const char* chars =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (int i = 0; i < 64; i++) {
+      t[static_cast<uint8_t>(chars[i])] = static_cast<int8_t>(i);
+    }
+    return t;
+  }();
+
+  dst->clear();
+  dst->reserve((src.size() - begin) / 4 * 3);
+  uint32_t acc = 0;
+  int bits = 0;
+  for (size_t i = begin; i < src.size(); i++) {
+    const char c = src[i];
+    if (c == '=') {
+      break;
+    }
+    const int8_t v = table[static_cast<uint8_t>(c)];
+    if (v < 0) {
+      return false;
+    }
+    acc = (acc << 6) | static_cast<uint32_t>(v);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      dst->push_back(static_cast<uint8_t>((acc >> bits) & 0xFF));
+    }
+  }
+  return true;
+}
+
+// data uri (base64) or a file relative to the document
+bool LoadUri(const std::string& uri, GltfDocument* doc, Bytes* bytes) {
+  if (uri.compare(0, 5, "data:") == 0) {
+    const size_t comma = uri.find(',');
+    if (comma == std::string::npos ||
+        uri.rfind(";base64", comma) == std::string::npos) {
+      LOGE("Unsupported data uri\n");
+      return false;
+    }
+    doc->decoded.emplace_back();
+    if (!DecodeBase64(uri, comma + 1, &doc->decoded.back())) {
+      LOGE("Broken base64\n");
+      return false;
+    }
+    bytes->data = doc->decoded.back().data();
+    bytes->size = doc->decoded.back().size();
+    return true;
+  }
+
+  auto file = std::make_shared<MappedFile>();
+  if (!file->Open(doc->dir + uri)) {
+    return false;
+  }
+  bytes->data = file->data();
+  bytes->size = file->size();
+  doc->external_files.push_back(file);
+  return true;
+}
+
+bool ParseDocument(const std::string& path, GltfDocument* doc) {
+  doc->file = std::make_shared<MappedFile>();
+  if (!doc->file->Open(path)) {
+    return false;
+  }
+  doc->dir = ExtractDir(path);
+  const uint8_t* data = doc->file->data();
+  const size_t size = doc->file->size();
+
+  auto read_u32 = [&](size_t pos) {
+    std::uint32_t v;
+    std::memcpy(&v, data + pos, sizeof(v));
+    return v;
+  };
+
+  Bytes bin;
+  try {
+    if (size >= 12 && read_u32(0) == kGlbMagic) {
+      if (read_u32(4) != 2) {
+        LOGE("Unsupported glb version %d\n", read_u32(4));
+        return false;
+      }
+      const size_t length = std::min(size, static_cast<size_t>(read_u32(8)));
+      size_t pos = 12;
+      bool json_found = false;
+      while (pos + 8 <= length) {
+        const size_t chunk_length = read_u32(pos);
+        const std::uint32_t chunk_type = read_u32(pos + 4);
+        pos += 8;
+        if (length - pos < chunk_length) {
+          LOGE("Broken chunk %s\n", path.c_str());
+          return false;
+        }
+        if (chunk_type == kGlbJsonChunk && !json_found) {
+          doc->j = json::parse(data + pos, data + pos + chunk_length);
+          json_found = true;
+        } else if (chunk_type == kGlbBinChunk && bin.data == nullptr) {
+          bin.data = data + pos;
+          bin.size = chunk_length;
+        }
+        pos += chunk_length;
+      }
+      if (!json_found) {
+        LOGE("JSON chunk was not found %s\n", path.c_str());
+        return false;
+      }
+    } else {
+      doc->j = json::parse(data, data + size);
+    }
+  } catch (const json::exception& e) {
+    LOGE("Failed to parse %s: %s\n", path.c_str(), e.what());
+    return false;
+  }
+
+  // The first buffer without uri refers the BIN chunk
+  const json& buffers = ArrayMember(doc->j, "buffers");
+  // Keep decoded buffers from reallocation
+  doc->decoded.reserve(buffers.size() + ArrayMember(doc->j, "images").size());
+  for (const auto& b : buffers) {
+    Bytes bytes;
+    if (b.contains("uri")) {
+      if (!LoadUri(b["uri"].get<std::string>(), doc, &bytes)) {
+        LOGE("Failed to load buffer %s\n",
+             b["uri"].get<std::string>().c_str());
+        return false;
+      }
+    } else {
+      bytes = bin;
+    }
+    const size_t byte_length = b.value("byteLength", size_t(0));
+    if (bytes.size < byte_length) {
+      LOGE("Too small buffer\n");
+      return false;
+    }
+    doc->buffers.push_back(bytes);
+  }
+
+  return true;
+}
+
+bool GetBufferView(const GltfDocument& doc, int index, Bytes* bytes,
+                   size_t* stride) {
+  const json& views = ArrayMember(doc.j, "bufferViews");
+  if (index < 0 || views.size() <= static_cast<size_t>(index)) {
+    return false;
+  }
+  const json& view = views[index];
+  const size_t buffer = view.value("buffer", size_t(0));
+  const size_t offset = view.value("byteOffset", size_t(0));
+  const size_t length = view.value("byteLength", size_t(0));
+  if (doc.buffers.size() <= buffer ||
+      doc.buffers[buffer].size < offset + length) {
+    return false;
+  }
+  bytes->data = doc.buffers[buffer].data + offset;
+  bytes->size = length;
+  if (stride != nullptr) {
+    *stride = view.value("byteStride", size_t(0));
+  }
+  return true;
+}
+
+struct AccessorView {
+  const uint8_t* data = nullptr;  // nullptr: all zeros
+  size_t count = 0;
+  size_t stride = 0;
+  int component_type = 5126;
+  int components = 1;
+  bool normalized = false;
+};
+
+int ComponentSize(int component_type) {
+  switch (component_type) {
+    case 5120:  // BYTE
+    case 5121:  // UNSIGNED_BYTE
+      return 1;
+    case 5122:  // SHORT
+    case 5123:  // UNSIGNED_SHORT
+      return 2;
+    case 5125:  // UNSIGNED_INT
+    case 5126:  // FLOAT
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+int Components(const std::string& type) {
+  if (type == "SCALAR") {
+    return 1;
+  } else if (type == "VEC2") {
+    return 2;
+  } else if (type == "VEC3") {
+    return 3;
+  } else if (type == "VEC4") {
+    return 4;
+  } else if (type == "MAT4") {
+    return 16;
+  }
+  return 0;
+}
+
+bool GetAccessor(const GltfDocument& doc, int index, AccessorView* view) {
+  const json& accessors = ArrayMember(doc.j, "accessors");
+  if (index < 0 || accessors.size() <= static_cast<size_t>(index)) {
+    LOGE("Invalid accessor %d\n", index);
+    return false;
+  }
+  const json& acc = accessors[index];
+  if (acc.contains("sparse")) {
+    LOGE("Sparse accessor is not supported\n");
+    return false;
+  }
+  view->count = acc.value("count", size_t(0));
+  view->component_type = acc.value("componentType", 5126);
+  view->components = Components(acc.value("type", std::string()));
+  view->normalized = acc.value("normalized", false);
+  const size_t elem_size =
+      static_cast<size_t>(ComponentSize(view->component_type)) *
+      view->components;
+  if (elem_size == 0) {
+    LOGE("Invalid accessor type %d\n", index);
+    return false;
+  }
+  view->stride = elem_size;
+  if (!acc.contains("bufferView")) {
+    view->data = nullptr;
+    return true;
+  }
+
+  Bytes bytes;
+  size_t stride = 0;
+  if (!GetBufferView(doc, acc["bufferView"].get<int>(), &bytes, &stride)) {
+    LOGE("Invalid bufferView of accessor %d\n", index);
+    return false;
+  }
+  if (stride != 0) {
+    view->stride = stride;
+  }
+  const size_t offset = acc.value("byteOffset", size_t(0));
+  if (view->count > 0 &&
+      bytes.size < offset + view->stride * (view->count - 1) + elem_size) {
+    LOGE("Out of range accessor %d\n", index);
+    return false;
+  }
+  view->data = bytes.data + offset;
+  return true;
+}
+
+inline float ReadComponent(const uint8_t* p, int component_type,
+                           bool normalized) {
+  switch (component_type) {
+    case 5126: {
+      float v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case 5121:
+      return normalized ? *p / 255.f : static_cast<float>(*p);
+    case 5120: {
+      const int8_t v = static_cast<int8_t>(*p);
+      return normalized ? std::max(v / 127.f, -1.f) : static_cast<float>(v);
+    }
+    case 5123: {
+      uint16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? v / 65535.f : static_cast<float>(v);
+    }
+    case 5122: {
+      int16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? std::max(v / 32767.f, -1.f) : static_cast<float>(v);
+    }
+    case 5125: {
+      uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return static_cast<float>(v);
+    }
+    default:
+      return 0.f;
+  }
+}
+
+inline uint32_t ReadIndex(const uint8_t* p, int component_type) {
+  switch (component_type) {
+    case 5121:
+      return *p;
+    case 5123: {
+      uint16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case 5125: {
+      uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    default:
+      return 0;
+  }
+}
+
+void ForEachBlock(size_t count, const std::function<void(size_t, size_t)>& f) {
+  parallel_for_blocks(0, count, kBlockSize, f);
+}
+
+// Writes count * N floats. Tightly packed float accessors are copied at once
+// from the mapped buffer.
+template <int N>
+bool ReadVectors(const AccessorView& view,
+                 Eigen::Matrix<float, N, 1>* dst) {
+  if (view.components < N && !(N == 3 && view.components == 4)) {
+    LOGE("Unexpected accessor type\n");
+    return false;
+  }
+  if (view.data == nullptr) {
+    std::fill(dst, dst + view.count, Eigen::Matrix<float, N, 1>::Zero());
+    return true;
+  }
+  if (view.component_type == 5126 && view.components == N &&
+      view.stride == sizeof(float) * N) {
+    ForEachBlock(view.count, [&](size_t st, size_t ed) {
+      std::memcpy(static_cast<void*>(dst + st),
+                  view.data + st * view.stride, (ed - st) * view.stride);
+    });
+    return true;
+  }
+  const size_t comp_size = ComponentSize(view.component_type);
+  ForEachBlock(view.count, [&](size_t st, size_t ed) {
+    for (size_t i = st; i < ed; i++) {
+      const uint8_t* p = view.data + i * view.stride;
+      for (int k = 0; k < N; k++) {
+        dst[i][k] =
+            ReadComponent(p + k * comp_size, view.component_type,
+                          view.normalized);
+      }
+    }
+  });
+  return true;
+}
+
+template <int N>
+bool ReadVectors(const GltfDocument& doc, int accessor, size_t expected_count,
+                 std::vector<Eigen::Matrix<float, N, 1>>* dst) {
+  AccessorView view;
+  if (!GetAccessor(doc, accessor, &view)) {
+    return false;
+  }
+  if (view.count != expected_count) {
+    LOGE("Unexpected accessor count %d\n", accessor);
+    return false;
+  }
+  const size_t offset = dst->size();
+  dst->resize(offset + view.count);
+  return ReadVectors<N>(view, dst->data() + offset);
+}
+
+inline Eigen::Vector3f TransformPoint(const Eigen::Matrix4f& T,
+                                      const Eigen::Vector3f& p) {
+  return T.block<3, 3>(0, 0) * p + T.block<3, 1>(0, 3);
+}
+
+// Geometry of a glTF mesh. Primitives are concatenated.
+struct MeshData {
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<Eigen::Vector3f> normals;
+  std::vector<Eigen::Vector2f> uv;
+  std::vector<Eigen::Vector3f> colors;
+  std::vector<Eigen::Vector3i> indices;
+  std::vector<int> material_ids;  // Index to materials
+  std::vector<ObjMaterial> materials;
+  std::vector<Blendshape> blendshapes;
+};
+
+bool LoadMeshData(const GltfDocument& doc, const json& gmesh,
+                  const std::vector<ObjMaterial>& materials, MeshData* data) {
+  const json& primitives = ArrayMember(gmesh, "primitives");
+
+  bool with_normal = false, with_uv = false, with_color = false;
+  size_t target_num = 0;
+  for (const auto& prim : primitives) {
+    const json& attrs = ObjectMember(prim, "attributes");
+    with_normal |= attrs.contains("NORMAL");
+    with_uv |= attrs.contains("TEXCOORD_0");
+    with_color |= attrs.contains("COLOR_0");
+    target_num = std::max(target_num, ArrayMember(prim, "targets").size());
+  }
+
+  data->blendshapes.resize(target_num);
+  const json& names =
+      ArrayMember(ObjectMember(gmesh, "extras"), "targetNames");
+  const json& weights = ArrayMember(gmesh, "weights");
+  for (size_t i = 0; i < target_num; i++) {
+    Blendshape& b = data->blendshapes[i];
+    b.name = i < names.size() ? names[i].get<std::string>()
+                              : "target_" + std::to_string(i);
+    b.weight = i < weights.size() ? weights[i].get<float>() : 0.f;
+  }
+
+  std::map<int, int> gltf2mat;
+  for (const auto& prim : primitives) {
+    const int mode = prim.value("mode", 4);
+    if (mode != 4) {
+      LOGW("Only triangles are supported. Skip primitive with mode %d\n",
+           mode);
+      continue;
+    }
+    const json& attrs = ObjectMember(prim, "attributes");
+    if (!attrs.contains("POSITION")) {
+      continue;
+    }
+
+    const size_t offset = data->vertices.size();
+    AccessorView pos_view;
+    if (!GetAccessor(doc, attrs["POSITION"].get<int>(), &pos_view)) {
+      return false;
+    }
+    const size_t num = pos_view.count;
+    data->vertices.resize(offset + num);
+    if (!ReadVectors<3>(pos_view, data->vertices.data() + offset)) {
+      return false;
+    }
+
+    auto read_or_fill = [&](const char* name, auto* dst, const auto& value) {
+      using Vec = typename std::decay_t<decltype(*dst)>::value_type;
+      if (attrs.contains(name)) {
+        return ReadVectors<Vec::RowsAtCompileTime>(doc, attrs[name].get<int>(),
+                                                   num, dst);
+      }
+      dst->resize(offset + num, value);
+      return true;
+    };
+    if ((with_normal &&
+         !read_or_fill("NORMAL", &data->normals, Eigen::Vector3f::Zero())) ||
+        (with_uv &&
+         !read_or_fill("TEXCOORD_0", &data->uv, Eigen::Vector2f::Zero())) ||
+        (with_color && !read_or_fill("COLOR_0", &data->colors,
+                                     Eigen::Vector3f::Ones().eval()))) {
+      return false;
+    }
+
+    const json& targets = ArrayMember(prim, "targets");
+    for (size_t i = 0; i < target_num; i++) {
+      Blendshape& b = data->blendshapes[i];
+      static const json no_target = json::object();
+      const json& target = i < targets.size() ? targets[i] : no_target;
+      for (auto [name, dst] :
+           {std::make_pair("POSITION", &b.vertices),
+            std::make_pair("NORMAL", &b.normals)}) {
+        if (target.contains(name)) {
+          if (!ReadVectors<3>(doc, target[name].get<int>(), num, dst)) {
+            return false;
+          }
+        } else {
+          dst->resize(offset + num, Eigen::Vector3f::Zero());
+        }
+      }
+    }
+
+    const size_t face_offset = data->indices.size();
+    if (prim.contains("indices")) {
+      AccessorView view;
+      if (!GetAccessor(doc, prim["indices"].get<int>(), &view) ||
+          view.data == nullptr || view.components != 1) {
+        LOGE("Invalid indices\n");
+        return false;
+      }
+      // The spec allows only unsigned integers for indices
+      if (view.component_type != 5121 && view.component_type != 5123 &&
+          view.component_type != 5125) {
+        LOGE("Unsupported component type of indices %d\n",
+             view.component_type);
+        return false;
+      }
+      data->indices.resize(face_offset + view.count / 3);
+      // One past the end without faces, which is not dereferenced
+      int* dst = reinterpret_cast<int*>(data->indices.data() + face_offset);
+      std::atomic_bool valid{true};
+      ForEachBlock(view.count / 3 * 3, [&](size_t st, size_t ed) {
+        for (size_t i = st; i < ed; i++) {
+          const uint32_t idx =
+              ReadIndex(view.data + i * view.stride, view.component_type);
+          if (num <= idx) {
+            valid = false;
+          }
+          dst[i] = static_cast<int>(offset + idx);
+        }
+      });
+      if (!valid) {
+        LOGE("Out of range index\n");
+        return false;
+      }
+    } else {
+      data->indices.resize(face_offset + num / 3);
+      for (size_t i = 0; i < num / 3; i++) {
+        const int base = static_cast<int>(offset + i * 3);
+        data->indices[face_offset + i] =
+            Eigen::Vector3i(base, base + 1, base + 2);
+      }
+    }
+
+    // Materials in the order of appearance
+    const int gmat = prim.value("material", -1);
+    auto it = gltf2mat.find(gmat);
+    if (it == gltf2mat.end()) {
+      const int id = static_cast<int>(data->materials.size());
+      it = gltf2mat.insert({gmat, id}).first;
+      data->materials.push_back(
+          0 <= gmat && static_cast<size_t>(gmat) < materials.size()
+              ? materials[gmat]
+              : ObjMaterial());
+    }
+    data->material_ids.resize(data->indices.size(), it->second);
+  }
+
+  if (data->materials.empty()) {
+    data->materials.push_back(ObjMaterial());
+  }
+
+  // Flip v to match the writer
+  for (auto& uv : data->uv) {
+    uv[1] = 1.f - uv[1];
+  }
+  for (auto& c : data->colors) {
+    c *= 255.f;
+  }
+
+  return true;
+}
+
+// 8 bit image with ch channels. Missing alpha is filled with 255.
+ImageBase ConvertChannels(const ImageBase& src, int ch) {
+  const int src_ch = src.channels();
+  const size_t elem1 = src.elemSize1();
+  if (src_ch == ch && elem1 == 1) {
+    return src;
+  }
+  ImageBase dst(src.rows, src.cols, CV_MAKETYPE(CV_8U, ch));
+  for (int y = 0; y < src.rows; y++) {
+    const uint8_t* s = src.data + y * src.step[0];
+    uint8_t* d = dst.data + y * dst.step[0];
+    for (int x = 0; x < src.cols; x++) {
+      uint8_t v[4] = {0, 0, 0, 255};
+      for (int c = 0; c < src_ch && c < 4; c++) {
+        // Take the upper byte of 16 bit (little endian)
+        v[c] = s[(x * src_ch + c) * elem1 + elem1 - 1];
+      }
+      if (src_ch <= 2) {
+        // Gray (+ alpha)
+        v[3] = src_ch == 2 ? v[1] : 255;
+        v[1] = v[2] = v[0];
+      }
+      for (int c = 0; c < ch; c++) {
+        d[x * ch + c] = v[c];
+      }
+    }
+  }
+  return dst;
+}
+
+bool LoadMaterials(GltfDocument& doc, std::vector<ObjMaterial>* materials) {
+  const json& gimages = ArrayMember(doc.j, "images");
+  const json& gtextures = ArrayMember(doc.j, "textures");
+  const json& gmaterials = ArrayMember(doc.j, "materials");
+
+  auto texture_image = [&](const json& gmat) {
+    const json& pbr = ObjectMember(gmat, "pbrMetallicRoughness");
+    if (!pbr.contains("baseColorTexture")) {
+      return -1;
+    }
+    const int tex = pbr["baseColorTexture"].value("index", -1);
+    if (tex < 0 || gtextures.size() <= static_cast<size_t>(tex)) {
+      return -1;
+    }
+    const int source = gtextures[tex].value("source", -1);
+    return static_cast<size_t>(source) < gimages.size() ? source : -1;
+  };
+  auto is_alpha = [&](const json& gmat) {
+    return gmat.value("alphaMode", std::string("OPAQUE")) != "OPAQUE";
+  };
+
+  // Encoded bytes, names and channels of used images
+  struct ImageSource {
+    Bytes bytes;
+    std::string texname;
+    std::string texpath;
+    bool alpha = false;
+    bool used = false;
+    ImageBase decoded;
+  };
+  std::vector<ImageSource> images(gimages.size());
+  for (const auto& gmat : gmaterials) {
+    const int image = texture_image(gmat);
+    if (image >= 0) {
+      images[image].used = true;
+      images[image].alpha |= is_alpha(gmat);
+    }
+  }
+  for (size_t i = 0; i < gimages.size(); i++) {
+    ImageSource& src = images[i];
+    if (!src.used) {
+      continue;
+    }
+    const json& gimage = gimages[i];
+    const std::string mime = gimage.value("mimeType", std::string());
+    const std::string ext = mime == "image/png" ? ".png" : ".jpg";
+    std::string name = gimage.value("name", "image_" + std::to_string(i));
+    if (gimage.contains("bufferView")) {
+      if (!GetBufferView(doc, gimage["bufferView"].get<int>(), &src.bytes,
+                         nullptr)) {
+        LOGE("Invalid bufferView of image %d\n", static_cast<int>(i));
+        src.used = false;
+        continue;
+      }
+      src.texname = name + ext;
+    } else if (gimage.contains("uri")) {
+      const std::string uri = gimage["uri"].get<std::string>();
+      if (!LoadUri(uri, &doc, &src.bytes)) {
+        LOGE("Failed to load image %s\n", uri.c_str());
+        src.used = false;
+        continue;
+      }
+      if (uri.compare(0, 5, "data:") == 0) {
+        src.texname = name + ext;
+      } else {
+        src.texname = uri;
+        src.texpath = doc.dir + uri;
+      }
+    }
+  }
+
+  // Decode embedded and external images in parallel
+  parallel_for(size_t(0), images.size(), [&](size_t i) {
+    ImageSource& src = images[i];
+    if (!src.used || src.bytes.size == 0) {
+      return;
+    }
+    ImageBase img = imdecode(src.bytes.data, src.bytes.size,
+                             ImreadModes::IMREAD_UNCHANGED);
+    if (!img.empty()) {
+      src.decoded = ConvertChannels(img, src.alpha ? 4 : 3);
+    }
+  });
+
+  materials->clear();
+  for (size_t i = 0; i < gmaterials.size(); i++) {
+    const json& gmat = gmaterials[i];
+    ObjMaterial mat;
+    mat.name = gmat.value("name", "material_" + std::to_string(i));
+    const json& pbr = ObjectMember(gmat, "pbrMetallicRoughness");
+    if (pbr.contains("baseColorFactor")) {
+      const auto factor = pbr["baseColorFactor"].get<std::vector<float>>();
+      for (size_t k = 0; k < 3 && k < factor.size(); k++) {
+        mat.diffuse[k] = factor[k];
+      }
+      if (factor.size() == 4) {
+        mat.dissolve = factor[3];
+      }
+    }
+
+    const int image = texture_image(gmat);
+    if (image >= 0 && images[image].used) {
+      const ImageSource& src = images[image];
+      if (src.decoded.empty()) {
+        LOGW("Failed to decode texture %s\n", src.texname.c_str());
+      }
+      // Keep the encoded bytes so that writing glb does not re-encode
+      std::vector<uint8_t> compressed(src.bytes.data,
+                                      src.bytes.data + src.bytes.size);
+      if (src.alpha) {
+        mat.with_alpha_texname = src.texname;
+        mat.with_alpha_texpath = src.texpath;
+        mat.with_alpha_tex = src.decoded;
+        mat.with_alpha_compressed = std::move(compressed);
+      } else {
+        mat.diffuse_texname = src.texname;
+        mat.diffuse_texpath = src.texpath;
+        mat.diffuse_tex = src.decoded;
+        mat.diffuse_compressed = std::move(compressed);
+      }
+    }
+    materials->push_back(std::move(mat));
+  }
+
+  return true;
+}
+
+// Fixed size number array of node. Returns false if it exists but is
+// malformed.
+bool ReadFloats(const json& node, const char* key, size_t size,
+                std::vector<float>* v) {
+  v->clear();
+  auto it = node.find(key);
+  if (it == node.end()) {
+    return true;
+  }
+  if (!it->is_array() || it->size() != size) {
+    return false;
+  }
+  for (const auto& x : *it) {
+    if (!x.is_number()) {
+      return false;
+    }
+    v->push_back(x.get<float>());
+  }
+  return true;
+}
+
+Eigen::Matrix4f NodeMatrix(const json& node) {
+  std::vector<float> m, t, r, s;
+  if (!ReadFloats(node, "matrix", 16, &m) ||
+      !ReadFloats(node, "translation", 3, &t) ||
+      !ReadFloats(node, "rotation", 4, &r) ||
+      !ReadFloats(node, "scale", 3, &s)) {
+    LOGE("Invalid node transform. Identity is used\n");
+    return Eigen::Matrix4f::Identity();
+  }
+  if (!m.empty()) {
+    // Column major
+    return Eigen::Map<const Eigen::Matrix4f>(m.data());
+  }
+  Eigen::Affine3f T = Eigen::Affine3f::Identity();
+  if (!t.empty()) {
+    T.translate(Eigen::Vector3f(t[0], t[1], t[2]));
+  }
+  if (!r.empty()) {
+    T.rotate(Eigen::Quaternionf(r[3], r[0], r[1], r[2]));
+  }
+  if (!s.empty()) {
+    T.scale(Eigen::Vector3f(s[0], s[1], s[2]));
+  }
+  return T.matrix();
+}
+
+// Keyframes of the node. Rotation, translation, uniform scale and weights
+// are supported.
+bool LoadKeyframes(const GltfDocument& doc, int node,
+                   std::map<float, AnimKeyframe>* keyframes,
+                   AnimInterp* interp) {
+  for (const auto& anim : ArrayMember(doc.j, "animations")) {
+    const json& samplers = ArrayMember(anim, "samplers");
+    for (const auto& channel : ArrayMember(anim, "channels")) {
+      const json& target = ObjectMember(channel, "target");
+      if (target.value("node", -1) != node) {
+        continue;
+      }
+      const int sampler_id = channel.value("sampler", -1);
+      if (sampler_id < 0 ||
+          samplers.size() <= static_cast<size_t>(sampler_id)) {
+        return false;
+      }
+      const json& sampler = samplers[sampler_id];
+      const std::string interpolation =
+          sampler.value("interpolation", std::string("LINEAR"));
+      *interp = interpolation == "STEP" ? AnimInterp::NN : AnimInterp::LINEAR;
+      // CUBICSPLINE has in-tangent, value and out-tangent per key
+      const size_t values_per_key = interpolation == "CUBICSPLINE" ? 3 : 1;
+      const size_t value_index = interpolation == "CUBICSPLINE" ? 1 : 0;
+
+      AccessorView input, output;
+      if (!GetAccessor(doc, sampler.value("input", -1), &input) ||
+          !GetAccessor(doc, sampler.value("output", -1), &output)) {
+        return false;
+      }
+      std::vector<Eigen::Matrix<float, 1, 1>> times(input.count);
+      if (!ReadVectors<1>(input, times.data())) {
+        return false;
+      }
+      const size_t key_num = times.size();
+      if (key_num == 0) {
+        continue;
+      }
+      // Scalars of weights are flattened
+      const size_t elem_num = output.count * output.components;
+      const size_t per_key = elem_num / key_num / values_per_key;
+      std::vector<float> values(elem_num);
+      {
+        const size_t comp_size = ComponentSize(output.component_type);
+        for (size_t i = 0; i < output.count; i++) {
+          for (int k = 0; k < output.components; k++) {
+            values[i * output.components + k] =
+                output.data == nullptr
+                    ? 0.f
+                    : ReadComponent(output.data + i * output.stride +
+                                        k * comp_size,
+                                    output.component_type, output.normalized);
+          }
+        }
+      }
+
+      const std::string path = target.value("path", std::string());
+      for (size_t i = 0; i < key_num; i++) {
+        const float* v =
+            values.data() + (i * values_per_key + value_index) * per_key;
+        AnimKeyframe& kf = (*keyframes)[times[i][0]];
+        if (path == "translation" && per_key == 3) {
+          kf.t = Eigen::Vector3f(v[0], v[1], v[2]);
+          kf.t_valid = true;
+        } else if (path == "rotation" && per_key == 4) {
+          kf.q = Eigen::Quaternionf(v[3], v[0], v[1], v[2]).normalized();
+          kf.R_valid = true;
+        } else if (path == "scale" && per_key == 3) {
+          kf.s = v[0];
+          kf.s_valid = true;
+        } else if (path == "weights") {
+          kf.weights.assign(v, v + per_key);
+          kf.weights_valid = true;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+MeshPtr MakeMesh(const MeshData& data, const Eigen::Matrix4f& T,
+                 std::map<float, AnimKeyframe>&& keyframes,
+                 AnimInterp interp) {
+  std::vector<Eigen::Vector3f> vertices = data.vertices;
+  std::vector<Eigen::Vector3f> normals = data.normals;
+  std::vector<Blendshape> blendshapes = data.blendshapes;
+  if (!T.isIdentity()) {
+    const Eigen::Matrix3f R = T.block<3, 3>(0, 0);
+    const Eigen::Matrix3f N = R.inverse().transpose();
+    auto apply = [&](std::vector<Eigen::Vector3f>& vs, bool is_normal,
+                     bool is_point) {
+      ForEachBlock(vs.size(), [&](size_t st, size_t ed) {
+        for (size_t i = st; i < ed; i++) {
+          if (is_point) {
+            vs[i] = TransformPoint(T, vs[i]);
+          } else if (is_normal) {
+            vs[i] = (N * vs[i]).normalized();
+          } else {
+            vs[i] = R * vs[i];
+          }
+        }
+      });
+    };
+    apply(vertices, false, true);
+    apply(normals, true, false);
+    for (auto& b : blendshapes) {
+      apply(b.vertices, false, false);
+      // Normal displacements are treated as directions
+      apply(b.normals, false, false);
+    }
+  }
+
+  auto mesh = Mesh::Create();
+  mesh->set_vertices(std::move(vertices));
+  mesh->set_vertex_indices(data.indices);
+  if (!data.colors.empty()) {
+    mesh->set_vertex_colors(data.colors);
+  }
+  if (!data.uv.empty()) {
+    mesh->set_uv(data.uv);
+    mesh->set_uv_indices(data.indices);
+  }
+  if (!normals.empty()) {
+    mesh->set_normals(std::move(normals));
+    mesh->set_normal_indices(data.indices);
+  } else {
+    mesh->CalcNormal();
+  }
+  mesh->CalcFaceNormal();
+  mesh->set_materials(data.materials);
+  if (!data.material_ids.empty()) {
+    // Also makes face_indices_per_material
+    mesh->set_material_ids(data.material_ids);
+  }
+  if (!blendshapes.empty()) {
+    mesh->set_blendshapes(std::move(blendshapes));
+  }
+  if (!keyframes.empty()) {
+    mesh->set_keyframes(std::move(keyframes));
+    mesh->set_anim_interp(interp);
+  }
+  mesh->CalcStats();
+  return mesh;
+}
+
+bool LoadScene(GltfDocument& doc, Scene* scene) {
+  std::vector<ObjMaterial> materials;
+  if (!LoadMaterials(doc, &materials)) {
+    return false;
+  }
+
+  const json& gmeshes = ArrayMember(doc.j, "meshes");
+  std::vector<MeshData> mesh_data(gmeshes.size());
+  std::vector<bool> loaded(gmeshes.size(), false);
+  auto get_mesh_data = [&](size_t i) -> const MeshData* {
+    if (!loaded[i]) {
+      if (!LoadMeshData(doc, gmeshes[i], materials, &mesh_data[i])) {
+        return nullptr;
+      }
+      loaded[i] = true;
+    }
+    return &mesh_data[i];
+  };
+
+  // Mesh instances in the node hierarchy
+  const json& nodes = ArrayMember(doc.j, "nodes");
+  const json& scenes = ArrayMember(doc.j, "scenes");
+  std::vector<int> roots;
+  if (!scenes.empty()) {
+    const size_t scene_id = doc.j.value("scene", size_t(0));
+    const json& s = scenes[std::min(scene_id, scenes.size() - 1)];
+    roots = s.value("nodes", std::vector<int>());
+  }
+
+  std::vector<bool> animated(nodes.size(), false);
+  for (const auto& anim : ArrayMember(doc.j, "animations")) {
+    for (const auto& channel : ArrayMember(anim, "channels")) {
+      const int node =
+          ObjectMember(channel, "target").value("node", -1);
+      if (0 <= node && static_cast<size_t>(node) < nodes.size()) {
+        animated[node] = true;
+      }
+    }
+  }
+
+  std::vector<bool> visited(nodes.size(), false);
+  std::function<bool(int, const Eigen::Matrix4f&)> traverse =
+      [&](int node_id, const Eigen::Matrix4f& parent) {
+        if (node_id < 0 || nodes.size() <= static_cast<size_t>(node_id) ||
+            visited[node_id]) {
+          return true;
+        }
+        visited[node_id] = true;
+        const json& node = nodes[node_id];
+        const Eigen::Matrix4f world = parent * NodeMatrix(node);
+        const int mesh_id = node.value("mesh", -1);
+        if (0 <= mesh_id && static_cast<size_t>(mesh_id) < gmeshes.size()) {
+          const MeshData* data = get_mesh_data(mesh_id);
+          if (data == nullptr) {
+            return false;
+          }
+          std::map<float, AnimKeyframe> keyframes;
+          AnimInterp interp = AnimInterp::LINEAR;
+          if (animated[node_id] &&
+              !LoadKeyframes(doc, node_id, &keyframes, &interp)) {
+            return false;
+          }
+          // Keyframes replace the local transform of animated nodes
+          scene->push_back(MakeMesh(*data, animated[node_id] ? parent : world,
+                                    std::move(keyframes), interp));
+        }
+        for (int child : node.value("children", std::vector<int>())) {
+          if (!traverse(child, world)) {
+            return false;
+          }
+        }
+        return true;
+      };
+  for (int root : roots) {
+    if (!traverse(root, Eigen::Matrix4f::Identity())) {
+      return false;
+    }
+  }
+
+  // No scene: meshes as they are
+  if (roots.empty()) {
+    for (size_t i = 0; i < gmeshes.size(); i++) {
+      const MeshData* data = get_mesh_data(i);
+      if (data == nullptr) {
+        return false;
+      }
+      scene->push_back(MakeMesh(*data, Eigen::Matrix4f::Identity(), {},
+                                AnimInterp::LINEAR));
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+namespace ugu {
+
+bool LoadGltf(const std::string& path, Scene* scene) {
+  scene->clear();
+
+  GltfDocument doc;
+  if (!ParseDocument(path, &doc)) {
+    return false;
+  }
+
+  bool ret = false;
+  try {
+    ret = LoadScene(doc, scene);
+  } catch (const json::exception& e) {
+    LOGE("Failed to parse %s: %s\n", path.c_str(), e.what());
+  }
+  if (!ret) {
+    scene->clear();
+  }
+
+  return ret;
+}
+
+}  // namespace ugu
+
+#else
+
+namespace ugu {
+
+bool LoadGltf(const std::string& path, Scene* scene) {
+  (void)path;
+  (void)scene;
+  LOGE("Not supported with this configuration\n");
+  return false;
+}
+
+}  // namespace ugu
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/image_codec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+// Target raw bytes per chunk
+constexpr size_t kChunkBytes = 1 << 18;
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+// Keep the tail as literals so that matching never reads beyond the end
+constexpr size_t kLastLiterals = 5;
+constexpr int kHashBits = 14;
+
+inline uint32_t Read32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t Hash32(uint32_t v) {
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+void WriteLength(size_t len, std::vector<uint8_t>* out) {
+  while (len >= 255) {
+    out->push_back(255);
+    len -= 255;
+  }
+  out->push_back(static_cast<uint8_t>(len));
+}
+
+bool ReadLength(const uint8_t*& ip, const uint8_t* iend, size_t* len) {
+  uint8_t b = 0;
+  do {
+    if (ip >= iend) {
+      return false;
+    }
+    b = *ip++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+// Sequence: token (literal length | match length), literals, 2 byte offset.
+// The last sequence has literals only.
+void EmitSequence(const uint8_t* literals, size_t lit_len, size_t offset,
+                  size_t match_len, std::vector<uint8_t>* out) {
+  const size_t ml = match_len > 0 ? match_len - kMinMatch : 0;
+  out->push_back(static_cast<uint8_t>((std::min<size_t>(lit_len, 15) << 4) |
+                                      std::min<size_t>(ml, 15)));
+  if (lit_len >= 15) {
+    WriteLength(lit_len - 15, out);
+  }
+  out->insert(out->end(), literals, literals + lit_len);
+  if (match_len == 0) {
+    return;
+  }
+  out->push_back(static_cast<uint8_t>(offset & 0xff));
+  out->push_back(static_cast<uint8_t>(offset >> 8));
+  if (ml >= 15) {
+    WriteLength(ml - 15, out);
+  }
+}
+
+void LzCompress(const uint8_t* src, size_t n, std::vector<uint8_t>* out) {
+  std::vector<int64_t> table(size_t(1) << kHashBits, -1);
+  size_t anchor = 0;
+  if (n > kMinMatch + kLastLiterals) {
+    const size_t limit = n - kLastLiterals - kMinMatch;
+    size_t i = 0;
+    size_t misses = 0;
+    while (i <= limit) {
+      const uint32_t v = Read32(src + i);
+      const uint32_t h = Hash32(v);
+      const int64_t ref = table[h];
+      table[h] = static_cast<int64_t>(i);
+      if (ref >= 0 && i - static_cast<size_t>(ref) <= kMaxOffset &&
+          Read32(src + ref) == v) {
+        size_t len = kMinMatch;
+        const size_t max_len = n - kLastLiterals - i;
+        while (len < max_len && src[ref + len] == src[i + len]) {
+          len++;
+        }
+        EmitSequence(src + anchor, i - anchor, i - static_cast<size_t>(ref),
+                     len, out);
+        i += len;
+        anchor = i;
+        misses = 0;
+      } else {
+        // Skip faster on incompressible data
+        misses++;
+        i += 1 + (misses >> 6);
+      }
+    }
+  }
+  EmitSequence(src + anchor, n - anchor, 0, 0, out);
+}
+
+bool LzDecompress(const uint8_t* src, size_t n, uint8_t* dst,
+                  size_t dst_size) {
+  const uint8_t* ip = src;
+  const uint8_t* iend = src + n;
+  size_t op = 0;
+  while (ip < iend) {
+    const uint8_t token = *ip++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !ReadLength(ip, iend, &lit_len)) {
+      return false;
+    }
+    if (static_cast<size_t>(iend - ip) < lit_len || dst_size - op < lit_len) {
+      return false;
+    }
+    std::memcpy(dst + op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == iend) {
+      break;
+    }
+
+    if (iend - ip < 2) {
+      return false;
+    }
+    const size_t offset = static_cast<size_t>(ip[0]) |
+                          (static_cast<size_t>(ip[1]) << 8);
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15 && !ReadLength(ip, iend, &match_len)) {
+      return false;
+    }
+    match_len += kMinMatch;
+    if (offset == 0 || offset > op || dst_size - op < match_len) {
+      return false;
+    }
+    const uint8_t* match = dst + op - offset;
+    if (offset >= match_len) {
+      std::memcpy(dst + op, match, match_len);
+    } else {
+      // Overlapped copy repeats the pattern
+      for (size_t k = 0; k < match_len; k++) {
+        dst[op + k] = match[k];
+      }
+    }
+    op += match_len;
+  }
+  return op == dst_size;
+}
+
+// Residuals against the left pixel (the upper one at the row head) are
+// stored as byte planes
+template <typename U>
+void Predict(const ImageBase& img, int r0, int r1, uint8_t* planes) {
+  const size_t ch = static_cast<size_t>(img.channels());
+  const size_t row_elems = static_cast<size_t>(img.cols) * ch;
+  const size_t num = static_cast<size_t>(r1 - r0) * row_elems;
+  for (int y = r0; y < r1; y++) {
+    const U* row = reinterpret_cast<const U*>(img.data + y * img.step[0]);
+    const U* prev = y > r0 ? reinterpret_cast<const U*>(
+                                 img.data + (y - 1) * img.step[0])
+                           : nullptr;
+    const size_t offset = static_cast<size_t>(y - r0) * row_elems;
+    for (size_t j = 0; j < row_elems; j++) {
+      const U pred = j >= ch ? row[j - ch] : (prev != nullptr ? prev[j] : 0);
+      const U r = static_cast<U>(row[j] - pred);
+      for (size_t b = 0; b < sizeof(U); b++) {
+        planes[b * num + offset + j] = static_cast<uint8_t>(r >> (8 * b));
+      }
+    }
+  }
+}
+
+template <typename U>
+void Unpredict(const uint8_t* planes, int r0, int r1, ImageBase& img) {
+  const size_t ch = static_cast<size_t>(img.channels());
+  const size_t row_elems = static_cast<size_t>(img.cols) * ch;
+  const size_t num = static_cast<size_t>(r1 - r0) * row_elems;
+  for (int y = r0; y < r1; y++) {
+    U* row = reinterpret_cast<U*>(img.data + y * img.step[0]);
+    const U* prev = y > r0 ? reinterpret_cast<const U*>(
+                                 img.data + (y - 1) * img.step[0])
+                           : nullptr;
+    const size_t offset = static_cast<size_t>(y - r0) * row_elems;
+    for (size_t j = 0; j < row_elems; j++) {
+      U r = 0;
+      for (size_t b = 0; b < sizeof(U); b++) {
+        r = static_cast<U>(r | (static_cast<U>(planes[b * num + offset + j])
+                                << (8 * b)));
+      }
+      const U pred = j >= ch ? row[j - ch] : (prev != nullptr ? prev[j] : 0);
+      row[j] = static_cast<U>(r + pred);
+    }
+  }
+}
+
+bool PredictByDepth(const ImageBase& img, int r0, int r1, uint8_t* planes) {
+  switch (img.elemSize1()) {
+    case 1:
+      Predict<uint8_t>(img, r0, r1, planes);
+      return true;
+    case 2:
+      Predict<uint16_t>(img, r0, r1, planes);
+      return true;
+    case 4:
+      Predict<uint32_t>(img, r0, r1, planes);
+      return true;
+    case 8:
+      Predict<uint64_t>(img, r0, r1, planes);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool UnpredictByDepth(const uint8_t* planes, int r0, int r1, ImageBase& img) {
+  switch (img.elemSize1()) {
+    case 1:
+      Unpredict<uint8_t>(planes, r0, r1, img);
+      return true;
+    case 2:
+      Unpredict<uint16_t>(planes, r0, r1, img);
+      return true;
+    case 4:
+      Unpredict<uint32_t>(planes, r0, r1, img);
+      return true;
+    case 8:
+      Unpredict<uint64_t>(planes, r0, r1, img);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void AppendBytes(const void* p, size_t size, std::vector<uint8_t>* out) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+  out->insert(out->end(), b, b + size);
+}
+
+}  // namespace
+
+namespace ugu {
+
+bool EncodeLossless(const ImageBase& img, std::vector<uint8_t>* encoded,
+                    int num_threads) {
+  encoded->clear();
+  const size_t row_bytes = static_cast<size_t>(img.cols) * img.elemSize();
+  const uint32_t rows = static_cast<uint32_t>(std::max(img.rows, 0));
+  const uint32_t chunk_rows = static_cast<uint32_t>(
+      std::max<size_t>(1, kChunkBytes / std::max<size_t>(row_bytes, 1)));
+  const uint32_t chunk_num = (rows + chunk_rows - 1) / chunk_rows;
+
+  std::vector<std::vector<uint8_t>> chunks(chunk_num);
+  // Stream: chunk_rows (uint32), chunk_num (uint32), compressed size of each
+  // chunk (uint64), chunk data. A chunk whose size equals its raw size is
+  // stored without LZ compression.
+  std::atomic_bool ok{true};
+  auto encode_chunk = [&](size_t i) {
+    const int r0 = static_cast<int>(i * chunk_rows);
+    const int r1 = std::min(r0 + static_cast<int>(chunk_rows), img.rows);
+    const size_t raw_size = static_cast<size_t>(r1 - r0) * row_bytes;
+    std::vector<uint8_t> planes(raw_size);
+    if (!PredictByDepth(img, r0, r1, planes.data())) {
+      ok = false;
+      return;
+    }
+    chunks[i].reserve(raw_size / 2);
+    LzCompress(planes.data(), raw_size, &chunks[i]);
+    if (chunks[i].size() >= raw_size) {
+      chunks[i] = std::move(planes);
+    }
+  };
+  parallel_for(size_t(0), size_t(chunk_num), encode_chunk, num_threads);
+  if (!ok) {
+    LOGE("Unsupported type %d\n", img.type());
+    return false;
+  }
+
+  size_t total = 0;
+  for (const auto& c : chunks) {
+    total += c.size();
+  }
+  encoded->reserve(sizeof(uint32_t) * 2 + sizeof(uint64_t) * chunk_num +
+                   total);
+  AppendBytes(&chunk_rows, sizeof(chunk_rows), encoded);
+  AppendBytes(&chunk_num, sizeof(chunk_num), encoded);
+  for (const auto& c : chunks) {
+    const uint64_t size = c.size();
+    AppendBytes(&size, sizeof(size), encoded);
+  }
+  for (const auto& c : chunks) {
+    AppendBytes(c.data(), c.size(), encoded);
+  }
+
+  return true;
+}
+
+bool DecodeLossless(const uint8_t* encoded, size_t size, ImageBase& img,
+                    int num_threads) {
+  uint32_t chunk_rows = 0;
+  uint32_t chunk_num = 0;
+  if (size < sizeof(chunk_rows) + sizeof(chunk_num)) {
+    LOGE("Too small stream\n");
+    return false;
+  }
+  std::memcpy(&chunk_rows, encoded, sizeof(chunk_rows));
+  std::memcpy(&chunk_num, encoded + sizeof(chunk_rows), sizeof(chunk_num));
+  const size_t rows = static_cast<size_t>(std::max(img.rows, 0));
+  if ((rows > 0 && chunk_rows == 0) ||
+      (chunk_rows > 0 && chunk_num != (rows + chunk_rows - 1) / chunk_rows)) {
+    LOGE("Shape mismatch\n");
+    return false;
+  }
+
+  size_t pos = sizeof(chunk_rows) + sizeof(chunk_num);
+  if (size - pos < sizeof(uint64_t) * chunk_num) {
+    LOGE("Broken stream\n");
+    return false;
+  }
+  std::vector<uint64_t> sizes(chunk_num);
+  std::memcpy(sizes.data(), encoded + pos, sizeof(uint64_t) * chunk_num);
+  pos += sizeof(uint64_t) * chunk_num;
+  std::vector<size_t> offsets(chunk_num);
+  for (uint32_t i = 0; i < chunk_num; i++) {
+    offsets[i] = pos;
+    if (size - pos < sizes[i]) {
+      LOGE("Broken stream\n");
+      return false;
+    }
+    pos += static_cast<size_t>(sizes[i]);
+  }
+
+  const size_t row_bytes = static_cast<size_t>(img.cols) * img.elemSize();
+  std::atomic_bool ok{true};
+  auto decode_chunk = [&](size_t i) {
+    const int r0 = static_cast<int>(i * chunk_rows);
+    const int r1 = std::min(r0 + static_cast<int>(chunk_rows), img.rows);
+    const size_t raw_size = static_cast<size_t>(r1 - r0) * row_bytes;
+    std::vector<uint8_t> planes(raw_size);
+    const uint8_t* src = encoded + offsets[i];
+    if (sizes[i] == raw_size) {
+      std::memcpy(planes.data(), src, raw_size);
+    } else if (!LzDecompress(src, static_cast<size_t>(sizes[i]),
+                             planes.data(), raw_size)) {
+      ok = false;
+      return;
+    }
+    if (!UnpredictByDepth(planes.data(), r0, r1, img)) {
+      ok = false;
+    }
+  };
+  parallel_for(size_t(0), size_t(chunk_num), decode_chunk, num_threads);
+  if (!ok) {
+    LOGE("Decode failed\n");
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace ugu
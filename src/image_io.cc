@@ -5,57 +5,202 @@
 
 #include "ugu/image_io.h"
 
+#include "ugu/image_codec.h"
 #include "ugu/util/image_util.h"
 #include "ugu/util/io_util.h"
 
+namespace {
+using namespace ugu;
+
+struct ImageBinaryHeader {
+  char magic[4];
+  uint32_t version;
+  int32_t rows;
+  int32_t cols;
+  int32_t cv_type;
+  uint32_t compression;
+  uint64_t raw_size;      // Bytes of pixels after decompression
+  uint64_t payload_size;  // Bytes stored after the header
+  uint8_t reserved[24];
+};
+// Keep the pixels after the header aligned for mapped views
+static_assert(sizeof(ImageBinaryHeader) == 64, "Unexpected header size");
+
+constexpr char kImageBinaryMagic[4] = {'U', 'G', 'U', 'I'};
+constexpr uint32_t kImageBinaryVersion = 1;
+
+}  // namespace
+
+namespace ugu {
+
+bool WriteImageBinary(const std::string& path, const ImageBase& img,
+                      ImageBinaryCompression compression) {
+  std::vector<uint8_t> encoded;
+  if (compression == ImageBinaryCompression::kLossless) {
+    if (!EncodeLossless(img, &encoded)) {
+      return false;
+    }
+  } else if (compression != ImageBinaryCompression::kNone) {
+    LOGE("Unsupported compression %d\n", static_cast<int>(compression));
+    return false;
+  }
+
+  ImageBinaryHeader header{};
+  std::memcpy(header.magic, kImageBinaryMagic, sizeof(header.magic));
+  header.version = kImageBinaryVersion;
+  header.rows = img.rows;
+  header.cols = img.cols;
+  header.cv_type = img.type();
+  header.compression = static_cast<uint32_t>(compression);
+  const size_t row_bytes = static_cast<size_t>(img.cols) * img.elemSize();
+  header.raw_size = row_bytes * static_cast<size_t>(img.rows);
+  header.payload_size = compression == ImageBinaryCompression::kNone
+                            ? header.raw_size
+                            : encoded.size();
+
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs.is_open()) {
+    LOGE("Failed to open %s\n", path.c_str());
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (compression != ImageBinaryCompression::kNone) {
+    ofs.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    return !ofs.bad();
+  }
+  // Row by row since cv::Mat may not be continuous
+  for (int y = 0; y < img.rows; y++) {
+    ofs.write(reinterpret_cast<const char*>(img.data + y * img.step[0]),
+              row_bytes);
+  }
+
+  return !ofs.bad();
+}
+
+ImageBase LoadImageBinary(const std::string& path, bool use_mmap) {
+  auto file = std::make_shared<MappedFile>();
+  std::vector<uint8_t> buf;
+  const uint8_t* bytes = nullptr;
+  size_t size = 0;
+  if (use_mmap) {
+    if (!file->Open(path)) {
+      return ImageBase();
+    }
+    bytes = file->data();
+    size = file->size();
+  } else {
+    if (!LoadBinary(path, &buf)) {
+      LOGE("Failed to read %s\n", path.c_str());
+      return ImageBase();
+    }
+    bytes = buf.data();
+    size = buf.size();
+  }
+
+  ImageBinaryHeader header;
+  if (size < sizeof(header)) {
+    LOGE("Too small file %s\n", path.c_str());
+    return ImageBase();
+  }
+  std::memcpy(&header, bytes, sizeof(header));
+  if (std::memcmp(header.magic, kImageBinaryMagic, sizeof(header.magic)) !=
+          0 ||
+      header.version != kImageBinaryVersion) {
+    LOGE("Not a binary image or unsupported version %s\n", path.c_str());
+    return ImageBase();
+  }
+  const auto compression =
+      static_cast<ImageBinaryCompression>(header.compression);
+  if (compression != ImageBinaryCompression::kNone &&
+      compression != ImageBinaryCompression::kLossless) {
+    LOGE("Unsupported compression %d\n", header.compression);
+    return ImageBase();
+  }
+
+  const size_t elem_size = ElemSizeFromCvType(header.cv_type);
+  const size_t expected = static_cast<size_t>(header.rows) *
+                          static_cast<size_t>(header.cols) * elem_size;
+  if (header.rows < 0 || header.cols < 0 || elem_size == 0 ||
+      header.raw_size != expected ||
+      (compression == ImageBinaryCompression::kNone &&
+       header.payload_size != expected) ||
+      size - sizeof(header) < header.payload_size) {
+    LOGE("Broken header %s\n", path.c_str());
+    return ImageBase();
+  }
+
+  if (compression == ImageBinaryCompression::kLossless) {
+    ImageBase img(header.rows, header.cols, header.cv_type);
+    if (!DecodeLossless(bytes + sizeof(header),
+                        static_cast<size_t>(header.payload_size), img)) {
+      LOGE("Failed to decode %s\n", path.c_str());
+      return ImageBase();
+    }
+    return img;
+  }
+
+  uint8_t* pixels = const_cast<uint8_t*>(bytes) + sizeof(header);
+#ifdef UGU_USE_OPENCV
+  return ImageBase(header.rows, header.cols, header.cv_type, pixels).clone();
+#else
+  if (use_mmap) {
+    // The mapping is released with the last image referring it
+    return ImageBase(header.rows, header.cols, header.cv_type, pixels, file);
+  }
+  ImageBase img(header.rows, header.cols, header.cv_type);
+  std::memcpy(img.data, pixels, expected);
+  return img;
+#endif
+}
+
+}  // namespace ugu
+
 #ifdef UGU_USE_OPENCV
+namespace ugu {
+
+ImageBase imdecode(const uint8_t* buf, size_t size, int flags) {
+  if (size == 0) {
+    return ImageBase();
+  }
+  return cv::imdecode(
+      cv::Mat(1, static_cast<int>(size), CV_8UC1, const_cast<uint8_t*>(buf)),
+      flags);
+}
+
+}  // namespace ugu
 #else
 
 namespace {
 using namespace ugu;
 
 #ifdef UGU_USE_STB
-bool LoadByStb(ImageBase& img, const std::string& path) {
-  int bit_depth = 0;
-
-  auto ext = ExtractExt(path);
-  if (ext == "png" || ext == "PNG") {
-    // https://stackoverflow.com/questions/6278159/find-out-if-png-is-8-or-24
-    std::ifstream fin(path, std::ios::in | std::ios::binary);
-    fin.seekg(24);
-    bit_depth = fin.get();
-  } else {
-    bit_depth = 8;
-  }
-
-  uint8_t* in_pixels_tmp = NULL;
+bool DecodeByStb(ImageBase& img, const uint8_t* buf, size_t size) {
+  const int len = static_cast<int>(size);
   int width = -1;
   int height = -1;
   int bpp = -1;
-
   const int desired_ch = 0;  // Not desire
-  int cv_type = -1;
-
-  if (bit_depth == 8) {
-    in_pixels_tmp = stbi_load(path.c_str(), &width, &height, &bpp, desired_ch);
-    cv_type = MakeCvType(&typeid(uint8_t), bpp);
-  } else if (bit_depth == 16 || in_pixels_tmp == NULL) {
-    in_pixels_tmp = reinterpret_cast<uint8_t*>(
-        stbi_load_16(path.c_str(), &width, &height, &bpp, desired_ch));
-    cv_type = MakeCvType(&typeid(uint16_t), bpp);
+
+  void* pixels = nullptr;
+  const std::type_info* cpp_type = nullptr;
+  if (stbi_is_16_bit_from_memory(buf, len)) {
+    pixels = stbi_load_16_from_memory(buf, len, &width, &height, &bpp,
+                                      desired_ch);
+    cpp_type = &typeid(uint16_t);
   } else {
-    LOGE("Load failed. bit depth is %d\n", bit_depth);
-    return false;
+    pixels =
+        stbi_load_from_memory(buf, len, &width, &height, &bpp, desired_ch);
+    cpp_type = &typeid(uint8_t);
   }
 
-  if (in_pixels_tmp == NULL) {
-    LOGE("Load failed\n");
+  if (pixels == nullptr) {
+    LOGE("Decode failed: %s\n", stbi_failure_reason());
     return false;
   }
 
-  img = ImageBase(height, width, cv_type);
-  std::memcpy(img.data, in_pixels_tmp, SizeInBytes(img));
-  stbi_image_free(in_pixels_tmp);
+  // Adopt the decoded buffer as pixel memory to avoid an extra copy
+  img = ImageBase(height, width, MakeCvType(cpp_type, bpp), pixels,
+                  std::shared_ptr<void>(pixels, stbi_image_free));
 
   return true;
 }
@@ -158,9 +303,11 @@ bool WriteJpg(const ImageBase& img, const std::string& path) {
   return ret != 0;
 }
 #else
-bool LoadByStb(ImageBase& img, const std::string& path) {
-  (void)img, path;
-  LOGE("can't load image with this configuration\n");
+bool DecodeByStb(ImageBase& img, const uint8_t* buf, size_t size) {
+  (void)img;
+  (void)buf;
+  (void)size;
+  LOGE("can't decode image with this configuration\n");
   return false;
 }
 
@@ -201,18 +348,26 @@ bool imwrite(const std::string& filename, const ImageBase& img,
     return WriteJpg(img, filename);
   } else if (extname == ".bin" || extname == ".BIN") {
     return WriteBinary(img, filename);
+  } else if (extname == ".ugi" || extname == ".UGI") {
+    return WriteImageBinary(filename, img);
   }
 
   LOGE(
-      "acceptable extention is .png, .jpg or .jpeg. this extention is not "
-      "supported: %s\n",
+      "acceptable extention is .png, .jpg, .jpeg, .bin or .ugi. this "
+      "extention is not supported: %s\n",
       filename.c_str());
   return false;
 }
 
-ImageBase imread(const std::string& filename, int flags) {
+ImageBase imdecode(const std::vector<uint8_t>& buf, int flags) {
+  return imdecode(buf.data(), buf.size(), flags);
+}
+
+ImageBase imdecode(const uint8_t* buf, size_t size, int flags) {
   ImageBase loaded;
-  LoadByStb(loaded, filename);
+  if (size == 0 || !DecodeByStb(loaded, buf, size)) {
+    return ImageBase();
+  }
 
   if (flags == ImreadModes::IMREAD_COLOR) {
     // TODO: other cases...
@@ -226,5 +381,19 @@ ImageBase imread(const std::string& filename, int flags) {
   return loaded;
 }
 
+ImageBase imread(const std::string& filename, int flags) {
+  auto ext = ExtractExt(filename);
+  if (ext == "ugi" || ext == "UGI") {
+    return LoadImageBinary(filename);
+  }
+
+  std::vector<uint8_t> buf;
+  if (!LoadBinary(filename, &buf)) {
+    LOGE("Failed to read %s\n", filename.c_str());
+    return ImageBase();
+  }
+  return imdecode(buf, flags);
+}
+
 }  // namespace ugu
 #endif
@@ -14,6 +14,9 @@
 #pragma warning(pop)
 #endif
 
+#include <cmath>
+#include <functional>
+
 namespace {
 
 // https://stackoverflow.com/questions/7880264/convert-lab-color-to-rgb
@@ -177,6 +180,194 @@ ugu::Image3b LabToRgb(const ugu::Image3b& src) {
   return rgb;
 }
 
+#ifndef UGU_USE_OPENCV
+
+// Precomputed coefficients of separable resampling along one axis.
+// Every output position has the same number of taps and border pixels are
+// replicated by clamped indices, so that inner loops have no branch.
+struct ResizeCoeffTable {
+  int taps{0};
+  std::vector<int> indices;    // out_size * taps
+  std::vector<float> weights;  // out_size * taps
+};
+
+float LinearKernel(float x) {
+  x = std::abs(x);
+  return x < 1.f ? 1.f - x : 0.f;
+}
+
+// Keys cubic with a = -0.75, same to OpenCV
+float CubicKernel(float x) {
+  const float a = -0.75f;
+  x = std::abs(x);
+  if (x < 1.f) {
+    return ((a + 2.f) * x - (a + 3.f)) * x * x + 1.f;
+  }
+  if (x < 2.f) {
+    return ((a * x - 5.f * a) * x + 8.f * a) * x - 4.f * a;
+  }
+  return 0.f;
+}
+
+float Lanczos4Kernel(float x) {
+  const float a = 4.f;
+  x = std::abs(x);
+  if (x < 1e-6f) {
+    return 1.f;
+  }
+  if (x >= a) {
+    return 0.f;
+  }
+  const float px = static_cast<float>(ugu::pi) * x;
+  return a * std::sin(px) * std::sin(px / a) / (px * px);
+}
+
+ResizeCoeffTable MakeKernelCoeffTable(
+    int in_size, int out_size, float radius,
+    const std::function<float(float)>& kernel) {
+  const float scale =
+      static_cast<float>(in_size) / static_cast<float>(out_size);
+  // Widen kernel for downsampling to avoid aliasing
+  const float filter_scale = std::max(scale, 1.f);
+  const float support = radius * filter_scale;
+
+  ResizeCoeffTable table;
+  table.taps = static_cast<int>(std::ceil(support * 2.f)) + 1;
+  table.indices.resize(static_cast<size_t>(out_size) * table.taps);
+  table.weights.resize(static_cast<size_t>(out_size) * table.taps);
+
+  for (int i = 0; i < out_size; i++) {
+    // Pixel centers are aligned like OpenCV
+    const float center = (static_cast<float>(i) + 0.5f) * scale;
+    const int st = static_cast<int>(std::floor(center - support));
+    int* idx = table.indices.data() + static_cast<size_t>(i) * table.taps;
+    float* w = table.weights.data() + static_cast<size_t>(i) * table.taps;
+    float sum = 0.f;
+    for (int k = 0; k < table.taps; k++) {
+      const int j = st + k;
+      idx[k] = std::clamp(j, 0, in_size - 1);
+      w[k] = kernel((static_cast<float>(j) + 0.5f - center) / filter_scale);
+      sum += w[k];
+    }
+    if (std::abs(sum) > std::numeric_limits<float>::min()) {
+      const float inv_sum = 1.f / sum;
+      for (int k = 0; k < table.taps; k++) {
+        w[k] *= inv_sum;
+      }
+    }
+  }
+
+  return table;
+}
+
+// Exact pixel area coverage. Same to linear for upsampling.
+ResizeCoeffTable MakeAreaCoeffTable(int in_size, int out_size) {
+  const double scale =
+      static_cast<double>(in_size) / static_cast<double>(out_size);
+  if (scale <= 1.0) {
+    return MakeKernelCoeffTable(in_size, out_size, 1.f, LinearKernel);
+  }
+
+  ResizeCoeffTable table;
+  table.taps = static_cast<int>(std::ceil(scale)) + 1;
+  table.indices.resize(static_cast<size_t>(out_size) * table.taps);
+  table.weights.resize(static_cast<size_t>(out_size) * table.taps);
+
+  for (int i = 0; i < out_size; i++) {
+    const double src0 = i * scale;
+    const double src1 = (i + 1) * scale;
+    const int st = static_cast<int>(std::floor(src0));
+    int* idx = table.indices.data() + static_cast<size_t>(i) * table.taps;
+    float* w = table.weights.data() + static_cast<size_t>(i) * table.taps;
+    for (int k = 0; k < table.taps; k++) {
+      const int j = st + k;
+      const double overlap = std::min(static_cast<double>(j + 1), src1) -
+                             std::max(static_cast<double>(j), src0);
+      idx[k] = std::clamp(j, 0, in_size - 1);
+      w[k] = static_cast<float>(std::max(0.0, overlap) / scale);
+    }
+  }
+
+  return table;
+}
+
+ResizeCoeffTable MakeCoeffTable(int in_size, int out_size, int interpolation) {
+  if (interpolation == ugu::InterpolationFlags::INTER_AREA) {
+    return MakeAreaCoeffTable(in_size, out_size);
+  } else if (interpolation == ugu::InterpolationFlags::INTER_CUBIC) {
+    return MakeKernelCoeffTable(in_size, out_size, 2.f, CubicKernel);
+  } else if (interpolation == ugu::InterpolationFlags::INTER_LANCZOS4) {
+    return MakeKernelCoeffTable(in_size, out_size, 4.f, Lanczos4Kernel);
+  }
+  return MakeKernelCoeffTable(in_size, out_size, 1.f, LinearKernel);
+}
+
+template <typename V, typename Acc>
+V CastResized(Acc v) {
+  if constexpr (std::is_integral_v<V>) {
+    return ugu::saturate_cast<V>(std::round(v));
+  } else {
+    return static_cast<V>(v);
+  }
+}
+
+// Horizontal pass into an intermediate buffer, then vertical pass.
+// Both are row-parallel. The vertical pass is a sequence of axpy over
+// contiguous rows, which compilers vectorize.
+template <typename V, typename Acc>
+void ResizeSeparableImpl(const ugu::ImageBase& src, ugu::ImageBase& dst,
+                         const ResizeCoeffTable& x_table,
+                         const ResizeCoeffTable& y_table) {
+  const int ch = src.channels();
+  const size_t tmp_stride = static_cast<size_t>(dst.cols) * ch;
+  std::vector<Acc> tmp(static_cast<size_t>(src.rows) * tmp_stride);
+
+  auto horizontal_func = [&](int y) {
+    const V* src_row = reinterpret_cast<const V*>(src.data + src.step[0] * y);
+    Acc* tmp_row = tmp.data() + tmp_stride * y;
+    for (int x = 0; x < dst.cols; x++) {
+      const int* idx = x_table.indices.data() + x * x_table.taps;
+      const float* w = x_table.weights.data() + x * x_table.taps;
+      Acc* out = tmp_row + x * ch;
+      for (int c = 0; c < ch; c++) {
+        out[c] = Acc(0);
+      }
+      for (int k = 0; k < x_table.taps; k++) {
+        const V* s = src_row + idx[k] * ch;
+        const Acc wk = static_cast<Acc>(w[k]);
+        for (int c = 0; c < ch; c++) {
+          out[c] += wk * static_cast<Acc>(s[c]);
+        }
+      }
+    }
+  };
+  ugu::parallel_for(0, src.rows, horizontal_func);
+
+  auto vertical_func = [&](int y) {
+    std::vector<Acc> acc(tmp_stride, Acc(0));
+    const int* idx = y_table.indices.data() + y * y_table.taps;
+    const float* w = y_table.weights.data() + y * y_table.taps;
+    for (int k = 0; k < y_table.taps; k++) {
+      const Acc wk = static_cast<Acc>(w[k]);
+      if (wk == Acc(0)) {
+        continue;
+      }
+      const Acc* tmp_row = tmp.data() + tmp_stride * idx[k];
+      Acc* acc_ptr = acc.data();
+      for (size_t i = 0; i < tmp_stride; i++) {
+        acc_ptr[i] += wk * tmp_row[i];
+      }
+    }
+    V* dst_row = reinterpret_cast<V*>(dst.data + dst.step[0] * y);
+    for (size_t i = 0; i < tmp_stride; i++) {
+      dst_row[i] = CastResized<V, Acc>(acc[i]);
+    }
+  };
+  ugu::parallel_for(0, dst.rows, vertical_func);
+}
+
+#endif
+
 }  // namespace
 
 namespace ugu {
@@ -302,6 +493,44 @@ void addWeighted(InputArray src1, double alpha, InputArray src2, double beta,
   LOGE("Not implemented\n");
 }
 
+bool ResizeSeparable(const ImageBase& src, ImageBase& dst, int out_w,
+                     int out_h, int interpolation) {
+  if (src.empty() || out_w <= 0 || out_h <= 0) {
+    LOGE("Wrong size\n");
+    return false;
+  }
+
+  const ResizeCoeffTable x_table =
+      MakeCoeffTable(src.cols, out_w, interpolation);
+  const ResizeCoeffTable y_table =
+      MakeCoeffTable(src.rows, out_h, interpolation);
+
+  // src and dst may be the same instance
+  ImageBase out(out_h, out_w, src.type());
+  const int depth = CV_MAT_DEPTH(src.type());
+  if (depth == CV_8U) {
+    ResizeSeparableImpl<uint8_t, float>(src, out, x_table, y_table);
+  } else if (depth == CV_8S) {
+    ResizeSeparableImpl<int8_t, float>(src, out, x_table, y_table);
+  } else if (depth == CV_16U) {
+    ResizeSeparableImpl<uint16_t, float>(src, out, x_table, y_table);
+  } else if (depth == CV_16S) {
+    ResizeSeparableImpl<int16_t, float>(src, out, x_table, y_table);
+  } else if (depth == CV_32S) {
+    ResizeSeparableImpl<int32_t, double>(src, out, x_table, y_table);
+  } else if (depth == CV_32F) {
+    ResizeSeparableImpl<float, float>(src, out, x_table, y_table);
+  } else if (depth == CV_64F) {
+    ResizeSeparableImpl<double, double>(src, out, x_table, y_table);
+  } else {
+    LOGE("Not supported type\n");
+    return false;
+  }
+  dst = out;
+
+  return true;
+}
+
 #endif
 
 Image3b ColorTransfer(const Image3b& refer, const Image3b& target,
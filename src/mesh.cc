@@ -5,6 +5,8 @@
 
 #include "ugu/mesh.h"
 
+#include <atomic>
+#include <cstring>
 #include <fstream>
 #include <map>
 #include <random>
@@ -12,20 +14,16 @@
 #include <unordered_set>
 
 #include "gltf.h"
+#include "obj.h"
+#include "ply.h"
 #include "ugu/face_adjacency.h"
 #include "ugu/image_io.h"
+#include "ugu/mesh_binary.h"
+#include "ugu/util/csr_util.h"
+#include "ugu/util/geom_util.h"
 #include "ugu/util/image_util.h"
 #include "ugu/util/string_util.h"
-
-#ifdef UGU_USE_TINYOBJLOADER
-#ifdef _WIN32
-#pragma warning(push, 0)
-#endif
-#include "tiny_obj_loader.h"
-#ifdef _WIN32
-#pragma warning(pop)
-#endif
-#endif
+#include "ugu/util/thread_util.h"
 
 namespace {
 
@@ -39,6 +37,40 @@ void CopyVec(const std::vector<T>& src, std::vector<T>* dst,
   std::copy(src.begin(), src.end(), std::back_inserter(*dst));
 }
 
+// Elements per task of the parallel mesh kernels
+constexpr size_t kMeshBlockSize = 1 << 16;
+
+// Bytes of a buffer divided by the number of copies sharing it. elem_bytes
+// gives the bytes owned by each element out of the buffer.
+template <typename T, typename Func>
+size_t SharedBytes(const ugu::CowVector<T>& v, Func elem_bytes) {
+  if (v.use_count() == 0) {
+    return 0;
+  }
+  size_t bytes = v.get().capacity() * sizeof(T);
+  for (const T& e : v) {
+    bytes += elem_bytes(e);
+  }
+  return bytes / v.use_count();
+}
+
+template <typename T>
+size_t SharedBytes(const ugu::CowVector<T>& v) {
+  return SharedBytes(v, [](const T&) { return size_t(0); });
+}
+
+// Faces around each vertex in CSR, sorted by face index
+void MakeVertexFaceCsr(const std::vector<Eigen::Vector3i>& indices,
+                       size_t vertex_num, std::vector<int>* offsets,
+                       std::vector<int>* faces) {
+  const int* corners = indices.empty() ? nullptr : indices[0].data();
+  ugu::MakeCsr(
+      vertex_num, indices.size() * 3,
+      [&](size_t c) { return corners[c]; },
+      [](size_t c) { return static_cast<int>(c / 3); }, offsets, faces,
+      kMeshBlockSize);
+}
+
 bool WriteMtl(const std::string& path,
               const std::vector<ugu::ObjMaterial>& materials) {
   std::ofstream ofs(path);
@@ -79,6 +111,270 @@ bool WriteTexture(const std::vector<ugu::ObjMaterial>& materials) {
 
   return ret;
 }
+
+#ifdef UGU_USE_JSON
+// Images for glb. Compressed data in memory are referred without copy and
+// texture files are streamed on writing. If encode_texture, textures in
+// memory are encoded in parallel unless compressed data exist.
+std::vector<ugu::gltf::Image> MakeGlbImages(
+    const std::vector<const ugu::ObjMaterial*>& materials,
+    bool encode_texture) {
+  struct ImageSource {
+    const ugu::ObjMaterial* mat;
+    bool with_alpha;
+    std::string name;
+    std::string path;
+    std::string ext;
+  };
+  std::vector<ImageSource> sources;
+  for (const auto* mat : materials) {
+    ImageSource src;
+    src.mat = mat;
+    src.with_alpha = !mat->with_alpha_texname.empty();
+    src.name = src.with_alpha ? mat->with_alpha_texname : mat->diffuse_texname;
+    src.path = src.with_alpha ? mat->with_alpha_texpath : mat->diffuse_texpath;
+    if (src.name.empty()) {
+      continue;
+    }
+    if (src.path.empty()) {
+      src.path = src.name;
+    }
+    src.ext = ugu::ExtractExt(src.path);
+    if (src.ext != "jpg" && src.ext != "jpeg" && src.ext != "png") {
+      ugu::LOGE("ext %s is not supported\n", src.ext.c_str());
+      continue;
+    }
+    sources.push_back(src);
+  }
+
+  std::vector<ugu::gltf::Image> images(sources.size());
+  std::vector<uint8_t> valid(sources.size(), 0);
+  ugu::parallel_for(size_t(0), sources.size(), [&](size_t i) {
+    const ImageSource& src = sources[i];
+    ugu::gltf::Image& image = images[i];
+    image.is_glb = true;
+    image.mimeType = src.ext == "png" ? "image/png" : "image/jpeg";
+    image.name = ugu::ExtractPathWithoutExt(src.name);
+
+    const std::vector<uint8_t>& compressed =
+        src.with_alpha ? src.mat->with_alpha_compressed
+                       : src.mat->diffuse_compressed;
+    if (!compressed.empty()) {
+      image.bin =
+          ugu::gltf::MemorySegment(compressed.data(), compressed.size());
+      valid[i] = 1;
+      return;
+    }
+
+    if (encode_texture) {
+      std::vector<uint8_t> encoded;
+      if (src.with_alpha) {
+        if (!src.mat->with_alpha_tex.empty() && src.ext == "png") {
+          encoded = ugu::PngData(src.mat->with_alpha_tex);
+        }
+      } else if (!src.mat->diffuse_tex.empty()) {
+        encoded = src.ext == "png" ? ugu::PngData(src.mat->diffuse_tex)
+                                   : ugu::JpgData(src.mat->diffuse_tex);
+      }
+      if (!encoded.empty()) {
+        image.bin = ugu::gltf::OwnedSegment(std::move(encoded));
+        valid[i] = 1;
+        return;
+      }
+    }
+
+    valid[i] = ugu::gltf::FileSegment(src.path, &image.bin) ? 1 : 0;
+  });
+
+  // Failed images are kept empty since textures refer to them by index
+  for (size_t i = 0; i < images.size(); i++) {
+    if (!valid[i]) {
+      ugu::LOGE("Failed to get texture %s\n", sources[i].path.c_str());
+      images[i].bin = ugu::gltf::OwnedSegment(std::vector<uint8_t>());
+    }
+  }
+  return images;
+}
+#endif
+
+// Serializer of small parameters for the binary container
+class ByteWriter {
+ public:
+  template <typename T>
+  void Put(const T& v) {
+    const auto* p = reinterpret_cast<const uint8_t*>(&v);
+    bytes_.insert(bytes_.end(), p, p + sizeof(T));
+  }
+  void Put(const std::string& s) {
+    Put(static_cast<uint64_t>(s.size()));
+    bytes_.insert(bytes_.end(), s.begin(), s.end());
+  }
+  void Put(const std::vector<float>& v) {
+    Put(static_cast<uint64_t>(v.size()));
+    const auto* p = reinterpret_cast<const uint8_t*>(v.data());
+    bytes_.insert(bytes_.end(), p, p + sizeof(float) * v.size());
+  }
+  const std::vector<uint8_t>& bytes() const { return bytes_; }
+
+ private:
+  std::vector<uint8_t> bytes_;
+};
+
+class ByteReader {
+ public:
+  ByteReader(const std::vector<uint8_t>& bytes) : bytes_(bytes) {}
+  template <typename T>
+  bool Get(T* v) {
+    if (bytes_.size() - pos_ < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(static_cast<void*>(v), bytes_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+  bool Get(std::string* s) {
+    uint64_t size = 0;
+    if (!Get(&size) || bytes_.size() - pos_ < size) {
+      return false;
+    }
+    s->assign(reinterpret_cast<const char*>(bytes_.data() + pos_), size);
+    pos_ += size;
+    return true;
+  }
+  bool Get(std::vector<float>* v) {
+    uint64_t size = 0;
+    if (!Get(&size) || (bytes_.size() - pos_) / sizeof(float) < size) {
+      return false;
+    }
+    v->resize(size);
+    std::memcpy(v->data(), bytes_.data() + pos_, sizeof(float) * size);
+    pos_ += sizeof(float) * size;
+    return true;
+  }
+
+ private:
+  const std::vector<uint8_t>& bytes_;
+  size_t pos_ = 0;
+};
+
+std::vector<uint8_t> SerializeMaterials(
+    const std::vector<ugu::ObjMaterial>& materials) {
+  ByteWriter w;
+  w.Put(static_cast<uint64_t>(materials.size()));
+  for (const auto& m : materials) {
+    w.Put(m.name);
+    w.Put(m.ambient);
+    w.Put(m.diffuse);
+    w.Put(m.specular);
+    w.Put(m.shininess);
+    w.Put(m.dissolve);
+    w.Put(m.illum);
+    w.Put(m.diffuse_texname);
+    w.Put(m.with_alpha_texname);
+  }
+  return w.bytes();
+}
+
+bool DeserializeMaterials(const std::vector<uint8_t>& bytes,
+                          std::vector<ugu::ObjMaterial>* materials) {
+  ByteReader r(bytes);
+  uint64_t num = 0;
+  if (!r.Get(&num)) {
+    return false;
+  }
+  materials->clear();
+  for (uint64_t i = 0; i < num; i++) {
+    ugu::ObjMaterial m;
+    if (!r.Get(&m.name) || !r.Get(&m.ambient) || !r.Get(&m.diffuse) ||
+        !r.Get(&m.specular) || !r.Get(&m.shininess) || !r.Get(&m.dissolve) ||
+        !r.Get(&m.illum) || !r.Get(&m.diffuse_texname) ||
+        !r.Get(&m.with_alpha_texname)) {
+      return false;
+    }
+    materials->push_back(std::move(m));
+  }
+  return true;
+}
+
+std::vector<uint8_t> SerializeBlendshapes(
+    const std::vector<ugu::Blendshape>& blendshapes) {
+  ByteWriter w;
+  w.Put(static_cast<uint64_t>(blendshapes.size()));
+  for (const auto& b : blendshapes) {
+    w.Put(b.name);
+    w.Put(b.max);
+    w.Put(b.min);
+    w.Put(b.weight);
+  }
+  return w.bytes();
+}
+
+bool DeserializeBlendshapes(const std::vector<uint8_t>& bytes,
+                            std::vector<ugu::Blendshape>* blendshapes) {
+  ByteReader r(bytes);
+  uint64_t num = 0;
+  if (!r.Get(&num)) {
+    return false;
+  }
+  blendshapes->clear();
+  for (uint64_t i = 0; i < num; i++) {
+    ugu::Blendshape b;
+    if (!r.Get(&b.name) || !r.Get(&b.max) || !r.Get(&b.min) ||
+        !r.Get(&b.weight)) {
+      return false;
+    }
+    blendshapes->push_back(std::move(b));
+  }
+  return true;
+}
+
+std::vector<uint8_t> SerializeKeyframes(
+    const std::map<float, ugu::AnimKeyframe>& keyframes,
+    ugu::AnimInterp anim_interp) {
+  ByteWriter w;
+  w.Put(static_cast<int32_t>(anim_interp));
+  w.Put(static_cast<uint64_t>(keyframes.size()));
+  for (const auto& [time, k] : keyframes) {
+    w.Put(time);
+    const uint8_t valid[4] = {k.R_valid, k.t_valid, k.s_valid,
+                              k.weights_valid};
+    w.Put(valid);
+    w.Put(k.q.coeffs());
+    w.Put(k.t);
+    w.Put(k.s);
+    w.Put(k.weights);
+  }
+  return w.bytes();
+}
+
+bool DeserializeKeyframes(const std::vector<uint8_t>& bytes,
+                          std::map<float, ugu::AnimKeyframe>* keyframes,
+                          ugu::AnimInterp* anim_interp) {
+  ByteReader r(bytes);
+  int32_t interp = 0;
+  uint64_t num = 0;
+  if (!r.Get(&interp) || !r.Get(&num)) {
+    return false;
+  }
+  *anim_interp = static_cast<ugu::AnimInterp>(interp);
+  keyframes->clear();
+  for (uint64_t i = 0; i < num; i++) {
+    float time = 0.f;
+    uint8_t valid[4];
+    ugu::AnimKeyframe k;
+    if (!r.Get(&time) || !r.Get(&valid) || !r.Get(&k.q.coeffs()) ||
+        !r.Get(&k.t) || !r.Get(&k.s) || !r.Get(&k.weights)) {
+      return false;
+    }
+    k.R_valid = valid[0] != 0;
+    k.t_valid = valid[1] != 0;
+    k.s_valid = valid[2] != 0;
+    k.weights_valid = valid[3] != 0;
+    (*keyframes)[time] = std::move(k);
+  }
+  return true;
+}
+
 }  // namespace
 
 namespace ugu {
@@ -103,21 +399,22 @@ std::string ObjMaterial::ToString() const {
 }
 
 Mesh::Mesh() {}
+// Attributes are shared until either of the meshes modifies them
 Mesh::Mesh(const Mesh& src) {
-  CopyVec(src.vertices_, &vertices_);
-  CopyVec(src.vertex_colors_, &vertex_colors_);
-  CopyVec(src.vertex_indices_, &vertex_indices_);
+  vertices_ = src.vertices_;
+  vertex_colors_ = src.vertex_colors_;
+  vertex_indices_ = src.vertex_indices_;
 
-  CopyVec(src.normals_, &normals_);
-  CopyVec(src.face_normals_, &face_normals_);
-  CopyVec(src.normal_indices_, &normal_indices_);
+  normals_ = src.normals_;
+  face_normals_ = src.face_normals_;
+  normal_indices_ = src.normal_indices_;
 
-  CopyVec(src.uv_, &uv_);
-  CopyVec(src.uv_indices_, &uv_indices_);
+  uv_ = src.uv_;
+  uv_indices_ = src.uv_indices_;
 
-  CopyVec(src.materials_, &materials_);
-  CopyVec(src.material_ids_, &material_ids_);
-  CopyVec(src.face_indices_per_material_, &face_indices_per_material_);
+  materials_ = src.materials_;
+  material_ids_ = src.material_ids_;
+  face_indices_per_material_ = src.face_indices_per_material_;
 
   stats_ = src.stats_;
 }
@@ -167,6 +464,29 @@ const std::map<float, AnimKeyframe>& Mesh::keyframes() const {
 
 const AnimInterp& Mesh::anim_interp() const { return anim_interp_; };
 
+size_t Mesh::memory_bytes() const {
+  size_t bytes = SharedBytes(vertices_) + SharedBytes(vertex_colors_) +
+                 SharedBytes(vertex_indices_) + SharedBytes(normals_) +
+                 SharedBytes(face_normals_) + SharedBytes(normal_indices_) +
+                 SharedBytes(uv_) + SharedBytes(uv_indices_) +
+                 SharedBytes(material_ids_);
+  bytes += SharedBytes(materials_, [](const ObjMaterial& m) {
+    return m.diffuse_tex.total() * m.diffuse_tex.elemSize() +
+           m.diffuse_compressed.capacity() +
+           m.with_alpha_tex.total() * m.with_alpha_tex.elemSize() +
+           m.with_alpha_compressed.capacity();
+  });
+  bytes += SharedBytes(face_indices_per_material_,
+                       [](const std::vector<int>& f) {
+                         return f.capacity() * sizeof(int);
+                       });
+  bytes += SharedBytes(blendshapes_, [](const Blendshape& b) {
+    return (b.vertices.capacity() + b.normals.capacity()) *
+           sizeof(Eigen::Vector3f);
+  });
+  return bytes;
+}
+
 void Mesh::CalcStats() {
   stats_ = GetStatsWithTransform(Eigen::Affine3f::Identity());
 }
@@ -184,46 +504,61 @@ MeshStats Mesh::GetStatsWithTransform(const Eigen::Affine3f& T) const {
     return stats;
   }
 
-  double sum[3] = {0.0, 0.0, 0.0};  // use double to avoid overflow
-  for (const auto& v : vertices_) {
-    Eigen::Vector3f v_ = T * v;
-    for (int i = 0; i < 3; i++) {
-      sum[i] += v_[i];
-
-      if (v_[i] < stats.bb_min[i]) {
-        stats.bb_min[i] = v_[i];
-      }
-
-      if (stats.bb_max[i] < v_[i]) {
-        stats.bb_max[i] = v_[i];
-      }
-    }
-  }
+  // Partial results per block are reduced in the block order so that the
+  // center does not depend on the number of threads
+  struct Partial {
+    Eigen::Vector3f bb_min, bb_max;
+    Eigen::Vector3d sum;  // use double to avoid overflow
+  };
+  const size_t block_num =
+      (vertices_.size() + kMeshBlockSize - 1) / kMeshBlockSize;
+  std::vector<Partial> partials(block_num);
+  parallel_for_blocks(
+      0, vertices_.size(), kMeshBlockSize, [&](size_t st, size_t ed) {
+        Partial& p = partials[st / kMeshBlockSize];
+        p.bb_min = stats.bb_min;
+        p.bb_max = stats.bb_max;
+        p.sum.setZero();
+        for (size_t i = st; i < ed; i++) {
+          const Eigen::Vector3f v_ = T * vertices_[i];
+          p.bb_min = p.bb_min.cwiseMin(v_);
+          p.bb_max = p.bb_max.cwiseMax(v_);
+          p.sum += v_.cast<double>();
+        }
+      });
 
-  for (int i = 0; i < 3; i++) {
-    stats.center[i] = static_cast<float>(sum[i] / vertices_.size());
+  Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+  for (const auto& p : partials) {
+    stats.bb_min = stats.bb_min.cwiseMin(p.bb_min);
+    stats.bb_max = stats.bb_max.cwiseMax(p.bb_max);
+    sum += p.sum;
   }
+  stats.center = (sum / static_cast<double>(vertices_.size())).cast<float>();
 
   return stats;
 }
 
 void Mesh::Rotate(const Eigen::Matrix3f& R) {
-  for (auto& v : vertices_) {
-    v = R * v;
-  }
-  for (auto& n : normals_) {
-    n = R * n;
-  }
-  for (auto& fn : face_normals_) {
-    fn = R * fn;
+  for (auto* attr : {&vertices_, &normals_, &face_normals_}) {
+    auto& vs = attr->mut();
+    parallel_for_blocks(0, vs.size(), kMeshBlockSize,
+                        [&](size_t st, size_t ed) {
+                          for (size_t i = st; i < ed; i++) {
+                            vs[i] = R * vs[i];
+                          }
+                        });
   }
   CalcStats();
 }
 
 void Mesh::Translate(const Eigen::Vector3f& t) {
-  for (auto& v : vertices_) {
-    v = v + t;
-  }
+  auto& vertices = vertices_.mut();
+  parallel_for_blocks(0, vertices.size(), kMeshBlockSize,
+                      [&](size_t st, size_t ed) {
+                        for (size_t i = st; i < ed; i++) {
+                          vertices[i] += t;
+                        }
+                      });
   CalcStats();
 }
 
@@ -236,18 +571,29 @@ void Mesh::Transform(const Eigen::Matrix3f& R, const Eigen::Vector3f& t,
 #else
   Eigen::Affine3f T = Eigen::Translation3f(t) * R * Eigen::Scaling(s);
 
-#pragma omp parallel for
-  for (int64_t i = 0; i < static_cast<int64_t>(vertices_.size()); i++) {
-    vertices_[i] = T * vertices_[i];
-    if (normals_.size() == vertices_.size()) {
-      normals_[i] = R * normals_[i];
-    }
-  }
-#pragma omp parallel for
-  for (int64_t i = 0; i < static_cast<int64_t>(vertex_indices_.size()); i++) {
-    if (face_normals_.size() == vertex_indices_.size()) {
-      face_normals_[i] = R * face_normals_[i];
-    }
+  auto& vertices = vertices_.mut();
+  // Shared normals are detached only if they are rotated
+  std::vector<Eigen::Vector3f>* normals =
+      normals_.size() == vertices_.size() ? &normals_.mut() : nullptr;
+  parallel_for_blocks(0, vertices.size(), kMeshBlockSize,
+                      [&](size_t st, size_t ed) {
+                        for (size_t i = st; i < ed; i++) {
+                          vertices[i] = T * vertices[i];
+                        }
+                        if (normals != nullptr) {
+                          for (size_t i = st; i < ed; i++) {
+                            (*normals)[i] = R * (*normals)[i];
+                          }
+                        }
+                      });
+  if (face_normals_.size() == vertex_indices_.size()) {
+    auto& face_normals = face_normals_.mut();
+    parallel_for_blocks(0, face_normals.size(), kMeshBlockSize,
+                        [&](size_t st, size_t ed) {
+                          for (size_t i = st; i < ed; i++) {
+                            face_normals[i] = R * face_normals[i];
+                          }
+                        });
   }
 
 #endif
@@ -267,11 +613,14 @@ void Mesh::Transform(const Eigen::Affine3f& T, bool update_stats) {
 void Mesh::Scale(float scale) { Scale(scale, scale, scale); }
 
 void Mesh::Scale(float x_scale, float y_scale, float z_scale) {
-  for (auto& v : vertices_) {
-    v[0] = v[0] * x_scale;
-    v[1] = v[1] * y_scale;
-    v[2] = v[2] * z_scale;
-  }
+  const Eigen::Vector3f scale(x_scale, y_scale, z_scale);
+  auto& vertices = vertices_.mut();
+  parallel_for_blocks(0, vertices.size(), kMeshBlockSize,
+                      [&](size_t st, size_t ed) {
+                        for (size_t i = st; i < ed; i++) {
+                          vertices[i] = vertices[i].cwiseProduct(scale);
+                        }
+                      });
 }
 
 void Mesh::Scale(const Eigen::Vector3f& scale) {
@@ -301,137 +650,178 @@ void Mesh::CalcNormal() {
 
   CalcFaceNormal();
 
-  normals_.clear();
-  normal_indices_.clear();
-
-  std::copy(vertex_indices_.begin(), vertex_indices_.end(),
-            std::back_inserter(normal_indices_));
-
-  Eigen::Vector3f zero{0.0f, 0.0f, 0.0f};
-  normals_.resize(vertices_.size(), zero);
-
-  std::vector<int> add_count(vertices_.size(), 0);
-
-  for (size_t i = 0; i < vertex_indices_.size(); i++) {
-    const auto& face = vertex_indices_[i];
-    for (int j = 0; j < 3; j++) {
-      int idx = face[j];
-      normals_[idx] += face_normals_[i];
-      add_count[idx]++;
-    }
-  }
+  normal_indices_ = vertex_indices_;
+  std::vector<Eigen::Vector3f> normals(vertices_.size());
+  const std::vector<Eigen::Vector3f>& face_normals = face_normals_;
+
+  // Gather face normals per vertex instead of scattering to vertices. Faces
+  // are summed in the index order as the serial accumulation.
+  std::vector<int> offsets, faces;
+  MakeVertexFaceCsr(vertex_indices_, vertices_.size(), &offsets, &faces);
+
+  std::atomic<int> invalid_num{0};
+  parallel_for_blocks(
+      0, vertices_.size(), kMeshBlockSize, [&](size_t st, size_t ed) {
+        for (size_t i = st; i < ed; i++) {
+          const int count = offsets[i + 1] - offsets[i];
+          if (count <= 0) {
+            // for unreferenced vertices, set (0, 0, 0)
+            normals[i].setZero();
+            invalid_num++;
+            continue;
+          }
+          Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+          for (int k = offsets[i]; k < offsets[i + 1]; k++) {
+            sum += face_normals[faces[k]];
+          }
+          // get average normal
+          // caution: this does not work for cube
+          // https://answers.unity.com/questions/441722/splitting-up-verticies.html
+          normals[i] = (sum / static_cast<float>(count)).normalized();
+        }
+      });
+  normals_ = std::move(normals);
 
-  // get average normal
-  // caution: this does not work for cube
-  // https://answers.unity.com/questions/441722/splitting-up-verticies.html
-  for (size_t i = 0; i < vertices_.size(); i++) {
-    if (add_count[i] > 0) {
-      normals_[i] /= static_cast<float>(add_count[i]);
-      normals_[i].normalize();
-    } else {
-      // for unreferenced vertices, set (0, 0, 0)
-      normals_[i].setZero();
-      LOGW("vertex %d has invalid normal\n", i);
-    }
+  if (invalid_num > 0) {
+    LOGW("%d vertices have invalid normal\n", invalid_num.load());
   }
 }
 
 void Mesh::CalcFaceNormal() {
-  face_normals_.clear();
-  face_normals_.resize(vertex_indices_.size());
-
-  for (size_t i = 0; i < vertex_indices_.size(); i++) {
-    const auto& f = vertex_indices_[i];
-    Eigen::Vector3f v1 = (vertices_[f[1]] - vertices_[f[0]]).normalized();
-    Eigen::Vector3f v2 = (vertices_[f[2]] - vertices_[f[0]]).normalized();
-    face_normals_[i] = v1.cross(v2).normalized();
-  }
+  std::vector<Eigen::Vector3f> face_normals(vertex_indices_.size());
+
+  parallel_for_blocks(
+      0, vertex_indices_.size(), kMeshBlockSize, [&](size_t st, size_t ed) {
+        for (size_t i = st; i < ed; i++) {
+          const auto& f = vertex_indices_[i];
+          Eigen::Vector3f v1 = (vertices_[f[1]] - vertices_[f[0]]).normalized();
+          Eigen::Vector3f v2 = (vertices_[f[2]] - vertices_[f[0]]).normalized();
+          face_normals[i] = v1.cross(v2).normalized();
+        }
+      });
+  face_normals_ = std::move(face_normals);
 }
 
 bool Mesh::set_vertices(const std::vector<Eigen::Vector3f>& vertices) {
+  return set_vertices(std::vector<Eigen::Vector3f>(vertices));
+}
+
+bool Mesh::set_vertices(std::vector<Eigen::Vector3f>&& vertices) {
   if (vertices.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of vertices exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(vertices, &vertices_);
+  vertices_ = std::move(vertices);
   return true;
 }
 
 bool Mesh::set_vertex_colors(
     const std::vector<Eigen::Vector3f>& vertex_colors) {
+  return set_vertex_colors(std::vector<Eigen::Vector3f>(vertex_colors));
+}
+
+bool Mesh::set_vertex_colors(std::vector<Eigen::Vector3f>&& vertex_colors) {
   if (vertex_colors.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of vertices exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(vertex_colors, &vertex_colors_);
+  vertex_colors_ = std::move(vertex_colors);
   return true;
 }
 
 bool Mesh::set_vertex_indices(
     const std::vector<Eigen::Vector3i>& vertex_indices) {
+  return set_vertex_indices(std::vector<Eigen::Vector3i>(vertex_indices));
+}
+
+bool Mesh::set_vertex_indices(std::vector<Eigen::Vector3i>&& vertex_indices) {
   if (vertex_indices.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of faces exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(vertex_indices, &vertex_indices_);
+  vertex_indices_ = std::move(vertex_indices);
   return true;
 }
 
 bool Mesh::set_normals(const std::vector<Eigen::Vector3f>& normals) {
+  return set_normals(std::vector<Eigen::Vector3f>(normals));
+}
+
+bool Mesh::set_normals(std::vector<Eigen::Vector3f>&& normals) {
   if (normals.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of vertices exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(normals, &normals_);
+  normals_ = std::move(normals);
   return true;
 }
 
 bool Mesh::set_face_normals(const std::vector<Eigen::Vector3f>& face_normals) {
+  return set_face_normals(std::vector<Eigen::Vector3f>(face_normals));
+}
+
+bool Mesh::set_face_normals(std::vector<Eigen::Vector3f>&& face_normals) {
   if (face_normals.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of faces exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(face_normals, &face_normals_);
+  face_normals_ = std::move(face_normals);
   return true;
 }
 
 bool Mesh::set_normal_indices(
     const std::vector<Eigen::Vector3i>& normal_indices) {
+  return set_normal_indices(std::vector<Eigen::Vector3i>(normal_indices));
+}
+
+bool Mesh::set_normal_indices(std::vector<Eigen::Vector3i>&& normal_indices) {
   if (normal_indices.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of faces exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(normal_indices, &normal_indices_);
+  normal_indices_ = std::move(normal_indices);
   return true;
 }
 
 bool Mesh::set_uv(const std::vector<Eigen::Vector2f>& uv) {
+  return set_uv(std::vector<Eigen::Vector2f>(uv));
+}
+
+bool Mesh::set_uv(std::vector<Eigen::Vector2f>&& uv) {
   if (uv.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of vertices exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(uv, &uv_);
+  uv_ = std::move(uv);
   return true;
 }
 
 bool Mesh::set_uv_indices(const std::vector<Eigen::Vector3i>& uv_indices) {
+  return set_uv_indices(std::vector<Eigen::Vector3i>(uv_indices));
+}
+
+bool Mesh::set_uv_indices(std::vector<Eigen::Vector3i>&& uv_indices) {
   if (uv_indices.size() > std::numeric_limits<int>::max()) {
     LOGE("The number of faces exceeds the maximum: %d\n",
          std::numeric_limits<int>::max());
     return false;
   }
-  CopyVec(uv_indices, &uv_indices_);
+  uv_indices_ = std::move(uv_indices);
   return true;
 }
 
 bool Mesh::set_material_ids(const std::vector<int>& material_ids) {
+  return set_material_ids(std::vector<int>(material_ids));
+}
+
+bool Mesh::set_material_ids(std::vector<int>&& material_ids) {
   if (material_ids.empty()) {
     LOGE("material id is empty\n");
     return false;
@@ -442,37 +832,43 @@ bool Mesh::set_material_ids(const std::vector<int>& material_ids) {
     return false;
   }
 
-  CopyVec(material_ids, &material_ids_);
+  material_ids_ = std::move(material_ids);
 
-  face_indices_per_material_.resize(max_id + 1);
-  for (auto& fipm : face_indices_per_material_) {
-    fipm.clear();
-  }
+  std::vector<std::vector<int>> face_indices_per_material(max_id + 1);
   for (int i = 0; i < static_cast<int>(material_ids_.size()); i++) {
-    face_indices_per_material_[material_ids_[i]].push_back(i);
+    face_indices_per_material[material_ids_[i]].push_back(i);
   }
+  face_indices_per_material_ = std::move(face_indices_per_material);
 
   return true;
 }
 
 bool Mesh::set_materials(const std::vector<ObjMaterial>& materials) {
-  CopyVec(materials, &materials_);
+  materials_ = materials;
+  return true;
+}
+
+bool Mesh::set_materials(std::vector<ObjMaterial>&& materials) {
+  materials_ = std::move(materials);
   return true;
 }
 
 bool Mesh::set_face_indices_per_material(
     const std::vector<std::vector<int>>& face_indices_per_material) {
-  face_indices_per_material_.resize(face_indices_per_material.size());
-  for (size_t k = 0; k < face_indices_per_material.size(); k++) {
-    CopyVec(face_indices_per_material[k], &face_indices_per_material_[k]);
-  }
+  face_indices_per_material_ = face_indices_per_material;
+  return true;
+}
+
+bool Mesh::set_face_indices_per_material(
+    std::vector<std::vector<int>>&& face_indices_per_material) {
+  face_indices_per_material_ = std::move(face_indices_per_material);
   return true;
 }
 
 bool Mesh::set_single_material(const ObjMaterial& material) {
   set_materials({material});
   std::vector<int> material_ids(vertex_indices_.size(), 0);
-  set_material_ids(material_ids);
+  set_material_ids(std::move(material_ids));
   return true;
 }
 
@@ -482,7 +878,12 @@ bool Mesh::set_default_material() {
 }
 
 bool Mesh::set_blendshapes(const std::vector<Blendshape>& blendshapes) {
-  CopyVec(blendshapes, &blendshapes_);
+  blendshapes_ = blendshapes;
+  return true;
+}
+
+bool Mesh::set_blendshapes(std::vector<Blendshape>&& blendshapes) {
+  blendshapes_ = std::move(blendshapes);
   return true;
 }
 
@@ -491,179 +892,47 @@ bool Mesh::set_keyframes(const std::map<float, AnimKeyframe>& keyframes) {
   return true;
 }
 
+bool Mesh::set_keyframes(std::map<float, AnimKeyframe>&& keyframes) {
+  keyframes_ = std::move(keyframes);
+  return true;
+}
+
 bool Mesh::set_anim_interp(const AnimInterp& anim_interp) {
   anim_interp_ = anim_interp;
   return true;
 }
 
-#ifdef UGU_USE_TINYOBJLOADER
 bool Mesh::LoadObj(const std::string& obj_path, const std::string& mtl_dir) {
   Clear();
 
-  std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
-  tinyobj::attrib_t attrib;
-  std::string err_str, warn_str;
-  bool return_default_vertex_color{false};
-  std::string mtl_dir_ = mtl_dir;
-  if (mtl_dir_.empty()) {
-    mtl_dir_ = ExtractDir(obj_path);
-  }
-  bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn_str, &err_str,
-                              obj_path.c_str(), mtl_dir_.c_str(), true,
-                              return_default_vertex_color);
-
-  if (!err_str.empty()) {  // `err` may contain warning message.
-    LOGE("%s\n", err_str.c_str());
-  }
-
-  if (!ret) {
+  ObjGeometry geom;
+  if (!LoadObjGeometry(obj_path, &geom)) {
     return false;
   }
 
-  size_t face_num = 0;
-  for (size_t s = 0; s < shapes.size(); s++) {
-    face_num += shapes[s].mesh.num_face_vertices.size();
+  std::string mtl_dir_ = mtl_dir;
+  if (mtl_dir_.empty()) {
+    mtl_dir_ = ExtractDir(obj_path);
   }
-
-  if (face_num > std::numeric_limits<int>::max()) {
-    LOGE("The number of faces exceeds the maximum: %d\n",
-         std::numeric_limits<int>::max());
-    return false;
+  std::vector<ObjMaterial> materials;
+  for (const auto& mtllib : geom.mtllibs) {
+    LoadMtl(mtl_dir_ + mtllib, &materials);
   }
 
-  vertex_indices_.resize(face_num);  // face
-  uv_indices_.resize(face_num);
-  normal_indices_.resize(face_num);
-  material_ids_.resize(face_num, 0);
-
-  if (attrib.vertices.size() / 3 > std::numeric_limits<int>::max() ||
-      attrib.normals.size() / 3 > std::numeric_limits<int>::max() ||
-      attrib.texcoords.size() / 2 > std::numeric_limits<int>::max() ||
-      attrib.colors.size() / 3 > std::numeric_limits<int>::max()) {
-    LOGE("The number of vertices exceeds the maximum: %d\n",
-         std::numeric_limits<int>::max());
-    return false;
-  }
-
-  vertices_.resize(attrib.vertices.size() / 3);
-  normals_.resize(attrib.normals.size() / 3);
-  uv_.resize(attrib.texcoords.size() / 2);
-  vertex_colors_.resize(attrib.colors.size() / 3);
-
-  std::vector<bool> valid_vertices(vertices_.size(), false);
-  bool no_face = shapes.empty();
-  if (no_face) {
-    // No face
-    for (size_t idx = 0; idx < attrib.vertices.size() / 3; idx++) {
-      // access to vertex
-      tinyobj::real_t vx = attrib.vertices[3 * idx + 0];
-      tinyobj::real_t vy = attrib.vertices[3 * idx + 1];
-      tinyobj::real_t vz = attrib.vertices[3 * idx + 2];
-
-      vertices_[idx][0] = vx;
-      vertices_[idx][1] = vy;
-      vertices_[idx][2] = vz;
-
-      if (!attrib.normals.empty()) {
-        tinyobj::real_t nx = attrib.normals[3 * idx + 0];
-        tinyobj::real_t ny = attrib.normals[3 * idx + 1];
-        tinyobj::real_t nz = attrib.normals[3 * idx + 2];
-
-        normals_[idx][0] = nx;
-        normals_[idx][1] = ny;
-        normals_[idx][2] = nz;
-        normals_[idx].normalize();  // Fail safe
-      }
-
-      if (!attrib.texcoords.empty()) {
-        tinyobj::real_t tx = attrib.texcoords[2 * idx + 0];
-        tinyobj::real_t ty = attrib.texcoords[2 * idx + 1];
-
-        uv_[idx][0] = tx;
-        uv_[idx][1] = ty;
-      }
-      // Optional: vertex colors
-      if (!attrib.colors.empty()) {
-        tinyobj::real_t red = attrib.colors[3 * idx + 0];
-        tinyobj::real_t green = attrib.colors[3 * idx + 1];
-        tinyobj::real_t blue = attrib.colors[3 * idx + 2];
-
-        vertex_colors_[idx][0] = red * 255.f;
-        vertex_colors_[idx][1] = green * 255.f;
-        vertex_colors_[idx][2] = blue * 255.f;
-      }
-    }
-
-  } else {
-    size_t face_offset = 0;
-    // Loop over shapes
-    for (size_t s = 0; s < shapes.size(); s++) {
-      // Loop over faces(polygon)
-      size_t index_offset = 0;
-
-      for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-        int fv = shapes[s].mesh.num_face_vertices[f];
-
-        if (fv != 3) {
-          LOGE("Doesn't support face num %d. Must be 3\n", fv);
-          return false;
-        }
-
-        // per-face material
-        material_ids_[face_offset] = shapes[s].mesh.material_ids[f];
-
-        // Loop over vertices in the face.
-        for (int v = 0; v < fv; v++) {
-          // access to vertex
-          tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-          tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
-          tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
-          tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
-
-          vertex_indices_[face_offset][v] = idx.vertex_index;
-
-          vertices_[idx.vertex_index][0] = vx;
-          vertices_[idx.vertex_index][1] = vy;
-          vertices_[idx.vertex_index][2] = vz;
-          valid_vertices[idx.vertex_index] = true;
-
-          if (!attrib.normals.empty()) {
-            tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
-            tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
-            tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
-
-            normal_indices_[face_offset][v] = idx.normal_index;
-            normals_[idx.normal_index][0] = nx;
-            normals_[idx.normal_index][1] = ny;
-            normals_[idx.normal_index][2] = nz;
-            normals_[idx.normal_index].normalize();  // Fail safe
-          }
+  const size_t face_num = geom.vertex_indices.size();
+  const bool no_face = face_num == 0;
 
-          if (!attrib.texcoords.empty()) {
-            tinyobj::real_t tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-            tinyobj::real_t ty = attrib.texcoords[2 * idx.texcoord_index + 1];
+  // Fail safe
+  parallel_for(size_t(0), geom.normals.size(),
+               [&](size_t i) { geom.normals[i].normalize(); });
 
-            uv_indices_[face_offset][v] = idx.texcoord_index;
-            uv_[idx.texcoord_index][0] = tx;
-            uv_[idx.texcoord_index][1] = ty;
-          }
-          // Optional: vertex colors
-          if (!attrib.colors.empty()) {
-            tinyobj::real_t red = attrib.colors[3 * idx.vertex_index + 0];
-            tinyobj::real_t green = attrib.colors[3 * idx.vertex_index + 1];
-            tinyobj::real_t blue = attrib.colors[3 * idx.vertex_index + 2];
-
-            vertex_colors_[idx.vertex_index][0] = red * 255.f;
-            vertex_colors_[idx.vertex_index][1] = green * 255.f;
-            vertex_colors_[idx.vertex_index][2] = blue * 255.f;
-          }
-        }
-        index_offset += fv;
-        face_offset++;
-      }
-    }
-  }
+  vertices_ = std::move(geom.vertices);
+  vertex_colors_ = std::move(geom.vertex_colors);
+  uv_ = std::move(geom.uv);
+  normals_ = std::move(geom.normals);
+  vertex_indices_ = std::move(geom.vertex_indices);
+  uv_indices_ = std::move(geom.uv_indices);
+  normal_indices_ = std::move(geom.normal_indices);
 
   CalcFaceNormal();
 
@@ -673,56 +942,70 @@ bool Mesh::LoadObj(const std::string& obj_path, const std::string& mtl_dir) {
 
   CalcStats();
 
+  bool ret = true;
   if (materials.empty()) {
-    materials_.resize(1);
-    materials_[0] = ObjMaterial();
-    material_ids_.assign(face_num, 0);
+    materials_ = std::vector<ObjMaterial>(1);
+    material_ids_ = std::vector<int>(face_num, 0);
 
     LOGW(
         "Default material was added because material did not find on input "
         "obj\n");
 
   } else {
-    materials_.resize(materials.size());
+    // usemtl order to mtl order. Faces without known material use the first.
+    std::vector<int> name2mat(geom.material_names.size(), 0);
+    for (size_t i = 0; i < geom.material_names.size(); i++) {
+      for (size_t j = 0; j < materials.size(); j++) {
+        if (materials[j].name == geom.material_names[i]) {
+          name2mat[i] = static_cast<int>(j);
+          break;
+        }
+      }
+    }
+    std::vector<int> material_ids(face_num);
+    for (size_t i = 0; i < face_num; i++) {
+      const int id = geom.material_ids[i];
+      material_ids[i] = id < 0 ? 0 : name2mat[id];
+    }
+    material_ids_ = std::move(material_ids);
+
     for (size_t i = 0; i < materials.size(); i++) {
-      materials_[i].name = materials[i].name;
-      std::copy(std::begin(materials[i].ambient),
-                std::end(materials[i].ambient), materials_[i].ambient.begin());
-      std::copy(std::begin(materials[i].diffuse),
-                std::end(materials[i].diffuse), materials_[i].diffuse.begin());
-      std::copy(std::begin(materials[i].specular),
-                std::end(materials[i].specular),
-                materials_[i].specular.begin());
-      materials_[i].shininess = materials[i].shininess;
-      materials_[i].dissolve = materials[i].dissolve;
-      materials_[i].illum = materials[i].illum;
-
-      materials_[i].diffuse_texname = materials[i].diffuse_texname;
-      materials_[i].diffuse_texpath = mtl_dir_ + materials_[i].diffuse_texname;
-      std::ifstream ifs(materials_[i].diffuse_texpath);
+      if (materials[i].diffuse_texname.empty()) {
+        continue;
+      }
+      materials[i].diffuse_texpath = mtl_dir_ + materials[i].diffuse_texname;
+      std::ifstream ifs(materials[i].diffuse_texpath);
       if (ifs.is_open()) {
 #if defined(UGU_USE_STB) || defined(UGU_USE_OPENCV)
         // todo: force convert to Image3b
-        materials_[i].diffuse_tex =
-            Imread<Image3b>(materials_[i].diffuse_texpath);
-        ret = !materials_[i].diffuse_tex.empty();
+        materials[i].diffuse_tex =
+            Imread<Image3b>(materials[i].diffuse_texpath);
+        ret = !materials[i].diffuse_tex.empty();
 #else
         LOGW("define UGU_USE_STB to load diffuse texture.\n");
 #endif
       } else {
         LOGW("diffuse texture doesn't exist %s\n",
-             materials_[i].diffuse_texpath.c_str());
+             materials[i].diffuse_texpath.c_str());
       }
     }
+    materials_ = std::move(materials);
   }
 
-  face_indices_per_material_.resize(materials_.size());
+  std::vector<std::vector<int>> face_indices_per_material(materials_.size());
   for (int i = 0; i < static_cast<int>(material_ids_.size()); i++) {
-    face_indices_per_material_[material_ids_[i]].push_back(i);
+    face_indices_per_material[material_ids_[i]].push_back(i);
   }
+  face_indices_per_material_ = std::move(face_indices_per_material);
 
   if (!no_face) {
     // Remove unreferenced vertices
+    std::vector<bool> valid_vertices(vertices_.size(), false);
+    for (const auto& f : vertex_indices_) {
+      valid_vertices[f[0]] = true;
+      valid_vertices[f[1]] = true;
+      valid_vertices[f[2]] = true;
+    }
     size_t valid_count = static_cast<size_t>(
         std::count(valid_vertices.begin(), valid_vertices.end(), true));
     if (valid_count != valid_vertices.size()) {
@@ -732,203 +1015,137 @@ bool Mesh::LoadObj(const std::string& obj_path, const std::string& mtl_dir) {
 
   return ret;
 }
-#else
-bool Mesh::LoadObj(const std::string& obj_path, const std::string& mtl_dir) {
-  (void)obj_path;
-  (void)mtl_dir;
-  LOGE("can't load obj with this configuration\n");
-  return false;
-}
-#endif
 
 bool Mesh::LoadPly(const std::string& ply_path) {
-  std::ifstream ifs(ply_path);
-  std::string str;
-  if (ifs.fail()) {
-    LOGE("couldn't open ply: %s\n", ply_path.c_str());
+  Clear();
+
+  // Parsed directly into the members
+  if (!ugu::LoadPly(ply_path, &vertices_.mut(), &normals_.mut(),
+                    &vertex_colors_.mut(), &vertex_indices_.mut())) {
     return false;
   }
 
-  getline(ifs, str);
-  if (str != "ply") {
-    LOGE("ply first line is wrong: %s\n", str.c_str());
-    return false;
+  // As LoadObj(), face normals are always made. CalcNormal() makes them too.
+  if (normals_.size() == vertices_.size()) {
+    CalcFaceNormal();
+    normal_indices_ = vertex_indices_;
+  } else {
+    CalcNormal();
   }
-  getline(ifs, str);
-  if (str.find("ascii") == std::string::npos) {
-    LOGE("only ascii ply is supported: %s\n", str.c_str());
+
+  CalcStats();
+
+  return true;
+}
+
+bool Mesh::WritePly(const std::string& ply_path, bool binary) const {
+  return ugu::WritePly(
+      ply_path, binary ? PlyFormat::kBinaryLittleEndian : PlyFormat::kAscii,
+      vertices_.get(), normals_.get(), vertex_colors_.get(),
+      vertex_indices_.get());
+}
+
+bool Mesh::LoadBinary(const std::string& path) {
+  Clear();
+
+  MeshBinaryView view;
+  if (!view.Open(path)) {
     return false;
   }
 
-  bool ret = false;
-  std::int64_t vertex_num = 0;
-  while (getline(ifs, str)) {
-    if (str.find("element vertex") != std::string::npos) {
-      std::vector<std::string> splitted = Split(str, ' ');
-      if (splitted.size() == 3) {
-        vertex_num = std::atol(splitted[2].c_str());
-        ret = true;
-        break;
-      }
-    }
-  }
-  if (!ret) {
-    LOGE("couldn't find element vertex\n");
+  using A = MeshBinaryArray;
+  // Absent arrays are left empty
+  view.Read(A::kVertices, &vertices_.mut());
+  view.Read(A::kVertexColors, &vertex_colors_.mut());
+  view.Read(A::kVertexIndices, &vertex_indices_.mut());
+  view.Read(A::kNormals, &normals_.mut());
+  view.Read(A::kFaceNormals, &face_normals_.mut());
+  view.Read(A::kNormalIndices, &normal_indices_.mut());
+  view.Read(A::kUv, &uv_.mut());
+  view.Read(A::kUvIndices, &uv_indices_.mut());
+  view.Read(A::kMaterialIds, &material_ids_.mut());
+
+  std::vector<uint8_t> bytes;
+  std::vector<ObjMaterial> materials;
+  if (view.Read(A::kMaterials, &bytes) &&
+      !DeserializeMaterials(bytes, &materials)) {
+    LOGE("Broken materials %s\n", path.c_str());
     return false;
   }
-  if (vertex_num > std::numeric_limits<int>::max()) {
-    LOGE("The number of vertices exceeds the maximum: %d\n",
-         std::numeric_limits<int>::max());
-    return false;
+  std::vector<std::vector<int>> face_indices_per_material(materials.size());
+  for (uint32_t i = 0; i < static_cast<uint32_t>(materials.size()); i++) {
+    view.Read(A::kFaceIndicesPerMaterial, &face_indices_per_material[i], i);
+    materials[i].diffuse_tex = view.ReadImage(A::kDiffuseTexture, i);
+    materials[i].with_alpha_tex = view.ReadImage(A::kWithAlphaTexture, i);
   }
+  materials_ = std::move(materials);
+  face_indices_per_material_ = std::move(face_indices_per_material);
 
-  ret = false;
-  std::int64_t face_num = 0;
-  while (getline(ifs, str)) {
-    if (str.find("element face") != std::string::npos) {
-      std::vector<std::string> splitted = Split(str, ' ');
-      if (splitted.size() == 3) {
-        face_num = std::atol(splitted[2].c_str());
-        ret = true;
-        break;
-      }
-    }
-  }
-  if (!ret) {
-    LOGE("couldn't find element face\n");
+  std::vector<Blendshape> blendshapes;
+  if (view.Read(A::kBlendshapes, &bytes) &&
+      !DeserializeBlendshapes(bytes, &blendshapes)) {
+    LOGE("Broken blendshapes %s\n", path.c_str());
     return false;
   }
-  if (face_num > std::numeric_limits<int>::max()) {
-    LOGE("The number of faces exceeds the maximum: %d\n",
-         std::numeric_limits<int>::max());
-    return false;
-  }
-
-  while (getline(ifs, str)) {
-    if (str.find("end_header") != std::string::npos) {
-      break;
-    }
+  for (uint32_t i = 0; i < static_cast<uint32_t>(blendshapes.size()); i++) {
+    view.Read(A::kBlendshapeVertices, &blendshapes[i].vertices, i);
+    view.Read(A::kBlendshapeNormals, &blendshapes[i].normals, i);
   }
+  blendshapes_ = std::move(blendshapes);
 
-  vertices_.resize(vertex_num);
-  int vertex_count = 0;
-  while (getline(ifs, str)) {
-    std::vector<std::string> splitted = Split(str, ' ');
-    vertices_[vertex_count][0] =
-        static_cast<float>(std::atof(splitted[0].c_str()));
-    vertices_[vertex_count][1] =
-        static_cast<float>(std::atof(splitted[1].c_str()));
-    vertices_[vertex_count][2] =
-        static_cast<float>(std::atof(splitted[2].c_str()));
-
-    // TODO
-    if (splitted.size() >= 6) {
-      auto vn = Eigen::Vector3f();
-      vn[0] = static_cast<float>(std::atof(splitted[3].c_str()));
-      vn[1] = static_cast<float>(std::atof(splitted[4].c_str()));
-      vn[2] = static_cast<float>(std::atof(splitted[5].c_str()));
-      normals_.push_back(vn);
-    }
-
-    if (splitted.size() >= 9) {
-      auto vc = Eigen::Vector3f();
-      vc[0] = static_cast<float>(std::atof(splitted[6].c_str()));
-      vc[1] = static_cast<float>(std::atof(splitted[7].c_str()));
-      vc[2] = static_cast<float>(std::atof(splitted[8].c_str()));
-      vertex_colors_.push_back(vc);
-    }
-    vertex_count++;
-    if (vertex_count >= vertex_num) {
-      break;
-    }
+  if (view.Read(A::kKeyframes, &bytes) &&
+      !DeserializeKeyframes(bytes, &keyframes_, &anim_interp_)) {
+    LOGE("Broken keyframes %s\n", path.c_str());
+    return false;
   }
 
-  vertex_indices_.resize(face_num);
-  int face_count = 0;
-  while (getline(ifs, str)) {
-    std::vector<std::string> splitted = Split(str, ' ');
-    vertex_indices_[face_count][0] = std::atoi(splitted[1].c_str());
-    vertex_indices_[face_count][1] = std::atoi(splitted[2].c_str());
-    vertex_indices_[face_count][2] = std::atoi(splitted[3].c_str());
-
-    face_count++;
-    if (face_count >= face_num) {
-      break;
-    }
+  if (face_normals_.size() != vertex_indices_.size()) {
+    CalcFaceNormal();
   }
 
-  ifs.close();
-
-  CalcNormal();
-
   CalcStats();
 
   return true;
 }
 
-bool Mesh::WritePly(const std::string& ply_path) const {
-  std::ofstream ofs(ply_path);
-  std::string str;
-  if (ofs.fail()) {
-    LOGE("couldn't open ply: %s\n", ply_path.c_str());
-    return false;
-  }
-
-  bool has_vertex_normal =
-      !vertices_.empty() && vertices_.size() == normals_.size();
-
-  bool has_vertex_color =
-      !vertices_.empty() && vertices_.size() == vertex_colors_.size();
-
-  ofs << "ply"
-      << "\n";
-  ofs << "format ascii 1.0"
-      << "\n";
-  ofs << "element vertex " + std::to_string(vertices_.size()) << "\n";
-  ofs << "property float x\n"
-         "property float y\n"
-         "property float z\n";
-  if (has_vertex_normal) {
-    ofs << "property float nx\n"
-           "property float ny\n"
-           "property float nz\n";
-  }
-  if (has_vertex_color) {
-    ofs << "property uchar red\n"
-           "property uchar green\n"
-           "property uchar blue\n"
-           "property uchar alpha\n";
-  }
-  ofs << "element face " + std::to_string(vertex_indices_.size()) << "\n";
-  ofs << "property list uchar int vertex_indices"
-      << "\n";
-  ofs << "end_header"
-      << "\n";
-
-  for (size_t i = 0; i < vertices_.size(); i++) {
-    ofs << vertices_[i][0] << " " << vertices_[i][1] << " " << vertices_[i][2]
-        << " ";
-    if (has_vertex_normal) {
-      ofs << normals_[i][0] << " " << normals_[i][1] << " " << normals_[i][2]
-          << " ";
-    }
-    if (has_vertex_color) {
-      ofs << static_cast<int>(std::round(vertex_colors_[i][0])) << " "
-          << static_cast<int>(std::round(vertex_colors_[i][1])) << " "
-          << static_cast<int>(std::round(vertex_colors_[i][2])) << " 255 ";
-    }
-    ofs << "\n";
-  }
-
-  for (size_t i = 0; i < vertex_indices_.size(); i++) {
-    ofs << "3 " << vertex_indices_[i][0] << " " << vertex_indices_[i][1] << " "
-        << vertex_indices_[i][2] << " "
-        << "\n";
-  }
-
-  ofs.close();
-
-  return true;
+bool Mesh::WriteBinary(const std::string& path, bool compress) const {
+  MeshBinaryWriter writer(compress ? MeshBinaryCompression::kLossless
+                                   : MeshBinaryCompression::kNone);
+  using A = MeshBinaryArray;
+  writer.Add(A::kVertices, vertices_.get(), CV_32FC3);
+  writer.Add(A::kVertexColors, vertex_colors_.get(), CV_32FC3);
+  writer.Add(A::kVertexIndices, vertex_indices_.get(), CV_32SC3);
+  writer.Add(A::kNormals, normals_.get(), CV_32FC3);
+  writer.Add(A::kFaceNormals, face_normals_.get(), CV_32FC3);
+  writer.Add(A::kNormalIndices, normal_indices_.get(), CV_32SC3);
+  writer.Add(A::kUv, uv_.get(), CV_32FC2);
+  writer.Add(A::kUvIndices, uv_indices_.get(), CV_32SC3);
+  writer.Add(A::kMaterialIds, material_ids_.get(), CV_32SC1);
+
+  const std::vector<uint8_t> material_bytes = SerializeMaterials(materials_);
+  writer.Add(A::kMaterials, material_bytes, CV_8UC1);
+  for (uint32_t i = 0; i < static_cast<uint32_t>(materials_.size()); i++) {
+    if (i < face_indices_per_material_.size()) {
+      writer.Add(A::kFaceIndicesPerMaterial, face_indices_per_material_[i],
+                 CV_32SC1, i);
+    }
+    writer.Add(A::kDiffuseTexture, materials_[i].diffuse_tex, i);
+    writer.Add(A::kWithAlphaTexture, materials_[i].with_alpha_tex, i);
+  }
+
+  const std::vector<uint8_t> blendshape_bytes =
+      SerializeBlendshapes(blendshapes_);
+  writer.Add(A::kBlendshapes, blendshape_bytes, CV_8UC1);
+  for (uint32_t i = 0; i < static_cast<uint32_t>(blendshapes_.size()); i++) {
+    writer.Add(A::kBlendshapeVertices, blendshapes_[i].vertices, CV_32FC3, i);
+    writer.Add(A::kBlendshapeNormals, blendshapes_[i].normals, CV_32FC3, i);
+  }
+
+  const std::vector<uint8_t> keyframe_bytes =
+      SerializeKeyframes(keyframes_, anim_interp_);
+  writer.Add(A::kKeyframes, keyframe_bytes, CV_8UC1);
+
+  return writer.Write(path);
 }
 
 bool Mesh::WriteObj(const std::string& obj_dir, const std::string& obj_basename,
@@ -954,85 +1171,15 @@ bool Mesh::WriteObj(const std::string& obj_dir, const std::string& obj_basename,
     ofs << "mtllib " << mtl_name << "\n"
         << "\n";
 
-    // vertices
-    if (!vertex_colors_.empty() && vertex_colors_.size() == vertices_.size()) {
-      for (size_t i = 0; i < vertices_.size(); i++) {
-        const auto& v = vertices_[i];
-        const auto& vc = vertex_colors_[i] / 255.f;
-        ofs << "v " << v.x() << " " << v.y() << " " << v.z() << " " << vc.x()
-            << " " << vc.y() << " " << vc.z() << "\n";
-      }
-    } else {
-      for (const auto& v : vertices_) {
-        ofs << "v " << v.x() << " " << v.y() << " " << v.z() << " 1.0"
-            << "\n";
-      }
-    }
-
-    // uv
-    for (const auto& vt : uv_) {
-      ofs << "vt " << vt.x() << " " << vt.y() << " 0"
-          << "\n";
-    }
-
-    // vertex normals
-    for (const auto& vn : normals_) {
-      ofs << "vn " << vn.x() << " " << vn.y() << " " << vn.z() << "\n";
-    }
-
-    // indices by material (group)
-    // CAUTION: This breaks original face indices
-    bool write_uv_indices = !uv_indices_.empty();
-    bool write_normal_indices = !normal_indices_.empty();
-#if 1
-    for (size_t k = 0; k < face_indices_per_material_.size(); k++) {
-      auto mat_name = materials_[k].name;
-      if (!mat_name.empty()) {
-        ofs << "usemtl " << materials_[k].name << "\n";
-      }
-      for (size_t i = 0; i < face_indices_per_material_[k].size(); i++) {
-        int f_idx = face_indices_per_material_[k][i];
-        ofs << "f";
-        for (int j = 0; j < 3; j++) {
-          ofs << " " << std::to_string(vertex_indices_[f_idx][j] + 1);
-          if (!write_uv_indices && !write_normal_indices) {
-            continue;
-          }
-          ofs << "/";
-          if (write_uv_indices) {
-            ofs << std::to_string(uv_indices_[f_idx][j] + 1);
-          }
-          if (write_normal_indices) {
-            ofs << "/" << std::to_string(normal_indices_[f_idx][j] + 1);
-          }
-        }
-        ofs << "\n";
-      }
-    }
-#else
-    // naive writing keeping original face indices
-    for (size_t i = 0; i < vertex_indices_.size(); i++) {
-      ofs << "f";
-      for (int j = 0; j < 3; j++) {
-        ofs << " " << std::to_string(vertex_indices_[i][j] + 1);
-        if (!write_uv_indices && !write_normal_indices) {
-          continue;
-        }
-        ofs << "/";
-        if (write_uv_indices) {
-          ofs << std::to_string(uv_indices_[i][j] + 1);
-        }
-        ofs << "/" << std::to_string(normal_indices_[i][j] + 1);
-      }
-      ofs << "\n";
-    }
-#endif
+    WriteObjBody(ofs, vertices_, vertex_colors_, uv_, normals_,
+                 vertex_indices_, uv_indices_, normal_indices_, materials_,
+                 face_indices_per_material_);
 
     ofs.close();
   }
 
   // update texture path
-  for (auto& material : materials_) {
+  for (auto& material : materials_.mut()) {
     if (material.diffuse_texname.empty() && !material.diffuse_tex.empty()) {
       // default name
       material.diffuse_texname = obj_basename + ".png";
@@ -1183,24 +1330,24 @@ bool Mesh::WriteGltfSeparate(const std::string& gltf_dir,
   for (const auto& b : this->blendshapes_) {
     model.meshes[0].blendshape_names.push_back(b.name);
     model.meshes[0].blendshape_weights.push_back(b.weight);
+    model.meshes[0].primitives[0].blendshape_with_normals.push_back(
+        !b.normals.empty());
   }
-  model.meshes[0].primitives[0].blendshape_num =
-      static_cast<std::uint32_t>(this->blendshapes_.size());
 
   std::string bin_name = gltf_basename + ".bin";
-  std::vector<std::uint8_t> bin;
+  gltf::BinLayout layout;
   model.accessors.clear();
   model.bufferViews.clear();
-  MakeGltfBinAndUpdateModel(*this, bin_name, false, model, bin);
+  MakeGltfBinAndUpdateModel(*this, bin_name, false, model, layout);
 
   // Write .bin
   std::ofstream bin_out(gltf_dir + bin_name,
                         std::ios::out | std::ios::binary | std::ios::trunc);
-  bin_out.write(reinterpret_cast<char*>(bin.data()), bin.size());
+  gltf::WriteBinLayout(bin_out, layout);
 
   // Write texture
   // Update path
-  for (auto& mat : this->materials_) {
+  for (auto& mat : this->materials_.mut()) {
     mat.diffuse_texpath = gltf_dir + mat.diffuse_texname;
     mat.with_alpha_texpath = gltf_dir + mat.with_alpha_texname;
   }
@@ -1214,7 +1361,7 @@ bool Mesh::WriteGltfSeparate(const std::string& gltf_dir,
 
   model.images.clear();
   std::vector<ObjMaterial> to_write_mats;
-  for (auto& mat : this->materials_) {
+  for (auto& mat : this->materials_.mut()) {
     to_write_mats.push_back(mat);
     std::string tex_name = mat.with_alpha_texname;
     std::string tex_path = mat.with_alpha_texpath;
@@ -1266,9 +1413,9 @@ bool Mesh::WriteGlb(const std::string& glb_dir, const std::string& glb_name,
   for (const auto& b : this->blendshapes_) {
     model.meshes[0].blendshape_names.push_back(b.name);
     model.meshes[0].blendshape_weights.push_back(b.weight);
+    model.meshes[0].primitives[0].blendshape_with_normals.push_back(
+        !b.normals.empty());
   }
-  model.meshes[0].primitives[0].blendshape_num =
-      static_cast<std::uint32_t>(this->blendshapes_.size());
 
   // Update materials and textures of the model
   model.materials.resize(this->materials_.size());  // todo: update pbr params
@@ -1276,89 +1423,19 @@ bool Mesh::WriteGlb(const std::string& glb_dir, const std::string& glb_name,
     model.materials[i].name = this->materials_[i].name;
     model.materials[i].is_unlit = is_unlit;
   }
-  model.images.clear();
-  for (auto& mat : this->materials_) {
-    std::string tex_name = mat.with_alpha_texname;
-    std::string tex_path = mat.with_alpha_texpath;
-    std::vector<uint8_t> tex_data = mat.with_alpha_compressed;
-    if (tex_name.empty()) {
-      tex_name = mat.diffuse_texname;
-      tex_path = mat.diffuse_texpath;
-      tex_data = mat.diffuse_compressed;
-    }
-    if (tex_name.empty()) {
-      continue;
-    }
-    gltf::Image image;
-    image.is_glb = true;
-    std::string ext = ExtractExt(tex_path);
-    if (ext == "jpg" || ext == "jpeg") {
-      image.mimeType = "image/jpeg";
-    } else if (ext == "png") {
-      image.mimeType = "image/png";
-    } else {
-      LOGE("ext %s is not supported\n", ext.c_str());
-      continue;
-    }
-
-    image.name = ExtractPathWithoutExt(tex_name);
-    if (tex_data.empty()) {
-      // Read jpeg or png data
-      std::ifstream ifs(tex_path, std::ios::in | std::ios::binary);
-      // Get size
-      ifs.seekg(0, std::ios::end);
-      long long int size = ifs.tellg();
-      ifs.seekg(0);
-      // Read binary
-      image.data.resize(size);
-      ifs.read(reinterpret_cast<char*>(image.data.data()), size);
-    } else {
-      // Copy from memory
-      image.data = std::move(tex_data);
-    }
-
-    model.images.push_back(image);
+  std::vector<const ObjMaterial*> materials;
+  for (const auto& mat : this->materials_) {
+    materials.push_back(&mat);
   }
+  model.images = MakeGlbImages(materials, false);
 
   std::string bin_name = glb_name + ".bin";
-  std::vector<std::uint8_t> bin;
+  gltf::BinLayout layout;
   model.accessors.clear();
   model.bufferViews.clear();
-  MakeGltfBinAndUpdateModel(*this, bin_name, true, model, bin);
-
-  gltf::Chunk bin_chunk{0x004E4942, bin};  // 0x004E4942 -> "BIN" in ASCII
-  std::vector<std::uint8_t> bin_bin = gltf::ChunkToBin(bin_chunk);
-
-  // Make json
-  std::string json_string = gltf::WriteGltfJsonToString(model);
-
-  std::vector<std::uint8_t> json_bytes(json_string.size());
-  std::memcpy(json_bytes.data(), json_string.c_str(), json_string.size());
-  gltf::Chunk json_chunk{0x4E4F534A,
-                         json_bytes};  // 0x4E4F534A	-> "JSON" in ASCII
-  std::vector<std::uint8_t> json_bin = gltf::ChunkToBin(json_chunk);
-
-  std::uint32_t magic = 0x46546C67;  //  0x46546C67 -> "glTF"in ASCII
-  std::uint32_t version = 2;
-  int header_size = 12;
-  std::uint32_t length = static_cast<std::uint32_t>(
-      header_size + json_bin.size() + bin_bin.size());
-  std::vector<std::uint8_t> header(header_size);
-  std::memcpy(header.data(), &magic, 4);
-  std::memcpy(header.data() + 4, &version, 4);
-  std::memcpy(header.data() + 8, &length, 4);
-
-  std::vector<std::uint8_t> combined(length);
-  std::memcpy(combined.data(), header.data(), header_size);
-  std::memcpy(combined.data() + header_size, json_bin.data(), json_bin.size());
-  std::memcpy(combined.data() + header_size + json_bin.size(), bin_bin.data(),
-              bin_bin.size());
-
-  std::ofstream glb_out(glb_dir + glb_name,
-                        std::ios::out | std::ios::binary | std::ios::trunc);
-  glb_out.write(reinterpret_cast<char*>(combined.data()), length);
+  MakeGltfBinAndUpdateModel(*this, bin_name, true, model, layout);
 
-  return true;
+  return gltf::WriteGlb(model, layout, glb_dir + glb_name);
 #else
   (void)glb_dir, glb_name, is_unlit;
   ugu::LOGE("Not supported with this configuration\n");
@@ -1366,6 +1443,17 @@ bool Mesh::WriteGlb(const std::string& glb_dir, const std::string& glb_name,
 #endif
 }
 
+bool Mesh::LoadGltf(const std::string& path) {
+  Clear();
+
+  Scene scene;
+  if (!ugu::LoadGltf(path, &scene) || scene.empty()) {
+    return false;
+  }
+
+  return MergeMeshes(scene, this);
+}
+
 int Mesh::RemoveUnreferencedVertices() {
   std::vector<bool> reference_table(vertices_.size(), false);
   for (const auto& f : vertex_indices_) {
@@ -1464,25 +1552,21 @@ int Mesh::RemoveDuplicateFaces() {
     return 0;
   }
 
-  std::vector<Eigen::Vector3i> org_vertex_indices;
-  std::vector<Eigen::Vector3i> org_uv_indices;
-
   bool keep_uv =
       (vertex_indices_.size() == uv_indices_.size()) && uv_indices_.size() > 0;
 
-  CopyVec(vertex_indices_, &org_vertex_indices);
-  CopyVec(uv_indices_, &org_uv_indices);
-  vertex_indices_.clear();
-  uv_indices_.clear();
-
-  for (int i = 0; i < static_cast<int>(org_vertex_indices.size()); i++) {
+  std::vector<Eigen::Vector3i> vertex_indices;
+  std::vector<Eigen::Vector3i> uv_indices;
+  for (int i = 0; i < static_cast<int>(vertex_indices_.size()); i++) {
     if (to_remove_faceids.count(i) == 0) {
-      vertex_indices_.push_back(org_vertex_indices[i]);
+      vertex_indices.push_back(vertex_indices_[i]);
       if (keep_uv) {
-        uv_indices_.push_back(org_uv_indices[i]);
+        uv_indices.push_back(uv_indices_[i]);
       }
     }
   }
+  vertex_indices_ = std::move(vertex_indices);
+  uv_indices_ = std::move(uv_indices);
 
   return static_cast<int>(to_remove_faceids.size());
 }
@@ -1557,9 +1641,10 @@ bool Mesh::SplitMultipleUvVertices() {
 
 bool Mesh::FlipFaces() {
   auto flip = [](Eigen::Vector3i& i) { std::swap(i[1], i[2]); };
-  std::for_each(vertex_indices_.begin(), vertex_indices_.end(), flip);
-  std::for_each(uv_indices_.begin(), uv_indices_.end(), flip);
-  std::for_each(normal_indices_.begin(), normal_indices_.end(), flip);
+  for (auto* indices : {&vertex_indices_, &uv_indices_, &normal_indices_}) {
+    auto& idx = indices->mut();
+    std::for_each(idx.begin(), idx.end(), flip);
+  }
 
   CalcNormal();
 
@@ -1713,7 +1798,7 @@ bool WriteGltfSeparate(Scene& scene, const std::string& gltf_dir,
   gltf::Model model;
   std::string bin_name = gltf_basename + ".bin";
 
-  std::vector<std::uint8_t> bin_all;
+  gltf::BinLayout layout;
 
   model.meshes.resize(scene.size());
 
@@ -1774,14 +1859,12 @@ bool WriteGltfSeparate(Scene& scene, const std::string& gltf_dir,
     for (const auto& b : mesh->blendshapes()) {
       model.meshes[msh_idx].blendshape_names.push_back(b.name);
       model.meshes[msh_idx].blendshape_weights.push_back(b.weight);
+      model.meshes[msh_idx].primitives[0].blendshape_with_normals.push_back(
+          !b.normals.empty());
     }
-    model.meshes[msh_idx].primitives[0].blendshape_num =
-        static_cast<std::uint32_t>(mesh->blendshapes().size());
 
     // std::vector<std::uint8_t> bin =
-    MakeGltfBinAndUpdateModel(*mesh, bin_name, false, model, bin_all);
-    // std::copy(bin.begin(), bin.end(), std::back_inserter(bin_all));
-    // bin_all = std::move(bin);
+    MakeGltfBinAndUpdateModel(*mesh, bin_name, false, model, layout);
 
     // Write texture
 
@@ -1833,7 +1916,7 @@ bool WriteGltfSeparate(Scene& scene, const std::string& gltf_dir,
   // Write .bin
   std::ofstream bin_out(gltf_dir + bin_name,
                         std::ios::out | std::ios::binary | std::ios::trunc);
-  bin_out.write(reinterpret_cast<char*>(bin_all.data()), bin_all.size());
+  gltf::WriteBinLayout(bin_out, layout);
 
   // Write .gltf (json)
   gltf::WriteGltfJsonToFile(model, gltf_dir + gltf_basename + ".gltf");
@@ -1850,9 +1933,8 @@ bool WriteGlb(Scene& scene, const std::string& glb_dir,
               const std::string& glb_name, bool is_unlit) {
 #ifdef UGU_USE_JSON
   gltf::Model model;
-  std::string bin_name = glb_name + ".bin";
-
-  std::vector<std::uint8_t> bin_all;
+  gltf::BinLayout layout;
+  std::vector<const ObjMaterial*> materials;
 
   model.meshes.resize(scene.size());
 
@@ -1913,9 +1995,9 @@ bool WriteGlb(Scene& scene, const std::string& glb_dir,
     for (const auto& b : mesh->blendshapes()) {
       model.meshes[msh_idx].blendshape_names.push_back(b.name);
       model.meshes[msh_idx].blendshape_weights.push_back(b.weight);
+      model.meshes[msh_idx].primitives[0].blendshape_with_normals.push_back(
+          !b.normals.empty());
     }
-    model.meshes[msh_idx].primitives[0].blendshape_num =
-        static_cast<std::uint32_t>(mesh->blendshapes().size());
 
     for (size_t i = 0; i < mesh->materials().size(); i++) {
       model.materials[mat_count + i].name = mesh->materials()[i].name;
@@ -1961,155 +2043,19 @@ bool WriteGlb(Scene& scene, const std::string& glb_dir,
     WriteTexture(to_write_mats);
 #endif  // 0
 
-    for (auto mat : mesh->materials()) {
-      std::string tex_name = mat.with_alpha_texname;
-      std::string tex_path = mat.with_alpha_texpath;
-      if (tex_path.empty()) {
-        tex_path = tex_name;
-      }
-      if (mat.with_alpha_compressed.empty()) {
-        std::string ext = ExtractExt(tex_path);
-        if (ext == "png") {
-          mat.with_alpha_compressed = PngData(mat.with_alpha_tex);
-        }
-      }
-      std::vector<uint8_t> tex_data = mat.with_alpha_compressed;
-      if (tex_name.empty()) {
-        tex_name = mat.diffuse_texname;
-        tex_path = mat.diffuse_texpath;
-        if (tex_path.empty()) {
-          tex_path = tex_name;
-        }
-        if (mat.diffuse_compressed.empty()) {
-          std::string ext = ExtractExt(tex_path);
-          if (ext == "jpg" || ext == "jpeg") {
-            mat.diffuse_compressed = JpgData(mat.diffuse_tex);
-          } else if (ext == "png") {
-            mat.diffuse_compressed = PngData(mat.diffuse_tex);
-          }
-        }
-        tex_data = mat.diffuse_compressed;
-      }
-      if (tex_name.empty()) {
-        continue;
-      }
-
-      gltf::Image image;
-      image.is_glb = true;
-      std::string ext = ExtractExt(tex_path);
-      if (ext == "jpg" || ext == "jpeg") {
-        image.mimeType = "image/jpeg";
-      } else if (ext == "png") {
-        image.mimeType = "image/png";
-      } else {
-        LOGE("ext %s is not supported\n", ext.c_str());
-        continue;
-      }
-
-      image.name = ExtractPathWithoutExt(tex_name);
-      if (tex_data.empty()) {
-        // Read jpeg or png data
-        std::ifstream ifs(tex_path, std::ios::in | std::ios::binary);
-        // Get size
-        ifs.seekg(0, std::ios::end);
-        long long int size = ifs.tellg();
-        ifs.seekg(0);
-        // Read binary
-        image.data.resize(size);
-        ifs.read(reinterpret_cast<char*>(image.data.data()), size);
-      } else {
-        // Copy from memory
-        image.data = std::move(tex_data);
-      }
-
-      model.images.push_back(image);
+    for (const auto& mat : mesh->materials()) {
+      materials.push_back(&mat);
     }
 
     std::string bin_name_ = glb_name + ".bin";
-    MakeGltfBinAndUpdateModel(*mesh, bin_name_, true, model, bin_all, false);
+    MakeGltfBinAndUpdateModel(*mesh, bin_name_, true, model, layout, false);
   }
 
-  uint32_t num_bv = static_cast<uint32_t>(model.bufferViews.size());
-  uint32_t total_size = static_cast<uint32_t>(bin_all.size());
-  uint32_t org_total_size = total_size;
-  std::vector<std::vector<std::uint8_t>> bytes_list;
-  if (true) {
-    model.buffers[0].is_glb = true;
-
-    for (auto& image : model.images) {
-      if (image.glb_processed) {
-        continue;
-      }
-
-      image.is_glb = true;
-      image.glb_processed = true;
-      image.bufferView = num_bv;
-
-      // Does not need accessor for image
-      // BufferView and mimeType are enough for decoding
-      gltf::BufferView bv;
-      bv.buffer = 0;
-      // Image data should be last of buffer
-      // Otherwise you may get ""ACCESSOR_TOTAL_OFFSET_ALIGNMENT" Accessor's
-      // total byteOffset XXXX isn't a multiple of componentType length 4." for
-      // other (e.g. vertices) bufferViews
-      bv.byteLength = static_cast<int>(image.data.size());
-      bv.byteOffset = static_cast<std::uint32_t>(total_size);
-      total_size += bv.byteLength;
-      model.bufferViews.push_back(bv);
-
-      bytes_list.push_back(image.data);
-
-      num_bv++;
-    }
-
-  } else {
-    model.buffers[0].is_glb = false;
-    model.buffers[0].uri = bin_name;
-  }
+  // Textures of all meshes are encoded in parallel
+  model.images = MakeGlbImages(materials, true);
+  gltf::AddGlbImages(model, layout);
 
-  model.buffers[0].byteLength = static_cast<std::uint32_t>(total_size);
-
-  bin_all.resize(total_size);
-  size_t offset = org_total_size;
-  for (auto& bytes : bytes_list) {
-    bin_all.insert(bin_all.begin() + offset, bytes.begin(), bytes.end());
-    offset += bytes.size();
-  }
-
-  gltf::Chunk bin_chunk{0x004E4942, bin_all};  // 0x004E4942 -> "BIN" in ASCII
-  std::vector<std::uint8_t> bin_bin = gltf::ChunkToBin(bin_chunk);
-
-  // Make json
-  std::string json_string = gltf::WriteGltfJsonToString(model);
-
-  std::vector<std::uint8_t> json_bytes(json_string.size());
-  std::memcpy(json_bytes.data(), json_string.c_str(), json_string.size());
-  gltf::Chunk json_chunk{0x4E4F534A,
-                         json_bytes};  // 0x4E4F534A	-> "JSON" in ASCII
-  std::vector<std::uint8_t> json_bin = gltf::ChunkToBin(json_chunk);
-
-  std::uint32_t magic = 0x46546C67;  //  0x46546C67 -> "glTF"in ASCII
-  std::uint32_t version = 2;
-  int header_size = 12;
-  std::uint32_t length = static_cast<std::uint32_t>(
-      header_size + json_bin.size() + bin_bin.size());
-  std::vector<std::uint8_t> header(header_size);
-  std::memcpy(header.data(), &magic, 4);
-  std::memcpy(header.data() + 4, &version, 4);
-  std::memcpy(header.data() + 8, &length, 4);
-
-  std::vector<std::uint8_t> combined(length);
-  std::memcpy(combined.data(), header.data(), header_size);
-  std::memcpy(combined.data() + header_size, json_bin.data(), json_bin.size());
-  std::memcpy(combined.data() + header_size + json_bin.size(), bin_bin.data(),
-              bin_bin.size());
-
-  std::ofstream glb_out(glb_dir + glb_name,
-                        std::ios::out | std::ios::binary | std::ios::trunc);
-  glb_out.write(reinterpret_cast<char*>(combined.data()), length);
-
-  return true;
+  return gltf::WriteGlb(model, layout, glb_dir + glb_name);
 #else
   (void)scene, glb_dir, glb_name, is_unlit;
   ugu::LOGE("Not supported with this configuration\n");
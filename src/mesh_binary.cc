@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/mesh_binary.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+
+#include "ugu/image_codec.h"
+#include "ugu/util/image_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+struct MeshBinaryHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t array_num;
+  uint32_t reserved0;
+  uint64_t file_size;
+  uint8_t reserved[40];
+};
+static_assert(sizeof(MeshBinaryHeader) == 64, "Unexpected header size");
+static_assert(sizeof(MeshBinaryArrayInfo) == 64, "Unexpected entry size");
+
+constexpr char kMeshBinaryMagic[4] = {'U', 'G', 'U', 'M'};
+constexpr uint32_t kMeshBinaryVersion = 1;
+constexpr uint64_t kAlignment = 64;
+// Small arrays are not worth compressing
+constexpr size_t kMinCompressBytes = 1 << 12;
+// Bytes per task of parallel copy
+constexpr size_t kCopyBlockBytes = 1 << 22;
+
+inline uint64_t AlignUp(uint64_t x) {
+  return (x + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Non-owning image on an array for the codec
+ImageBase WrapArray(const MeshBinaryArrayInfo& info, const void* data) {
+  void* ptr = const_cast<void*>(data);
+  const int rows = static_cast<int>(info.rows);
+  const int cols = static_cast<int>(info.cols);
+#ifdef UGU_USE_OPENCV
+  return ImageBase(rows, cols, info.cv_type, ptr);
+#else
+  return ImageBase(rows, cols, info.cv_type, ptr, nullptr);
+#endif
+}
+
+void ParallelCopy(uint8_t* dst, const uint8_t* src, size_t size) {
+  const size_t block_num = (size + kCopyBlockBytes - 1) / kCopyBlockBytes;
+  if (block_num <= 1) {
+    std::memcpy(dst, src, size);
+    return;
+  }
+  parallel_for(size_t(0), block_num, [&](size_t i) {
+    const size_t st = i * kCopyBlockBytes;
+    const size_t len = std::min(kCopyBlockBytes, size - st);
+    std::memcpy(dst + st, src + st, len);
+  });
+}
+
+}  // namespace
+
+namespace ugu {
+
+MeshBinaryWriter::MeshBinaryWriter(MeshBinaryCompression compression)
+    : compression_(compression) {}
+
+void MeshBinaryWriter::Add(MeshBinaryArray type, uint32_t index, int cv_type,
+                           size_t rows, size_t cols, const void* data) {
+  Item item{};
+  item.info.type = static_cast<uint32_t>(type);
+  item.info.index = index;
+  item.info.cv_type = cv_type;
+  item.info.rows = rows;
+  item.info.cols = cols;
+  item.info.raw_size = rows * cols * ElemSizeFromCvType(cv_type);
+  item.data = data;
+  items_.push_back(item);
+}
+
+void MeshBinaryWriter::Add(MeshBinaryArray type, const ImageBase& image,
+                           uint32_t index) {
+  if (image.empty()) {
+    return;
+  }
+  const ImageBase* src = &image;
+  if (!image.isContinuous()) {
+    images_.push_back(image.clone());
+    src = &images_.back();
+  }
+  Add(type, index, src->type(), src->rows, src->cols, src->data);
+}
+
+bool MeshBinaryWriter::Write(const std::string& path) const {
+  // Compress first to fix the offsets
+  std::vector<std::vector<uint8_t>> encoded(items_.size());
+  std::vector<MeshBinaryArrayInfo> infos(items_.size());
+  uint64_t offset =
+      AlignUp(sizeof(MeshBinaryHeader) + sizeof(MeshBinaryArrayInfo) *
+                                             static_cast<uint64_t>(infos.size()));
+  for (size_t i = 0; i < items_.size(); i++) {
+    MeshBinaryArrayInfo& info = infos[i];
+    info = items_[i].info;
+    info.compression = static_cast<uint32_t>(MeshBinaryCompression::kNone);
+    info.stored_size = info.raw_size;
+    if (compression_ == MeshBinaryCompression::kLossless &&
+        info.raw_size >= kMinCompressBytes && info.rows <= INT_MAX &&
+        info.cols <= INT_MAX) {
+      if (!EncodeLossless(WrapArray(info, items_[i].data), &encoded[i])) {
+        return false;
+      }
+      if (encoded[i].size() < info.raw_size) {
+        info.compression = static_cast<uint32_t>(compression_);
+        info.stored_size = encoded[i].size();
+      } else {
+        encoded[i].clear();
+      }
+    }
+    info.offset = offset;
+    offset = AlignUp(offset + info.stored_size);
+  }
+
+  MeshBinaryHeader header{};
+  std::memcpy(header.magic, kMeshBinaryMagic, sizeof(header.magic));
+  header.version = kMeshBinaryVersion;
+  header.array_num = static_cast<uint32_t>(infos.size());
+  header.file_size = offset;
+
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs.is_open()) {
+    LOGE("Failed to open %s\n", path.c_str());
+    return false;
+  }
+  const char padding[kAlignment] = {};
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(infos.data()),
+            sizeof(MeshBinaryArrayInfo) * infos.size());
+  uint64_t written =
+      sizeof(header) + sizeof(MeshBinaryArrayInfo) * infos.size();
+  for (size_t i = 0; i < infos.size(); i++) {
+    ofs.write(padding, infos[i].offset - written);
+    const char* src = encoded[i].empty()
+                          ? reinterpret_cast<const char*>(items_[i].data)
+                          : reinterpret_cast<const char*>(encoded[i].data());
+    ofs.write(src, infos[i].stored_size);
+    written = infos[i].offset + infos[i].stored_size;
+  }
+  ofs.write(padding, header.file_size - written);
+
+  return !ofs.bad();
+}
+
+bool MeshBinaryView::Open(const std::string& path) {
+  Close();
+
+  auto file = std::make_shared<MappedFile>();
+  if (!file->Open(path)) {
+    return false;
+  }
+  const uint8_t* bytes = file->data();
+  const size_t size = file->size();
+
+  MeshBinaryHeader header;
+  if (size < sizeof(header)) {
+    LOGE("Too small file %s\n", path.c_str());
+    return false;
+  }
+  std::memcpy(&header, bytes, sizeof(header));
+  if (std::memcmp(header.magic, kMeshBinaryMagic, sizeof(header.magic)) != 0 ||
+      header.version != kMeshBinaryVersion) {
+    LOGE("Not a binary mesh or unsupported version %s\n", path.c_str());
+    return false;
+  }
+  const uint64_t table_size =
+      sizeof(MeshBinaryArrayInfo) * static_cast<uint64_t>(header.array_num);
+  if (header.file_size != size || size - sizeof(header) < table_size) {
+    LOGE("Broken header %s\n", path.c_str());
+    return false;
+  }
+
+  std::vector<MeshBinaryArrayInfo> arrays(header.array_num);
+  std::memcpy(arrays.data(), bytes + sizeof(header), table_size);
+  for (const auto& info : arrays) {
+    const size_t elem_size = ElemSizeFromCvType(info.cv_type);
+    const auto compression =
+        static_cast<MeshBinaryCompression>(info.compression);
+    const bool valid_compression =
+        (compression == MeshBinaryCompression::kNone &&
+         info.stored_size == info.raw_size) ||
+        (compression == MeshBinaryCompression::kLossless &&
+         info.rows <= INT_MAX && info.cols <= INT_MAX);
+    if (elem_size == 0 || info.raw_size != info.rows * info.cols * elem_size ||
+        !valid_compression || info.offset % kAlignment != 0 ||
+        info.offset > size || size - info.offset < info.stored_size) {
+      LOGE("Broken array table %s\n", path.c_str());
+      return false;
+    }
+  }
+
+  file_ = std::move(file);
+  arrays_ = std::move(arrays);
+  return true;
+}
+
+void MeshBinaryView::Close() {
+  file_ = nullptr;
+  arrays_.clear();
+}
+
+const MeshBinaryArrayInfo* MeshBinaryView::Find(MeshBinaryArray type,
+                                                uint32_t index) const {
+  for (const auto& info : arrays_) {
+    if (info.type == static_cast<uint32_t>(type) && info.index == index) {
+      return &info;
+    }
+  }
+  return nullptr;
+}
+
+const void* MeshBinaryView::Map(MeshBinaryArray type, uint32_t index) const {
+  const MeshBinaryArrayInfo* info = Find(type, index);
+  if (info == nullptr || static_cast<MeshBinaryCompression>(
+                             info->compression) != MeshBinaryCompression::kNone) {
+    return nullptr;
+  }
+  return file_->data() + info->offset;
+}
+
+bool MeshBinaryView::Read(MeshBinaryArray type, uint32_t index,
+                          void* dst) const {
+  const MeshBinaryArrayInfo* info = Find(type, index);
+  if (info == nullptr) {
+    return false;
+  }
+  const uint8_t* src = file_->data() + info->offset;
+  if (static_cast<MeshBinaryCompression>(info->compression) ==
+      MeshBinaryCompression::kNone) {
+    ParallelCopy(reinterpret_cast<uint8_t*>(dst), src, info->raw_size);
+    return true;
+  }
+  ImageBase img = WrapArray(*info, dst);
+  if (!DecodeLossless(src, info->stored_size, img)) {
+    LOGE("Failed to decode array %d (%d)\n", info->type, info->index);
+    return false;
+  }
+  return true;
+}
+
+ImageBase MeshBinaryView::ReadImage(MeshBinaryArray type,
+                                    uint32_t index) const {
+  const MeshBinaryArrayInfo* info = Find(type, index);
+  if (info == nullptr || INT_MAX < info->rows || INT_MAX < info->cols) {
+    return ImageBase();
+  }
+  const int rows = static_cast<int>(info->rows);
+  const int cols = static_cast<int>(info->cols);
+  if (static_cast<MeshBinaryCompression>(info->compression) ==
+      MeshBinaryCompression::kNone) {
+    uint8_t* pixels = file_->data() + info->offset;
+#ifdef UGU_USE_OPENCV
+    return ImageBase(rows, cols, info->cv_type, pixels).clone();
+#else
+    // The mapping is released with the last image referring it
+    return ImageBase(rows, cols, info->cv_type, pixels, file_);
+#endif
+  }
+  ImageBase img(rows, cols, info->cv_type);
+  if (!Read(type, index, img.data)) {
+    return ImageBase();
+  }
+  return img;
+}
+
+}  // namespace ugu
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/mesh_soa.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+using namespace ugu;
+
+// Faces per block of gathered SoA in CalcFaceNormalSoA()
+constexpr size_t kFaceBlock = 256;
+
+// Same as Eigen's normalized(): zero vectors are kept as they are
+inline void Normalize(float* __restrict x, float* __restrict y,
+                      float* __restrict z, size_t n) {
+#pragma omp simd
+  for (size_t i = 0; i < n; i++) {
+    const float sq = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+    const float inv = sq > 0.f ? 1.f / std::sqrt(sq) : 1.f;
+    x[i] *= inv;
+    y[i] *= inv;
+    z[i] *= inv;
+  }
+}
+
+// src and dst may be the same arrays
+void AffineSoA(const Eigen::Matrix3f& A, const Eigen::Vector3f& t,
+               const float* sx, const float* sy, const float* sz, float* dx,
+               float* dy, float* dz, size_t n) {
+  const float a00 = A(0, 0), a01 = A(0, 1), a02 = A(0, 2);
+  const float a10 = A(1, 0), a11 = A(1, 1), a12 = A(1, 2);
+  const float a20 = A(2, 0), a21 = A(2, 1), a22 = A(2, 2);
+  const float t0 = t[0], t1 = t[1], t2 = t[2];
+#pragma omp simd
+  for (size_t i = 0; i < n; i++) {
+    const float x = sx[i], y = sy[i], z = sz[i];
+    dx[i] = a00 * x + a01 * y + a02 * z + t0;
+    dy[i] = a10 * x + a11 * y + a12 * z + t1;
+    dz[i] = a20 * x + a21 * y + a22 * z + t2;
+  }
+}
+
+}  // namespace
+
+namespace ugu {
+
+Vec3fSoA::Vec3fSoA(size_t size) { resize(size); }
+
+Vec3fSoA::Vec3fSoA(const std::vector<Eigen::Vector3f>& aos) { FromAoS(aos); }
+
+void Vec3fSoA::resize(size_t size) {
+  x_.resize(size);
+  y_.resize(size);
+  z_.resize(size);
+}
+
+void Vec3fSoA::clear() {
+  x_.clear();
+  y_.clear();
+  z_.clear();
+}
+
+void Vec3fSoA::FromAoS(const std::vector<Eigen::Vector3f>& aos) {
+  resize(aos.size());
+  const float* src = aos.empty() ? nullptr : aos[0].data();
+  for (size_t i = 0; i < size(); i++) {
+    x_[i] = src[i * 3 + 0];
+    y_[i] = src[i * 3 + 1];
+    z_[i] = src[i * 3 + 2];
+  }
+}
+
+void Vec3fSoA::ToAoS(std::vector<Eigen::Vector3f>* aos) const {
+  aos->resize(size());
+  float* dst = aos->empty() ? nullptr : (*aos)[0].data();
+  for (size_t i = 0; i < size(); i++) {
+    dst[i * 3 + 0] = x_[i];
+    dst[i * 3 + 1] = y_[i];
+    dst[i * 3 + 2] = z_[i];
+  }
+}
+
+void TransformSoA(const Eigen::Affine3f& T, Vec3fSoA* points) {
+  AffineSoA(T.linear(), T.translation(), points->x(), points->y(),
+            points->z(), points->x(), points->y(), points->z(),
+            points->size());
+}
+
+void RotateSoA(const Eigen::Matrix3f& R, Vec3fSoA* directions) {
+  AffineSoA(R, Eigen::Vector3f::Zero(), directions->x(), directions->y(),
+            directions->z(), directions->x(), directions->y(),
+            directions->z(), directions->size());
+}
+
+void CalcFaceNormalSoA(const Vec3fSoA& vertices,
+                       const std::vector<Eigen::Vector3i>& indices,
+                       Vec3fSoA* face_normals) {
+  face_normals->resize(indices.size());
+  const float* vx = vertices.x();
+  const float* vy = vertices.y();
+  const float* vz = vertices.z();
+  float* nx = face_normals->x();
+  float* ny = face_normals->y();
+  float* nz = face_normals->z();
+
+  // Edges are gathered per block so that the arithmetic is vectorized
+  alignas(32) float e1[3][kFaceBlock];
+  alignas(32) float e2[3][kFaceBlock];
+  for (size_t st = 0; st < indices.size(); st += kFaceBlock) {
+    const size_t n = std::min(kFaceBlock, indices.size() - st);
+    for (size_t i = 0; i < n; i++) {
+      const Eigen::Vector3i& f = indices[st + i];
+      e1[0][i] = vx[f[1]] - vx[f[0]];
+      e1[1][i] = vy[f[1]] - vy[f[0]];
+      e1[2][i] = vz[f[1]] - vz[f[0]];
+      e2[0][i] = vx[f[2]] - vx[f[0]];
+      e2[1][i] = vy[f[2]] - vy[f[0]];
+      e2[2][i] = vz[f[2]] - vz[f[0]];
+    }
+    Normalize(e1[0], e1[1], e1[2], n);
+    Normalize(e2[0], e2[1], e2[2], n);
+    float* __restrict ox = nx + st;
+    float* __restrict oy = ny + st;
+    float* __restrict oz = nz + st;
+#pragma omp simd
+    for (size_t i = 0; i < n; i++) {
+      ox[i] = e1[1][i] * e2[2][i] - e1[2][i] * e2[1][i];
+      oy[i] = e1[2][i] * e2[0][i] - e1[0][i] * e2[2][i];
+      oz[i] = e1[0][i] * e2[1][i] - e1[1][i] * e2[0][i];
+    }
+    Normalize(ox, oy, oz, n);
+  }
+}
+
+void CalcNormalSoA(const Vec3fSoA& vertices,
+                   const std::vector<Eigen::Vector3i>& indices,
+                   Vec3fSoA* normals) {
+  Vec3fSoA face_normals;
+  CalcFaceNormalSoA(vertices, indices, &face_normals);
+
+  // Normalizing the sum is the same as normalizing the average.
+  // Unreferenced vertices stay (0, 0, 0).
+  normals->resize(vertices.size());
+  std::fill(normals->x(), normals->x() + normals->size(), 0.f);
+  std::fill(normals->y(), normals->y() + normals->size(), 0.f);
+  std::fill(normals->z(), normals->z() + normals->size(), 0.f);
+  float* nx = normals->x();
+  float* ny = normals->y();
+  float* nz = normals->z();
+  for (size_t i = 0; i < indices.size(); i++) {
+    const float fx = face_normals.x()[i];
+    const float fy = face_normals.y()[i];
+    const float fz = face_normals.z()[i];
+    for (int j = 0; j < 3; j++) {
+      const int idx = indices[i][j];
+      nx[idx] += fx;
+      ny[idx] += fy;
+      nz[idx] += fz;
+    }
+  }
+  Normalize(nx, ny, nz, normals->size());
+}
+
+MeshStats CalcStatsSoA(const Vec3fSoA& points) {
+  MeshStats stats;
+  stats.bb_min = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+  stats.bb_max =
+      Eigen::Vector3f::Constant(std::numeric_limits<float>::lowest());
+  if (points.empty()) {
+    return stats;
+  }
+
+  const float* components[3] = {points.x(), points.y(), points.z()};
+  for (int c = 0; c < 3; c++) {
+    const float* p = components[c];
+    float lo = std::numeric_limits<float>::max();
+    float hi = std::numeric_limits<float>::lowest();
+    double sum = 0.0;  // use double to avoid overflow
+#pragma omp simd reduction(min : lo) reduction(max : hi) reduction(+ : sum)
+    for (size_t i = 0; i < points.size(); i++) {
+      lo = std::min(lo, p[i]);
+      hi = std::max(hi, p[i]);
+      sum += p[i];
+    }
+    stats.bb_min[c] = lo;
+    stats.bb_max[c] = hi;
+    stats.center[c] = static_cast<float>(sum / points.size());
+  }
+  return stats;
+}
+
+void ProjectPinholeSoA(const Vec3fSoA& points_w, const Eigen::Matrix3f& w2c_R,
+                       const Eigen::Vector3f& w2c_t,
+                       const Eigen::Vector2f& focal_length,
+                       const Eigen::Vector2f& principal_point,
+                       Vec3fSoA* points_c, Vec3fSoA* points_i) {
+  points_c->resize(points_w.size());
+  points_i->resize(points_w.size());
+  AffineSoA(w2c_R, w2c_t, points_w.x(), points_w.y(), points_w.z(),
+            points_c->x(), points_c->y(), points_c->z(), points_w.size());
+
+  const float fx = focal_length[0], fy = focal_length[1];
+  const float px = principal_point[0], py = principal_point[1];
+  const float* __restrict cx = points_c->x();
+  const float* __restrict cy = points_c->y();
+  const float* __restrict cz = points_c->z();
+  float* __restrict ix = points_i->x();
+  float* __restrict iy = points_i->y();
+  float* __restrict iz = points_i->z();
+#pragma omp simd
+  for (size_t i = 0; i < points_w.size(); i++) {
+    ix[i] = fx / cz[i] * cx[i] + px;
+    iy[i] = fy / cz[i] * cy[i] + py;
+    iz[i] = cz[i];
+  }
+}
+
+}  // namespace ugu
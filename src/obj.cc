@@ -0,0 +1,652 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "obj.h"
+
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+#include "ugu/util/io_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+// Target bytes of a chunk parsed by a task
+constexpr size_t kChunkBytes = 1 << 22;
+// Lines formatted by a task
+constexpr size_t kLineBlock = 1 << 15;
+constexpr size_t kLineBufSize = 512;
+
+// An index relative to the end of the attributes (negative index in obj)
+// resolved only inside a chunk. pos is the position in the flattened
+// index array of the chunk.
+struct RelativeIndex {
+  size_t pos;
+  int local;
+};
+
+struct ObjChunk {
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<Eigen::Vector3f> vertex_colors;
+  size_t colored_num = 0;
+  std::vector<Eigen::Vector2f> uv;
+  std::vector<Eigen::Vector3f> normals;
+
+  std::vector<Eigen::Vector3i> vertex_indices;
+  std::vector<Eigen::Vector3i> uv_indices;
+  std::vector<Eigen::Vector3i> normal_indices;
+  std::vector<RelativeIndex> relative_v, relative_vt, relative_vn;
+  size_t corners_with_vt = 0;
+  size_t corners_with_vn = 0;
+
+  // Index to usemtl_names. -1 before the first usemtl in this chunk.
+  std::vector<int> material_slots;
+  std::vector<std::string> usemtl_names;
+  std::vector<std::string> mtllibs;
+
+  bool ok = true;
+  size_t error_line_pos = 0;
+};
+
+inline const char* SkipSpace(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+template <typename T>
+inline bool ParseNumber(const char*& p, const char* end, T* v) {
+  p = SkipSpace(p, end);
+  if (p < end && *p == '+') {
+    p++;
+  }
+  auto [ptr, ec] = std::from_chars(p, end, *v);
+  if (ec != std::errc()) {
+    return false;
+  }
+  p = ptr;
+  return true;
+}
+
+inline bool StartsWith(const char* p, const char* end, const char* word) {
+  const size_t len = std::strlen(word);
+  if (static_cast<size_t>(end - p) < len ||
+      std::memcmp(p, word, len) != 0) {
+    return false;
+  }
+  // Must be followed by a separator
+  return static_cast<size_t>(end - p) == len || p[len] == ' ' ||
+         p[len] == '\t';
+}
+
+std::string TrimmedRest(const char* p, const char* end) {
+  p = SkipSpace(p, end);
+  while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+    end--;
+  }
+  return std::string(p, end);
+}
+
+struct Corner {
+  int v = -1;
+  int vt = -1;
+  int vn = -1;
+  bool v_rel = false;
+  bool vt_rel = false;
+  bool vn_rel = false;
+};
+
+// Converts 1-based obj index to 0-based. Negative ones are resolved against
+// the number of attributes in the chunk so far.
+inline bool ResolveIndex(int idx, size_t local_num, int* resolved,
+                         bool* relative) {
+  if (idx > 0) {
+    *resolved = idx - 1;
+    *relative = false;
+    return true;
+  } else if (idx < 0) {
+    *resolved = static_cast<int>(local_num) + idx;
+    *relative = true;
+    return true;
+  }
+  return false;
+}
+
+bool ParseCorner(const char*& p, const char* end, const ObjChunk& chunk,
+                 Corner* c) {
+  int idx = 0;
+  if (!ParseNumber(p, end, &idx) ||
+      !ResolveIndex(idx, chunk.vertices.size(), &c->v, &c->v_rel)) {
+    return false;
+  }
+  if (p < end && *p == '/') {
+    p++;
+    if (p < end && *p != '/') {
+      if (!ParseNumber(p, end, &idx) ||
+          !ResolveIndex(idx, chunk.uv.size(), &c->vt, &c->vt_rel)) {
+        return false;
+      }
+    }
+    if (p < end && *p == '/') {
+      p++;
+      if (!ParseNumber(p, end, &idx) ||
+          !ResolveIndex(idx, chunk.normals.size(), &c->vn, &c->vn_rel)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void AddTriangle(const Corner& c0, const Corner& c1, const Corner& c2,
+                 ObjChunk* chunk) {
+  const size_t base = chunk->vertex_indices.size() * 3;
+  const Corner* corners[3] = {&c0, &c1, &c2};
+  Eigen::Vector3i v, vt, vn;
+  for (int k = 0; k < 3; k++) {
+    const Corner& c = *corners[k];
+    v[k] = c.v;
+    vt[k] = c.vt;
+    vn[k] = c.vn;
+    if (c.v_rel) {
+      chunk->relative_v.push_back({base + k, c.v});
+    }
+    if (c.vt_rel) {
+      chunk->relative_vt.push_back({base + k, c.vt});
+    }
+    if (c.vn_rel) {
+      chunk->relative_vn.push_back({base + k, c.vn});
+    }
+    chunk->corners_with_vt += c.vt >= 0 || c.vt_rel ? 1 : 0;
+    chunk->corners_with_vn += c.vn >= 0 || c.vn_rel ? 1 : 0;
+  }
+  chunk->vertex_indices.push_back(v);
+  chunk->uv_indices.push_back(vt);
+  chunk->normal_indices.push_back(vn);
+  chunk->material_slots.push_back(
+      chunk->usemtl_names.empty()
+          ? -1
+          : static_cast<int>(chunk->usemtl_names.size()) - 1);
+}
+
+void ParseChunk(const char* begin, const char* end, ObjChunk* chunk) {
+  std::vector<Corner> corners;
+  const char* p = begin;
+  while (p < end) {
+    const char* line_end =
+        reinterpret_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+    const char* q = SkipSpace(p, line_end);
+    bool ok = true;
+    if (StartsWith(q, line_end, "v")) {
+      q += 1;
+      float vals[6];
+      int n = 0;
+      while (n < 6 && ParseNumber(q, line_end, &vals[n])) {
+        n++;
+      }
+      ok = n >= 3;
+      chunk->vertices.emplace_back(vals[0], vals[1], vals[2]);
+      if (n >= 6) {
+        chunk->vertex_colors.emplace_back(vals[3] * 255.f, vals[4] * 255.f,
+                                          vals[5] * 255.f);
+        chunk->colored_num++;
+      } else {
+        chunk->vertex_colors.emplace_back(255.f, 255.f, 255.f);
+      }
+    } else if (StartsWith(q, line_end, "vt")) {
+      q += 2;
+      float u = 0.f, v = 0.f;
+      ok = ParseNumber(q, line_end, &u);
+      // 1D texture coordinate is allowed
+      ParseNumber(q, line_end, &v);
+      chunk->uv.emplace_back(u, v);
+    } else if (StartsWith(q, line_end, "vn")) {
+      q += 2;
+      Eigen::Vector3f n;
+      ok = ParseNumber(q, line_end, &n[0]) && ParseNumber(q, line_end, &n[1]) &&
+           ParseNumber(q, line_end, &n[2]);
+      chunk->normals.push_back(n);
+    } else if (StartsWith(q, line_end, "f")) {
+      q += 1;
+      corners.clear();
+      while (true) {
+        q = SkipSpace(q, line_end);
+        if (q >= line_end) {
+          break;
+        }
+        Corner c;
+        if (!ParseCorner(q, line_end, *chunk, &c)) {
+          ok = false;
+          break;
+        }
+        corners.push_back(c);
+      }
+      ok = ok && corners.size() >= 3;
+      if (ok) {
+        for (size_t k = 1; k + 1 < corners.size(); k++) {
+          AddTriangle(corners[0], corners[k], corners[k + 1], chunk);
+        }
+      }
+    } else if (StartsWith(q, line_end, "usemtl")) {
+      chunk->usemtl_names.push_back(TrimmedRest(q + 6, line_end));
+    } else if (StartsWith(q, line_end, "mtllib")) {
+      std::istringstream ss(TrimmedRest(q + 6, line_end));
+      std::string name;
+      while (ss >> name) {
+        chunk->mtllibs.push_back(name);
+      }
+    }
+    // Others (comments, o, g, s, l, p, etc.) are ignored
+
+    if (!ok) {
+      chunk->ok = false;
+      chunk->error_line_pos = static_cast<size_t>(p - begin);
+      return;
+    }
+    p = line_end + 1;
+  }
+}
+
+bool CheckIndices(std::vector<Eigen::Vector3i>* indices, size_t attr_num,
+                  bool allow_missing) {
+  std::atomic_bool ok{true};
+  const size_t num = indices->size();
+  const size_t block_num = (num + kLineBlock - 1) / kLineBlock;
+  auto func = [&](size_t b) {
+    const size_t st = b * kLineBlock;
+    const size_t ed = std::min(st + kLineBlock, num);
+    for (size_t i = st; i < ed; i++) {
+      for (int k = 0; k < 3; k++) {
+        int& idx = (*indices)[i][k];
+        if (idx < 0 && allow_missing) {
+          idx = 0;
+        } else if (idx < 0 || static_cast<size_t>(idx) >= attr_num) {
+          ok = false;
+          return;
+        }
+      }
+    }
+  };
+  parallel_for(size_t(0), block_num, func);
+  return ok;
+}
+
+char* WriteFloat(char* p, char* end, float v) {
+  return std::to_chars(p, end, v).ptr;
+}
+
+char* WriteInt(char* p, char* end, int v) {
+  return std::to_chars(p, end, v).ptr;
+}
+
+char* WriteStr(char* p, const char* s) {
+  const size_t len = std::strlen(s);
+  std::memcpy(p, s, len);
+  return p + len;
+}
+
+// Formats num lines by blocks in parallel and writes them in order
+template <typename Func>
+void WriteLines(std::ofstream& ofs, size_t num, Func format_line) {
+  const size_t block_num = (num + kLineBlock - 1) / kLineBlock;
+  // Bound memory by processing some blocks at once
+  const size_t blocks_per_round = 64;
+  std::vector<std::string> bufs(blocks_per_round);
+  for (size_t round_st = 0; round_st < block_num;
+       round_st += blocks_per_round) {
+    const size_t round_ed = std::min(round_st + blocks_per_round, block_num);
+    auto func = [&](size_t b) {
+      std::string& buf = bufs[b - round_st];
+      buf.clear();
+      char line[kLineBufSize];
+      const size_t st = b * kLineBlock;
+      const size_t ed = std::min(st + kLineBlock, num);
+      for (size_t i = st; i < ed; i++) {
+        char* line_end = format_line(i, line, line + kLineBufSize);
+        buf.append(line, line_end);
+      }
+    };
+    parallel_for(round_st, round_ed, func);
+    for (size_t b = round_st; b < round_ed; b++) {
+      ofs.write(bufs[b - round_st].data(), bufs[b - round_st].size());
+    }
+  }
+}
+
+}  // namespace
+
+namespace ugu {
+
+bool LoadObjGeometry(const std::string& path, ObjGeometry* geom) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    LOGE("couldn't open obj: %s\n", path.c_str());
+    return false;
+  }
+  const char* data = reinterpret_cast<const char*>(file.data());
+  const size_t size = file.size();
+
+  // Line-aligned chunks
+  const size_t chunk_num = std::max<size_t>(1, size / kChunkBytes);
+  std::vector<size_t> bounds(chunk_num + 1, size);
+  bounds[0] = 0;
+  for (size_t i = 1; i < chunk_num; i++) {
+    size_t pos = std::max(size * i / chunk_num, bounds[i - 1]);
+    const void* nl = pos < size ? std::memchr(data + pos, '\n', size - pos)
+                                : nullptr;
+    bounds[i] = nl == nullptr
+                    ? size
+                    : static_cast<size_t>(
+                          reinterpret_cast<const char*>(nl) - data) +
+                          1;
+  }
+
+  std::vector<ObjChunk> chunks(chunk_num);
+  parallel_for(size_t(0), chunk_num, [&](size_t i) {
+    ParseChunk(data + bounds[i], data + bounds[i + 1], &chunks[i]);
+  });
+
+  for (size_t i = 0; i < chunk_num; i++) {
+    if (!chunks[i].ok) {
+      const size_t pos = bounds[i] + chunks[i].error_line_pos;
+      const size_t line_no = std::count(data, data + pos, '\n') + 1;
+      LOGE("failed to parse obj at line %d\n", static_cast<int>(line_no));
+      return false;
+    }
+  }
+
+  // Prefix sums to merge chunks
+  std::vector<size_t> v_offsets(chunk_num + 1, 0),
+      vt_offsets(chunk_num + 1, 0), vn_offsets(chunk_num + 1, 0),
+      f_offsets(chunk_num + 1, 0);
+  size_t colored_num = 0, corners_with_vt = 0, corners_with_vn = 0;
+  for (size_t i = 0; i < chunk_num; i++) {
+    v_offsets[i + 1] = v_offsets[i] + chunks[i].vertices.size();
+    vt_offsets[i + 1] = vt_offsets[i] + chunks[i].uv.size();
+    vn_offsets[i + 1] = vn_offsets[i] + chunks[i].normals.size();
+    f_offsets[i + 1] = f_offsets[i] + chunks[i].vertex_indices.size();
+    colored_num += chunks[i].colored_num;
+    corners_with_vt += chunks[i].corners_with_vt;
+    corners_with_vn += chunks[i].corners_with_vn;
+  }
+  const size_t max_num = static_cast<size_t>(std::numeric_limits<int>::max());
+  if (v_offsets.back() > max_num || vt_offsets.back() > max_num ||
+      vn_offsets.back() > max_num || f_offsets.back() > max_num) {
+    LOGE("The number of elements exceeds the maximum: %d\n",
+         std::numeric_limits<int>::max());
+    return false;
+  }
+
+  const bool with_color = colored_num > 0 && colored_num == v_offsets.back();
+  const bool with_vt = corners_with_vt > 0;
+  const bool with_vn = corners_with_vn > 0;
+  geom->vertices.resize(v_offsets.back());
+  geom->vertex_colors.resize(with_color ? v_offsets.back() : 0);
+  geom->uv.resize(vt_offsets.back());
+  geom->normals.resize(vn_offsets.back());
+  geom->vertex_indices.resize(f_offsets.back());
+  geom->uv_indices.resize(with_vt ? f_offsets.back() : 0);
+  geom->normal_indices.resize(with_vn ? f_offsets.back() : 0);
+  geom->material_ids.resize(f_offsets.back());
+
+  // Materials are carried over chunks
+  std::unordered_map<std::string, int> name2id;
+  std::vector<std::vector<int>> slot2id(chunk_num);
+  std::vector<int> initial_ids(chunk_num, -1);
+  int current_id = -1;
+  geom->material_names.clear();
+  geom->mtllibs.clear();
+  for (size_t i = 0; i < chunk_num; i++) {
+    initial_ids[i] = current_id;
+    for (const auto& name : chunks[i].usemtl_names) {
+      auto it = name2id.find(name);
+      if (it == name2id.end()) {
+        it = name2id.emplace(name, static_cast<int>(name2id.size())).first;
+        geom->material_names.push_back(name);
+      }
+      slot2id[i].push_back(it->second);
+      current_id = it->second;
+    }
+    for (const auto& lib : chunks[i].mtllibs) {
+      if (std::find(geom->mtllibs.begin(), geom->mtllibs.end(), lib) ==
+          geom->mtllibs.end()) {
+        geom->mtllibs.push_back(lib);
+      }
+    }
+  }
+
+  auto fix_relative = [](const std::vector<RelativeIndex>& relative,
+                         size_t offset, Eigen::Vector3i* indices) {
+    for (const auto& r : relative) {
+      indices[r.pos / 3][r.pos % 3] = static_cast<int>(offset) + r.local;
+    }
+  };
+
+  parallel_for(size_t(0), chunk_num, [&](size_t i) {
+    ObjChunk& c = chunks[i];
+    std::copy(c.vertices.begin(), c.vertices.end(),
+              geom->vertices.begin() + v_offsets[i]);
+    if (with_color) {
+      std::copy(c.vertex_colors.begin(), c.vertex_colors.end(),
+                geom->vertex_colors.begin() + v_offsets[i]);
+    }
+    std::copy(c.uv.begin(), c.uv.end(), geom->uv.begin() + vt_offsets[i]);
+    std::copy(c.normals.begin(), c.normals.end(),
+              geom->normals.begin() + vn_offsets[i]);
+
+    Eigen::Vector3i* vi = geom->vertex_indices.data() + f_offsets[i];
+    std::copy(c.vertex_indices.begin(), c.vertex_indices.end(), vi);
+    fix_relative(c.relative_v, v_offsets[i], vi);
+    if (with_vt) {
+      Eigen::Vector3i* ti = geom->uv_indices.data() + f_offsets[i];
+      std::copy(c.uv_indices.begin(), c.uv_indices.end(), ti);
+      fix_relative(c.relative_vt, vt_offsets[i], ti);
+    }
+    if (with_vn) {
+      Eigen::Vector3i* ni = geom->normal_indices.data() + f_offsets[i];
+      std::copy(c.normal_indices.begin(), c.normal_indices.end(), ni);
+      fix_relative(c.relative_vn, vn_offsets[i], ni);
+    }
+
+    for (size_t j = 0; j < c.material_slots.size(); j++) {
+      const int slot = c.material_slots[j];
+      geom->material_ids[f_offsets[i] + j] =
+          slot < 0 ? initial_ids[i] : slot2id[i][slot];
+    }
+
+    // Release memory early
+    c = ObjChunk();
+  });
+
+  if (!CheckIndices(&geom->vertex_indices, geom->vertices.size(),
+                         false)) {
+    LOGE("vertex index is out of range\n");
+    return false;
+  }
+  if (with_vt && corners_with_vt != geom->uv_indices.size() * 3) {
+    LOGW("Some faces do not have texture coordinates. 0 is used for them\n");
+  }
+  if (with_vt &&
+      !CheckIndices(&geom->uv_indices, geom->uv.size(), true)) {
+    LOGE("texture coordinate index is out of range\n");
+    return false;
+  }
+  if (with_vn && corners_with_vn != geom->normal_indices.size() * 3) {
+    LOGW("Some faces do not have normals. 0 is used for them\n");
+  }
+  if (with_vn &&
+      !CheckIndices(&geom->normal_indices, geom->normals.size(), true)) {
+    LOGE("normal index is out of range\n");
+    return false;
+  }
+
+  return true;
+}
+
+bool LoadMtl(const std::string& path, std::vector<ObjMaterial>* materials) {
+  std::ifstream ifs(path);
+  if (ifs.fail()) {
+    LOGW("couldn't open mtl: %s\n", path.c_str());
+    return false;
+  }
+
+  auto read3 = [](std::istringstream& ss, std::array<float, 3>& v) {
+    ss >> v[0] >> v[1] >> v[2];
+  };
+
+  std::string line;
+  ObjMaterial* mat = nullptr;
+  while (std::getline(ifs, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    std::istringstream ss(line);
+    std::string key;
+    ss >> key;
+    if (key == "newmtl") {
+      materials->push_back(ObjMaterial());
+      mat = &materials->back();
+      // Same defaults as tinyobjloader
+      mat->ambient = {0.f, 0.f, 0.f};
+      mat->diffuse = {0.f, 0.f, 0.f};
+      mat->specular = {0.f, 0.f, 0.f};
+      mat->shininess = 1.f;
+      mat->dissolve = 1.f;
+      mat->illum = 0;
+      const auto pos = line.find("newmtl") + 6;
+      std::string name = line.substr(pos);
+      name.erase(0, name.find_first_not_of(" \t"));
+      name.erase(name.find_last_not_of(" \t") + 1);
+      mat->name = name;
+    } else if (mat == nullptr) {
+      continue;
+    } else if (key == "Ka") {
+      read3(ss, mat->ambient);
+    } else if (key == "Kd") {
+      read3(ss, mat->diffuse);
+    } else if (key == "Ks") {
+      read3(ss, mat->specular);
+    } else if (key == "Ns") {
+      ss >> mat->shininess;
+    } else if (key == "d") {
+      ss >> mat->dissolve;
+    } else if (key == "Tr") {
+      float tr = 0.f;
+      ss >> tr;
+      mat->dissolve = 1.f - tr;
+    } else if (key == "illum") {
+      ss >> mat->illum;
+    } else if (key == "map_Kd") {
+      // The last token is the file name after options
+      std::string token;
+      while (ss >> token) {
+        mat->diffuse_texname = token;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool WriteObjBody(
+    std::ofstream& ofs, const std::vector<Eigen::Vector3f>& vertices,
+    const std::vector<Eigen::Vector3f>& vertex_colors,
+    const std::vector<Eigen::Vector2f>& uv,
+    const std::vector<Eigen::Vector3f>& normals,
+    const std::vector<Eigen::Vector3i>& vertex_indices,
+    const std::vector<Eigen::Vector3i>& uv_indices,
+    const std::vector<Eigen::Vector3i>& normal_indices,
+    const std::vector<ObjMaterial>& materials,
+    const std::vector<std::vector<int>>& face_indices_per_material) {
+  // vertices
+  const bool with_color =
+      !vertex_colors.empty() && vertex_colors.size() == vertices.size();
+  WriteLines(ofs, vertices.size(), [&](size_t i, char* p, char* end) {
+    const auto& v = vertices[i];
+    p = WriteStr(p, "v");
+    for (int k = 0; k < 3; k++) {
+      *p++ = ' ';
+      p = WriteFloat(p, end, v[k]);
+    }
+    if (with_color) {
+      const auto vc = vertex_colors[i] / 255.f;
+      for (int k = 0; k < 3; k++) {
+        *p++ = ' ';
+        p = WriteFloat(p, end, vc[k]);
+      }
+    } else {
+      p = WriteStr(p, " 1.0");
+    }
+    *p++ = '\n';
+    return p;
+  });
+
+  // uv
+  WriteLines(ofs, uv.size(), [&](size_t i, char* p, char* end) {
+    p = WriteStr(p, "vt ");
+    p = WriteFloat(p, end, uv[i].x());
+    *p++ = ' ';
+    p = WriteFloat(p, end, uv[i].y());
+    p = WriteStr(p, " 0\n");
+    return p;
+  });
+
+  // vertex normals
+  WriteLines(ofs, normals.size(), [&](size_t i, char* p, char* end) {
+    p = WriteStr(p, "vn");
+    for (int k = 0; k < 3; k++) {
+      *p++ = ' ';
+      p = WriteFloat(p, end, normals[i][k]);
+    }
+    *p++ = '\n';
+    return p;
+  });
+
+  // indices by material (group)
+  // CAUTION: This breaks original face indices
+  const bool write_uv_indices = !uv_indices.empty();
+  const bool write_normal_indices = !normal_indices.empty();
+  for (size_t k = 0; k < face_indices_per_material.size(); k++) {
+    const auto& mat_name = materials[k].name;
+    if (!mat_name.empty()) {
+      ofs << "usemtl " << mat_name << "\n";
+    }
+    const auto& face_ids = face_indices_per_material[k];
+    WriteLines(ofs, face_ids.size(), [&](size_t i, char* p, char* end) {
+      const int f_idx = face_ids[i];
+      *p++ = 'f';
+      for (int j = 0; j < 3; j++) {
+        *p++ = ' ';
+        p = WriteInt(p, end, vertex_indices[f_idx][j] + 1);
+        if (!write_uv_indices && !write_normal_indices) {
+          continue;
+        }
+        *p++ = '/';
+        if (write_uv_indices) {
+          p = WriteInt(p, end, uv_indices[f_idx][j] + 1);
+        }
+        if (write_normal_indices) {
+          *p++ = '/';
+          p = WriteInt(p, end, normal_indices[f_idx][j] + 1);
+        }
+      }
+      *p++ = '\n';
+      return p;
+    });
+  }
+
+  return !ofs.bad();
+}
+
+}  // namespace ugu
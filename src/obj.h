@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ugu/mesh.h"
+
+namespace ugu {
+
+struct ObjGeometry {
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<Eigen::Vector3f> vertex_colors;  // [0, 255]
+  std::vector<Eigen::Vector2f> uv;
+  std::vector<Eigen::Vector3f> normals;
+
+  // Polygons are fan-triangulated. uv_indices/normal_indices are empty if
+  // faces do not have them.
+  std::vector<Eigen::Vector3i> vertex_indices;
+  std::vector<Eigen::Vector3i> uv_indices;
+  std::vector<Eigen::Vector3i> normal_indices;
+
+  // Index to material_names per face. -1 before the first usemtl.
+  std::vector<int> material_ids;
+  std::vector<std::string> material_names;
+  std::vector<std::string> mtllibs;
+};
+
+// The file is mapped and split into line-aligned chunks parsed in parallel
+bool LoadObjGeometry(const std::string& path, ObjGeometry* geom);
+
+// Appends materials in the mtl file
+bool LoadMtl(const std::string& path, std::vector<ObjMaterial>* materials);
+
+// Writes v, vt, vn and f (grouped by usemtl) lines. Lines are formatted in
+// parallel chunks.
+bool WriteObjBody(std::ofstream& ofs,
+                  const std::vector<Eigen::Vector3f>& vertices,
+                  const std::vector<Eigen::Vector3f>& vertex_colors,
+                  const std::vector<Eigen::Vector2f>& uv,
+                  const std::vector<Eigen::Vector3f>& normals,
+                  const std::vector<Eigen::Vector3i>& vertex_indices,
+                  const std::vector<Eigen::Vector3i>& uv_indices,
+                  const std::vector<Eigen::Vector3i>& normal_indices,
+                  const std::vector<ObjMaterial>& materials,
+                  const std::vector<std::vector<int>>& face_indices_per_material);
+
+}  // namespace ugu
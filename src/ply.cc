@@ -0,0 +1,939 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ply.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "ugu/util/io_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+// Elements processed by a task of parallel_for
+constexpr size_t kBlockSize = 1 << 16;
+
+enum class PlyType {
+  kInvalid,
+  kInt8,
+  kUint8,
+  kInt16,
+  kUint16,
+  kInt32,
+  kUint32,
+  kFloat32,
+  kFloat64
+};
+
+struct PlyProperty {
+  std::string name;
+  PlyType type = PlyType::kInvalid;  // Item type for list
+  bool is_list = false;
+  PlyType count_type = PlyType::kInvalid;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count = 0;
+  std::vector<PlyProperty> props;
+};
+
+PlyType ParsePlyType(const std::string& str) {
+  if (str == "char" || str == "int8") {
+    return PlyType::kInt8;
+  } else if (str == "uchar" || str == "uint8") {
+    return PlyType::kUint8;
+  } else if (str == "short" || str == "int16") {
+    return PlyType::kInt16;
+  } else if (str == "ushort" || str == "uint16") {
+    return PlyType::kUint16;
+  } else if (str == "int" || str == "int32") {
+    return PlyType::kInt32;
+  } else if (str == "uint" || str == "uint32") {
+    return PlyType::kUint32;
+  } else if (str == "float" || str == "float32") {
+    return PlyType::kFloat32;
+  } else if (str == "double" || str == "float64") {
+    return PlyType::kFloat64;
+  }
+  return PlyType::kInvalid;
+}
+
+size_t SizeOf(PlyType type) {
+  switch (type) {
+    case PlyType::kInt8:
+    case PlyType::kUint8:
+      return 1;
+    case PlyType::kInt16:
+    case PlyType::kUint16:
+      return 2;
+    case PlyType::kInt32:
+    case PlyType::kUint32:
+    case PlyType::kFloat32:
+      return 4;
+    case PlyType::kFloat64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+bool IsFloatType(PlyType type) {
+  return type == PlyType::kFloat32 || type == PlyType::kFloat64;
+}
+
+bool IsHostBigEndian() {
+  const uint16_t v = 1;
+  uint8_t b;
+  std::memcpy(&b, &v, 1);
+  return b == 0;
+}
+
+template <typename T>
+T LoadScalar(const uint8_t* p, bool swap) {
+  uint8_t bytes[sizeof(T)];
+  std::memcpy(bytes, p, sizeof(T));
+  if (swap) {
+    std::reverse(bytes, bytes + sizeof(T));
+  }
+  T v;
+  std::memcpy(&v, bytes, sizeof(T));
+  return v;
+}
+
+double ReadBinary(const uint8_t* p, PlyType type, bool swap) {
+  switch (type) {
+    case PlyType::kInt8:
+      return LoadScalar<int8_t>(p, swap);
+    case PlyType::kUint8:
+      return LoadScalar<uint8_t>(p, swap);
+    case PlyType::kInt16:
+      return LoadScalar<int16_t>(p, swap);
+    case PlyType::kUint16:
+      return LoadScalar<uint16_t>(p, swap);
+    case PlyType::kInt32:
+      return LoadScalar<int32_t>(p, swap);
+    case PlyType::kUint32:
+      return LoadScalar<uint32_t>(p, swap);
+    case PlyType::kFloat32:
+      return LoadScalar<float>(p, swap);
+    case PlyType::kFloat64:
+      return LoadScalar<double>(p, swap);
+    default:
+      return 0.0;
+  }
+}
+
+int64_t ReadBinaryInt(const uint8_t* p, PlyType type, bool swap) {
+  switch (type) {
+    case PlyType::kInt8:
+      return LoadScalar<int8_t>(p, swap);
+    case PlyType::kUint8:
+      return LoadScalar<uint8_t>(p, swap);
+    case PlyType::kInt16:
+      return LoadScalar<int16_t>(p, swap);
+    case PlyType::kUint16:
+      return LoadScalar<uint16_t>(p, swap);
+    case PlyType::kInt32:
+      return LoadScalar<int32_t>(p, swap);
+    case PlyType::kUint32:
+      return LoadScalar<uint32_t>(p, swap);
+    default:
+      return static_cast<int64_t>(ReadBinary(p, type, swap));
+  }
+}
+
+template <typename T>
+void StoreScalar(T v, bool swap, uint8_t* p) {
+  std::memcpy(p, &v, sizeof(T));
+  if (swap) {
+    std::reverse(p, p + sizeof(T));
+  }
+}
+
+bool ParseHeader(const uint8_t* data, size_t size, PlyFormat* format,
+                 std::vector<PlyElement>* elements, size_t* body_offset) {
+  size_t pos = 0;
+  bool first = true;
+  bool format_found = false;
+  while (pos < size) {
+    const uint8_t* nl = reinterpret_cast<const uint8_t*>(
+        std::memchr(data + pos, '\n', size - pos));
+    if (nl == nullptr) {
+      break;
+    }
+    size_t len = static_cast<size_t>(nl - (data + pos));
+    std::string line(reinterpret_cast<const char*>(data + pos), len);
+    pos += len + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    if (first) {
+      if (line != "ply") {
+        LOGE("ply first line is wrong: %s\n", line.c_str());
+        return false;
+      }
+      first = false;
+      continue;
+    }
+
+    std::istringstream ss(line);
+    std::string keyword;
+    ss >> keyword;
+    if (keyword == "format") {
+      std::string type;
+      ss >> type;
+      if (type == "ascii") {
+        *format = PlyFormat::kAscii;
+      } else if (type == "binary_little_endian") {
+        *format = PlyFormat::kBinaryLittleEndian;
+      } else if (type == "binary_big_endian") {
+        *format = PlyFormat::kBinaryBigEndian;
+      } else {
+        LOGE("unknown ply format: %s\n", type.c_str());
+        return false;
+      }
+      format_found = true;
+    } else if (keyword == "element") {
+      PlyElement element;
+      ss >> element.name >> element.count;
+      if (ss.fail()) {
+        LOGE("wrong element line: %s\n", line.c_str());
+        return false;
+      }
+      elements->push_back(element);
+    } else if (keyword == "property") {
+      if (elements->empty()) {
+        LOGE("property without element: %s\n", line.c_str());
+        return false;
+      }
+      PlyProperty prop;
+      std::string type;
+      ss >> type;
+      if (type == "list") {
+        std::string count_type, item_type;
+        ss >> count_type >> item_type >> prop.name;
+        prop.is_list = true;
+        prop.count_type = ParsePlyType(count_type);
+        prop.type = ParsePlyType(item_type);
+        if (prop.count_type == PlyType::kInvalid ||
+            IsFloatType(prop.count_type)) {
+          LOGE("wrong list count type: %s\n", line.c_str());
+          return false;
+        }
+      } else {
+        ss >> prop.name;
+        prop.type = ParsePlyType(type);
+      }
+      if (prop.type == PlyType::kInvalid) {
+        LOGE("unknown property type: %s\n", line.c_str());
+        return false;
+      }
+      elements->back().props.push_back(prop);
+    } else if (keyword == "end_header") {
+      if (!format_found) {
+        LOGE("couldn't find format\n");
+        return false;
+      }
+      *body_offset = pos;
+      return true;
+    }
+    // comment, obj_info, etc. are ignored
+  }
+
+  LOGE("couldn't find end_header\n");
+  return false;
+}
+
+int FindProperty(const PlyElement& element,
+                 const std::vector<std::string>& names) {
+  for (const auto& name : names) {
+    for (size_t i = 0; i < element.props.size(); i++) {
+      if (element.props[i].name == name) {
+        return static_cast<int>(i);
+      }
+    }
+  }
+  return -1;
+}
+
+// Property indices of vertex attributes
+struct VertexLayout {
+  std::array<int, 3> pos{{-1, -1, -1}};
+  std::array<int, 3> normal{{-1, -1, -1}};
+  std::array<int, 3> color{{-1, -1, -1}};
+  bool has_normal = false;
+  bool has_color = false;
+  float color_scale = 1.f;
+
+  explicit VertexLayout(const PlyElement& element) {
+    pos = {FindProperty(element, {"x"}), FindProperty(element, {"y"}),
+           FindProperty(element, {"z"})};
+    normal = {FindProperty(element, {"nx"}), FindProperty(element, {"ny"}),
+              FindProperty(element, {"nz"})};
+    color = {FindProperty(element, {"red", "r", "diffuse_red"}),
+             FindProperty(element, {"green", "g", "diffuse_green"}),
+             FindProperty(element, {"blue", "b", "diffuse_blue"})};
+    has_normal = normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+    has_color = color[0] >= 0 && color[1] >= 0 && color[2] >= 0;
+    if (has_color && IsFloatType(element.props[color[0]].type)) {
+      // Floating point colors are in [0, 1]
+      color_scale = 255.f;
+    }
+  }
+
+  bool valid() const { return pos[0] >= 0 && pos[1] >= 0 && pos[2] >= 0; }
+};
+
+// Skips an element in a binary body. Returns the byte size.
+bool BinaryElementSize(const PlyElement& element, const uint8_t* p,
+                       const uint8_t* end, bool swap, size_t* size) {
+  bool has_list = false;
+  size_t stride = 0;
+  for (const auto& prop : element.props) {
+    has_list |= prop.is_list;
+    stride += SizeOf(prop.type);
+  }
+  if (!has_list) {
+    *size = stride * element.count;
+    return static_cast<size_t>(end - p) >= *size;
+  }
+
+  // cur never passes end since every advance is checked first
+  const uint8_t* cur = p;
+  for (size_t i = 0; i < element.count; i++) {
+    for (const auto& prop : element.props) {
+      if (!prop.is_list) {
+        if (static_cast<size_t>(end - cur) < SizeOf(prop.type)) {
+          return false;
+        }
+        cur += SizeOf(prop.type);
+        continue;
+      }
+      const size_t count_size = SizeOf(prop.count_type);
+      if (static_cast<size_t>(end - cur) < count_size) {
+        return false;
+      }
+      const int64_t n =
+          std::max<int64_t>(ReadBinaryInt(cur, prop.count_type, swap), 0);
+      cur += count_size;
+      const size_t bytes = static_cast<size_t>(n) * SizeOf(prop.type);
+      if (static_cast<size_t>(end - cur) < bytes) {
+        return false;
+      }
+      cur += bytes;
+    }
+  }
+  *size = static_cast<size_t>(cur - p);
+  return true;
+}
+
+bool ParseBinaryVertex(const PlyElement& element, const uint8_t* p,
+                       const uint8_t* end, bool swap,
+                       std::vector<Eigen::Vector3f>* vertices,
+                       std::vector<Eigen::Vector3f>* normals,
+                       std::vector<Eigen::Vector3f>* colors, size_t* size) {
+  VertexLayout layout(element);
+  if (!layout.valid()) {
+    LOGE("couldn't find x, y, z\n");
+    return false;
+  }
+  std::vector<size_t> offsets;
+  std::vector<PlyType> types;
+  size_t stride = 0;
+  for (const auto& prop : element.props) {
+    if (prop.is_list) {
+      LOGE("list property in vertex is not supported: %s\n",
+           prop.name.c_str());
+      return false;
+    }
+    offsets.push_back(stride);
+    types.push_back(prop.type);
+    stride += SizeOf(prop.type);
+  }
+  *size = stride * element.count;
+  if (static_cast<size_t>(end - p) < *size) {
+    LOGE("vertex data is truncated\n");
+    return false;
+  }
+
+  const size_t num = element.count;
+  vertices->resize(num);
+  if (layout.has_normal) {
+    normals->resize(num);
+  }
+  if (layout.has_color) {
+    colors->resize(num);
+  }
+
+  auto read3 = [&](const uint8_t* v, const std::array<int, 3>& ids,
+                   Eigen::Vector3f& out) {
+    for (int k = 0; k < 3; k++) {
+      out[k] = static_cast<float>(
+          ReadBinary(v + offsets[ids[k]], types[ids[k]], swap));
+    }
+  };
+
+  const size_t block_num = (num + kBlockSize - 1) / kBlockSize;
+  auto func = [&](size_t b) {
+    const size_t st = b * kBlockSize;
+    const size_t ed = std::min(st + kBlockSize, num);
+    for (size_t i = st; i < ed; i++) {
+      const uint8_t* v = p + i * stride;
+      read3(v, layout.pos, (*vertices)[i]);
+      if (layout.has_normal) {
+        read3(v, layout.normal, (*normals)[i]);
+      }
+      if (layout.has_color) {
+        read3(v, layout.color, (*colors)[i]);
+        (*colors)[i] *= layout.color_scale;
+      }
+    }
+  };
+  parallel_for(size_t(0), block_num, func);
+
+  return true;
+}
+
+// Fan triangulation of a polygon
+void AddFan(const int* ids, int64_t n, Eigen::Vector3i* dst) {
+  for (int64_t k = 0; k + 2 < n; k++) {
+    dst[k] = Eigen::Vector3i(ids[0], ids[k + 1], ids[k + 2]);
+  }
+}
+
+int64_t TriangleNum(int64_t n) { return std::max<int64_t>(n - 2, 0); }
+
+bool ParseBinaryFace(const PlyElement& element, const uint8_t* p,
+                     const uint8_t* end, bool swap,
+                     std::vector<Eigen::Vector3i>* indices, size_t* size) {
+  const int list_id =
+      FindProperty(element, {"vertex_indices", "vertex_index"});
+  if (list_id < 0 || !element.props[list_id].is_list) {
+    LOGE("couldn't find vertex_indices\n");
+    return false;
+  }
+  const PlyType id_type = element.props[list_id].type;
+  const size_t id_size = SizeOf(id_type);
+  const size_t num = element.count;
+  indices->clear();
+  *size = 0;
+  if (num == 0) {
+    return true;
+  }
+
+  // Layout of the first face
+  struct ListSlot {
+    size_t offset;
+    PlyType count_type;
+    int64_t n;
+  };
+  std::vector<ListSlot> slots;
+  size_t stride = 0;
+  size_t id_offset = 0;
+  int64_t poly_n = 0;
+  for (size_t i = 0; i < element.props.size(); i++) {
+    const auto& prop = element.props[i];
+    if (!prop.is_list) {
+      stride += SizeOf(prop.type);
+      continue;
+    }
+    const size_t count_size = SizeOf(prop.count_type);
+    if (static_cast<size_t>(end - p) < stride + count_size) {
+      LOGE("face data is truncated\n");
+      return false;
+    }
+    const int64_t n =
+        std::max<int64_t>(ReadBinaryInt(p + stride, prop.count_type, swap), 0);
+    slots.push_back({stride, prop.count_type, n});
+    if (static_cast<int>(i) == list_id) {
+      id_offset = stride + count_size;
+      poly_n = n;
+    }
+    stride += count_size + static_cast<size_t>(n) * SizeOf(prop.type);
+  }
+
+  // Fast path: all lists have the same length as the first face. Then faces
+  // have a constant stride and can be parsed in parallel.
+  bool uniform = static_cast<size_t>(end - p) / stride >= num;
+  const size_t block_num = (num + kBlockSize - 1) / kBlockSize;
+  if (uniform) {
+    std::atomic_bool same{true};
+    auto check = [&](size_t b) {
+      const size_t st = b * kBlockSize;
+      const size_t ed = std::min(st + kBlockSize, num);
+      for (size_t i = st; i < ed; i++) {
+        const uint8_t* f = p + i * stride;
+        for (const auto& slot : slots) {
+          if (ReadBinaryInt(f + slot.offset, slot.count_type, swap) !=
+              slot.n) {
+            same = false;
+            return;
+          }
+        }
+      }
+    };
+    parallel_for(size_t(0), block_num, check);
+    uniform = same;
+  }
+
+  if (uniform) {
+    const int64_t tri_num = TriangleNum(poly_n);
+    indices->resize(num * static_cast<size_t>(tri_num));
+    auto func = [&](size_t b) {
+      const size_t st = b * kBlockSize;
+      const size_t ed = std::min(st + kBlockSize, num);
+      std::vector<int> ids(static_cast<size_t>(poly_n));
+      for (size_t i = st; i < ed; i++) {
+        const uint8_t* f = p + i * stride + id_offset;
+        for (int64_t k = 0; k < poly_n; k++) {
+          ids[k] = static_cast<int>(ReadBinaryInt(f + k * id_size, id_type,
+                                                  swap));
+        }
+        AddFan(ids.data(), poly_n,
+               indices->data() + i * static_cast<size_t>(tri_num));
+      }
+    };
+    parallel_for(size_t(0), block_num, func);
+    *size = stride * num;
+    return true;
+  }
+
+  // General path for mixed polygons
+  indices->reserve(num);
+  std::vector<int> ids;
+  const uint8_t* cur = p;
+  for (size_t i = 0; i < num; i++) {
+    for (size_t j = 0; j < element.props.size(); j++) {
+      const auto& prop = element.props[j];
+      if (!prop.is_list) {
+        if (static_cast<size_t>(end - cur) < SizeOf(prop.type)) {
+          LOGE("face data is truncated\n");
+          return false;
+        }
+        cur += SizeOf(prop.type);
+        continue;
+      }
+      const size_t count_size = SizeOf(prop.count_type);
+      if (static_cast<size_t>(end - cur) < count_size) {
+        LOGE("face data is truncated\n");
+        return false;
+      }
+      const int64_t n =
+          std::max<int64_t>(ReadBinaryInt(cur, prop.count_type, swap), 0);
+      cur += count_size;
+      const size_t bytes = static_cast<size_t>(n) * SizeOf(prop.type);
+      if (static_cast<size_t>(end - cur) < bytes) {
+        LOGE("face data is truncated\n");
+        return false;
+      }
+      if (static_cast<int>(j) == list_id) {
+        ids.resize(static_cast<size_t>(n));
+        for (int64_t k = 0; k < n; k++) {
+          ids[k] = static_cast<int>(ReadBinaryInt(cur + k * id_size, id_type,
+                                                  swap));
+        }
+        const size_t org = indices->size();
+        indices->resize(org + static_cast<size_t>(TriangleNum(n)));
+        AddFan(ids.data(), n, indices->data() + org);
+      }
+      cur += bytes;
+    }
+  }
+  *size = static_cast<size_t>(cur - p);
+  return true;
+}
+
+class AsciiReader {
+ public:
+  AsciiReader(const char* p, const char* end) : p_(p), end_(end) {}
+
+  bool Next(double* v) {
+    while (p_ < end_ &&
+           (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) {
+      p_++;
+    }
+    if (p_ < end_ && *p_ == '+') {
+      p_++;
+    }
+    if (p_ >= end_) {
+      return false;
+    }
+    auto [ptr, ec] = std::from_chars(p_, end_, *v);
+    if (ec != std::errc()) {
+      return false;
+    }
+    p_ = ptr;
+    return true;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+// Reads all properties of an element. Only the first value of a list is
+// stored in values and the items are stored in list_items for list_id.
+bool ReadAsciiElement(AsciiReader& reader, const PlyElement& element,
+                      int list_id, std::vector<double>* values,
+                      std::vector<int>* list_items) {
+  for (size_t j = 0; j < element.props.size(); j++) {
+    const auto& prop = element.props[j];
+    double v = 0.0;
+    if (!reader.Next(&v)) {
+      return false;
+    }
+    (*values)[j] = v;
+    if (!prop.is_list) {
+      continue;
+    }
+    const int64_t n = std::max<int64_t>(static_cast<int64_t>(v), 0);
+    if (static_cast<int>(j) == list_id) {
+      list_items->resize(static_cast<size_t>(n));
+    }
+    for (int64_t k = 0; k < n; k++) {
+      if (!reader.Next(&v)) {
+        return false;
+      }
+      if (static_cast<int>(j) == list_id) {
+        (*list_items)[k] = static_cast<int>(v);
+      }
+    }
+  }
+  return true;
+}
+
+bool ParseAscii(const std::vector<PlyElement>& elements, AsciiReader& reader,
+                std::vector<Eigen::Vector3f>* vertices,
+                std::vector<Eigen::Vector3f>* normals,
+                std::vector<Eigen::Vector3f>* colors,
+                std::vector<Eigen::Vector3i>* indices) {
+  std::vector<double> values;
+  std::vector<int> ids;
+  for (const auto& element : elements) {
+    values.resize(element.props.size());
+    if (element.name == "vertex") {
+      VertexLayout layout(element);
+      if (!layout.valid()) {
+        LOGE("couldn't find x, y, z\n");
+        return false;
+      }
+      vertices->resize(element.count);
+      if (layout.has_normal) {
+        normals->resize(element.count);
+      }
+      if (layout.has_color) {
+        colors->resize(element.count);
+      }
+      for (size_t i = 0; i < element.count; i++) {
+        if (!ReadAsciiElement(reader, element, -1, &values, &ids)) {
+          LOGE("vertex data is truncated\n");
+          return false;
+        }
+        for (int k = 0; k < 3; k++) {
+          (*vertices)[i][k] = static_cast<float>(values[layout.pos[k]]);
+          if (layout.has_normal) {
+            (*normals)[i][k] = static_cast<float>(values[layout.normal[k]]);
+          }
+          if (layout.has_color) {
+            (*colors)[i][k] = static_cast<float>(values[layout.color[k]]) *
+                              layout.color_scale;
+          }
+        }
+      }
+    } else if (element.name == "face") {
+      const int list_id =
+          FindProperty(element, {"vertex_indices", "vertex_index"});
+      if (list_id < 0 || !element.props[list_id].is_list) {
+        LOGE("couldn't find vertex_indices\n");
+        return false;
+      }
+      indices->reserve(element.count);
+      for (size_t i = 0; i < element.count; i++) {
+        if (!ReadAsciiElement(reader, element, list_id, &values, &ids)) {
+          LOGE("face data is truncated\n");
+          return false;
+        }
+        const int64_t n = static_cast<int64_t>(ids.size());
+        const size_t org = indices->size();
+        indices->resize(org + static_cast<size_t>(TriangleNum(n)));
+        AddFan(ids.data(), n, indices->data() + org);
+      }
+    } else {
+      for (size_t i = 0; i < element.count; i++) {
+        if (!ReadAsciiElement(reader, element, -1, &values, &ids)) {
+          LOGE("%s data is truncated\n", element.name.c_str());
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool ParseBinary(const std::vector<PlyElement>& elements, const uint8_t* p,
+                 const uint8_t* end, bool swap,
+                 std::vector<Eigen::Vector3f>* vertices,
+                 std::vector<Eigen::Vector3f>* normals,
+                 std::vector<Eigen::Vector3f>* colors,
+                 std::vector<Eigen::Vector3i>* indices) {
+  const uint8_t* cur = p;
+  for (const auto& element : elements) {
+    size_t size = 0;
+    bool ret = false;
+    if (element.name == "vertex") {
+      ret = ParseBinaryVertex(element, cur, end, swap, vertices, normals,
+                              colors, &size);
+    } else if (element.name == "face") {
+      ret = ParseBinaryFace(element, cur, end, swap, indices, &size);
+    } else {
+      ret = BinaryElementSize(element, cur, end, swap, &size);
+      if (!ret) {
+        LOGE("%s data is truncated\n", element.name.c_str());
+      }
+    }
+    if (!ret) {
+      return false;
+    }
+    cur += size;
+  }
+  return true;
+}
+
+std::string MakeHeader(PlyFormat format, size_t vertex_num, size_t face_num,
+                       bool has_normal, bool has_color) {
+  std::string header = "ply\n";
+  if (format == PlyFormat::kAscii) {
+    header += "format ascii 1.0\n";
+  } else if (format == PlyFormat::kBinaryLittleEndian) {
+    header += "format binary_little_endian 1.0\n";
+  } else {
+    header += "format binary_big_endian 1.0\n";
+  }
+  header += "element vertex " + std::to_string(vertex_num) + "\n";
+  header +=
+      "property float x\n"
+      "property float y\n"
+      "property float z\n";
+  if (has_normal) {
+    header +=
+        "property float nx\n"
+        "property float ny\n"
+        "property float nz\n";
+  }
+  if (has_color) {
+    header +=
+        "property uchar red\n"
+        "property uchar green\n"
+        "property uchar blue\n"
+        "property uchar alpha\n";
+  }
+  header += "element face " + std::to_string(face_num) + "\n";
+  header += "property list uchar int vertex_indices\n";
+  header += "end_header\n";
+  return header;
+}
+
+void WriteAsciiBody(std::ofstream& ofs,
+                    const std::vector<Eigen::Vector3f>& vertices,
+                    const std::vector<Eigen::Vector3f>& normals,
+                    const std::vector<Eigen::Vector3f>& colors,
+                    const std::vector<Eigen::Vector3i>& indices,
+                    bool has_normal, bool has_color) {
+  for (size_t i = 0; i < vertices.size(); i++) {
+    ofs << vertices[i][0] << " " << vertices[i][1] << " " << vertices[i][2]
+        << " ";
+    if (has_normal) {
+      ofs << normals[i][0] << " " << normals[i][1] << " " << normals[i][2]
+          << " ";
+    }
+    if (has_color) {
+      ofs << static_cast<int>(std::round(colors[i][0])) << " "
+          << static_cast<int>(std::round(colors[i][1])) << " "
+          << static_cast<int>(std::round(colors[i][2])) << " 255 ";
+    }
+    ofs << "\n";
+  }
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    ofs << "3 " << indices[i][0] << " " << indices[i][1] << " "
+        << indices[i][2] << " "
+        << "\n";
+  }
+}
+
+uint8_t ToUchar(float v) {
+  return static_cast<uint8_t>(std::clamp(std::round(v), 0.f, 255.f));
+}
+
+// Each element is serialized into one buffer in parallel and written at once
+void WriteBinaryBody(std::ofstream& ofs, bool swap,
+                     const std::vector<Eigen::Vector3f>& vertices,
+                     const std::vector<Eigen::Vector3f>& normals,
+                     const std::vector<Eigen::Vector3f>& colors,
+                     const std::vector<Eigen::Vector3i>& indices,
+                     bool has_normal, bool has_color) {
+  const size_t stride = sizeof(float) * 3 +
+                        (has_normal ? sizeof(float) * 3 : 0) +
+                        (has_color ? 4 : 0);
+  std::vector<uint8_t> buf(stride * vertices.size());
+  const size_t vertex_blocks = (vertices.size() + kBlockSize - 1) / kBlockSize;
+  auto write_vertex = [&](size_t b) {
+    const size_t st = b * kBlockSize;
+    const size_t ed = std::min(st + kBlockSize, vertices.size());
+    for (size_t i = st; i < ed; i++) {
+      uint8_t* v = buf.data() + i * stride;
+      for (int k = 0; k < 3; k++) {
+        StoreScalar(vertices[i][k], swap, v);
+        v += sizeof(float);
+      }
+      if (has_normal) {
+        for (int k = 0; k < 3; k++) {
+          StoreScalar(normals[i][k], swap, v);
+          v += sizeof(float);
+        }
+      }
+      if (has_color) {
+        v[0] = ToUchar(colors[i][0]);
+        v[1] = ToUchar(colors[i][1]);
+        v[2] = ToUchar(colors[i][2]);
+        v[3] = 255;
+      }
+    }
+  };
+  parallel_for(size_t(0), vertex_blocks, write_vertex);
+  ofs.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+
+  const size_t face_stride = 1 + sizeof(int) * 3;
+  buf.resize(face_stride * indices.size());
+  const size_t face_blocks = (indices.size() + kBlockSize - 1) / kBlockSize;
+  auto write_face = [&](size_t b) {
+    const size_t st = b * kBlockSize;
+    const size_t ed = std::min(st + kBlockSize, indices.size());
+    for (size_t i = st; i < ed; i++) {
+      uint8_t* f = buf.data() + i * face_stride;
+      f[0] = 3;
+      for (int k = 0; k < 3; k++) {
+        StoreScalar(static_cast<int32_t>(indices[i][k]), swap,
+                    f + 1 + sizeof(int) * k);
+      }
+    }
+  };
+  parallel_for(size_t(0), face_blocks, write_face);
+  ofs.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+}
+
+}  // namespace
+
+namespace ugu {
+
+bool LoadPly(const std::string& path, std::vector<Eigen::Vector3f>* vertices,
+             std::vector<Eigen::Vector3f>* normals,
+             std::vector<Eigen::Vector3f>* colors,
+             std::vector<Eigen::Vector3i>* indices) {
+  vertices->clear();
+  normals->clear();
+  colors->clear();
+  indices->clear();
+
+  MappedFile file;
+  if (!file.Open(path)) {
+    LOGE("couldn't open ply: %s\n", path.c_str());
+    return false;
+  }
+  const uint8_t* data = file.data();
+  const uint8_t* end = data + file.size();
+
+  PlyFormat format = PlyFormat::kAscii;
+  std::vector<PlyElement> elements;
+  size_t body_offset = 0;
+  if (!ParseHeader(data, file.size(), &format, &elements, &body_offset)) {
+    return false;
+  }
+
+  bool vertex_found = false;
+  for (const auto& element : elements) {
+    if (element.count > static_cast<size_t>(std::numeric_limits<int>::max())) {
+      LOGE("The number of %s exceeds the maximum: %d\n", element.name.c_str(),
+           std::numeric_limits<int>::max());
+      return false;
+    }
+    vertex_found |= element.name == "vertex";
+  }
+  if (!vertex_found) {
+    LOGE("couldn't find element vertex\n");
+    return false;
+  }
+
+  bool ret = false;
+  if (format == PlyFormat::kAscii) {
+    AsciiReader reader(reinterpret_cast<const char*>(data + body_offset),
+                       reinterpret_cast<const char*>(end));
+    ret = ParseAscii(elements, reader, vertices, normals, colors, indices);
+  } else {
+    const bool swap =
+        (format == PlyFormat::kBinaryBigEndian) != IsHostBigEndian();
+    ret = ParseBinary(elements, data + body_offset, end, swap, vertices,
+                      normals, colors, indices);
+  }
+  if (!ret) {
+    return false;
+  }
+
+  // A corrupt file must not produce indices out of the vertices
+  const int vertex_num = static_cast<int>(vertices->size());
+  for (const auto& f : *indices) {
+    if (f.minCoeff() < 0 || f.maxCoeff() >= vertex_num) {
+      LOGE("face has invalid vertex index (%d, %d, %d)\n", f[0], f[1], f[2]);
+      indices->clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool WritePly(const std::string& path, PlyFormat format,
+              const std::vector<Eigen::Vector3f>& vertices,
+              const std::vector<Eigen::Vector3f>& normals,
+              const std::vector<Eigen::Vector3f>& colors,
+              const std::vector<Eigen::Vector3i>& indices) {
+  std::ofstream ofs(path, std::ios::binary);
+  if (ofs.fail()) {
+    LOGE("couldn't open ply: %s\n", path.c_str());
+    return false;
+  }
+
+  const bool has_normal =
+      !vertices.empty() && vertices.size() == normals.size();
+  const bool has_color = !vertices.empty() && vertices.size() == colors.size();
+
+  ofs << MakeHeader(format, vertices.size(), indices.size(), has_normal,
+                    has_color);
+
+  if (format == PlyFormat::kAscii) {
+    WriteAsciiBody(ofs, vertices, normals, colors, indices, has_normal,
+                   has_color);
+  } else {
+    const bool swap =
+        (format == PlyFormat::kBinaryBigEndian) != IsHostBigEndian();
+    WriteBinaryBody(ofs, swap, vertices, normals, colors, indices, has_normal,
+                    has_color);
+  }
+
+  return !ofs.bad();
+}
+
+}  // namespace ugu
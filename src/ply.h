@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ugu/common.h"
+
+namespace ugu {
+
+enum class PlyFormat { kAscii, kBinaryLittleEndian, kBinaryBigEndian };
+
+// Reads ascii and binary (little/big endian) PLY with arbitrary property
+// order. Colors are returned in [0, 255]. Polygons are fan-triangulated.
+// Outputs not found in the file are cleared.
+bool LoadPly(const std::string& path, std::vector<Eigen::Vector3f>* vertices,
+             std::vector<Eigen::Vector3f>* normals,
+             std::vector<Eigen::Vector3f>* colors,
+             std::vector<Eigen::Vector3i>* indices);
+
+// Empty normals/colors are not written
+bool WritePly(const std::string& path, PlyFormat format,
+              const std::vector<Eigen::Vector3f>& vertices,
+              const std::vector<Eigen::Vector3f>& normals,
+              const std::vector<Eigen::Vector3f>& colors,
+              const std::vector<Eigen::Vector3i>& indices);
+
+}  // namespace ugu
@@ -64,9 +64,10 @@ void RenderableMesh::SetupMesh(int geo_id) {
 #if 1
 
   // Keep original vertices
-  std::vector<Eigen::Vector3f> vertices_org, normals_org;
-  std::vector<Eigen::Vector2f> uv_org;
-  std::vector<Eigen::Vector3i> indices_org, uv_indices_org, normal_indices_org;
+  // Shared with the members until SplitMultipleUvVertices() modifies them
+  CowVector<Eigen::Vector3f> vertices_org, normals_org;
+  CowVector<Eigen::Vector2f> uv_org;
+  CowVector<Eigen::Vector3i> indices_org, uv_indices_org, normal_indices_org;
 
   bool to_split_uv = HasIndepentUv();
   if (to_split_uv) {
@@ -114,12 +115,12 @@ void RenderableMesh::SetupMesh(int geo_id) {
 
   if (to_split_uv) {
     // Copy back
-    vertices_ = vertices_org;
-    normals_ = normals_org;
-    uv_ = uv_org;
-    vertex_indices_ = indices_org;
-    uv_indices_ = uv_indices_org;
-    normal_indices_ = normal_indices_org;
+    vertices_ = std::move(vertices_org);
+    normals_ = std::move(normals_org);
+    uv_ = std::move(uv_org);
+    vertex_indices_ = std::move(indices_org);
+    uv_indices_ = std::move(uv_indices_org);
+    normal_indices_ = std::move(normal_indices_org);
   }
 #else
 
@@ -8,6 +8,7 @@
 #include <cassert>
 
 #include "ugu/image_proc.h"
+#include "ugu/mesh_soa.h"
 #include "ugu/renderer/cpu/pixel_shader.h"
 #include "ugu/renderer/cpu/util_private.h"
 #include "ugu/timer.h"
@@ -27,6 +28,31 @@ inline float EdgeFunction(const Eigen::Vector3f& a, const Eigen::Vector3f& b,
   return (c[0] - a[0]) * (b[1] - a[1]) - (c[1] - a[1]) * (b[0] - a[0]);
 }
 
+// Pinhole projection is done by the SoA kernel with vertices_soa, the SoA copy
+// of vertices
+void ProjectVertices(const ugu::Camera& camera,
+                     const std::vector<Eigen::Vector3f>& vertices,
+                     const ugu::Vec3fSoA& vertices_soa,
+                     const Eigen::Matrix3f& w2c_R, const Eigen::Vector3f& w2c_t,
+                     std::vector<Eigen::Vector3f>* camera_vertices,
+                     std::vector<Eigen::Vector3f>* image_vertices) {
+  const auto* pinhole = dynamic_cast<const ugu::PinholeCamera*>(&camera);
+  if (pinhole != nullptr &&
+      dynamic_cast<const ugu::OpenCvCamera*>(&camera) == nullptr) {
+    ugu::Vec3fSoA points_c, points_i;
+    ugu::ProjectPinholeSoA(vertices_soa, w2c_R, w2c_t, pinhole->focal_length(),
+                           pinhole->principal_point(), &points_c, &points_i);
+    points_c.ToAoS(camera_vertices);
+    points_i.ToAoS(image_vertices);
+    return;
+  }
+
+  for (size_t i = 0; i < vertices.size(); i++) {
+    (*camera_vertices)[i] = w2c_R * vertices[i] + w2c_t;
+    camera.Project((*camera_vertices)[i], &(*image_vertices)[i]);
+  }
+}
+
 }  // namespace
 
 namespace ugu {
@@ -36,6 +62,8 @@ class Rasterizer::Impl {
   bool mesh_initialized_{false};
   std::shared_ptr<const Camera> camera_{nullptr};
   std::shared_ptr<const Mesh> mesh_{nullptr};
+  // Converted once in PrepareMesh() not to do it in every Render()
+  Vec3fSoA vertices_soa_;
   RendererCpuOption option_;
 
  public:
@@ -77,6 +105,7 @@ void Rasterizer::Impl::set_option(const RendererCpuOption& option) {
 void Rasterizer::Impl::set_mesh(std::shared_ptr<const Mesh> mesh) {
   mesh_initialized_ = false;
   mesh_ = mesh;
+  vertices_soa_.clear();
 
   if (mesh_->face_normals().empty()) {
     LOGW("face normal is empty. culling and shading may not work\n");
@@ -93,6 +122,8 @@ bool Rasterizer::Impl::PrepareMesh() {
     return false;
   }
 
+  vertices_soa_.FromAoS(mesh_->vertices());
+
   mesh_initialized_ = true;
 
   return true;
@@ -128,11 +159,11 @@ bool Rasterizer::Impl::Render(Image3b* color, Image1f* depth, Image3f* normal,
   std::vector<Eigen::Vector3f> image_vertices(mesh_->vertices().size());
 
   // get projected vertex positions
+  ProjectVertices(*camera_, mesh_->vertices(), vertices_soa_, w2c_R, w2c_t,
+                  &camera_vertices, &image_vertices);
   for (int i = 0; i < static_cast<int>(mesh_->vertices().size()); i++) {
-    camera_vertices[i] = w2c_R * mesh_->vertices()[i] + w2c_t;
     camera_normals[i] = w2c_R * mesh_->normals()[i];
     camera_depth_list[i] = camera_vertices[i].z();
-    camera_->Project(camera_vertices[i], &image_vertices[i]);
   }
 
   Image1f depth_internal;
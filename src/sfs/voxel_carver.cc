@@ -6,14 +6,551 @@
 #include "ugu/sfs/voxel_carver.h"
 
 #include <array>
+#include <numeric>
 
 #include "ugu/image_proc.h"
 #include "ugu/timer.h"
 #include "ugu/util/image_util.h"
 #include "ugu/util/rgbd_util.h"
+#include "ugu/util/thread_util.h"
 #include "ugu/voxel/extract_voxel.h"
 #include "ugu/voxel/marching_cubes.h"
 
+namespace {
+
+// Policies of VoxelUpdateOption resolved at compile time
+struct NnInterpolation {
+  static float Interpolate(const Eigen::Vector2f& image_p,
+                           const ugu::Image1f& sdf,
+                           const Eigen::Vector2i& roi_min,
+                           const Eigen::Vector2i& roi_max) {
+    return ugu::SdfInterpolationNn(image_p, sdf, roi_min, roi_max);
+  }
+};
+
+struct BilinearInterpolation {
+  static float Interpolate(const Eigen::Vector2f& image_p,
+                           const ugu::Image1f& sdf,
+                           const Eigen::Vector2i& roi_min,
+                           const Eigen::Vector2i& roi_max) {
+    return ugu::SdfInterpolationBiliner(image_p, sdf, roi_min, roi_max);
+  }
+};
+
+struct MaxUpdate {
+  static void Update(ugu::Voxel* voxel, const ugu::VoxelUpdateOption& option,
+                     float dist) {
+    ugu::UpdateVoxelMax(voxel, option, dist);
+  }
+};
+
+struct WeightedAverageUpdate {
+  static void Update(ugu::Voxel* voxel, const ugu::VoxelUpdateOption& option,
+                     float dist) {
+    ugu::UpdateVoxelWeightedAverage(voxel, option, dist);
+  }
+};
+
+// Calls func(Interpolation(), Update()) of option
+template <typename Func>
+void DispatchPolicies(const ugu::VoxelUpdateOption& option, Func func) {
+  const bool nn = option.sdf_interp == ugu::SdfInterpolation::kNn;
+  const bool average =
+      option.voxel_update == ugu::VoxelUpdate::kWeightedAverage;
+  if (nn && average) {
+    func(NnInterpolation(), WeightedAverageUpdate());
+  } else if (nn) {
+    func(NnInterpolation(), MaxUpdate());
+  } else if (average) {
+    func(BilinearInterpolation(), WeightedAverageUpdate());
+  } else {
+    func(BilinearInterpolation(), MaxUpdate());
+  }
+}
+
+struct SilhouetteView {
+  const ugu::Camera* camera{nullptr};
+  Eigen::Affine3f w2c;
+  const ugu::Image1f* sdf{nullptr};
+  Eigen::Vector2i roi_min, roi_max;
+  float max_sdf{0.f};
+
+  // Projection without virtual call for PinholeCamera without distortion
+  bool pinhole{false};
+  Eigen::Vector2f focal_length, principal_point;
+
+  // Axes of the grid are orthogonal, so the voxel (x, y, z) is at
+  // x_table[x] + y_table[y] + z_table[z] in the camera coordinate
+  std::vector<Eigen::Vector3f> x_table, y_table, z_table;
+
+  void Project(const Eigen::Vector3f& pos_c, Eigen::Vector2f* image_p) const {
+    if (pinhole) {
+      const float inv_z = 1.f / pos_c[2];
+      (*image_p)[0] = focal_length[0] * inv_z * pos_c[0] + principal_point[0];
+      (*image_p)[1] = focal_length[1] * inv_z * pos_c[1] + principal_point[1];
+    } else {
+      camera->Project(pos_c, image_p);
+    }
+  }
+};
+
+SilhouetteView MakeSilhouetteView(const ugu::Camera& camera,
+                                  const ugu::Image1f& sdf,
+                                  const Eigen::Vector2i& roi_min,
+                                  const Eigen::Vector2i& roi_max,
+                                  const ugu::VoxelGrid& voxel_grid) {
+  SilhouetteView view;
+  view.camera = &camera;
+  view.w2c = camera.w2c().cast<float>();
+  view.sdf = &sdf;
+  view.roi_min = roi_min;
+  view.roi_max = roi_max;
+  double min_sdf = std::numeric_limits<double>::max(),
+         max_sdf = std::numeric_limits<double>::lowest();
+  ugu::minMaxLoc(sdf, &min_sdf, &max_sdf);
+  view.max_sdf = static_cast<float>(max_sdf);
+
+  const auto* pinhole = dynamic_cast<const ugu::PinholeCamera*>(&camera);
+  if (pinhole != nullptr &&
+      dynamic_cast<const ugu::OpenCvCamera*>(&camera) == nullptr) {
+    view.pinhole = true;
+    view.focal_length = pinhole->focal_length();
+    view.principal_point = pinhole->principal_point();
+  }
+
+  const Eigen::Vector3i& voxel_num = voxel_grid.voxel_num();
+  const Eigen::Matrix3f& R = view.w2c.linear();
+  view.x_table.resize(voxel_num.x());
+  for (int x = 0; x < voxel_num.x(); x++) {
+    view.x_table[x] = R.col(0) * voxel_grid.get(x, 0, 0).pos.x();
+  }
+  view.y_table.resize(voxel_num.y());
+  for (int y = 0; y < voxel_num.y(); y++) {
+    view.y_table[y] =
+        R.col(1) * voxel_grid.get(0, y, 0).pos.y() + view.w2c.translation();
+  }
+  view.z_table.resize(voxel_num.z());
+  for (int z = 0; z < voxel_num.z(); z++) {
+    view.z_table[z] = R.col(2) * voxel_grid.get(0, 0, z).pos.z();
+  }
+
+  return view;
+}
+
+// Carves voxels [x_st, x_ed) of a row (y, z) by a view. The whole update is
+// in this loop so that projection and interpolation are inlined.
+template <typename Interpolation, typename Update>
+void CarveRow(const SilhouetteView& view, const ugu::VoxelUpdateOption& option,
+              int x_st, int x_ed, int y, int z, ugu::Voxel* voxels) {
+  const Eigen::Vector3f pos_c_yz = view.y_table[y] + view.z_table[z];
+  for (int x = x_st; x < x_ed; x++) {
+    ugu::Voxel* voxel = voxels + (x - x_st);
+    if (voxel->outside || voxel->update_num > option.voxel_max_update_num) {
+      continue;
+    }
+
+    const Eigen::Vector3f pos_c = view.x_table[x] + pos_c_yz;
+
+    // skip if the voxel is in the back of the camera
+    if (pos_c.z() < 0) {
+      continue;
+    }
+
+    Eigen::Vector2f image_p_f;
+    view.Project(pos_c, &image_p_f);
+
+    float dist = ugu::InvalidSdf::kVal;
+
+    if (image_p_f.x() < view.roi_min.x() || image_p_f.y() < view.roi_min.y() ||
+        view.roi_max.x() < image_p_f.x() || view.roi_max.y() < image_p_f.y()) {
+      if (option.update_outside == ugu::UpdateOutsideImage::kNone) {
+        continue;
+      } else if (option.update_outside == ugu::UpdateOutsideImage::kMax) {
+        dist = view.max_sdf;
+      }
+    } else {
+      dist = Interpolation::Interpolate(image_p_f, *view.sdf, view.roi_min,
+                                        view.roi_max);
+    }
+
+    // skip if dist is truncated
+    if (option.use_truncation && dist < -1.0f) {
+      continue;
+    }
+
+    if (voxel->update_num < 1) {
+      voxel->sdf = dist;
+      voxel->update_num++;
+      continue;
+    }
+
+    Update::Update(voxel, option, dist);
+  }
+}
+
+// Carves voxels in [st, ed) by all views in order. A block of a brick stays
+// in cache while views are swept.
+template <typename Interpolation, typename Update>
+void CarveBlock(const std::vector<SilhouetteView>& views,
+                const ugu::VoxelUpdateOption& option,
+                const Eigen::Vector3i& st, const Eigen::Vector3i& ed,
+                ugu::VoxelGrid& voxel_grid) {
+  for (const SilhouetteView& view : views) {
+    for (int z = st.z(); z < ed.z(); z++) {
+      for (int y = st.y(); y < ed.y(); y++) {
+        CarveRow<Interpolation, Update>(view, option, st.x(), ed.x(), y, z,
+                                        voxel_grid.get_ptr(st.x(), y, z));
+      }
+    }
+  }
+}
+
+// Min and max of SDF in tiles of 2^level pixels
+struct SdfRange {
+  float min{std::numeric_limits<float>::max()};
+  float max{std::numeric_limits<float>::lowest()};
+  bool has_valid{false};
+  bool has_invalid{false};
+
+  void Merge(const SdfRange& other) {
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    has_valid |= other.has_valid;
+    has_invalid |= other.has_invalid;
+  }
+};
+
+class SdfRangePyramid {
+ public:
+  void Build(const ugu::Image1f& sdf, const Eigen::Vector2i& roi_min,
+             const Eigen::Vector2i& roi_max, bool use_truncation) {
+    roi_min_ = roi_min;
+    Eigen::Vector2i size = roi_max - roi_min + Eigen::Vector2i::Ones();
+    sizes_ = {size};
+    levels_.assign(1, std::vector<SdfRange>(size.x() * size.y()));
+    for (int y = 0; y < size.y(); y++) {
+      for (int x = 0; x < size.x(); x++) {
+        const float d = sdf.at<float>(y + roi_min.y(), x + roi_min.x());
+        SdfRange& r = levels_[0][y * size.x() + x];
+        // Same as the truncation check of CarveRow()
+        if (use_truncation && d < -1.0f) {
+          r.has_invalid = true;
+        } else {
+          r.min = r.max = d;
+          r.has_valid = true;
+        }
+      }
+    }
+    while (1 < size.x() || 1 < size.y()) {
+      const Eigen::Vector2i prev_size = size;
+      size = (size + Eigen::Vector2i::Ones()) / 2;
+      const std::vector<SdfRange>& prev = levels_.back();
+      std::vector<SdfRange> level(size.x() * size.y());
+      for (int y = 0; y < prev_size.y(); y++) {
+        for (int x = 0; x < prev_size.x(); x++) {
+          level[(y / 2) * size.x() + x / 2].Merge(prev[y * prev_size.x() + x]);
+        }
+      }
+      levels_.push_back(std::move(level));
+      sizes_.push_back(size);
+    }
+  }
+
+  // Conservative range of pixels in [p_min, p_max] inside the roi
+  SdfRange Query(Eigen::Vector2i p_min, Eigen::Vector2i p_max) const {
+    p_min = (p_min - roi_min_).cwiseMax(0).cwiseMin(sizes_[0] -
+                                                    Eigen::Vector2i::Ones());
+    p_max = (p_max - roi_min_).cwiseMax(0).cwiseMin(sizes_[0] -
+                                                    Eigen::Vector2i::Ones());
+    const int len = (p_max - p_min).maxCoeff() + 1;
+    // Tiles of at least half the length cover the rectangle by 3x3
+    int level = 0;
+    while ((2 << level) < len && level + 1 < static_cast<int>(levels_.size())) {
+      level++;
+    }
+    SdfRange range;
+    const std::vector<SdfRange>& tiles = levels_[level];
+    const int w = sizes_[level].x();
+    for (int y = p_min.y() >> level; y <= p_max.y() >> level; y++) {
+      for (int x = p_min.x() >> level; x <= p_max.x() >> level; x++) {
+        range.Merge(tiles[y * w + x]);
+      }
+    }
+    return range;
+  }
+
+ private:
+  Eigen::Vector2i roi_min_;
+  std::vector<Eigen::Vector2i> sizes_;
+  std::vector<std::vector<SdfRange>> levels_;
+};
+
+// Carves octree nodes of a newly initialized grid by all views at once with
+// VoxelUpdate::kMax. A node is filled by one value if the max of SDF over the
+// node dilated by a voxel has one sign. Then any edge of MarchingCubes()
+// crossing the surface has both ends in subdivided nodes, which are carved per
+// voxel.
+template <typename Interpolation, typename Update>
+class OctreeCarver {
+ public:
+  OctreeCarver(ugu::VoxelGrid& voxel_grid,
+               const std::vector<SilhouetteView>& views,
+               const std::vector<SdfRangePyramid>& pyramids,
+               const ugu::VoxelUpdateOption& option)
+      : voxel_grid_(voxel_grid),
+        views_(views),
+        pyramids_(pyramids),
+        option_(option) {}
+
+  // Carves voxels in [st, ed). Returns the number of projections.
+  size_t Carve(const Eigen::Vector3i& st, const Eigen::Vector3i& ed) const {
+    if ((ed - st).maxCoeff() <= 1) {
+      CarveBlock<Interpolation, Update>(views_, option_, st, ed, voxel_grid_);
+      return views_.size();
+    }
+
+    size_t eval_num = 0;
+    ugu::Voxel node_voxel;
+    if (CarveNode(st, ed, &node_voxel, &eval_num)) {
+      if (0 < node_voxel.update_num) {
+        for (int z = st.z(); z < ed.z(); z++) {
+          for (int y = st.y(); y < ed.y(); y++) {
+            for (int x = st.x(); x < ed.x(); x++) {
+              ugu::Voxel* voxel = voxel_grid_.get_ptr(x, y, z);
+              voxel->sdf = node_voxel.sdf;
+              voxel->update_num = node_voxel.update_num;
+            }
+          }
+        }
+      }
+      return eval_num;
+    }
+
+    const Eigen::Vector3i half = (ed - st + Eigen::Vector3i::Ones()) / 2;
+    for (int i = 0; i < 8; i++) {
+      Eigen::Vector3i child_st = st, child_ed = ed;
+      for (int k = 0; k < 3; k++) {
+        if ((i >> k) & 1) {
+          child_st[k] += half[k];
+        } else {
+          child_ed[k] = st[k] + half[k];
+        }
+      }
+      if ((child_st.array() < child_ed.array()).all()) {
+        eval_num += Carve(child_st, child_ed);
+      }
+    }
+    return eval_num;
+  }
+
+ private:
+  // kRange: updates all voxels of a box by values in [lo, hi]
+  // kPartial: may skip some voxels and updates the others by values <= hi
+  enum class NodeState { kSkip, kRange, kPartial };
+
+  NodeState ViewRange(const SilhouetteView& view,
+                      const SdfRangePyramid& pyramid,
+                      const Eigen::Vector3f& box_min,
+                      const Eigen::Vector3f& box_max, float* lo,
+                      float* hi) const {
+    // A box in front of the camera is projected into the hull of its corners
+    Eigen::Vector2f p_min(std::numeric_limits<float>::max(),
+                          std::numeric_limits<float>::max());
+    Eigen::Vector2f p_max(std::numeric_limits<float>::lowest(),
+                          std::numeric_limits<float>::lowest());
+    int front_num = 0;
+    for (int i = 0; i < 8; i++) {
+      const Eigen::Vector3f corner((i & 1) ? box_max.x() : box_min.x(),
+                                   (i & 2) ? box_max.y() : box_min.y(),
+                                   (i & 4) ? box_max.z() : box_min.z());
+      const Eigen::Vector3f corner_c = view.w2c * corner;
+      if (corner_c.z() < 0) {
+        continue;
+      }
+      front_num++;
+      Eigen::Vector2f image_p;
+      view.Project(corner_c, &image_p);
+      p_min = p_min.cwiseMin(image_p);
+      p_max = p_max.cwiseMax(image_p);
+    }
+    if (front_num == 0) {
+      return NodeState::kSkip;
+    }
+    if (front_num < 8) {
+      *hi = std::numeric_limits<float>::max();
+      return NodeState::kPartial;
+    }
+
+    // Margin for rounding of projection
+    const float margin = 0.5f;
+    p_min.array() -= margin;
+    p_max.array() += margin;
+    const Eigen::Vector2f roi_min = view.roi_min.cast<float>();
+    const Eigen::Vector2f roi_max = view.roi_max.cast<float>();
+    const bool outside_roi = (p_max.array() < roi_min.array()).any() ||
+                             (roi_max.array() < p_min.array()).any();
+    const bool inside_roi = (roi_min.array() <= p_min.array()).all() &&
+                            (p_max.array() <= roi_max.array()).all();
+    const bool outside_max =
+        option_.update_outside == ugu::UpdateOutsideImage::kMax;
+    if (outside_roi) {
+      if (outside_max) {
+        *lo = *hi = view.max_sdf;
+        return NodeState::kRange;
+      }
+      return NodeState::kSkip;
+    }
+
+    // Pixels referred by nearest neighbor or bilinear interpolation. Query()
+    // clips them by the roi.
+    const Eigen::Vector2i q_min(static_cast<int>(std::floor(p_min.x())),
+                                static_cast<int>(std::floor(p_min.y())));
+    const Eigen::Vector2i q_max(static_cast<int>(std::floor(p_max.x())) + 1,
+                                static_cast<int>(std::floor(p_max.y())) + 1);
+    const SdfRange range = pyramid.Query(q_min, q_max);
+    if (!range.has_valid) {
+      // Truncated everywhere or skipped outside the roi
+      if (inside_roi || !outside_max) {
+        return NodeState::kSkip;
+      }
+      *hi = view.max_sdf;
+      return NodeState::kPartial;
+    }
+    *lo = range.min;
+    *hi = range.max;
+    if (!inside_roi) {
+      if (outside_max) {
+        *lo = std::min(*lo, view.max_sdf);
+        *hi = std::max(*hi, view.max_sdf);
+      } else {
+        return NodeState::kPartial;
+      }
+    }
+    return range.has_invalid ? NodeState::kPartial : NodeState::kRange;
+  }
+
+  // Returns true if the node has one sign and sets node_voxel
+  bool CarveNode(const Eigen::Vector3i& st, const Eigen::Vector3i& ed,
+                 ugu::Voxel* node_voxel, size_t* eval_num) const {
+    const Eigen::Vector3i& voxel_num = voxel_grid_.voxel_num();
+    const Eigen::Vector3i dilated_st = (st.array() - 1).max(0);
+    const Eigen::Vector3i dilated_ed =
+        (ed.array() + 1).min(voxel_num.array());
+    const Eigen::Vector3f& box_min =
+        voxel_grid_.get(dilated_st.x(), dilated_st.y(), dilated_st.z()).pos;
+    const Eigen::Vector3f& box_max =
+        voxel_grid_
+            .get(dilated_ed.x() - 1, dilated_ed.y() - 1, dilated_ed.z() - 1)
+            .pos;
+
+    // Views skipping some voxels do not change the sign by the max of the
+    // others
+    std::vector<size_t> updating_views;
+    size_t range_num = 0;
+    float lo_all = std::numeric_limits<float>::lowest();
+    float hi_all = std::numeric_limits<float>::lowest();
+    for (size_t i = 0; i < views_.size(); i++) {
+      float lo = 0.f, hi = 0.f;
+      (*eval_num) += 8;
+      NodeState state =
+          ViewRange(views_[i], pyramids_[i], box_min, box_max, &lo, &hi);
+      if (state == NodeState::kSkip) {
+        continue;
+      }
+      updating_views.push_back(i);
+      if (state == NodeState::kRange) {
+        range_num++;
+        lo_all = std::max(lo_all, lo);
+      }
+      hi_all = std::max(hi_all, hi);
+    }
+
+    if (updating_views.empty()) {
+      return true;
+    }
+    // Some voxels may not be updated at all
+    if (range_num == 0) {
+      return false;
+    }
+
+    if (lo_all <= 0.f && 0.f <= hi_all) {
+      return false;
+    }
+
+    // Values at the center voxel are in the ranges and keep the sign
+    const Eigen::Vector3i center = (st + ed - Eigen::Vector3i::Ones()) / 2;
+    for (size_t i : updating_views) {
+      (*eval_num)++;
+      CarveRow<Interpolation, Update>(views_[i], option_, center.x(),
+                                      center.x() + 1, center.y(), center.z(),
+                                      node_voxel);
+    }
+    return true;
+  }
+
+  ugu::VoxelGrid& voxel_grid_;
+  const std::vector<SilhouetteView>& views_;
+  const std::vector<SdfRangePyramid>& pyramids_;
+  const ugu::VoxelUpdateOption& option_;
+};
+
+// Carves all voxels by all views in one pass over the grid
+void CarveDense(const std::vector<SilhouetteView>& views,
+                const ugu::VoxelUpdateOption& option,
+                ugu::VoxelGrid& voxel_grid) {
+  const int brick_size = ugu::DirtyBricks::kBrickSize;
+  const Eigen::Vector3i& voxel_num = voxel_grid.voxel_num();
+  const Eigen::Vector3i brick_num =
+      (voxel_num.array() + brick_size - 1) / brick_size;
+  const size_t total_brick_num =
+      static_cast<size_t>(brick_num.x()) * brick_num.y() * brick_num.z();
+  DispatchPolicies(option, [&](auto interpolation, auto update) {
+    using Interpolation = decltype(interpolation);
+    using Update = decltype(update);
+    ugu::parallel_for(size_t(0), total_brick_num, [&](size_t i) {
+      const int x = static_cast<int>(i % brick_num.x());
+      const int y = static_cast<int>((i / brick_num.x()) % brick_num.y());
+      const int z = static_cast<int>(i / brick_num.x() / brick_num.y());
+      const Eigen::Vector3i st = Eigen::Vector3i(x, y, z) * brick_size;
+      const Eigen::Vector3i ed =
+          (st.array() + brick_size).min(voxel_num.array());
+      CarveBlock<Interpolation, Update>(views, option, st, ed, voxel_grid);
+    });
+  });
+  voxel_grid.dirty_bricks().MarkAll();
+}
+
+// Returns the number of projections
+size_t CarveOctree(const std::vector<SilhouetteView>& views,
+                   const std::vector<SdfRangePyramid>& pyramids,
+                   const ugu::VoxelUpdateOption& option, int max_octree_depth,
+                   ugu::VoxelGrid& voxel_grid) {
+  const int root_size = 1 << max_octree_depth;
+  const Eigen::Vector3i& voxel_num = voxel_grid.voxel_num();
+  const Eigen::Vector3i root_num =
+      (voxel_num.array() + root_size - 1) / root_size;
+  const size_t total_root_num =
+      static_cast<size_t>(root_num.x()) * root_num.y() * root_num.z();
+  std::vector<size_t> eval_nums(total_root_num, 0);
+  DispatchPolicies(option, [&](auto interpolation, auto) {
+    const OctreeCarver<decltype(interpolation), MaxUpdate> carver(
+        voxel_grid, views, pyramids, option);
+    ugu::parallel_for(size_t(0), total_root_num, [&](size_t i) {
+      const int x = static_cast<int>(i % root_num.x());
+      const int y = static_cast<int>((i / root_num.x()) % root_num.y());
+      const int z = static_cast<int>(i / root_num.x() / root_num.y());
+      const Eigen::Vector3i st = Eigen::Vector3i(x, y, z) * root_size;
+      const Eigen::Vector3i ed =
+          (st.array() + root_size).min(voxel_num.array());
+      eval_nums[i] = carver.Carve(st, ed);
+    });
+  });
+  voxel_grid.dirty_bricks().MarkAll();
+  return std::accumulate(eval_nums.begin(), eval_nums.end(), size_t(0));
+}
+
+}  // namespace
+
 namespace ugu {
 
 VoxelCarver::VoxelCarver() {}
@@ -40,6 +577,7 @@ bool VoxelCarver::Init() {
     return false;
   }
   voxel_grid_ = std::make_unique<VoxelGrid>();
+  carved_ = false;
   return voxel_grid_->Init(option_.bb_max, option_.bb_min, option_.resolution);
 }
 
@@ -57,88 +595,16 @@ bool VoxelCarver::Carve(const Camera& camera, const Image1b& silhouette,
   MakeSignedDistanceField(silhouette, roi_min, roi_max, sdf,
                           option_.sdf_minmax_normalize,
                           option_.update_option.use_truncation,
-                          option_.update_option.truncation_band);
+                          option_.update_option.truncation_band,
+                          option_.sdf_dist_type);
   timer.End();
   LOGI("VoxelCarver::Carve make SDF %02f\n", timer.elapsed_msec());
-  std::function<float(const Eigen::Vector2f&, const ugu::Image1f&,
-                      const Eigen::Vector2i&, const Eigen::Vector2i&)>
-      interpolate_sdf;
-  if (option_.update_option.sdf_interp == SdfInterpolation::kNn) {
-    interpolate_sdf = SdfInterpolationNn;
-  } else if (option_.update_option.sdf_interp == SdfInterpolation::kBilinear) {
-    interpolate_sdf = SdfInterpolationBiliner;
-  }
-
-  std::function<void(Voxel*, const VoxelUpdateOption&, float, bool,
-                     Eigen::Vector3f)>
-      update_voxel;
-  if (option_.update_option.voxel_update == VoxelUpdate::kMax) {
-    update_voxel = UpdateVoxelMax;
-  } else if (option_.update_option.voxel_update ==
-             VoxelUpdate::kWeightedAverage) {
-    update_voxel = UpdateVoxelWeightedAverage;
-  }
 
   timer.Start();
-  double min_sdf = std::numeric_limits<double>::max(),
-         max_sdf = std::numeric_limits<double>::lowest();
-  ugu::minMaxLoc(*sdf, &min_sdf, &max_sdf);
-  const Eigen::Vector3i& voxel_num = voxel_grid_->voxel_num();
-  const Eigen::Affine3f& w2c = camera.w2c().cast<float>();
-#if defined(_OPENMP) && defined(VACANCY_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
-#endif
-  for (int z = 0; z < voxel_num.z(); z++) {
-    for (int y = 0; y < voxel_num.y(); y++) {
-      for (int x = 0; x < voxel_num.x(); x++) {
-        Voxel* voxel = voxel_grid_->get_ptr(x, y, z);
-
-        if (voxel->outside ||
-            voxel->update_num > option_.update_option.voxel_max_update_num) {
-          continue;
-        }
-
-        Eigen::Vector2f image_p_f;
-        Eigen::Vector3f voxel_pos_c = w2c * voxel->pos;
-
-        // skip if the voxel is in the back of the camera
-        if (voxel_pos_c.z() < 0) {
-          continue;
-        }
-
-        camera.Project(voxel_pos_c, &image_p_f);
-
-        float dist = InvalidSdf::kVal;
-
-        if (image_p_f.x() < roi_min.x() || image_p_f.y() < roi_min.y() ||
-            roi_max.x() < image_p_f.x() || roi_max.y() < image_p_f.y()) {
-          if (option_.update_option.update_outside ==
-              UpdateOutsideImage::kNone) {
-            continue;
-          } else if (option_.update_option.update_outside ==
-                     UpdateOutsideImage::kMax) {
-            dist = static_cast<float>(max_sdf);
-          }
-        } else {
-          dist = interpolate_sdf(image_p_f, *sdf, roi_min, roi_max);
-        }
-
-        // skip if dist is truncated
-        if (option_.update_option.use_truncation && dist < -1.0f) {
-          continue;
-        }
-
-        if (voxel->update_num < 1) {
-          voxel->sdf = dist;
-          voxel->update_num++;
-          continue;
-        }
-
-        update_voxel(voxel, option_.update_option, dist, false,
-                     Eigen::Vector3f::Zero());
-      }
-    }
-  }
+  const std::vector<SilhouetteView> views = {
+      MakeSilhouetteView(camera, *sdf, roi_min, roi_max, *voxel_grid_)};
+  CarveDense(views, option_.update_option, *voxel_grid_);
+  carved_ = true;
   timer.End();
   LOGI("VoxelCarver::Carve main loop %02f\n", timer.elapsed_msec());
 
@@ -157,16 +623,66 @@ bool VoxelCarver::Carve(const Camera& camera, const Image1b& silhouette,
   return Carve(camera, silhouette, roi_min, roi_max, sdf);
 }
 
-bool VoxelCarver::Carve(const std::vector<Camera>& cameras,
+bool VoxelCarver::Carve(const std::vector<CameraPtr>& cameras,
                         const std::vector<Image1b>& silhouettes) {
-  assert(cameras.size() == silhouettes.size());
+  if (!voxel_grid_->initialized()) {
+    LOGE("VoxelCarver::Carve voxel grid has not been initialized\n");
+    return false;
+  }
+  if (cameras.size() != silhouettes.size()) {
+    LOGE("VoxelCarver::Carve camera and silhouette sizes are different\n");
+    return false;
+  }
 
+  // Voxels carved before may have any sign, so nodes are not uniform
+  const bool use_octree = !carved_ && 0 < option_.max_octree_depth &&
+                          option_.update_option.voxel_update ==
+                              VoxelUpdate::kMax &&
+                          static_cast<int>(cameras.size()) <=
+                              option_.update_option.voxel_max_update_num;
+
+  Timer<> timer;
+  timer.Start();
+  std::vector<Image1f> sdfs(cameras.size());
+  std::vector<SilhouetteView> views;
+  std::vector<SdfRangePyramid> pyramids(use_octree ? cameras.size() : 0);
   for (size_t i = 0; i < cameras.size(); i++) {
-    bool ret = Carve(cameras[i], silhouettes[i]);
-    if (!ret) {
-      return false;
+    const Image1b& silhouette = silhouettes[i];
+    const Eigen::Vector2i roi_min{0, 0};
+    const Eigen::Vector2i roi_max{silhouette.cols - 1, silhouette.rows - 1};
+    sdfs[i] = Image1f::zeros(cameras[i]->height(), cameras[i]->width());
+    MakeSignedDistanceField(silhouette, roi_min, roi_max, &sdfs[i],
+                            option_.sdf_minmax_normalize,
+                            option_.update_option.use_truncation,
+                            option_.update_option.truncation_band,
+                            option_.sdf_dist_type);
+    views.push_back(MakeSilhouetteView(*cameras[i], sdfs[i], roi_min, roi_max,
+                                       *voxel_grid_));
+    if (use_octree) {
+      pyramids[i].Build(sdfs[i], roi_min, roi_max,
+                        option_.update_option.use_truncation);
     }
   }
+  timer.End();
+  LOGI("VoxelCarver::Carve make SDF %02f\n", timer.elapsed_msec());
+
+  timer.Start();
+  const size_t dense_num =
+      static_cast<size_t>(voxel_grid_->voxel_num().prod()) * views.size();
+  if (use_octree) {
+    const size_t eval_num =
+        CarveOctree(views, pyramids, option_.update_option,
+                    option_.max_octree_depth, *voxel_grid_);
+    timer.End();
+    LOGI("VoxelCarver::Carve octree %02f, %zu evaluations (dense %zu)\n",
+         timer.elapsed_msec(), eval_num, dense_num);
+  } else {
+    CarveDense(views, option_.update_option, *voxel_grid_);
+    timer.End();
+    LOGI("VoxelCarver::Carve main loop %02f, %zu evaluations\n",
+         timer.elapsed_msec(), dense_num);
+  }
+  carved_ = true;
 
   return true;
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/texturing/keyframe_loader.h"
+
+#include <algorithm>
+
+#include "ugu/image_io.h"
+#include "ugu/util/io_util.h"
+#include "ugu/util/string_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+bool ReadEncoded(const std::string& path, std::vector<uint8_t>* buf) {
+  if (!LoadBinary(path, buf) || buf->empty()) {
+    LOGE("Failed to read %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool LoadDepth(const std::string& path, const Camera& camera, float scale,
+               Image1f* depth) {
+  auto ext = ExtractExt(path);
+  if (ext == "ugi" || ext == "UGI") {
+    // Mapped without decoding
+    ImageBase loaded = LoadImageBinary(path);
+    if (loaded.empty() || loaded.channels() != 1) {
+      LOGE("Failed to load %s\n", path.c_str());
+      return false;
+    }
+    if (loaded.type() == CV_32FC1) {
+      *depth = loaded;
+    } else {
+      loaded.convertTo(*depth, CV_32FC1, scale);
+    }
+    return true;
+  }
+
+  std::vector<uint8_t> buf;
+  if (!ReadEncoded(path, &buf)) {
+    return false;
+  }
+
+  if (ext == "bin" || ext == "BIN") {
+    // Raw float written by WriteBinary()
+    *depth = Image1f::zeros(camera.height(), camera.width());
+    if (buf.size() != depth->total() * depth->elemSize()) {
+      LOGE("Size mismatch %s\n", path.c_str());
+      return false;
+    }
+    std::memcpy(depth->data, buf.data(), buf.size());
+    return true;
+  }
+
+  ImageBase decoded = imdecode(buf, ImreadModes::IMREAD_UNCHANGED);
+  if (decoded.empty() || decoded.channels() != 1) {
+    LOGE("Failed to decode %s\n", path.c_str());
+    return false;
+  }
+  decoded.convertTo(*depth, CV_32FC1, scale);
+  return true;
+}
+
+}  // namespace
+
+namespace ugu {
+
+KeyframeLoader::KeyframeLoader(const std::vector<KeyframePtr>& keyframes,
+                               const KeyframeLoaderOption& option)
+    : keyframes_(keyframes),
+      option_(option),
+      states_(keyframes.size(), State::kPending) {
+  if (option_.prefetch_num < 1) {
+    option_.prefetch_num = 1;
+  }
+
+  int num_threads = option_.num_threads;
+  if (num_threads <= 0) {
+    num_threads = UGU_THREADS_NUM > 0
+                      ? static_cast<int>(UGU_THREADS_NUM)
+                      : static_cast<int>(std::thread::hardware_concurrency());
+  }
+  num_threads = std::min({std::max(num_threads, 1), option_.prefetch_num,
+                          static_cast<int>(keyframes_.size())});
+
+  for (int i = 0; i < num_threads; i++) {
+    workers_.emplace_back(&KeyframeLoader::Work, this);
+  }
+}
+
+KeyframeLoader::~KeyframeLoader() { Stop(); }
+
+void KeyframeLoader::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& w : workers_) {
+    if (w.joinable()) {
+      w.join();
+    }
+  }
+  workers_.clear();
+}
+
+size_t KeyframeLoader::size() const { return keyframes_.size(); }
+
+void KeyframeLoader::Work() {
+  const size_t prefetch_num = static_cast<size_t>(option_.prefetch_num);
+  while (true) {
+    size_t index = 0;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      // Bound the number of keyframes in flight to limit memory
+      cv_.wait(lock, [&] {
+        return stop_ || issued_ >= keyframes_.size() ||
+               issued_ < consumed_ + prefetch_num;
+      });
+      if (stop_ || issued_ >= keyframes_.size()) {
+        return;
+      }
+      index = issued_++;
+      states_[index] = State::kLoading;
+    }
+
+    bool ret = Load(*keyframes_[index]);
+
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      states_[index] = ret ? State::kLoaded : State::kFailed;
+    }
+    cv_.notify_all();
+  }
+}
+
+bool KeyframeLoader::Load(Keyframe& keyframe) const {
+  if (!keyframe.color_path.empty()) {
+    std::vector<uint8_t> buf;
+    if (!ReadEncoded(keyframe.color_path, &buf)) {
+      return false;
+    }
+    ImageBase decoded = imdecode(buf, ImreadModes::IMREAD_COLOR);
+    if (decoded.empty() || decoded.channels() != 3 ||
+        decoded.elemSize1() != 1) {
+      LOGE("Failed to decode %s\n", keyframe.color_path.c_str());
+      return false;
+    }
+    keyframe.color = decoded;
+  }
+
+  if (!keyframe.depth_path.empty()) {
+    if (keyframe.camera == nullptr) {
+      LOGE("camera is required to load depth\n");
+      return false;
+    }
+    if (!LoadDepth(keyframe.depth_path, *keyframe.camera, option_.depth_scale,
+                   &keyframe.depth)) {
+      return false;
+    }
+  }
+
+  if (!keyframe.mask_path.empty()) {
+    std::vector<uint8_t> buf;
+    if (!ReadEncoded(keyframe.mask_path, &buf)) {
+      return false;
+    }
+    ImageBase decoded = imdecode(buf, ImreadModes::IMREAD_GRAYSCALE);
+    if (decoded.empty() || decoded.channels() != 1 ||
+        decoded.elemSize1() != 1) {
+      LOGE("Failed to decode %s\n", keyframe.mask_path.c_str());
+      return false;
+    }
+    keyframe.mask = decoded;
+  }
+
+  return true;
+}
+
+KeyframePtr KeyframeLoader::Next() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (consumed_ < keyframes_.size()) {
+    const size_t index = consumed_;
+    cv_.wait(lock, [&] {
+      return stop_ || states_[index] == State::kLoaded ||
+             states_[index] == State::kFailed;
+    });
+    if (states_[index] != State::kLoaded && states_[index] != State::kFailed) {
+      // Stopped
+      return nullptr;
+    }
+
+    consumed_++;
+    // Let workers prefetch one more
+    cv_.notify_all();
+
+    if (states_[index] == State::kLoaded) {
+      return keyframes_[index];
+    }
+    LOGE("Skip keyframe %d since loading failed\n", keyframes_[index]->id);
+  }
+  return nullptr;
+}
+
+}  // namespace ugu
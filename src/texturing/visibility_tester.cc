@@ -9,6 +9,7 @@
 #include <iterator>
 
 #include "ugu/accel/bvh_nanort.h"
+#include "ugu/texturing/keyframe_loader.h"
 #include "ugu/timer.h"
 #include "ugu/util/math_util.h"
 #include "ugu/util/raster_util.h"
@@ -730,4 +731,46 @@ bool VisibilityTester::Test(std::vector<std::shared_ptr<Keyframe>> keyframes,
   return ret;
 }
 
+bool VisibilityTester::Test(KeyframeLoader& loader, VisibilityInfo* info,
+                            bool facewise,
+                            std::function<void(VertexInfo&)> vert_custom_func) {
+  bool ret = true;
+  VisibilityTesterOption org_option;
+  option_.CopyTo(&org_option);
+
+  // disable stat
+  option_.calc_stat_face_info = false;
+  option_.calc_stat_vertex_info = false;
+
+  // Keep one keyframe in hand since the last one is known only after the
+  // loader reaches the end
+  KeyframePtr current = loader.Next();
+  if (current == nullptr) {
+    set_option(org_option);
+    LOGE("No keyframe is loaded\n");
+    return false;
+  }
+  KeyframePtr next = loader.Next();
+  while (next != nullptr) {
+    set_keyframe(current);
+    if (!Test(info, facewise, vert_custom_func)) {
+      ret = false;
+      break;
+    }
+    current = next;
+    next = loader.Next();
+  }
+
+  // recover original option at the end
+  set_option(org_option);
+  if (ret) {
+    set_keyframe(current);
+    if (!Test(info, facewise, vert_custom_func)) {
+      ret = false;
+    }
+  }
+
+  return ret;
+}
+
 }  // namespace ugu
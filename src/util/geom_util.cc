@@ -6,11 +6,12 @@
 #include "ugu/util/geom_util.h"
 
 #include <algorithm>
-#include <deque>
+#include <atomic>
 #include <mutex>
 #include <random>
 
 #include "ugu/accel/kdtree.h"
+#include "ugu/corner_table.h"
 #include "ugu/util/math_util.h"
 #include "ugu/util/thread_util.h"
 
@@ -266,6 +267,151 @@ void MergeMaterialsAndIds(const std::vector<ugu::ObjMaterial>& src1_materials,
   }
 }
 
+// Elements per task of the connectivity passes
+constexpr size_t kConnectivityBlock = 1 << 14;
+
+// Lock-free union-find. Unite() hooks the larger root under the smaller one by
+// CAS, so every set ends up rooted at its smallest element regardless of the
+// order of concurrent calls. Find() halves the path while walking.
+class ConcurrentUnionFind {
+ public:
+  explicit ConcurrentUnionFind(size_t n) : parents_(n) {
+    parallel_for_blocks(0, n, kConnectivityBlock, [&](size_t st, size_t ed) {
+      for (size_t i = st; i < ed; i++) {
+        parents_[i].store(static_cast<int32_t>(i), std::memory_order_relaxed);
+      }
+    });
+  }
+
+  int32_t Find(int32_t x) {
+    while (true) {
+      int32_t p = parents_[x].load(std::memory_order_acquire);
+      if (p == x) {
+        return x;
+      }
+      const int32_t gp = parents_[p].load(std::memory_order_acquire);
+      if (p != gp) {
+        parents_[x].compare_exchange_weak(p, gp, std::memory_order_acq_rel);
+      }
+      x = gp;
+    }
+  }
+
+  void Unite(int32_t a, int32_t b) {
+    while (true) {
+      a = Find(a);
+      b = Find(b);
+      if (a == b) {
+        return;
+      }
+      if (a < b) {
+        std::swap(a, b);
+      }
+      int32_t expected = a;
+      if (parents_[a].compare_exchange_strong(expected, b,
+                                              std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  std::vector<std::atomic<int32_t>> parents_;
+};
+
+void UniteFaceVertices(const std::vector<Eigen::Vector3i>& indices,
+                       ConcurrentUnionFind* uf) {
+  parallel_for_blocks(0, indices.size(), kConnectivityBlock,
+                      [&](size_t st, size_t ed) {
+                        for (size_t i = st; i < ed; i++) {
+                          uf->Unite(indices[i][0], indices[i][1]);
+                          uf->Unite(indices[i][1], indices[i][2]);
+                        }
+                      });
+}
+
+// Components from the root of each element (-1 for none) in [0, root_num).
+// Labels are given in the order of the smallest members.
+ConnectedComponents MakeComponents(const std::vector<int32_t>& roots,
+                                   size_t root_num) {
+  ConnectedComponents components;
+  auto& labels = components.labels;
+  auto& offsets = components.offsets;
+  labels.assign(roots.size(), -1);
+  std::vector<int32_t> root2label(root_num, -1);
+  int32_t num = 0;
+  for (size_t i = 0; i < roots.size(); i++) {
+    if (roots[i] < 0) {
+      continue;
+    }
+    int32_t& label = root2label[roots[i]];
+    if (label < 0) {
+      label = num++;
+    }
+    labels[i] = label;
+  }
+
+  offsets.assign(num + 1, 0);
+  for (const int32_t l : labels) {
+    if (0 <= l) {
+      offsets[l + 1]++;
+    }
+  }
+  for (int32_t i = 0; i < num; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+  components.ids.resize(offsets.back());
+  std::vector<int32_t> cursor(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < labels.size(); i++) {
+    if (0 <= labels[i]) {
+      components.ids[cursor[labels[i]]++] = static_cast<int32_t>(i);
+    }
+  }
+  return components;
+}
+
+// Traces loops taking the first unused edge from the end of the current edge.
+// Used if a vertex has more than one boundary edge to choose.
+bool TraceBoundaryLoops(const std::vector<std::pair<int, int>>& edges,
+                        const std::vector<int32_t>& out_offsets,
+                        const std::vector<int32_t>& out_edges,
+                        std::vector<int32_t>* loop_offsets,
+                        std::vector<int32_t>* order) {
+  const int32_t edge_num = static_cast<int32_t>(edges.size());
+  std::vector<int32_t> heads(out_offsets.begin(), out_offsets.end() - 1);
+  std::vector<bool> used(edge_num, false);
+  auto pop_out_edge = [&](int32_t vid) {
+    int32_t& h = heads[vid];
+    while (h < out_offsets[vid + 1] && used[out_edges[h]]) {
+      h++;
+    }
+    if (h == out_offsets[vid + 1]) {
+      return -1;
+    }
+    used[out_edges[h]] = true;
+    return out_edges[h];
+  };
+
+  loop_offsets->assign(1, 0);
+  order->clear();
+  for (int32_t start = 0; start < edge_num; start++) {
+    if (used[start]) {
+      continue;
+    }
+    used[start] = true;
+    order->push_back(start);
+    for (int32_t e = pop_out_edge(edges[start].second); e >= 0;
+         e = pop_out_edge(edges[e].second)) {
+      order->push_back(e);
+    }
+    if (edges[order->back()].second != edges[start].first) {
+      return false;
+    }
+    loop_offsets->push_back(static_cast<int32_t>(order->size()));
+  }
+  return true;
+}
+
 }  // namespace
 
 namespace ugu {
@@ -365,99 +511,145 @@ FindBoundaryLoops(const std::vector<Eigen::Vector3i>& indices, int32_t vnum) {
   std::vector<std::vector<std::pair<int, int>>> boundary_edges_list;
   std::vector<std::vector<int>> boundary_vertex_ids_list;
 
-  ugu::FaceAdjacency face_adjacency;
-  face_adjacency.Init(vnum, indices);
-
-  auto [boundary_edges, boundary_vertex_ids] =
-      face_adjacency.GetBoundaryEdges();
-
-  if (boundary_edges.empty()) {
+  BoundaryLoops loops;
+  if (!ExtractBoundaryLoops(indices, vnum, &loops)) {
     return {boundary_edges_list, boundary_vertex_ids_list};
   }
 
-  auto cur_edge = boundary_edges[0];
-  boundary_edges.erase(boundary_edges.begin());
-
-  std::vector<std::pair<int, int>> cur_edges;
-  cur_edges.push_back(cur_edge);
-
-  while (true) {
-    // The same loop
-    // Find connecting vertex
-    bool found_connected = false;
-    int connected_index = -1;
-    for (size_t i = 0; i < boundary_edges.size(); i++) {
-      const auto& e = boundary_edges[i];
-      if (cur_edge.second == e.first) {
-        found_connected = true;
-        connected_index = static_cast<int>(i);
-        cur_edge = e;
-        cur_edges.push_back(cur_edge);
-        break;
-      }
+  for (size_t i = 0; i < loops.size(); i++) {
+    const auto st = loops.vids.begin() + loops.offsets[i];
+    const auto ed = loops.vids.begin() + loops.offsets[i + 1];
+    std::vector<int> cur_boundary(st, ed);
+    std::vector<std::pair<int, int>> cur_edges;
+    for (size_t j = 0; j < cur_boundary.size(); j++) {
+      cur_edges.push_back(
+          {cur_boundary[j], cur_boundary[(j + 1) % cur_boundary.size()]});
     }
+    boundary_edges_list.push_back(std::move(cur_edges));
+    boundary_vertex_ids_list.push_back(std::move(cur_boundary));
+  }
 
-    if (found_connected) {
-      boundary_edges.erase(boundary_edges.begin() + connected_index);
-    } else {
-      // May be the end of loop
-#if 0
-      bool loop_closed = false;
-      for (size_t i = 0; i < cur_edges.size(); i++) {
-        const auto& e = cur_edges[i];
-        if (cur_edge.second == e.first) {
-          loop_closed = true;
-          break;
-        }
-      }
-#endif  // 0
-      bool loop_closed = (cur_edge.second == cur_edges[0].first);
-
-      if (!loop_closed) {
-        ugu::LOGE("FindBoundaryLoops failed. Maybe non-manifold mesh?");
-        boundary_edges_list.clear();
-        boundary_vertex_ids_list.clear();
-        return {boundary_edges_list, boundary_vertex_ids_list};
-      }
-
-      boundary_edges_list.push_back(cur_edges);
+  return {boundary_edges_list, boundary_vertex_ids_list};
+}
 
-      std::vector<int> cur_boundary;
-      for (const auto& e : cur_edges) {
-        cur_boundary.push_back(e.first);
-      }
-      assert(3 <= cur_edges.size());
-      assert(3 <= cur_boundary.size());
-      boundary_vertex_ids_list.push_back(cur_boundary);
+bool ExtractBoundaryLoops(const std::vector<Eigen::Vector3i>& indices,
+                          int32_t vnum, BoundaryLoops* loops) {
+  loops->offsets.assign(1, 0);
+  loops->vids.clear();
 
-      cur_edges.clear();
+  const CornerTable corner_table(vnum, indices);
+  const std::vector<std::pair<int, int>> edges =
+      corner_table.GetBoundaryEdges();
+  const int32_t edge_num = static_cast<int32_t>(edges.size());
+  if (edge_num == 0) {
+    return true;
+  }
 
-      // Go to another loop
-      if (boundary_edges.empty()) {
-        break;
-      }
+  // Boundary edges starting at each vertex in CSR
+  std::vector<int32_t> out_offsets(vnum + 1, 0);
+  std::vector<int32_t> in_nums(vnum, 0);
+  for (const auto& e : edges) {
+    out_offsets[e.first + 1]++;
+    in_nums[e.second]++;
+  }
+  bool branching = false;
+  for (int32_t i = 0; i < vnum; i++) {
+    branching |= out_offsets[i + 1] > 1 || in_nums[i] > 1;
+    out_offsets[i + 1] += out_offsets[i];
+  }
+  std::vector<int32_t> out_edges(edge_num);
+  {
+    std::vector<int32_t> cursor(out_offsets.begin(), out_offsets.end() - 1);
+    for (int32_t i = 0; i < edge_num; i++) {
+      out_edges[cursor[edges[i].first]++] = i;
+    }
+  }
 
-      cur_edge = boundary_edges[0];
-      boundary_edges.erase(boundary_edges.begin());
-      cur_edges.push_back(cur_edge);
+  // Edge ids in the order of the loops
+  std::vector<int32_t> loop_offsets, order;
+  bool closed = true;
+  if (branching) {
+    closed = TraceBoundaryLoops(edges, out_offsets, out_edges, &loop_offsets,
+                                &order);
+  } else {
+    // Every edge has at most one successor, so the loops are the connected
+    // components of the successor links
+    std::vector<int32_t> nexts(edge_num);
+    std::atomic<bool> open{false};
+    parallel_for_blocks(
+        0, edge_num, kConnectivityBlock, [&](size_t st, size_t ed) {
+          for (size_t i = st; i < ed; i++) {
+            const int32_t v = edges[i].second;
+            if (out_offsets[v] == out_offsets[v + 1]) {
+              open = true;
+              nexts[i] = -1;
+            } else {
+              nexts[i] = out_edges[out_offsets[v]];
+            }
+          }
+        });
+    closed = !open;
+
+    if (closed) {
+      ConcurrentUnionFind uf(edge_num);
+      parallel_for_blocks(0, edge_num, kConnectivityBlock,
+                          [&](size_t st, size_t ed) {
+                            for (size_t i = st; i < ed; i++) {
+                              uf.Unite(static_cast<int32_t>(i), nexts[i]);
+                            }
+                          });
+      std::vector<int32_t> roots(edge_num);
+      parallel_for_blocks(0, edge_num, kConnectivityBlock,
+                          [&](size_t st, size_t ed) {
+                            for (size_t i = st; i < ed; i++) {
+                              roots[i] = uf.Find(static_cast<int32_t>(i));
+                            }
+                          });
+      const ConnectedComponents components = MakeComponents(roots, edge_num);
+
+      // Walk each loop from its first edge as the serial tracing does
+      loop_offsets = components.offsets;
+      order.resize(edge_num);
+      parallel_for(size_t(0), components.size(), [&](size_t i) {
+        int32_t e = components.ids[loop_offsets[i]];
+        for (int32_t j = loop_offsets[i]; j < loop_offsets[i + 1]; j++) {
+          order[j] = e;
+          e = nexts[e];
+        }
+      });
     }
   }
 
-  // Sort by decending order. Use stable_sort to ensure the same orders to the
-  // two returns
-  // TODO: argsort
-  std::stable_sort(boundary_edges_list.begin(), boundary_edges_list.end(),
-                   [&](const std::vector<std::pair<int, int>>& a,
-                       const std::vector<std::pair<int, int>>& b) {
-                     return a.size() > b.size();
-                   });
-  std::stable_sort(boundary_vertex_ids_list.begin(),
-                   boundary_vertex_ids_list.end(),
-                   [&](const std::vector<int>& a, const std::vector<int>& b) {
-                     return a.size() > b.size();
-                   });
+  if (!closed) {
+    ugu::LOGE("FindBoundaryLoops failed. Maybe non-manifold mesh?");
+    return false;
+  }
 
-  return {boundary_edges_list, boundary_vertex_ids_list};
+  // Sort by decending order. Stable to keep the order of the same length.
+  const size_t loop_num = loop_offsets.size() - 1;
+  std::vector<size_t> loop_ids(loop_num);
+  std::iota(loop_ids.begin(), loop_ids.end(), size_t(0));
+  auto loop_size = [&](size_t i) {
+    return loop_offsets[i + 1] - loop_offsets[i];
+  };
+  std::stable_sort(loop_ids.begin(), loop_ids.end(), [&](size_t a, size_t b) {
+    return loop_size(a) > loop_size(b);
+  });
+
+  loops->offsets.resize(loop_num + 1);
+  loops->vids.resize(edge_num);
+  for (size_t i = 0; i < loop_num; i++) {
+    loops->offsets[i + 1] =
+        loops->offsets[i] + static_cast<int32_t>(loop_size(loop_ids[i]));
+  }
+  parallel_for(size_t(0), loop_num, [&](size_t i) {
+    const int32_t src = loop_offsets[loop_ids[i]];
+    for (int32_t j = 0; j < loops->offsets[i + 1] - loops->offsets[i]; j++) {
+      loops->vids[loops->offsets[i] + j] = edges[order[src + j]].first;
+    }
+  });
+
+  return true;
 }
 
 std::tuple<std::vector<std::set<int32_t>>, std::set<int32_t>, std::set<int32_t>,
@@ -469,50 +661,12 @@ ClusterByConnectivity(const std::vector<Eigen::Vector3i>& indices, int32_t vnum,
 
   std::set<int32_t> non_orphans;
 
-  FaceAdjacency fa;
-  fa.Init(vnum, indices);
-
-  Adjacency fva;
-  if (vertex_based_adjacency) {
-    fva = fa.GenerateAdjacentFacesByVertex(
-        fa.GenerateVertexAdjacency(), GenerateVertex2FaceMap(indices, vnum));
-  }
-  std::unordered_set<int32_t> to_process;
-  // std::unordered_set<int32_t> processed;
-  for (size_t i = 0; i < indices.size(); i++) {
-    to_process.insert(static_cast<int32_t>(i));
-  }
-
-  std::deque<int32_t> q;
-
-  while (!to_process.empty()) {
-    q.push_back(*to_process.begin());
-    std::set<int32_t> cluster_f;
-    cluster_f.insert(q.back());
-    to_process.erase(q.back());
-
-    while (!q.empty()) {
-      int fid = q.front();
-      q.pop_front();
-      std::vector<int> adjacent_face_ids;
-
-      if (vertex_based_adjacency) {
-        auto tmp = fva[fid];
-        std::copy(tmp.begin(), tmp.end(),
-                  std::inserter(adjacent_face_ids, adjacent_face_ids.begin()));
-      } else {
-        fa.GetAdjacentFaces(fid, &adjacent_face_ids);
-        // fa.RemoveFace(fid);
-      }
-      for (const auto& afid : adjacent_face_ids) {
-        if (to_process.find(afid) != to_process.end()) {
-          // processed.insert(afid);
-          to_process.erase(afid);
-          q.push_back(afid);
-          cluster_f.insert(afid);
-        }
-      }
-    }
+  const ConnectedComponents components =
+      FindFaceComponents(indices, vnum, vertex_based_adjacency);
+  for (size_t i = 0; i < components.size(); i++) {
+    std::set<int32_t> cluster_f(
+        components.ids.begin() + components.offsets[i],
+        components.ids.begin() + components.offsets[i + 1]);
 
     std::set<int32_t> cluster;
     for (const auto& fid : cluster_f) {
@@ -523,8 +677,8 @@ ClusterByConnectivity(const std::vector<Eigen::Vector3i>& indices, int32_t vnum,
 
     non_orphans.insert(cluster.begin(), cluster.end());
 
-    clusters.push_back(cluster);
-    clusters_f.push_back(cluster_f);
+    clusters.push_back(std::move(cluster));
+    clusters_f.push_back(std::move(cluster_f));
   }
 
   std::set<int32_t> orphans, all_vids;
@@ -538,6 +692,82 @@ ClusterByConnectivity(const std::vector<Eigen::Vector3i>& indices, int32_t vnum,
   return {clusters, non_orphans, orphans, clusters_f};
 }
 
+ConnectedComponents FindVertexComponents(
+    const std::vector<Eigen::Vector3i>& indices, int32_t vnum) {
+  ConcurrentUnionFind uf(vnum);
+  UniteFaceVertices(indices, &uf);
+
+  // Unreferenced vertices are not members of any component
+  std::vector<int32_t> roots(vnum, -1);
+  for (const auto& f : indices) {
+    roots[f[0]] = roots[f[1]] = roots[f[2]] = 0;
+  }
+  parallel_for_blocks(0, vnum, kConnectivityBlock, [&](size_t st, size_t ed) {
+    for (size_t i = st; i < ed; i++) {
+      if (0 <= roots[i]) {
+        roots[i] = uf.Find(static_cast<int32_t>(i));
+      }
+    }
+  });
+
+  return MakeComponents(roots, vnum);
+}
+
+ConnectedComponents FindFaceComponents(
+    const std::vector<Eigen::Vector3i>& indices, int32_t vnum,
+    bool vertex_based_adjacency) {
+  const size_t face_num = indices.size();
+  std::vector<int32_t> roots(face_num);
+
+  if (vertex_based_adjacency) {
+    // Faces sharing a vertex belong to the component of the vertex
+    ConcurrentUnionFind uf(vnum);
+    UniteFaceVertices(indices, &uf);
+    parallel_for_blocks(0, face_num, kConnectivityBlock,
+                        [&](size_t st, size_t ed) {
+                          for (size_t i = st; i < ed; i++) {
+                            roots[i] = uf.Find(indices[i][0]);
+                          }
+                        });
+    return MakeComponents(roots, vnum);
+  }
+
+  const CornerTable corner_table(vnum, indices);
+  ConcurrentUnionFind uf(face_num);
+  parallel_for_blocks(
+      0, corner_table.NumCorners(), kConnectivityBlock,
+      [&](size_t st, size_t ed) {
+        for (size_t i = st; i < ed; i++) {
+          const int c = static_cast<int>(i);
+          const int o = corner_table.Opposite(c);
+          if (c < o) {
+            uf.Unite(CornerTable::Face(c), CornerTable::Face(o));
+          } else if (o == CornerTable::kNonManifold) {
+            // Connect all faces having the edge
+            const int a = corner_table.Vertex(CornerTable::Next(c));
+            const int b = corner_table.Vertex(CornerTable::Prev(c));
+            if (a == b) {
+              continue;
+            }
+            for (const int d : corner_table.VertexCorners(a)) {
+              if (corner_table.Vertex(CornerTable::Next(d)) == b ||
+                  corner_table.Vertex(CornerTable::Prev(d)) == b) {
+                uf.Unite(CornerTable::Face(c), CornerTable::Face(d));
+              }
+            }
+          }
+        }
+      });
+  parallel_for_blocks(0, face_num, kConnectivityBlock,
+                      [&](size_t st, size_t ed) {
+                        for (size_t i = st; i < ed; i++) {
+                          roots[i] = uf.Find(static_cast<int32_t>(i));
+                        }
+                      });
+
+  return MakeComponents(roots, face_num);
+}
+
 MeshPtr MakeCube(const Eigen::Vector3f& length, const Eigen::Matrix3f& R,
                  const Eigen::Vector3f& t) {
   MeshPtr cube(new Mesh);
@@ -1612,23 +1842,24 @@ bool RemoveSmallConnectedComponents(Mesh& mesh, size_t small_th,
     mesh.RemoveUnreferencedVertices();
   }
 
-  auto [clusters, non_orphans, orphans, clusters_f] =
-      ugu::ClusterByConnectivity(mesh.vertex_indices(),
-                                 static_cast<int32_t>(mesh.vertices().size()));
+  const ConnectedComponents components = FindVertexComponents(
+      mesh.vertex_indices(), static_cast<int32_t>(mesh.vertices().size()));
 
   std::vector<bool> big_cluster_vertices(mesh.vertices().size(), true);
-  for (size_t i = 0; i < clusters.size(); i++) {
-    const auto& c = clusters[i];
-    if (c.size() > small_th) {
-      ugu::LOGI("Cluster %d is big. Keep.: %d\n", i, c.size());
+  size_t removed_num = 0;
+  for (size_t i = 0; i < components.size(); i++) {
+    const int32_t st = components.offsets[i];
+    const int32_t ed = components.offsets[i + 1];
+    if (static_cast<size_t>(ed - st) > small_th) {
       continue;
     }
-
-    ugu::LOGI("Cluster %d is small. Will be removed: %d\n", i, c.size());
-    for (const auto& v : c) {
-      big_cluster_vertices[v] = false;
+    removed_num++;
+    for (int32_t j = st; j < ed; j++) {
+      big_cluster_vertices[components.ids[j]] = false;
     }
   }
+  ugu::LOGI("Removed %d small clusters out of %d\n",
+            static_cast<int>(removed_num), static_cast<int>(components.size()));
   mesh.RemoveVertices(big_cluster_vertices);
   mesh.RemoveUnreferencedVertices();
   CleanGeom(mesh);
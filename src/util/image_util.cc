@@ -385,6 +385,47 @@ bool PngDataImpl(int width, int height, int channels, uint8_t* data,
 #endif
 }
 
+// "Distance Transforms of Sampled Functions" by Pedro F. Felzenszwalb and
+// Daniel P. Huttenlocher
+// https://cs.brown.edu/people/pfelzens/papers/dt-final.pdf
+// Finite "infinity" keeps intersections of parabolas well-defined
+constexpr float kDtInf = 1e20f;
+
+// 1D squared Euclidean distance transform of f (lower envelope of parabolas)
+// v and z are work buffers whose sizes are n and n + 1
+void DistanceTransform1D(const float* f, int n, float* d, int* v, float* z) {
+  auto intersection = [&](int q, int r) {
+    return ((f[q] + static_cast<float>(q * q)) -
+            (f[r] + static_cast<float>(r * r))) /
+           static_cast<float>(2 * q - 2 * r);
+  };
+
+  int k = 0;
+  v[0] = 0;
+  z[0] = -std::numeric_limits<float>::max();
+  z[1] = std::numeric_limits<float>::max();
+  for (int q = 1; q < n; q++) {
+    float s = intersection(q, v[k]);
+    while (s <= z[k]) {
+      k--;
+      s = intersection(q, v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = std::numeric_limits<float>::max();
+  }
+
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k + 1] < static_cast<float>(q)) {
+      k++;
+    }
+    const float diff = static_cast<float>(q - v[k]);
+    d[q] = diff * diff + f[v[k]];
+  }
+}
+
 }  // namespace
 
 namespace ugu {
@@ -584,22 +625,81 @@ void DistanceTransformL1(const Image1b& mask, const Eigen::Vector2i& roi_min,
   }
 }
 
+void DistanceTransformL2(const Image1b& mask, Image1f* dist) {
+  return DistanceTransformL2(mask, Eigen::Vector2i(0, 0),
+                             Eigen::Vector2i(mask.cols - 1, mask.rows - 1),
+                             dist);
+}
+
+void DistanceTransformL2(const Image1b& mask, const Eigen::Vector2i& roi_min,
+                         const Eigen::Vector2i& roi_max, Image1f* dist) {
+  *dist = Image1f::zeros(mask.rows, mask.cols);
+
+  const int roi_w = roi_max.x() - roi_min.x() + 1;
+  const int roi_h = roi_max.y() - roi_min.y() + 1;
+  if (roi_w < 1 || roi_h < 1) {
+    return;
+  }
+
+  // Separable exact transform. Squared distances along rows first, then
+  // along columns. Each line is independent so that they run in parallel.
+  auto row_func = [&](int y) {
+    std::vector<float> f(roi_w), d(roi_w), z(roi_w + 1);
+    std::vector<int> v(roi_w);
+    for (int x = 0; x < roi_w; x++) {
+      f[x] = mask.at<unsigned char>(y, x + roi_min.x()) == 255 ? kDtInf : 0.f;
+    }
+    DistanceTransform1D(f.data(), roi_w, d.data(), v.data(), z.data());
+    for (int x = 0; x < roi_w; x++) {
+      dist->at<float>(y, x + roi_min.x()) = d[x];
+    }
+  };
+  parallel_for(roi_min.y(), roi_max.y() + 1, row_func);
+
+  auto col_func = [&](int x) {
+    std::vector<float> f(roi_h), d(roi_h), z(roi_h + 1);
+    std::vector<int> v(roi_h);
+    for (int y = 0; y < roi_h; y++) {
+      f[y] = std::min(dist->at<float>(y + roi_min.y(), x), kDtInf);
+    }
+    DistanceTransform1D(f.data(), roi_h, d.data(), v.data(), z.data());
+    for (int y = 0; y < roi_h; y++) {
+      // No source pixel in roi. Same to DistanceTransformL1
+      dist->at<float>(y + roi_min.y(), x) =
+          d[y] < kDtInf ? std::sqrt(d[y]) : std::numeric_limits<float>::max();
+    }
+  };
+  parallel_for(roi_min.x(), roi_max.x() + 1, col_func);
+}
+
+void DistanceTransform(const Image1b& mask, const Eigen::Vector2i& roi_min,
+                       const Eigen::Vector2i& roi_max, Image1f* dist,
+                       DistanceTransformType type) {
+  if (type == DistanceTransformType::kL2) {
+    DistanceTransformL2(mask, roi_min, roi_max, dist);
+  } else {
+    DistanceTransformL1(mask, roi_min, roi_max, dist);
+  }
+}
+
 void MakeSignedDistanceField(const Image1b& mask, Image1f* dist,
                              bool minmax_normalize, bool use_truncation,
-                             float truncation_band) {
+                             float truncation_band,
+                             DistanceTransformType dist_type) {
   return MakeSignedDistanceField(mask, Eigen::Vector2i(0, 0),
                                  Eigen::Vector2i(mask.cols - 1, mask.rows - 1),
                                  dist, minmax_normalize, use_truncation,
-                                 truncation_band);
+                                 truncation_band, dist_type);
 }
 
 void MakeSignedDistanceField(const Image1b& mask,
                              const Eigen::Vector2i& roi_min,
                              const Eigen::Vector2i& roi_max, Image1f* dist,
                              bool minmax_normalize, bool use_truncation,
-                             float truncation_band) {
+                             float truncation_band,
+                             DistanceTransformType dist_type) {
   Image1f* negative_dist = dist;
-  DistanceTransformL1(mask, roi_min, roi_max, negative_dist);
+  DistanceTransform(mask, roi_min, roi_max, negative_dist, dist_type);
   for (int y = roi_min.y(); y <= roi_max.y(); y++) {
     for (int x = roi_min.x(); x <= roi_max.x(); x++) {
       if (negative_dist->at<float>(y, x) > 0) {
@@ -622,7 +722,7 @@ void MakeSignedDistanceField(const Image1b& mask,
   }
 
   Image1f positive_dist;
-  DistanceTransformL1(inv_mask, roi_min, roi_max, &positive_dist);
+  DistanceTransform(inv_mask, roi_min, roi_max, &positive_dist, dist_type);
   for (int y = roi_min.y(); y <= roi_max.y(); y++) {
     for (int x = roi_min.x(); x <= roi_max.x(); x++) {
       if (inv_mask.at<unsigned char>(y, x) == 255) {
@@ -1182,4 +1282,14 @@ ImageBase Crop(const ImageBase& img, int min_x, int max_x, int min_y,
   return cropped;
 }
 
+size_t ElemSizeFromCvType(int cv_type) {
+  constexpr size_t kDepthBytes[7] = {1, 1, 2, 2, 4, 4, 8};
+  const int depth = cv_type & ((1 << CV_CN_SHIFT) - 1);
+  const int ch = (cv_type >> CV_CN_SHIFT) + 1;
+  if (depth < 0 || 6 < depth || ch < 1 || 4 < ch) {
+    return 0;
+  }
+  return kDepthBytes[depth] * static_cast<size_t>(ch);
+}
+
 }  // namespace ugu
@@ -7,6 +7,18 @@
 
 #include <fstream>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace ugu {
 
 std::string LoadTxt(const std::string& path) {
@@ -32,4 +44,103 @@ void WriteFaceIdAsText(const Image1i& face_id, const std::string& path) {
   ofs.flush();
 }
 
+MappedFile::~MappedFile() { Close(); }
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string& path) {
+  Close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    LOGE("Failed to open %s\n", path.c_str());
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+  file_ = file;
+  opened_ = true;
+  size_ = static_cast<size_t>(size.QuadPart);
+  if (size_ == 0) {
+    return true;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    Close();
+    return false;
+  }
+  mapping_ = mapping;
+  data_ =
+      reinterpret_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+  if (data_ == nullptr) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+  }
+  if (file_ != nullptr) {
+    CloseHandle(reinterpret_cast<HANDLE>(file_));
+  }
+  data_ = nullptr;
+  mapping_ = nullptr;
+  file_ = nullptr;
+  size_ = 0;
+  opened_ = false;
+}
+#else
+bool MappedFile::Open(const std::string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOGE("Failed to open %s\n", path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  opened_ = true;
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ == 0) {
+    close(fd);
+    return true;
+  }
+
+  void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after closing the descriptor
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOGE("Failed to map %s\n", path.c_str());
+    size_ = 0;
+    opened_ = false;
+    return false;
+  }
+  data_ = reinterpret_cast<uint8_t*>(p);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  opened_ = false;
+}
+#endif
+
 }  // namespace ugu
@@ -59,6 +59,13 @@ void parallel_for_impl(Index st, Index ed, Func func, int num_theads = -1,
 }  // namespace
 namespace ugu {
 
+uint32_t GetNumThreads() {
+  if (UGU_THREADS_NUM > 0) {
+    return UGU_THREADS_NUM;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
 void parallel_for(int st, int ed, std::function<void(int)> func, int num_theads,
                   int inc) {
   parallel_for_impl(st, ed, func, num_theads, inc);
@@ -68,4 +75,25 @@ void parallel_for(size_t st, size_t ed, std::function<void(size_t)> func,
   parallel_for_impl(st, ed, func, num_theads, inc);
 }
 
+void parallel_for_blocks(size_t st, size_t ed, size_t block_size,
+                         std::function<void(size_t, size_t)> func,
+                         int num_theads) {
+  if (ed <= st) {
+    return;
+  }
+  block_size = std::max(block_size, size_t(1));
+  const size_t block_num = (ed - st + block_size - 1) / block_size;
+  if (block_num == 1) {
+    func(st, ed);
+    return;
+  }
+  parallel_for_impl(
+      size_t(0), block_num,
+      [&](size_t i) {
+        const size_t begin = st + i * block_size;
+        func(begin, std::min(begin + block_size, ed));
+      },
+      num_theads, size_t(1));
+}
+
 }  // namespace ugu
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/voxel/dual_contouring.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "Eigen/Eigenvalues"
+#include "ugu/timer.h"
+#include "ugu/util/image_util.h"
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+// Quadratic error function of the tangent planes at edge intersections
+struct Qef {
+  Eigen::Matrix3d ata{Eigen::Matrix3d::Zero()};
+  Eigen::Vector3d atb{Eigen::Vector3d::Zero()};
+  double btb{0.0};
+  Eigen::Vector3d mass_sum{Eigen::Vector3d::Zero()};
+  Eigen::Vector3d normal_sum{Eigen::Vector3d::Zero()};
+  Eigen::Vector3d col_sum{Eigen::Vector3d::Zero()};
+  int num{0};
+
+  void Add(const Eigen::Vector3d& p, const Eigen::Vector3d& n,
+           const Eigen::Vector3d& c) {
+    const double b = n.dot(p);
+    ata += n * n.transpose();
+    atb += n * b;
+    btb += b * b;
+    mass_sum += p;
+    normal_sum += n;
+    col_sum += c;
+    num++;
+  }
+
+  void Add(const Qef& other) {
+    ata += other.ata;
+    atb += other.atb;
+    btb += other.btb;
+    mass_sum += other.mass_sum;
+    normal_sum += other.normal_sum;
+    col_sum += other.col_sum;
+    num += other.num;
+  }
+
+  // Minimizer closest to the mass point. Returns the RMS distance to the
+  // planes.
+  double Solve(double svd_th, Eigen::Vector3d* x) const {
+    const Eigen::Vector3d mass = mass_sum / num;
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(ata);
+    const Eigen::Vector3d& eigenvalues = solver.eigenvalues();
+    const double th = svd_th * eigenvalues.cwiseAbs().maxCoeff();
+    Eigen::Vector3d inv = Eigen::Vector3d::Zero();
+    for (int i = 0; i < 3; i++) {
+      if (std::abs(eigenvalues[i]) > th) {
+        inv[i] = 1.0 / eigenvalues[i];
+      }
+    }
+    const Eigen::Matrix3d& v = solver.eigenvectors();
+    *x = mass + v * inv.asDiagonal() * v.transpose() * (atb - ata * mass);
+    const double err = x->dot(ata * *x) - 2.0 * x->dot(atb) + btb;
+    return std::sqrt(std::max(err, 0.0) / num);
+  }
+};
+
+struct DcNode {
+  int id{-1};  // linear index in the level
+  Qef qef;
+  Eigen::Vector3f vertex;
+  // Whether the node may be merged into its parent
+  bool mergeable{true};
+  int vertex_id{-1};
+};
+
+// Nodes crossing the surface at an octree level. Level 0 is the cells.
+struct DcLevel {
+  Eigen::Vector3i dims;
+  // Index in nodes of each position, -1 if none
+  std::vector<int> node_ids;
+  std::vector<DcNode> nodes;
+
+  int node_at(const Eigen::Vector3i& p) const {
+    return node_ids[(p.z() * dims.y() + p.y()) * dims.x() + p.x()];
+  }
+
+  // Gathers the nodes made per z slab
+  void Build(std::vector<std::vector<DcNode>>&& slabs) {
+    node_ids.assign(static_cast<size_t>(dims.prod()), -1);
+    nodes.clear();
+    for (std::vector<DcNode>& slab : slabs) {
+      for (DcNode& node : slab) {
+        node_ids[node.id] = static_cast<int>(nodes.size());
+        nodes.push_back(std::move(node));
+      }
+    }
+  }
+};
+
+class DcSampler {
+ public:
+  DcSampler(const VoxelGrid& grid, double iso_level)
+      : grid_(grid), num_(grid.voxel_num()), iso_level_(iso_level) {}
+
+  bool valid(const Eigen::Vector3i& v) const {
+    return grid_.get(v[0], v[1], v[2]).sdf != InvalidSdf::kVal;
+  }
+  bool inside(const Eigen::Vector3i& v) const {
+    return grid_.get(v[0], v[1], v[2]).sdf < iso_level_;
+  }
+  const Voxel& get(const Eigen::Vector3i& v) const {
+    return grid_.get(v[0], v[1], v[2]);
+  }
+
+  // SDF gradient by central differences or one side at the boundary
+  Eigen::Vector3d Gradient(const Eigen::Vector3i& v) const {
+    Eigen::Vector3d g = Eigen::Vector3d::Zero();
+    for (int a = 0; a < 3; a++) {
+      Eigen::Vector3i v0 = v;
+      Eigen::Vector3i v1 = v;
+      v0[a]--;
+      v1[a]++;
+      const bool valid0 = 0 <= v0[a] && valid(v0);
+      const bool valid1 = v1[a] < num_[a] && valid(v1);
+      const double s0 = valid0 ? get(v0).sdf : get(v).sdf;
+      const double s1 = valid1 ? get(v1).sdf : get(v).sdf;
+      if (valid0 || valid1) {
+        g[a] = (s1 - s0) / ((valid0 && valid1) ? 2.0 : 1.0);
+      }
+    }
+    return g;
+  }
+
+  // Intersection of the edge from v0 along axis a with its normal and color.
+  // false if the edge does not cross the surface.
+  bool Intersect(const Eigen::Vector3i& v0, int a, Eigen::Vector3d* p,
+                 Eigen::Vector3d* n, Eigen::Vector3d* c) const {
+    Eigen::Vector3i v1 = v0;
+    v1[a]++;
+    const Voxel& voxel0 = get(v0);
+    const Voxel& voxel1 = get(v1);
+    if ((voxel0.sdf < iso_level_) == (voxel1.sdf < iso_level_)) {
+      return false;
+    }
+    const double mu = (iso_level_ - voxel0.sdf) / (voxel1.sdf - voxel0.sdf);
+    *p = voxel0.pos.cast<double>() +
+         mu * (voxel1.pos - voxel0.pos).cast<double>();
+    *c = voxel0.col.cast<double>() +
+         mu * (voxel1.col - voxel0.col).cast<double>();
+    *n = (1.0 - mu) * Gradient(v0) + mu * Gradient(v1);
+    if (n->squaredNorm() < std::numeric_limits<double>::min()) {
+      // Toward the outside along the edge
+      *n = Eigen::Vector3d::Zero();
+      (*n)[a] = voxel0.sdf < iso_level_ ? 1.0 : -1.0;
+    }
+    n->normalize();
+    return true;
+  }
+
+ private:
+  const VoxelGrid& grid_;
+  Eigen::Vector3i num_;
+  double iso_level_;
+};
+
+bool InBox(const Eigen::Vector3d& p, const Eigen::Vector3f& bb_min,
+           const Eigen::Vector3f& bb_max) {
+  return (p.array() >= bb_min.cast<double>().array()).all() &&
+         (p.array() <= bb_max.cast<double>().array()).all();
+}
+
+}  // namespace
+
+namespace ugu {
+
+DualContouringOption GenDualContouringDefaultOption(float resolution) {
+  DualContouringOption option;
+  option.max_octree_depth = 3;
+  option.max_qef_error = resolution * 0.1f;
+  return option;
+}
+
+bool DualContouring(const VoxelGrid& voxel_grid, Mesh* mesh,
+                    const DualContouringOption& option) {
+  Timer<> timer;
+  timer.Start();
+
+  mesh->Clear();
+  if (!voxel_grid.initialized()) {
+    LOGE("voxel_grid is not initialized\n");
+    return false;
+  }
+  if (option.max_octree_depth < 0) {
+    LOGE("max_octree_depth must not be negative %d\n",
+         option.max_octree_depth);
+    return false;
+  }
+
+  const DcSampler sampler(voxel_grid, option.iso_level);
+  const Eigen::Vector3i& voxel_num = voxel_grid.voxel_num();
+  if ((voxel_num.array() < 2).any()) {
+    return true;
+  }
+  const Eigen::Vector3i cell_num = voxel_num.array() - 1;
+  const int max_depth = option.max_octree_depth;
+  std::vector<DcLevel> levels(max_depth + 1);
+
+  // Cells whose 8 corners are valid and whose edges cross the surface
+  levels[0].dims = cell_num;
+  {
+    std::vector<std::vector<DcNode>> slabs(cell_num.z());
+    parallel_for(0, cell_num.z(), [&](int z) {
+      for (int y = 0; y < cell_num.y(); y++) {
+        for (int x = 0; x < cell_num.x(); x++) {
+          const Eigen::Vector3i cell(x, y, z);
+          bool valid = true;
+          int inside_num = 0;
+          for (int i = 0; i < 8 && valid; i++) {
+            const Eigen::Vector3i corner =
+                cell + Eigen::Vector3i(i & 1, (i >> 1) & 1, i >> 2);
+            valid = sampler.valid(corner);
+            inside_num += sampler.inside(corner) ? 1 : 0;
+          }
+          if (!valid || inside_num == 0 || inside_num == 8) {
+            continue;
+          }
+          DcNode node;
+          for (int a = 0; a < 3; a++) {
+            const int a1 = (a + 1) % 3;
+            const int a2 = (a + 2) % 3;
+            for (int k = 0; k < 4; k++) {
+              Eigen::Vector3i v0 = cell;
+              v0[a1] += k & 1;
+              v0[a2] += k >> 1;
+              Eigen::Vector3d p, n, c;
+              if (sampler.Intersect(v0, a, &p, &n, &c)) {
+                node.qef.Add(p, n, c);
+              }
+            }
+          }
+          if (node.qef.num < 1) {
+            continue;
+          }
+          node.id = (z * cell_num.y() + y) * cell_num.x() + x;
+          Eigen::Vector3d vertex;
+          node.qef.Solve(option.qef_svd_th, &vertex);
+          // Falls back to the mass point out of the cell
+          if (!InBox(vertex, sampler.get(cell).pos,
+                     sampler.get(cell + Eigen::Vector3i::Ones()).pos)) {
+            vertex = node.qef.mass_sum / node.qef.num;
+          }
+          node.vertex = vertex.cast<float>();
+          slabs[z].push_back(std::move(node));
+        }
+      }
+    });
+    levels[0].Build(std::move(slabs));
+  }
+
+  // Merge nodes bottom-up. A node is mergeable only if all of its children
+  // are.
+  for (int l = 1; l <= max_depth; l++) {
+    const DcLevel& children = levels[l - 1];
+    DcLevel& level = levels[l];
+    level.dims = (children.dims.array() + 1) / 2;
+    std::vector<std::vector<DcNode>> slabs(level.dims.z());
+    parallel_for(0, level.dims.z(), [&](int z) {
+      for (int y = 0; y < level.dims.y(); y++) {
+        for (int x = 0; x < level.dims.x(); x++) {
+          const Eigen::Vector3i p(x, y, z);
+          DcNode node;
+          bool exist = false;
+          for (int i = 0; i < 8; i++) {
+            const Eigen::Vector3i child =
+                p * 2 + Eigen::Vector3i(i & 1, (i >> 1) & 1, i >> 2);
+            if ((child.array() >= children.dims.array()).any()) {
+              continue;
+            }
+            const int child_id = children.node_at(child);
+            if (child_id < 0) {
+              continue;
+            }
+            exist = true;
+            node.mergeable &= children.nodes[child_id].mergeable;
+            node.qef.Add(children.nodes[child_id].qef);
+          }
+          if (!exist) {
+            continue;
+          }
+          node.id = (z * level.dims.y() + y) * level.dims.x() + x;
+          if (node.mergeable) {
+            const Eigen::Vector3i st = p * (1 << l);
+            const Eigen::Vector3i ed =
+                (st.array() + (1 << l)).min(cell_num.array());
+            Eigen::Vector3d vertex;
+            const double rms = node.qef.Solve(option.qef_svd_th, &vertex);
+            const double coherence = node.qef.normal_sum.norm() / node.qef.num;
+            node.mergeable = rms < option.max_qef_error &&
+                             coherence >= option.min_normal_coherence &&
+                             InBox(vertex, sampler.get(st).pos,
+                                   sampler.get(ed).pos);
+            node.vertex = vertex.cast<float>();
+          }
+          slabs[z].push_back(std::move(node));
+        }
+      }
+    });
+    level.Build(std::move(slabs));
+  }
+
+  // A vertex is made by the top mergeable node of each branch
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<Eigen::Vector3f> vertex_colors;
+  for (int l = 0; l <= max_depth; l++) {
+    DcLevel& level = levels[l];
+    for (DcNode& node : level.nodes) {
+      if (!node.mergeable) {
+        continue;
+      }
+      if (l < max_depth) {
+        const Eigen::Vector3i p(node.id % level.dims.x(),
+                                node.id / level.dims.x() % level.dims.y(),
+                                node.id / level.dims.x() / level.dims.y());
+        const DcLevel& parent = levels[l + 1];
+        if (parent.nodes[parent.node_at(p / 2)].mergeable) {
+          continue;
+        }
+      }
+      node.vertex_id = static_cast<int>(vertices.size());
+      vertices.push_back(node.vertex);
+      if (option.with_color) {
+        vertex_colors.push_back(
+            (node.qef.col_sum / node.qef.num).cast<float>());
+      }
+    }
+  }
+  auto vertex_of_cell = [&](const Eigen::Vector3i& cell) {
+    Eigen::Vector3i p = cell;
+    int vertex_id = levels[0].nodes[levels[0].node_at(p)].vertex_id;
+    for (int l = 1; l <= max_depth && vertex_id < 0; l++) {
+      p /= 2;
+      vertex_id = levels[l].nodes[levels[l].node_at(p)].vertex_id;
+    }
+    return vertex_id;
+  };
+
+  // A quad around each crossing edge shared by 4 valid cells
+  std::vector<std::vector<Eigen::Vector3i>> face_slabs(voxel_num.z());
+  parallel_for(0, voxel_num.z(), [&](int z) {
+    std::vector<Eigen::Vector3i>& faces = face_slabs[z];
+    for (int y = 0; y < voxel_num.y(); y++) {
+      for (int x = 0; x < voxel_num.x(); x++) {
+        const Eigen::Vector3i v0(x, y, z);
+        for (int a = 0; a < 3; a++) {
+          Eigen::Vector3i v1 = v0;
+          v1[a]++;
+          const int a1 = (a + 1) % 3;
+          const int a2 = (a + 2) % 3;
+          if (v1[a] >= voxel_num[a] || v0[a1] < 1 || v0[a2] < 1 ||
+              v0[a1] >= cell_num[a1] || v0[a2] >= cell_num[a2] ||
+              !sampler.valid(v0) || !sampler.valid(v1) ||
+              sampler.inside(v0) == sampler.inside(v1)) {
+            continue;
+          }
+          // Cells around the edge in the counterclockwise order seen from
+          // its upper end
+          std::array<int, 4> quad;
+          bool valid = true;
+          constexpr std::array<std::array<int, 2>, 4> kAround = {
+              {{{1, 1}}, {{0, 1}}, {{0, 0}}, {{1, 0}}}};
+          for (int k = 0; k < 4 && valid; k++) {
+            Eigen::Vector3i cell = v0;
+            cell[a1] -= kAround[k][0];
+            cell[a2] -= kAround[k][1];
+            if (levels[0].node_at(cell) < 0) {
+              valid = false;
+            } else {
+              quad[k] = vertex_of_cell(cell);
+            }
+          }
+          if (!valid) {
+            continue;
+          }
+          // Outward is toward the upper end if the lower end is inside
+          if (!sampler.inside(v0)) {
+            std::swap(quad[1], quad[3]);
+          }
+
+          // Drop vertices shared by merged cells
+          std::array<int, 4> polygon;
+          int num = 0;
+          for (int k = 0; k < 4; k++) {
+            if (quad[k] != quad[(k + 3) % 4]) {
+              polygon[num++] = quad[k];
+            }
+          }
+          if (num == 3) {
+            faces.emplace_back(polygon[0], polygon[1], polygon[2]);
+          } else if (num == 4) {
+            const float d02 = (vertices[polygon[0]] - vertices[polygon[2]])
+                                  .squaredNorm();
+            const float d13 = (vertices[polygon[1]] - vertices[polygon[3]])
+                                  .squaredNorm();
+            if (d02 <= d13) {
+              faces.emplace_back(polygon[0], polygon[1], polygon[2]);
+              faces.emplace_back(polygon[0], polygon[2], polygon[3]);
+            } else {
+              faces.emplace_back(polygon[1], polygon[2], polygon[3]);
+              faces.emplace_back(polygon[1], polygon[3], polygon[0]);
+            }
+          }
+        }
+      }
+    }
+  });
+
+  std::vector<Eigen::Vector3i> vertex_indices;
+  for (const auto& faces : face_slabs) {
+    vertex_indices.insert(vertex_indices.end(), faces.begin(), faces.end());
+  }
+
+  mesh->set_vertices(std::move(vertices));
+  mesh->set_vertex_indices(std::move(vertex_indices));
+  if (option.with_color) {
+    mesh->set_vertex_colors(std::move(vertex_colors));
+  }
+
+  timer.End();
+  LOGI("DualContouring %02f\n", timer.elapsed_msec());
+
+  return true;
+}
+
+}  // namespace ugu
@@ -8,13 +8,17 @@
 
 #include "ugu/voxel/marching_cubes.h"
 
+#include <algorithm>
 #include <array>
-#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "ugu/timer.h"
 #include "ugu/util/image_util.h"
+#include "ugu/util/thread_util.h"
 #include "ugu/voxel/marching_cubes_lut.h"
 
 namespace {
@@ -52,200 +56,917 @@ void VertexInterp(double isolevel, const Eigen::Vector3f &p1,
   c->z() = static_cast<float>(c1.z() + mu * (c2.z() - c1.z()));
 }
 
-void VertexInterp(double iso_level, const ugu::Voxel &v1, const ugu::Voxel &v2,
-                  Eigen::Vector3f *p, Eigen::Vector3f *c) {
-  VertexInterp(iso_level, v1.pos, v2.pos, v1.sdf, v2.sdf, p, v1.col, v2.col, c);
-}
+// Accessors to share MarchingCubes() between VoxelGrid and TsdfVoxelGrid
+struct VoxelGridSampler {
+  const ugu::VoxelGrid &grid;
+  bool updated(int x, int y, int z) const {
+    return grid.get(x, y, z).update_num > 0;
+  }
+  bool valid(int x, int y, int z) const {
+    return grid.get(x, y, z).sdf != ugu::InvalidSdf::kVal;
+  }
+  float sdf(int x, int y, int z) const { return grid.get(x, y, z).sdf; }
+  Eigen::Vector3f pos(int x, int y, int z) const {
+    return grid.get(x, y, z).pos;
+  }
+  Eigen::Vector3f col(int x, int y, int z) const {
+    return grid.get(x, y, z).col;
+  }
+};
 
-}  // namespace
+struct TsdfVoxelGridSampler {
+  const ugu::TsdfVoxelGrid &grid;
+  bool updated(int x, int y, int z) const {
+    return grid.get(x, y, z).weight > 0;
+  }
+  bool valid(int x, int y, int z) const { return updated(x, y, z); }
+  float sdf(int x, int y, int z) const { return grid.get(x, y, z).get_sdf(); }
+  Eigen::Vector3f pos(int x, int y, int z) const {
+    return grid.get_pos(x, y, z);
+  }
+  Eigen::Vector3f col(int x, int y, int z) const {
+    return grid.get(x, y, z).get_col();
+  }
+};
 
-namespace ugu {
+// Corners of a cube relative to its lower corner
+constexpr std::array<std::array<int, 3>, 8> kCornerOffsets = {
+    {{{0, 0, 0}}, {{1, 0, 0}}, {{1, 1, 0}}, {{0, 1, 0}}, {{0, 0, 1}},
+     {{1, 0, 1}}, {{1, 1, 1}}, {{0, 1, 1}}}};
 
-void MarchingCubes(const VoxelGrid &voxel_grid, Mesh *mesh, double iso_level,
-                   bool with_color) {
-  Timer<> timer;
-  timer.Start();
+// Index of a cube by its lower corner into the tables. false if corner 6 is
+// not updated or any corner is invalid.
+template <typename Sampler>
+bool ClassifyCube(const Sampler &sampler, int x, int y, int z,
+                  double iso_level, int *cube_index) {
+  if (!sampler.updated(x + 1, y + 1, z + 1)) {
+    return false;
+  }
+  *cube_index = 0;
+  for (int i = 0; i < 8; i++) {
+    const int cx = x + kCornerOffsets[i][0];
+    const int cy = y + kCornerOffsets[i][1];
+    const int cz = z + kCornerOffsets[i][2];
+    if (!sampler.valid(cx, cy, cz)) {
+      return false;
+    }
+    if (sampler.sdf(cx, cy, cz) < iso_level) {
+      *cube_index |= 1 << i;
+    }
+  }
+  return true;
+}
 
-  mesh->Clear();
+// Edges of a cube as (lower corner, axis)
+constexpr std::array<std::array<int, 2>, 12> kEdgeOwners = {
+    {{{0, 0}}, {{1, 1}}, {{3, 0}}, {{0, 1}}, {{4, 0}}, {{5, 1}}, {{7, 0}},
+     {{4, 1}}, {{0, 2}}, {{1, 2}}, {{2, 2}}, {{3, 2}}}};
 
-  const Eigen::Vector3i &voxel_num = voxel_grid.voxel_num();
+// Per block intermediate of MarchingCubes() for SparseVoxelGrid
+struct McBlock {
+  // Block ids of the 27 neighbors including itself, -1 if not allocated
+  std::array<int, 27> neighbors;
+  std::vector<uint8_t> cube_index;
+  std::vector<uint8_t> cube_valid;
+  // Vertex id on each edge owned by a voxel (3 axes per voxel), -1 if none
+  std::vector<int> edge_vertex;
+  int vertex_num{0};
+  int face_num{0};
+};
 
-  std::vector<Eigen::Vector3f> vertices;
-  std::vector<Eigen::Vector3i> vertex_indices;
-  std::vector<Eigen::Vector3f> vertex_colors;
+// Neighbor offset of a local coordinate in [-kBlockSize, 2 * kBlockSize)
+inline int NeighborOffset(int l) {
+  return l < 0 ? -1 : (l < ugu::SparseVoxelGrid::kBlockSize ? 0 : 1);
+}
+
+inline int NeighborSlot(int dx, int dy, int dz) {
+  return ((dz + 1) * 3 + (dy + 1)) * 3 + (dx + 1);
+}
 
-  // key: sorted a pair of unique voxel ids in the voxel grid
-  // value: the corresponding interpolated vertex id in the unified mesh
-  // todo: consider faster way... maybe unordered_map?
-  std::map<std::pair<int, int>, int> voxelids2vertexid;
+// Id in the neighbor block and its local id. block_id is -1 if not allocated.
+inline void ResolveLocal(const McBlock &work, int lx, int ly, int lz,
+                         int *block_id, int *local_id) {
+  constexpr int bs = ugu::SparseVoxelGrid::kBlockSize;
+  const int dx = NeighborOffset(lx);
+  const int dy = NeighborOffset(ly);
+  const int dz = NeighborOffset(lz);
+  *block_id = work.neighbors[NeighborSlot(dx, dy, dz)];
+  *local_id = ((lz - dz * bs) * bs + (ly - dy * bs)) * bs + (lx - dx * bs);
+}
 
+// Per z-slab intermediate of MarchingCubesImpl()
+struct McSlab {
+  std::vector<uint8_t> cube_index;
+  std::vector<uint8_t> cube_valid;
+  // Whether a voxel is a corner of a valid cube crossing the surface. The
+  // first half is for this slab and the second half is for the next one.
+  std::vector<uint8_t> surface_corner;
+  // Vertex id on each edge owned by a voxel (3 axes per voxel), -1 if none
+  std::vector<int> edge_vertex;
+  int vertex_num{0};
+  int face_num{0};
+};
+
+// Cubes are identified by their lower corner and edges are owned by their
+// lower voxel, so slabs are processed in parallel without hashing. Faces are
+// emitted in the same order as the serial scan.
+template <typename Sampler>
+void MarchingCubesImpl(const Sampler &sampler,
+                       const Eigen::Vector3i &voxel_num, ugu::Mesh *mesh,
+                       double iso_level, bool with_color) {
   const std::array<int, 256> &edge_table = ugu::marching_cubes_lut::kEdgeTable;
   const std::array<std::array<int, 16>, 256> &tri_table =
       ugu::marching_cubes_lut::kTriTable;
 
-  for (int z = 1; z < voxel_num.z(); z++) {
-    for (int y = 1; y < voxel_num.y(); y++) {
-      for (int x = 1; x < voxel_num.x(); x++) {
-        if (voxel_grid.get(x, y, z).update_num < 1) {
+  const int nx = voxel_num.x();
+  const int ny = voxel_num.y();
+  const int nz = voxel_num.z();
+  if (nx < 2 || ny < 2 || nz < 2) {
+    return;
+  }
+  const int slab_size = nx * ny;
+  std::vector<McSlab> slabs(nz);
+
+  // Classify cubes. Corner 6 of a cube must be updated and all corners valid.
+  ugu::parallel_for(0, nz - 1, [&](int z) {
+    McSlab &slab = slabs[z];
+    slab.cube_index.assign(slab_size, 0);
+    slab.cube_valid.assign(slab_size, 0);
+    slab.surface_corner.assign(slab_size * 2, 0);
+    for (int y = 0; y < ny - 1; y++) {
+      for (int x = 0; x < nx - 1; x++) {
+        int cube_index;
+        if (!ClassifyCube(sampler, x, y, z, iso_level, &cube_index)) {
           continue;
         }
-
-        std::array<const Voxel *, 8> voxels;
-        voxels[0] = &voxel_grid.get(x - 1, y - 1, z - 1);
-        voxels[1] = &voxel_grid.get(x, y - 1, z - 1);
-        voxels[2] = &voxel_grid.get(x, y, z - 1);
-        voxels[3] = &voxel_grid.get(x - 1, y, z - 1);
-
-        voxels[4] = &voxel_grid.get(x - 1, y - 1, z);
-        voxels[5] = &voxel_grid.get(x, y - 1, z);
-        voxels[6] = &voxel_grid.get(x, y, z);
-        voxels[7] = &voxel_grid.get(x - 1, y, z);
-
-        if (voxels[0]->sdf == InvalidSdf::kVal ||
-            voxels[1]->sdf == InvalidSdf::kVal ||
-            voxels[2]->sdf == InvalidSdf::kVal ||
-            voxels[3]->sdf == InvalidSdf::kVal ||
-            voxels[4]->sdf == InvalidSdf::kVal ||
-            voxels[5]->sdf == InvalidSdf::kVal ||
-            voxels[6]->sdf == InvalidSdf::kVal ||
-            voxels[7]->sdf == InvalidSdf::kVal) {
+        const int id = y * nx + x;
+        slab.cube_valid[id] = 1;
+        slab.cube_index[id] = static_cast<uint8_t>(cube_index);
+        if (edge_table[cube_index] == 0) {
           continue;
         }
+        for (int i = 0; tri_table[cube_index][i] != -1; i += 3) {
+          slab.face_num++;
+        }
+        for (const auto &o : kCornerOffsets) {
+          slab.surface_corner[o[2] * slab_size + id + o[1] * nx + o[0]] = 1;
+        }
+      }
+    }
+  });
+  // The last slab has no cube
+  slabs[nz - 1].cube_index.assign(slab_size, 0);
+  slabs[nz - 1].cube_valid.assign(slab_size, 0);
+  slabs[nz - 1].surface_corner.assign(slab_size * 2, 0);
 
-        int cube_index{0};
-        std::array<Eigen::Vector3f, 12> vert_list;
-        std::array<Eigen::Vector3f, 12> col_list;
-        std::array<std::pair<int, int>, 12> voxelids_list;
-        /*
-           Determine the index into the edge table which
-           tells us which vertices are inside of the surface
-        */
-        if (voxels[0]->sdf < iso_level) cube_index |= 1;
-        if (voxels[1]->sdf < iso_level) cube_index |= 2;
-        if (voxels[2]->sdf < iso_level) cube_index |= 4;
-        if (voxels[3]->sdf < iso_level) cube_index |= 8;
-        if (voxels[4]->sdf < iso_level) cube_index |= 16;
-        if (voxels[5]->sdf < iso_level) cube_index |= 32;
-        if (voxels[6]->sdf < iso_level) cube_index |= 64;
-        if (voxels[7]->sdf < iso_level) cube_index |= 128;
-
-        /* Cube is entirely in/out of the surface */
-        if (edge_table[cube_index] == 0) {
+  // Mark the owned edges crossing the surface in any valid cube
+  auto cube_valid_at = [&](const Eigen::Vector3i &c) {
+    return 0 <= c[0] && c[0] < nx - 1 && 0 <= c[1] && c[1] < ny - 1 &&
+           0 <= c[2] && c[2] < nz - 1 &&
+           slabs[c[2]].cube_valid[c[1] * nx + c[0]] != 0;
+  };
+  ugu::parallel_for(0, nz, [&](int z) {
+    McSlab &slab = slabs[z];
+    slab.edge_vertex.assign(slab_size * 3, -1);
+    for (int y = 0; y < ny; y++) {
+      for (int x = 0; x < nx; x++) {
+        const int id = y * nx + x;
+        // Only corners of the surface cubes may own vertices
+        if (slab.surface_corner[id] == 0 &&
+            (z == 0 || slabs[z - 1].surface_corner[slab_size + id] == 0)) {
           continue;
         }
+        const bool inside = sampler.sdf(x, y, z) < iso_level;
+        for (int a = 0; a < 3; a++) {
+          Eigen::Vector3i v1(x, y, z);
+          v1[a] += 1;
+          if (v1[a] >= voxel_num[a] || !sampler.valid(v1[0], v1[1], v1[2]) ||
+              inside == (sampler.sdf(v1[0], v1[1], v1[2]) < iso_level)) {
+            continue;
+          }
+          // Cubes sharing the edge have their lower corners on the other
+          // two axes
+          const int a1 = (a + 1) % 3;
+          const int a2 = (a + 2) % 3;
+          bool used = false;
+          for (int k = 0; k < 4 && !used; k++) {
+            Eigen::Vector3i c(x, y, z);
+            c[a1] -= k & 1;
+            c[a2] -= k >> 1;
+            used = cube_valid_at(c);
+          }
+          if (used) {
+            slab.edge_vertex[id * 3 + a] = slab.vertex_num++;
+          }
+        }
+      }
+    }
+  });
 
-/* Find the vertices where the surface intersects the cube
- * And save a pair of voxel ids when the vertices occur
- */
-#if 0
-#define UGU_VERTEX_INTERP_(TABLE_BIT, VOXEL_ID1, VOXEL_ID2, VERT_IDX) \
-  if (edge_table[cube_index] & TABLE_BIT) {                           \
-    VertexInterp(iso_level, *voxels[VOXEL_ID1], *voxels[VOXEL_ID2],   \
-                 &vert_list[VERT_IDX]);                               \
-    voxelids_list[VERT_IDX] =                                         \
-        std::make_pair(voxels[VOXEL_ID1]->id, voxels[VOXEL_ID2]->id); \
-  }
-#endif
-
-#if 1
-        if (edge_table[cube_index] & 1) {
-          VertexInterp(iso_level, *voxels[0], *voxels[1], &vert_list[0],
-                       &col_list[0]);
-          voxelids_list[0] = std::make_pair(voxels[0]->id, voxels[1]->id);
-        }
-        if (edge_table[cube_index] & 2) {
-          VertexInterp(iso_level, *voxels[1], *voxels[2], &vert_list[1],
-                       &col_list[1]);
-          voxelids_list[1] = std::make_pair(voxels[1]->id, voxels[2]->id);
-        }
-        if (edge_table[cube_index] & 4) {
-          VertexInterp(iso_level, *voxels[2], *voxels[3], &vert_list[2],
-                       &col_list[2]);
-          voxelids_list[2] = std::make_pair(voxels[3]->id, voxels[2]->id);
-        }
-        if (edge_table[cube_index] & 8) {
-          VertexInterp(iso_level, *voxels[3], *voxels[0], &vert_list[3],
-                       &col_list[3]);
-          voxelids_list[3] = std::make_pair(voxels[0]->id, voxels[3]->id);
-        }
-        if (edge_table[cube_index] & 16) {
-          VertexInterp(iso_level, *voxels[4], *voxels[5], &vert_list[4],
-                       &col_list[4]);
-          voxelids_list[4] = std::make_pair(voxels[4]->id, voxels[5]->id);
-        }
-        if (edge_table[cube_index] & 32) {
-          VertexInterp(iso_level, *voxels[5], *voxels[6], &vert_list[5],
-                       &col_list[5]);
-          voxelids_list[5] = std::make_pair(voxels[5]->id, voxels[6]->id);
-        }
-        if (edge_table[cube_index] & 64) {
-          VertexInterp(iso_level, *voxels[6], *voxels[7], &vert_list[6],
-                       &col_list[6]);
-          voxelids_list[6] = std::make_pair(voxels[7]->id, voxels[6]->id);
-        }
-        if (edge_table[cube_index] & 128) {
-          VertexInterp(iso_level, *voxels[7], *voxels[4], &vert_list[7],
-                       &col_list[7]);
-          voxelids_list[7] = std::make_pair(voxels[4]->id, voxels[7]->id);
-        }
-        if (edge_table[cube_index] & 256) {
-          VertexInterp(iso_level, *voxels[0], *voxels[4], &vert_list[8],
-                       &col_list[8]);
-          voxelids_list[8] = std::make_pair(voxels[0]->id, voxels[4]->id);
-        }
-        if (edge_table[cube_index] & 512) {
-          VertexInterp(iso_level, *voxels[1], *voxels[5], &vert_list[9],
-                       &col_list[9]);
-          voxelids_list[9] = std::make_pair(voxels[1]->id, voxels[5]->id);
-        }
-        if (edge_table[cube_index] & 1024) {
-          VertexInterp(iso_level, *voxels[2], *voxels[6], &vert_list[10],
-                       &col_list[10]);
-          voxelids_list[10] = std::make_pair(voxels[2]->id, voxels[6]->id);
-        }
-        if (edge_table[cube_index] & 2048) {
-          VertexInterp(iso_level, *voxels[3], *voxels[7], &vert_list[11],
-                       &col_list[11]);
-          voxelids_list[11] = std::make_pair(voxels[3]->id, voxels[7]->id);
-        }
-#endif
+  std::vector<int> vertex_offsets(nz + 1, 0);
+  std::vector<int> face_offsets(nz + 1, 0);
+  for (int z = 0; z < nz; z++) {
+    vertex_offsets[z + 1] = vertex_offsets[z] + slabs[z].vertex_num;
+    face_offsets[z + 1] = face_offsets[z] + slabs[z].face_num;
+  }
 
-        for (int i = 0; tri_table[cube_index][i] != -1; i += 3) {
-          Eigen::Vector3i face;
+  std::vector<Eigen::Vector3f> vertices(vertex_offsets.back());
+  std::vector<Eigen::Vector3f> vertex_colors;
+  if (with_color) {
+    vertex_colors.resize(vertex_offsets.back());
+  }
+  std::vector<Eigen::Vector3i> vertex_indices(face_offsets.back());
 
+  // Interpolate vertices and make their ids global
+  ugu::parallel_for(0, nz, [&](int z) {
+    McSlab &slab = slabs[z];
+    for (int id = 0; id < slab_size * 3; id++) {
+      int &vid = slab.edge_vertex[id];
+      if (vid < 0) {
+        continue;
+      }
+      vid += vertex_offsets[z];
+      const int a = id % 3;
+      const Eigen::Vector3i v0(id / 3 % nx, id / 3 / nx, z);
+      Eigen::Vector3i v1 = v0;
+      v1[a] += 1;
+      Eigen::Vector3f c;
+      VertexInterp(iso_level, sampler.pos(v0[0], v0[1], v0[2]),
+                   sampler.pos(v1[0], v1[1], v1[2]),
+                   sampler.sdf(v0[0], v0[1], v0[2]),
+                   sampler.sdf(v1[0], v1[1], v1[2]), &vertices[vid],
+                   sampler.col(v0[0], v0[1], v0[2]),
+                   sampler.col(v1[0], v1[1], v1[2]), &c);
+      if (with_color) {
+        vertex_colors[vid] = c;
+      }
+    }
+  });
+
+  // Emit faces
+  ugu::parallel_for(0, nz - 1, [&](int z) {
+    const McSlab &slab = slabs[z];
+    int fid = face_offsets[z];
+    for (int y = 0; y < ny - 1; y++) {
+      for (int x = 0; x < nx - 1; x++) {
+        const int id = y * nx + x;
+        const int cube_index = slab.cube_index[id];
+        if (slab.cube_valid[id] == 0 || edge_table[cube_index] == 0) {
+          continue;
+        }
+        for (int i = 0; tri_table[cube_index][i] != -1; i += 3) {
+          Eigen::Vector3i &face = vertex_indices[fid++];
           for (int j = 0; j < 3; j++) {
-            const std::pair<int, int> &key =
-                voxelids_list[tri_table[cube_index][i + (2 - j)]];
-            if (voxelids2vertexid.find(key) == voxelids2vertexid.end()) {
-              // if a pair of voxel ids has not been added, the current vertex
-              // is new. store the pair of voxel ids and new vertex position
-              face[j] = static_cast<int>(vertices.size());
-              vertices.push_back(vert_list[tri_table[cube_index][i + (2 - j)]]);
-              if (with_color) {
-                vertex_colors.push_back(
-                    col_list[tri_table[cube_index][i + (2 - j)]]);
-              }
-              voxelids2vertexid.insert(std::make_pair(key, face[j]));
-            } else {
-              // set existing vertex id if the pair of voxel ids has been
-              // already added
-              face[j] = voxelids2vertexid.at(key);
+            const auto &owner = kEdgeOwners[tri_table[cube_index][i + (2 - j)]];
+            const auto &o = kCornerOffsets[owner[0]];
+            const int owner_id = (y + o[1]) * nx + x + o[0];
+            face[j] = slabs[z + o[2]].edge_vertex[owner_id * 3 + owner[1]];
+          }
+        }
+      }
+    }
+  });
+
+  mesh->set_vertices(std::move(vertices));
+  mesh->set_vertex_indices(std::move(vertex_indices));
+  if (with_color) {
+    mesh->set_vertex_colors(std::move(vertex_colors));
+  }
+}
+
+// Faces are emitted only for the cubes whose lower corner is in the first
+// face_block_num blocks. vertex_keys receives the lower voxel index and the
+// axis of the edge of each vertex if not nullptr.
+void MarchingCubesBlocks(const ugu::SparseVoxelGrid &voxel_grid,
+                         size_t face_block_num, ugu::Mesh *mesh,
+                         double iso_level, bool with_color,
+                         std::vector<Eigen::Vector4i> *vertex_keys) {
+  using namespace ugu;
+  constexpr int bs = SparseVoxelGrid::kBlockSize;
+  constexpr int voxel_num = SparseVoxelGrid::kBlockVoxelNum;
+  const std::array<int, 256> &edge_table = ugu::marching_cubes_lut::kEdgeTable;
+  const std::array<std::array<int, 16>, 256> &tri_table =
+      ugu::marching_cubes_lut::kTriTable;
+
+  const size_t block_num = voxel_grid.block_num();
+  std::vector<McBlock> works(block_num);
+  auto voxel_at = [&](const McBlock &work, int lx, int ly,
+                      int lz) -> const TsdfVoxel * {
+    int block_id, local_id;
+    ResolveLocal(work, lx, ly, lz, &block_id, &local_id);
+    if (block_id < 0) {
+      return nullptr;
+    }
+    const TsdfVoxel *voxel = &voxel_grid.get_block(block_id).voxels[local_id];
+    return voxel->weight < 1 ? nullptr : voxel;
+  };
+
+  // Classify cubes whose lower corner is in each block
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    McBlock &work = works[b];
+    const Eigen::Vector3i &block_index =
+        voxel_grid.get_block(static_cast<int>(b)).index;
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          work.neighbors[NeighborSlot(dx, dy, dz)] = voxel_grid.find_block(
+              block_index + Eigen::Vector3i(dx, dy, dz));
+        }
+      }
+    }
+    work.cube_index.assign(voxel_num, 0);
+    work.cube_valid.assign(voxel_num, 0);
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          int cube_index = 0;
+          bool valid = true;
+          for (int i = 0; i < 8 && valid; i++) {
+            const TsdfVoxel *voxel =
+                voxel_at(work, x + kCornerOffsets[i][0],
+                         y + kCornerOffsets[i][1], z + kCornerOffsets[i][2]);
+            if (voxel == nullptr) {
+              valid = false;
+            } else if (voxel->get_sdf() < iso_level) {
+              cube_index |= 1 << i;
             }
           }
-          vertex_indices.push_back(face);
+          if (!valid) {
+            continue;
+          }
+          const int id = (z * bs + y) * bs + x;
+          work.cube_valid[id] = 1;
+          work.cube_index[id] = static_cast<uint8_t>(cube_index);
+          for (int i = 0; tri_table[cube_index][i] != -1 && b < face_block_num;
+               i += 3) {
+            work.face_num++;
+          }
         }
       }
     }
+  });
+
+  // Mark the owned edges crossing the surface in any valid cube
+  auto cube_valid_at = [&](const McBlock &work, int lx, int ly, int lz) {
+    int block_id, local_id;
+    ResolveLocal(work, lx, ly, lz, &block_id, &local_id);
+    return 0 <= block_id && works[block_id].cube_valid[local_id] != 0;
+  };
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    McBlock &work = works[b];
+    work.edge_vertex.assign(voxel_num * 3, -1);
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          const TsdfVoxel *v0 = voxel_at(work, x, y, z);
+          if (v0 == nullptr) {
+            continue;
+          }
+          const int id = (z * bs + y) * bs + x;
+          for (int a = 0; a < 3; a++) {
+            Eigen::Vector3i e = Eigen::Vector3i::Zero();
+            e[a] = 1;
+            const TsdfVoxel *v1 = voxel_at(work, x + e[0], y + e[1], z + e[2]);
+            if (v1 == nullptr ||
+                (v0->get_sdf() < iso_level) == (v1->get_sdf() < iso_level)) {
+              continue;
+            }
+            // Cubes sharing the edge have their lower corners on the other
+            // two axes
+            const int a1 = (a + 1) % 3;
+            const int a2 = (a + 2) % 3;
+            bool used = false;
+            for (int k = 0; k < 4 && !used; k++) {
+              Eigen::Vector3i c(x, y, z);
+              c[a1] -= k & 1;
+              c[a2] -= k >> 1;
+              used = cube_valid_at(work, c[0], c[1], c[2]);
+            }
+            if (used) {
+              work.edge_vertex[id * 3 + a] = work.vertex_num++;
+            }
+          }
+        }
+      }
+    }
+  });
+
+  std::vector<int> vertex_offsets(block_num + 1, 0);
+  std::vector<int> face_offsets(block_num + 1, 0);
+  for (size_t b = 0; b < block_num; b++) {
+    vertex_offsets[b + 1] = vertex_offsets[b] + works[b].vertex_num;
+    face_offsets[b + 1] = face_offsets[b] + works[b].face_num;
+  }
+
+  std::vector<Eigen::Vector3f> vertices(vertex_offsets.back());
+  std::vector<Eigen::Vector3f> vertex_colors;
+  if (with_color) {
+    vertex_colors.resize(vertex_offsets.back());
   }
+  std::vector<Eigen::Vector3i> vertex_indices(face_offsets.back());
+  if (vertex_keys != nullptr) {
+    vertex_keys->resize(vertex_offsets.back());
+  }
+
+  // Interpolate vertices and make their ids global
+  parallel_for(size_t(0), block_num, [&](size_t b) {
+    McBlock &work = works[b];
+    const Eigen::Vector3i base =
+        voxel_grid.get_block(static_cast<int>(b)).index * bs;
+    for (int id = 0; id < voxel_num * 3; id++) {
+      int &vid = work.edge_vertex[id];
+      if (vid < 0) {
+        continue;
+      }
+      vid += vertex_offsets[b];
+      const int a = id % 3;
+      const int lid = id / 3;
+      const Eigen::Vector3i l0(lid % bs, lid / bs % bs, lid / bs / bs);
+      Eigen::Vector3i l1 = l0;
+      l1[a] += 1;
+      const Eigen::Vector3i idx0 = base + l0;
+      const Eigen::Vector3i idx1 = base + l1;
+      const TsdfVoxel *v0 = voxel_at(work, l0[0], l0[1], l0[2]);
+      const TsdfVoxel *v1 = voxel_at(work, l1[0], l1[1], l1[2]);
+      Eigen::Vector3f c;
+      VertexInterp(iso_level, voxel_grid.get_pos(idx0),
+                   voxel_grid.get_pos(idx1), v0->get_sdf(), v1->get_sdf(),
+                   &vertices[vid], v0->get_col(), v1->get_col(), &c);
+      if (with_color) {
+        vertex_colors[vid] = c;
+      }
+      if (vertex_keys != nullptr) {
+        (*vertex_keys)[vid] = {idx0[0], idx0[1], idx0[2], a};
+      }
+    }
+  });
+
+  // Emit faces
+  parallel_for(size_t(0), face_block_num, [&](size_t b) {
+    const McBlock &work = works[b];
+    int fid = face_offsets[b];
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          const int id = (z * bs + y) * bs + x;
+          const int cube_index = work.cube_index[id];
+          if (work.cube_valid[id] == 0 || edge_table[cube_index] == 0) {
+            continue;
+          }
+          for (int i = 0; tri_table[cube_index][i] != -1; i += 3) {
+            Eigen::Vector3i &face = vertex_indices[fid++];
+            for (int j = 0; j < 3; j++) {
+              const auto &owner =
+                  kEdgeOwners[tri_table[cube_index][i + (2 - j)]];
+              const auto &o = kCornerOffsets[owner[0]];
+              int block_id, local_id;
+              ResolveLocal(work, x + o[0], y + o[1], z + o[2], &block_id,
+                           &local_id);
+              face[j] = works[block_id].edge_vertex[local_id * 3 + owner[1]];
+            }
+          }
+        }
+      }
+    }
+  });
 
-  mesh->set_vertices(vertices);
-  mesh->set_vertex_indices(vertex_indices);
+  mesh->set_vertices(std::move(vertices));
+  mesh->set_vertex_indices(std::move(vertex_indices));
   if (with_color) {
-    mesh->set_vertex_colors(vertex_colors);
+    mesh->set_vertex_colors(std::move(vertex_colors));
   }
+}
+
+// Blocks per axis of a chunk extracted at once by MarchingCubesPaged()
+constexpr int kPagedChunkSize = 8;
+
+// Extracts a grid with paged out blocks chunk by chunk, so that only a chunk
+// and its upper neighbor blocks are read at once. Vertices on the borders of
+// chunks are welded by their edges.
+void MarchingCubesPaged(const ugu::SparseVoxelGrid &voxel_grid,
+                        ugu::Mesh *mesh, double iso_level, bool with_color) {
+  using namespace ugu;
+  auto floor_div = [](int a, int b) {
+    return a >= 0 ? a / b : (a - b + 1) / b;
+  };
+  auto chunk_of = [&](const Eigen::Vector3i &block_index) {
+    return Eigen::Vector3i(floor_div(block_index.x(), kPagedChunkSize),
+                           floor_div(block_index.y(), kPagedChunkSize),
+                           floor_div(block_index.z(), kPagedChunkSize));
+  };
+  auto less = [](const Eigen::Vector3i &a, const Eigen::Vector3i &b) {
+    return std::make_tuple(a.z(), a.y(), a.x()) <
+           std::make_tuple(b.z(), b.y(), b.x());
+  };
+
+  std::vector<Eigen::Vector3i> all_blocks = voxel_grid.paged_block_indices();
+  for (size_t i = 0; i < voxel_grid.block_num(); i++) {
+    all_blocks.push_back(voxel_grid.get_block(static_cast<int>(i)).index);
+  }
+  // Sorted for the deterministic output
+  std::sort(all_blocks.begin(), all_blocks.end(), less);
+  const std::unordered_set<Eigen::Vector3i> allocated(all_blocks.begin(),
+                                                      all_blocks.end());
+  std::unordered_map<Eigen::Vector3i, std::vector<Eigen::Vector3i>> chunks;
+  std::vector<Eigen::Vector3i> chunk_order;
+  for (const Eigen::Vector3i &b : all_blocks) {
+    auto [it, inserted] = chunks.try_emplace(chunk_of(b));
+    if (inserted) {
+      chunk_order.push_back(it->first);
+    }
+    it->second.push_back(b);
+  }
+  std::sort(chunk_order.begin(), chunk_order.end(), less);
+
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<Eigen::Vector3f> vertex_colors;
+  std::vector<Eigen::Vector3i> vertex_indices;
+  std::unordered_map<Eigen::Vector4i, int> welded;
+  for (const Eigen::Vector3i &chunk : chunk_order) {
+    const std::vector<Eigen::Vector3i> &core = chunks[chunk];
+    SparseVoxelGrid part;
+    part.Init(voxel_grid.resolution());
+    bool read = true;
+    for (const Eigen::Vector3i &b : core) {
+      read = read &&
+             voxel_grid.read_block(b, &part.get_block(part.allocate_block(b)));
+    }
+    // Cubes in the chunk refer to the upper neighbor blocks
+    for (const Eigen::Vector3i &b : core) {
+      for (int k = 1; read && k < 8; k++) {
+        const Eigen::Vector3i n = b + Eigen::Vector3i(k & 1, (k >> 1) & 1,
+                                                      (k >> 2) & 1);
+        if (chunk_of(n) != chunk && part.find_block(n) < 0 &&
+            allocated.count(n) != 0) {
+          read = voxel_grid.read_block(
+              n, &part.get_block(part.allocate_block(n)));
+        }
+      }
+    }
+    if (!read) {
+      LOGE("Failed to read blocks of chunk (%d, %d, %d). Skipped\n",
+           chunk.x(), chunk.y(), chunk.z());
+      continue;
+    }
+
+    Mesh part_mesh;
+    std::vector<Eigen::Vector4i> keys;
+    MarchingCubesBlocks(part, core.size(), &part_mesh, iso_level, with_color,
+                        &keys);
+
+    std::vector<int> vertex_map(keys.size(), -1);
+    for (const Eigen::Vector3i &face : part_mesh.vertex_indices()) {
+      Eigen::Vector3i &global = vertex_indices.emplace_back();
+      for (int j = 0; j < 3; j++) {
+        int &vid = vertex_map[face[j]];
+        if (vid < 0) {
+          auto [it, inserted] = welded.try_emplace(
+              keys[face[j]], static_cast<int>(vertices.size()));
+          if (inserted) {
+            vertices.push_back(part_mesh.vertices()[face[j]]);
+            if (with_color) {
+              vertex_colors.push_back(part_mesh.vertex_colors()[face[j]]);
+            }
+          }
+          vid = it->second;
+        }
+        global[j] = vid;
+      }
+    }
+  }
+
+  mesh->set_vertices(std::move(vertices));
+  mesh->set_vertex_indices(std::move(vertex_indices));
+  if (with_color) {
+    mesh->set_vertex_colors(std::move(vertex_colors));
+  }
+}
+
+}  // namespace
+
+namespace ugu {
+
+void MarchingCubes(const VoxelGrid &voxel_grid, Mesh *mesh, double iso_level,
+                   bool with_color) {
+  Timer<> timer;
+  timer.Start();
+
+  mesh->Clear();
+  MarchingCubesImpl(VoxelGridSampler{voxel_grid}, voxel_grid.voxel_num(), mesh,
+                    iso_level, with_color);
+
+  timer.End();
+  LOGI("MarchingCubes %02f\n", timer.elapsed_msec());
+}
+
+void MarchingCubes(const TsdfVoxelGrid &voxel_grid, Mesh *mesh,
+                   double iso_level, bool with_color) {
+  Timer<> timer;
+  timer.Start();
+
+  mesh->Clear();
+  MarchingCubesImpl(TsdfVoxelGridSampler{voxel_grid}, voxel_grid.voxel_num(),
+                    mesh, iso_level, with_color);
 
   timer.End();
   LOGI("MarchingCubes %02f\n", timer.elapsed_msec());
 }
 
+void MarchingCubes(const SparseVoxelGrid &voxel_grid, Mesh *mesh,
+                   double iso_level, bool with_color) {
+  Timer<> timer;
+  timer.Start();
+
+  mesh->Clear();
+  if (voxel_grid.paged_block_num() > 0) {
+    MarchingCubesPaged(voxel_grid, mesh, iso_level, with_color);
+  } else {
+    MarchingCubesBlocks(voxel_grid, voxel_grid.block_num(), mesh, iso_level,
+                        with_color, nullptr);
+  }
+
+  timer.End();
+  LOGI("MarchingCubes %02f\n", timer.elapsed_msec());
+}
+
+IncrementalMarchingCubes::IncrementalMarchingCubes(double iso_level,
+                                                   bool with_color)
+    : iso_level_(iso_level), with_color_(with_color) {}
+
+IncrementalMarchingCubes::~IncrementalMarchingCubes() {}
+
+template <typename Sampler>
+void IncrementalMarchingCubes::UpdateImpl(const Sampler &sampler,
+                                          const Eigen::Vector3i &voxel_num,
+                                          DirtyBricks &dirty_bricks) {
+  constexpr int bs = DirtyBricks::kBrickSize;
+  constexpr int brick_voxel_num = bs * bs * bs;
+  const std::array<int, 256> &edge_table = ugu::marching_cubes_lut::kEdgeTable;
+  const std::array<std::array<int, 16>, 256> &tri_table =
+      ugu::marching_cubes_lut::kTriTable;
+
+  if (voxel_num != voxel_num_ || dirty_bricks.brick_num() != brick_num_) {
+    voxel_num_ = voxel_num;
+    brick_num_ = dirty_bricks.brick_num();
+    chunks_.assign(static_cast<size_t>(brick_num_.prod()), Chunk());
+    dirty_bricks.MarkAll();
+  }
+  auto chunk_id = [&](const Eigen::Vector3i &brick) {
+    return (brick.z() * brick_num_.y() + brick.y()) * brick_num_.x() +
+           brick.x();
+  };
+
+  // A chunk has the cubes whose lower corner is in the brick and the vertices
+  // on the edges owned by its voxels. They depend on the voxels in the
+  // neighbor bricks.
+  std::vector<uint8_t> update_flags(chunks_.size(), 0);
+  for (const Eigen::Vector3i &brick : dirty_bricks.Get()) {
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          const Eigen::Vector3i b = brick + Eigen::Vector3i(dx, dy, dz);
+          if ((b.array() < 0).any() ||
+              (b.array() >= brick_num_.array()).any()) {
+            continue;
+          }
+          update_flags[chunk_id(b)] = 1;
+        }
+      }
+    }
+  }
+  dirty_bricks.Clear();
+  std::vector<int> updated;
+  for (size_t i = 0; i < update_flags.size(); i++) {
+    if (update_flags[i] != 0) {
+      updated.push_back(static_cast<int>(i));
+    }
+  }
+  updated_chunk_num_ = static_cast<int>(updated.size());
+
+  parallel_for(size_t(0), updated.size(), [&](size_t i) {
+    const int id = updated[i];
+    const Eigen::Vector3i brick(id % brick_num_.x(),
+                                id / brick_num_.x() % brick_num_.y(),
+                                id / brick_num_.x() / brick_num_.y());
+    const Eigen::Vector3i st = brick * bs;
+    Chunk &chunk = chunks_[id];
+    chunk = Chunk();
+
+    std::array<uint8_t, brick_voxel_num> cube_index{};
+    std::array<uint8_t, brick_voxel_num> cube_valid{};
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          const Eigen::Vector3i c = st + Eigen::Vector3i(x, y, z);
+          int index;
+          if ((c.array() >= voxel_num.array() - 1).any() ||
+              !ClassifyCube(sampler, c[0], c[1], c[2], iso_level_, &index)) {
+            continue;
+          }
+          const int lid = (z * bs + y) * bs + x;
+          cube_valid[lid] = 1;
+          cube_index[lid] = static_cast<uint8_t>(index);
+        }
+      }
+    }
+    // Cubes out of the brick are classified again
+    auto cube_valid_at = [&](const Eigen::Vector3i &c) {
+      if ((c.array() < 0).any() || (c.array() >= voxel_num.array() - 1).any()) {
+        return false;
+      }
+      const Eigen::Vector3i l = c - st;
+      if ((l.array() < 0).any()) {
+        int index;
+        return ClassifyCube(sampler, c[0], c[1], c[2], iso_level_, &index);
+      }
+      return cube_valid[(l.z() * bs + l.y()) * bs + l.x()] != 0;
+    };
+
+    // Vertices on the owned edges crossing the surface in any valid cube
+    std::vector<int> edge_vertex(brick_voxel_num * 3, -1);
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          const Eigen::Vector3i v0 = st + Eigen::Vector3i(x, y, z);
+          if ((v0.array() >= voxel_num.array()).any() ||
+              !sampler.valid(v0[0], v0[1], v0[2])) {
+            continue;
+          }
+          const float sdf0 = sampler.sdf(v0[0], v0[1], v0[2]);
+          const int lid = (z * bs + y) * bs + x;
+          for (int a = 0; a < 3; a++) {
+            Eigen::Vector3i v1 = v0;
+            v1[a] += 1;
+            if (v1[a] >= voxel_num[a] || !sampler.valid(v1[0], v1[1], v1[2])) {
+              continue;
+            }
+            const float sdf1 = sampler.sdf(v1[0], v1[1], v1[2]);
+            if ((sdf0 < iso_level_) == (sdf1 < iso_level_)) {
+              continue;
+            }
+            const int a1 = (a + 1) % 3;
+            const int a2 = (a + 2) % 3;
+            bool used = false;
+            for (int k = 0; k < 4 && !used; k++) {
+              Eigen::Vector3i c = v0;
+              c[a1] -= k & 1;
+              c[a2] -= k >> 1;
+              used = cube_valid_at(c);
+            }
+            if (!used) {
+              continue;
+            }
+            edge_vertex[lid * 3 + a] = static_cast<int>(chunk.vertices.size());
+            Eigen::Vector3f p, c;
+            VertexInterp(iso_level_, sampler.pos(v0[0], v0[1], v0[2]),
+                         sampler.pos(v1[0], v1[1], v1[2]), sdf0, sdf1, &p,
+                         sampler.col(v0[0], v0[1], v0[2]),
+                         sampler.col(v1[0], v1[1], v1[2]), &c);
+            chunk.vertices.push_back(p);
+            if (with_color_) {
+              chunk.vertex_colors.push_back(c);
+            }
+          }
+        }
+      }
+    }
+    if (!chunk.vertices.empty()) {
+      chunk.edge_vertex = std::move(edge_vertex);
+    }
+
+    // Faces refer to the edges in this or the upper neighbor chunks
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          const int lid = (z * bs + y) * bs + x;
+          const int index = cube_index[lid];
+          if (cube_valid[lid] == 0 || edge_table[index] == 0) {
+            continue;
+          }
+          for (int t = 0; tri_table[index][t] != -1; t += 3) {
+            Eigen::Vector3i face;
+            for (int j = 0; j < 3; j++) {
+              const auto &owner = kEdgeOwners[tri_table[index][t + (2 - j)]];
+              const auto &o = kCornerOffsets[owner[0]];
+              const int px = x + o[0];
+              const int py = y + o[1];
+              const int pz = z + o[2];
+              const int slot = px / bs + (py / bs) * 2 + (pz / bs) * 4;
+              const int owner_id =
+                  ((pz % bs) * bs + (py % bs)) * bs + (px % bs);
+              face[j] = slot * brick_voxel_num * 3 + owner_id * 3 + owner[1];
+            }
+            chunk.faces.push_back(face);
+          }
+        }
+      }
+    }
+  });
+}
+
+bool IncrementalMarchingCubes::Update(VoxelGrid &voxel_grid) {
+  if (!voxel_grid.initialized()) {
+    return false;
+  }
+  UpdateImpl(VoxelGridSampler{voxel_grid}, voxel_grid.voxel_num(),
+             voxel_grid.dirty_bricks());
+  return true;
+}
+
+bool IncrementalMarchingCubes::Update(TsdfVoxelGrid &voxel_grid) {
+  if (!voxel_grid.initialized()) {
+    return false;
+  }
+  UpdateImpl(TsdfVoxelGridSampler{voxel_grid}, voxel_grid.voxel_num(),
+             voxel_grid.dirty_bricks());
+  return true;
+}
+
+void IncrementalMarchingCubes::Clear() {
+  voxel_num_ = Eigen::Vector3i::Zero();
+  brick_num_ = Eigen::Vector3i::Zero();
+  chunks_.clear();
+  updated_chunk_num_ = 0;
+}
+
+void IncrementalMarchingCubes::GetMesh(Mesh *mesh) const {
+  constexpr int bs = DirtyBricks::kBrickSize;
+  constexpr int brick_edge_num = bs * bs * bs * 3;
+
+  mesh->Clear();
+
+  const size_t chunk_num = chunks_.size();
+  std::vector<int> vertex_offsets(chunk_num + 1, 0);
+  std::vector<int> face_offsets(chunk_num + 1, 0);
+  for (size_t i = 0; i < chunk_num; i++) {
+    vertex_offsets[i + 1] =
+        vertex_offsets[i] + static_cast<int>(chunks_[i].vertices.size());
+    face_offsets[i + 1] =
+        face_offsets[i] + static_cast<int>(chunks_[i].faces.size());
+  }
+
+  std::vector<Eigen::Vector3f> vertices(vertex_offsets.back());
+  std::vector<Eigen::Vector3f> vertex_colors;
+  if (with_color_) {
+    vertex_colors.resize(vertex_offsets.back());
+  }
+  std::vector<Eigen::Vector3i> vertex_indices(face_offsets.back());
+
+  parallel_for(size_t(0), chunk_num, [&](size_t i) {
+    const Chunk &chunk = chunks_[i];
+    std::copy(chunk.vertices.begin(), chunk.vertices.end(),
+              vertices.begin() + vertex_offsets[i]);
+    if (with_color_) {
+      std::copy(chunk.vertex_colors.begin(), chunk.vertex_colors.end(),
+                vertex_colors.begin() + vertex_offsets[i]);
+    }
+    if (chunk.faces.empty()) {
+      return;
+    }
+    const int id = static_cast<int>(i);
+    const Eigen::Vector3i brick(id % brick_num_.x(),
+                                id / brick_num_.x() % brick_num_.y(),
+                                id / brick_num_.x() / brick_num_.y());
+    for (size_t f = 0; f < chunk.faces.size(); f++) {
+      Eigen::Vector3i &face = vertex_indices[face_offsets[i] + f];
+      for (int j = 0; j < 3; j++) {
+        const int slot = chunk.faces[f][j] / brick_edge_num;
+        const Eigen::Vector3i neighbor =
+            brick + Eigen::Vector3i(slot & 1, (slot >> 1) & 1, slot >> 2);
+        const int nid =
+            (neighbor.z() * brick_num_.y() + neighbor.y()) * brick_num_.x() +
+            neighbor.x();
+        face[j] = vertex_offsets[nid] +
+                  chunks_[nid].edge_vertex[chunk.faces[f][j] % brick_edge_num];
+      }
+    }
+  });
+
+  mesh->set_vertices(std::move(vertices));
+  mesh->set_vertex_indices(std::move(vertex_indices));
+  if (with_color_) {
+    mesh->set_vertex_colors(std::move(vertex_colors));
+  }
+}
+
+int IncrementalMarchingCubes::updated_chunk_num() const {
+  return updated_chunk_num_;
+}
+
+int IncrementalMarchingCubes::vertex_num() const {
+  int num = 0;
+  for (const Chunk &chunk : chunks_) {
+    num += static_cast<int>(chunk.vertices.size());
+  }
+  return num;
+}
+
+int IncrementalMarchingCubes::face_num() const {
+  int num = 0;
+  for (const Chunk &chunk : chunks_) {
+    num += static_cast<int>(chunk.faces.size());
+  }
+  return num;
+}
+
 }  // namespace ugu
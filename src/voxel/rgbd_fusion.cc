@@ -0,0 +1,612 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/voxel/rgbd_fusion.h"
+
+#include <algorithm>
+
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+// Image rows per task of ICP accumulation
+constexpr int kIcpRowBlock = 8;
+// Convergence of ICP in rotation angle
+constexpr double kIcpAngleEps = 1e-5;
+
+inline Eigen::Vector3f ToEigen(const Vec3f& v) { return {v[0], v[1], v[2]}; }
+
+inline bool IsValid(const Vec3f& n) {
+  return n[0] != 0.f || n[1] != 0.f || n[2] != 0.f;
+}
+
+// Pinhole intrinsics of a pyramid level. Pixel (x, y) of level l covers
+// [2^l * x, 2^l * (x + 1)) of the finest level.
+struct Intrinsics {
+  Eigen::Vector2f f;
+  Eigen::Vector2f c;
+
+  Intrinsics Half() const {
+    return {f * 0.5f, (c.array() + 0.5f) * 0.5f - 0.5f};
+  }
+};
+
+void ComputeVertexMap(const Image1f& depth, const Intrinsics& intr,
+                      Image3f* vertex) {
+  *vertex = Image3f::zeros(depth.rows, depth.cols);
+  parallel_for(0, depth.rows, [&](int y) {
+    for (int x = 0; x < depth.cols; x++) {
+      const float d = depth.at<float>(y, x);
+      if (d <= 0.f) {
+        continue;
+      }
+      vertex->at<Vec3f>(y, x) = {(static_cast<float>(x) - intr.c.x()) /
+                                     intr.f.x() * d,
+                                 (static_cast<float>(y) - intr.c.y()) /
+                                     intr.f.y() * d,
+                                 d};
+    }
+  });
+}
+
+// Normal by the cross product of the right and the lower neighbors
+void ComputeNormalMap(const Image3f& vertex, float dist_th, Image3f* normal) {
+  *normal = Image3f::zeros(vertex.rows, vertex.cols);
+  const float dist_th_sq = dist_th * dist_th;
+  parallel_for(0, vertex.rows - 1, [&](int y) {
+    for (int x = 0; x < vertex.cols - 1; x++) {
+      const Eigen::Vector3f v = ToEigen(vertex.at<Vec3f>(y, x));
+      const Eigen::Vector3f r = ToEigen(vertex.at<Vec3f>(y, x + 1)) - v;
+      const Eigen::Vector3f d = ToEigen(vertex.at<Vec3f>(y + 1, x)) - v;
+      if (v.z() <= 0.f || r.squaredNorm() > dist_th_sq ||
+          d.squaredNorm() > dist_th_sq) {
+        continue;
+      }
+      Eigen::Vector3f n = d.cross(r);
+      const float len = n.norm();
+      if (len <= std::numeric_limits<float>::min()) {
+        continue;
+      }
+      n /= len;
+      if (n.dot(v) > 0.f) {
+        n = -n;
+      }
+      normal->at<Vec3f>(y, x) = {n.x(), n.y(), n.z()};
+    }
+  });
+}
+
+// Averages valid pixels in 2x2 close to the first valid one
+void DownsampleMaps(const Image3f& vertex, const Image3f& normal,
+                    float dist_th, Image3f* vertex_half, Image3f* normal_half) {
+  const int w = vertex.cols / 2;
+  const int h = vertex.rows / 2;
+  *vertex_half = Image3f::zeros(h, w);
+  *normal_half = Image3f::zeros(h, w);
+  const float dist_th_sq = dist_th * dist_th;
+  parallel_for(0, h, [&](int y) {
+    for (int x = 0; x < w; x++) {
+      Eigen::Vector3f v_sum = Eigen::Vector3f::Zero();
+      Eigen::Vector3f n_sum = Eigen::Vector3f::Zero();
+      Eigen::Vector3f ref;
+      int num = 0;
+      for (int k = 0; k < 4; k++) {
+        const int xx = x * 2 + (k & 1);
+        const int yy = y * 2 + (k >> 1);
+        if (!IsValid(normal.at<Vec3f>(yy, xx))) {
+          continue;
+        }
+        const Eigen::Vector3f v = ToEigen(vertex.at<Vec3f>(yy, xx));
+        if (num == 0) {
+          ref = v;
+        } else if ((v - ref).squaredNorm() > dist_th_sq) {
+          continue;
+        }
+        v_sum += v;
+        n_sum += ToEigen(normal.at<Vec3f>(yy, xx));
+        num++;
+      }
+      const float len = n_sum.norm();
+      if (num == 0 || len <= std::numeric_limits<float>::min()) {
+        continue;
+      }
+      v_sum /= static_cast<float>(num);
+      n_sum /= len;
+      vertex_half->at<Vec3f>(y, x) = {v_sum.x(), v_sum.y(), v_sum.z()};
+      normal_half->at<Vec3f>(y, x) = {n_sum.x(), n_sum.y(), n_sum.z()};
+    }
+  });
+}
+
+// Normal equations of point-to-plane ICP
+struct IcpSums {
+  Eigen::Matrix<double, 6, 6> A{Eigen::Matrix<double, 6, 6>::Zero()};
+  Eigen::Matrix<double, 6, 1> b{Eigen::Matrix<double, 6, 1>::Zero()};
+  double error{0.0};
+  int num{0};
+
+  IcpSums& operator+=(const IcpSums& rhs) {
+    A += rhs.A;
+    b += rhs.b;
+    error += rhs.error;
+    num += rhs.num;
+    return *this;
+  }
+};
+
+}  // namespace
+
+namespace ugu {
+
+struct RgbdFusion::Frame {
+  int id{-1};
+  Image1f depth;
+  Image3b color;
+  // Per pyramid level in the camera coordinate
+  std::vector<Image3f> vertices;
+  std::vector<Image3f> normals;
+  // Pixels with normal at the finest level
+  int valid_num{0};
+  RgbdFusionResult result;
+};
+
+struct RgbdFusion::Model {
+  int id{-1};
+  Eigen::Affine3d c2w{Eigen::Affine3d::Identity()};
+  Image1f depth;
+  Image3f normal;
+  Image3b color;
+  // Per pyramid level in the world coordinate
+  std::vector<Image3f> vertices;
+  std::vector<Image3f> normals;
+};
+
+RgbdFusionOption GenRgbdFusionDefaultOption(float resolution) {
+  RgbdFusionOption option;
+  option.resolution = resolution;
+  option.fusion = GenFuseDepthDefaultOption(resolution);
+  option.icp_dist_th = option.fusion.truncation_band * 2.f;
+  return option;
+}
+
+RgbdFusion::RgbdFusion(const PinholeCamera& camera,
+                       const RgbdFusionOption& option,
+                       const Eigen::Affine3d& initial_c2w)
+    : camera_(camera), option_(option), initial_c2w_(initial_c2w) {
+  if (option_.icp_iterations.empty()) {
+    LOGE("icp_iterations is empty. Use 1 level\n");
+    option_.icp_iterations = {10};
+  }
+  if (option_.queue_size < 1) {
+    option_.queue_size = 1;
+  }
+  option_.raycast_level =
+      std::clamp(option_.raycast_level, 0,
+                 static_cast<int>(option_.icp_iterations.size()) - 1);
+  option_.fusion.use_truncation = true;
+  if (option_.max_resident_blocks > 0 && option_.swap_path.empty()) {
+    LOGE("swap_path is empty. Paging is disabled\n");
+    option_.max_resident_blocks = 0;
+  }
+  if (!volume_.Init(option_.resolution) ||
+      !volume_.EnablePaging(option_.swap_path, option_.max_resident_blocks)) {
+    stop_ = true;
+    return;
+  }
+
+  workers_.emplace_back(&RgbdFusion::Preprocess, this);
+  workers_.emplace_back(&RgbdFusion::Track, this);
+  workers_.emplace_back(&RgbdFusion::Fuse, this);
+}
+
+RgbdFusion::~RgbdFusion() { Stop(); }
+
+bool RgbdFusion::Push(const Image1f& depth, const Image3b& color) {
+  if (depth.cols != camera_.width() || depth.rows != camera_.height()) {
+    LOGE("depth size (%d, %d) is different from camera (%d, %d)\n",
+         depth.cols, depth.rows, camera_.width(), camera_.height());
+    return false;
+  }
+  if (!color.empty() &&
+      (color.cols != depth.cols || color.rows != depth.rows)) {
+    LOGE("color size (%d, %d) is different from depth\n", color.cols,
+         color.rows);
+    return false;
+  }
+
+  auto frame = std::make_shared<Frame>();
+  frame->depth = depth.clone();
+  if (!color.empty()) {
+    frame->color = color.clone();
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [&] {
+      return stop_ ||
+             raw_frames_.size() < static_cast<size_t>(option_.queue_size);
+    });
+    if (stop_) {
+      return false;
+    }
+    frame->id = pushed_num_++;
+    raw_frames_.push_back(frame);
+  }
+  cv_.notify_all();
+  return true;
+}
+
+void RgbdFusion::Flush() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  cv_.wait(lock, [&] { return stop_ || fused_num_ == pushed_num_; });
+}
+
+void RgbdFusion::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& w : workers_) {
+    if (w.joinable()) {
+      w.join();
+    }
+  }
+  workers_.clear();
+}
+
+std::vector<RgbdFusionResult> RgbdFusion::results() const {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return results_;
+}
+
+bool RgbdFusion::GetModelMaps(Image1f* depth, Image3f* normal, Image3b* color,
+                              Eigen::Affine3d* c2w) const {
+  std::shared_ptr<Model> model;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (models_.empty()) {
+      return false;
+    }
+    model = models_.back();
+  }
+  *depth = model->depth.clone();
+  *normal = model->normal.clone();
+  if (color != nullptr) {
+    *color = model->color.clone();
+  }
+  if (c2w != nullptr) {
+    *c2w = model->c2w;
+  }
+  return true;
+}
+
+const SparseVoxelGrid& RgbdFusion::volume() const { return volume_; }
+
+void RgbdFusion::Preprocess() {
+  const size_t level_num = option_.icp_iterations.size();
+  while (true) {
+    std::shared_ptr<Frame> frame;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] { return stop_ || !raw_frames_.empty(); });
+      if (stop_) {
+        return;
+      }
+      frame = raw_frames_.front();
+      raw_frames_.pop_front();
+    }
+    cv_.notify_all();
+
+    Image1f& depth = frame->depth;
+    depth.forEach([&](float& d, const int* pos) {
+      (void)pos;
+      if (d < option_.min_depth || option_.max_depth < d) {
+        d = 0.f;
+      }
+    });
+
+    Intrinsics intr{camera_.focal_length(), camera_.principal_point()};
+    frame->vertices.resize(level_num);
+    frame->normals.resize(level_num);
+    ComputeVertexMap(depth, intr, &frame->vertices[0]);
+    ComputeNormalMap(frame->vertices[0], option_.icp_dist_th,
+                     &frame->normals[0]);
+    for (size_t l = 1; l < level_num; l++) {
+      DownsampleMaps(frame->vertices[l - 1], frame->normals[l - 1],
+                     option_.icp_dist_th, &frame->vertices[l],
+                     &frame->normals[l]);
+    }
+    frame->valid_num = 0;
+    for (int y = 0; y < depth.rows; y++) {
+      for (int x = 0; x < depth.cols; x++) {
+        frame->valid_num += IsValid(frame->normals[0].at<Vec3f>(y, x)) ? 1 : 0;
+      }
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] {
+        return stop_ || preprocessed_frames_.size() <
+                            static_cast<size_t>(option_.queue_size);
+      });
+      if (stop_) {
+        return;
+      }
+      preprocessed_frames_.push_back(frame);
+    }
+    cv_.notify_all();
+  }
+}
+
+void RgbdFusion::Track() {
+  Eigen::Affine3d c2w = initial_c2w_;
+  const int lag = option_.overlap_fusion ? 2 : 1;
+  while (true) {
+    std::shared_ptr<Frame> frame;
+    std::shared_ptr<Model> model;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] { return stop_ || !preprocessed_frames_.empty(); });
+      if (stop_) {
+        return;
+      }
+      frame = preprocessed_frames_.front();
+      preprocessed_frames_.pop_front();
+      if (frame->id > 0) {
+        // The model of a fixed frame makes the result independent of timing
+        const int model_id = std::max(0, frame->id - lag);
+        cv_.wait(lock, [&] { return stop_ || fused_num_ > model_id; });
+        if (stop_) {
+          return;
+        }
+        for (const auto& m : models_) {
+          if (m->id == model_id) {
+            model = m;
+          }
+        }
+      }
+    }
+    cv_.notify_all();
+
+    RgbdFusionResult& result = frame->result;
+    result.id = frame->id;
+    if (model == nullptr) {
+      result.tracked = true;
+    } else {
+      Eigen::Affine3d estimated = c2w;
+      result.tracked = Icp(*frame, *model, &estimated, &result);
+      if (result.tracked) {
+        c2w = estimated;
+      }
+    }
+    result.c2w = c2w;
+
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] {
+        return stop_ || tracked_frames_.size() <
+                            static_cast<size_t>(option_.queue_size);
+      });
+      if (stop_) {
+        return;
+      }
+      tracked_frames_.push_back(frame);
+    }
+    cv_.notify_all();
+  }
+}
+
+void RgbdFusion::Fuse() {
+  std::shared_ptr<Model> last_model;
+  while (true) {
+    std::shared_ptr<Frame> frame;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [&] { return stop_ || !tracked_frames_.empty(); });
+      if (stop_) {
+        return;
+      }
+      frame = tracked_frames_.front();
+      tracked_frames_.pop_front();
+    }
+    cv_.notify_all();
+
+    std::shared_ptr<Model> model;
+    if (frame->result.tracked) {
+      PinholeCamera camera = camera_;
+      camera.set_c2w(frame->result.c2w);
+      frame->result.fused = FuseDepth(camera, frame->depth, option_.fusion,
+                                      volume_, frame->color);
+      if (!frame->result.fused) {
+        LOGE("Failed to fuse frame %d\n", frame->id);
+      }
+      // Raycast even on failure since the volume may be partially updated
+      model = MakeModel(frame->result.c2w);
+    } else {
+      // The volume is not changed
+      model = std::make_shared<Model>(*last_model);
+    }
+    model->id = frame->id;
+    last_model = model;
+
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      models_.push_back(model);
+      // Track() refers to the last two at most
+      while (models_.size() > 2) {
+        models_.pop_front();
+      }
+      results_.push_back(frame->result);
+      fused_num_++;
+    }
+    cv_.notify_all();
+  }
+}
+
+std::shared_ptr<RgbdFusion::Model> RgbdFusion::MakeModel(
+    const Eigen::Affine3d& c2w) const {
+  auto model = std::make_shared<Model>();
+  model->c2w = c2w;
+
+  // The camera of the pyramid level to raycast
+  const int level = option_.raycast_level;
+  Intrinsics intr{camera_.focal_length(), camera_.principal_point()};
+  for (int l = 0; l < level; l++) {
+    intr = intr.Half();
+  }
+  PinholeCamera camera(camera_.width() >> level, camera_.height() >> level,
+                       c2w, intr.c, intr.f);
+  Raycast(volume_, camera, option_.fusion.truncation_band, option_.min_depth,
+          option_.max_depth, &model->depth, &model->normal, &model->color);
+
+  // Levels finer than the raycast one are left empty
+  const size_t level_num = option_.icp_iterations.size();
+  model->vertices.resize(level_num);
+  model->normals.resize(level_num);
+  Image3f& vertices = model->vertices[level];
+  Image3f& normals = model->normals[level];
+  ComputeVertexMap(model->depth, intr, &vertices);
+  normals = Image3f::zeros(model->depth.rows, model->depth.cols);
+  const Eigen::Affine3f c2w_f = c2w.cast<float>();
+  parallel_for(0, model->depth.rows, [&](int y) {
+    for (int x = 0; x < model->depth.cols; x++) {
+      const Vec3f& n = model->normal.at<Vec3f>(y, x);
+      if (!IsValid(n)) {
+        continue;
+      }
+      Vec3f& v = vertices.at<Vec3f>(y, x);
+      const Eigen::Vector3f v_w = c2w_f * ToEigen(v);
+      const Eigen::Vector3f n_w = c2w_f.linear() * ToEigen(n);
+      v = {v_w.x(), v_w.y(), v_w.z()};
+      normals.at<Vec3f>(y, x) = {n_w.x(), n_w.y(), n_w.z()};
+    }
+  });
+  for (size_t l = static_cast<size_t>(level) + 1; l < level_num; l++) {
+    DownsampleMaps(model->vertices[l - 1], model->normals[l - 1],
+                   option_.icp_dist_th, &model->vertices[l],
+                   &model->normals[l]);
+  }
+  return model;
+}
+
+bool RgbdFusion::Icp(const Frame& frame, const Model& model,
+                     Eigen::Affine3d* c2w, RgbdFusionResult* result) const {
+  const int level_num = static_cast<int>(option_.icp_iterations.size());
+  std::vector<Intrinsics> intrs{
+      {camera_.focal_length(), camera_.principal_point()}};
+  for (int l = 1; l < level_num; l++) {
+    intrs.push_back(intrs.back().Half());
+  }
+  const Eigen::Affine3f model_w2c = model.c2w.inverse().cast<float>();
+  const float dist_th_sq = option_.icp_dist_th * option_.icp_dist_th;
+  const float cos_th = std::cos(radians(option_.icp_angle_th_deg));
+  // Converged if the update is less than 1/100 voxel
+  const double eps = option_.resolution * 0.01;
+
+  Eigen::Affine3d T = *c2w;
+  IcpSums sums;
+  // Coarse to fine
+  for (int l = level_num - 1; l >= 0; l--) {
+    const Image3f& src_v = frame.vertices[l];
+    const Image3f& src_n = frame.normals[l];
+    // The model is projected to the raycast level if l is finer
+    const int model_l = std::max(l, option_.raycast_level);
+    const Image3f& dst_v = model.vertices[model_l];
+    const Image3f& dst_n = model.normals[model_l];
+    const Intrinsics& intr = intrs[model_l];
+    for (int iter = 0; iter < option_.icp_iterations[l]; iter++) {
+      const Eigen::Affine3f T_f = T.cast<float>();
+      // Projective data association and accumulation per row block. They
+      // are summed in order to be deterministic.
+      const int task_num = (src_v.rows + kIcpRowBlock - 1) / kIcpRowBlock;
+      std::vector<IcpSums> task_sums(task_num);
+      parallel_for(0, task_num, [&](int t) {
+        IcpSums& s = task_sums[t];
+        const int y_ed = std::min(src_v.rows, (t + 1) * kIcpRowBlock);
+        for (int y = t * kIcpRowBlock; y < y_ed; y++) {
+          for (int x = 0; x < src_v.cols; x++) {
+            const Vec3f& n_c = src_n.at<Vec3f>(y, x);
+            if (!IsValid(n_c)) {
+              continue;
+            }
+            const Eigen::Vector3f p = T_f * ToEigen(src_v.at<Vec3f>(y, x));
+            const Eigen::Vector3f p_m = model_w2c * p;
+            if (p_m.z() <= 0.f) {
+              continue;
+            }
+            const int u = static_cast<int>(
+                std::round(intr.f.x() * p_m.x() / p_m.z() + intr.c.x()));
+            const int v = static_cast<int>(
+                std::round(intr.f.y() * p_m.y() / p_m.z() + intr.c.y()));
+            if (u < 0 || v < 0 || dst_v.cols <= u || dst_v.rows <= v) {
+              continue;
+            }
+            const Vec3f& n_m = dst_n.at<Vec3f>(v, u);
+            if (!IsValid(n_m)) {
+              continue;
+            }
+            const Eigen::Vector3f q = ToEigen(dst_v.at<Vec3f>(v, u));
+            const Eigen::Vector3f n = ToEigen(n_m);
+            if ((p - q).squaredNorm() > dist_th_sq ||
+                (T_f.linear() * ToEigen(n_c)).dot(n) < cos_th) {
+              continue;
+            }
+
+            // r = n . (p + w x p + t - q)
+            const double r = n.dot(p - q);
+            Eigen::Matrix<double, 6, 1> J;
+            J.head<3>() = p.cross(n).cast<double>();
+            J.tail<3>() = n.cast<double>();
+            s.A.selfadjointView<Eigen::Upper>().rankUpdate(J);
+            s.b += J * r;
+            s.error += r * r;
+            s.num++;
+          }
+        }
+      });
+      sums = IcpSums();
+      for (const IcpSums& s : task_sums) {
+        sums += s;
+      }
+      if (sums.num < 6) {
+        return false;
+      }
+
+      sums.A.triangularView<Eigen::StrictlyLower>() = sums.A.transpose();
+      const Eigen::Matrix<double, 6, 1> x = -sums.A.ldlt().solve(sums.b);
+      if (!x.allFinite()) {
+        return false;
+      }
+      const Eigen::Vector3d w = x.head<3>();
+      const double angle = w.norm();
+      Eigen::Affine3d inc = Eigen::Affine3d::Identity();
+      if (angle > 0.0) {
+        inc.linear() = Eigen::AngleAxisd(angle, w / angle).toRotationMatrix();
+      }
+      inc.translation() = x.tail<3>();
+      T = inc * T;
+
+      if (angle < kIcpAngleEps && x.tail<3>().norm() < eps) {
+        break;
+      }
+    }
+  }
+
+  // Statistics of the last iteration at the finest level
+  result->corresp_num = sums.num;
+  result->icp_rmse =
+      static_cast<float>(std::sqrt(sums.error / std::max(sums.num, 1)));
+  if (static_cast<float>(sums.num) <
+      option_.icp_min_corresp_ratio * static_cast<float>(frame.valid_num)) {
+    return false;
+  }
+  *c2w = T;
+  return true;
+}
+
+}  // namespace ugu
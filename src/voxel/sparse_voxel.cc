@@ -0,0 +1,889 @@
+/*
+ * Copyright (C) 2022, unclearness
+ * All rights reserved.
+ */
+
+#include "ugu/voxel/sparse_voxel.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <utility>
+
+#include "ugu/util/thread_util.h"
+
+namespace {
+
+using namespace ugu;
+
+// Image rows per allocation task in FuseDepth()
+constexpr int kRowBlock = 16;
+// Entries of the per-task filter of recently visited blocks
+constexpr size_t kRecentBlockNum = 1 << 12;
+
+inline size_t RecentSlot(const Eigen::Vector3i& block_index) {
+  const uint64_t h = (static_cast<uint64_t>(block_index.x()) * 73856093u) ^
+                     (static_cast<uint64_t>(block_index.y()) * 19349663u) ^
+                     (static_cast<uint64_t>(block_index.z()) * 83492791u);
+  return static_cast<size_t>(h % kRecentBlockNum);
+}
+
+bool ValidateOption(const VoxelUpdateOption& option) {
+  if (option.truncation_band <= 0.f) {
+    LOGE("truncation_band must be positive %f\n", option.truncation_band);
+    return false;
+  }
+  return true;
+}
+
+// Calls func(block_index) for the blocks crossed by the segment from s to e
+// A Fast Voxel Traversal Algorithm for Ray Tracing
+// http://www.cse.yorku.ca/~amana/research/grid.pdf
+template <typename Func>
+void TraverseBlocks(const SparseVoxelGrid& voxel_grid, const Eigen::Vector3f& s,
+                    const Eigen::Vector3f& e, Func func) {
+  // Block b covers [b, b + 1) in this coordinate
+  const float scale = 1.f / (voxel_grid.resolution() *
+                             static_cast<float>(SparseVoxelGrid::kBlockSize));
+  const float offset = 0.5f / static_cast<float>(SparseVoxelGrid::kBlockSize);
+  const Eigen::Vector3f a = s * scale + Eigen::Vector3f::Constant(offset);
+  const Eigen::Vector3f b = e * scale + Eigen::Vector3f::Constant(offset);
+  const Eigen::Vector3f d = b - a;
+
+  Eigen::Vector3i cur = a.array().floor().cast<int>();
+  const Eigen::Vector3i last = b.array().floor().cast<int>();
+  Eigen::Vector3i step;
+  Eigen::Vector3f t_max, t_delta;
+  for (int i = 0; i < 3; i++) {
+    if (d[i] > 0.f) {
+      step[i] = 1;
+      t_max[i] = (static_cast<float>(cur[i] + 1) - a[i]) / d[i];
+      t_delta[i] = 1.f / d[i];
+    } else if (d[i] < 0.f) {
+      step[i] = -1;
+      t_max[i] = (static_cast<float>(cur[i]) - a[i]) / d[i];
+      t_delta[i] = -1.f / d[i];
+    } else {
+      step[i] = 0;
+      t_max[i] = std::numeric_limits<float>::max();
+      t_delta[i] = std::numeric_limits<float>::max();
+    }
+  }
+
+  const int max_step = (last - cur).cwiseAbs().sum();
+  for (int i = 0; i <= max_step; i++) {
+    func(cur);
+    if (cur == last) {
+      break;
+    }
+    int axis;
+    if (t_max.minCoeff(&axis) > 1.f) {
+      break;
+    }
+    cur[axis] += step[axis];
+    t_max[axis] += t_delta[axis];
+  }
+}
+
+// Image tile size of the ray ranges in Raycast()
+constexpr int kRayTileSize = 16;
+// Ray step in the truncation band relative to the sdf
+constexpr float kRayStepFactor = 0.8f;
+
+// Caches blocks by the parity of their indices, so that the 8 blocks around
+// a point and consecutive blocks along a ray do not evict each other
+class BlockCache {
+ public:
+  explicit BlockCache(const SparseVoxelGrid& voxel_grid)
+      : voxel_grid_(voxel_grid) {}
+
+  const SparseVoxelGrid::Block* find(const Eigen::Vector3i& block_index) {
+    Slot& slot = slots_[(block_index.x() & 1) | ((block_index.y() & 1) << 1) |
+                        ((block_index.z() & 1) << 2)];
+    if (!slot.cached || block_index != slot.index) {
+      const int block_id = voxel_grid_.find_block(block_index);
+      slot.block = block_id < 0 ? nullptr : &voxel_grid_.get_block(block_id);
+      slot.index = block_index;
+      slot.cached = true;
+    }
+    return slot.block;
+  }
+
+  // nullptr if unobserved
+  const TsdfVoxel* get(const Eigen::Vector3i& index) {
+    const SparseVoxelGrid::Block* block =
+        find(SparseVoxelGrid::get_block_index(index));
+    if (block == nullptr) {
+      return nullptr;
+    }
+    const TsdfVoxel& voxel =
+        block->voxels[SparseVoxelGrid::get_local_id(index)];
+    return voxel.weight > 0 ? &voxel : nullptr;
+  }
+
+ private:
+  struct Slot {
+    const SparseVoxelGrid::Block* block{nullptr};
+    Eigen::Vector3i index{0, 0, 0};
+    bool cached{false};
+  };
+
+  const SparseVoxelGrid& voxel_grid_;
+  std::array<Slot, 8> slots_;
+};
+
+// Trilinear sdf and its gradient at p. Returns false if any of the 8 voxels
+// is unobserved.
+bool InterpolateSdf(const SparseVoxelGrid& voxel_grid, BlockCache& cache,
+                    const Eigen::Vector3f& p, float* sdf,
+                    Eigen::Vector3f* grad) {
+  const Eigen::Vector3f u = p / voxel_grid.resolution();
+  const Eigen::Vector3f u0 = u.array().floor();
+  const Eigen::Vector3i i0 = u0.cast<int>();
+  const Eigen::Vector3f w = u - u0;
+  std::array<float, 8> v;
+  constexpr int bs = SparseVoxelGrid::kBlockSize;
+  if ((i0.x() & (bs - 1)) < bs - 1 && (i0.y() & (bs - 1)) < bs - 1 &&
+      (i0.z() & (bs - 1)) < bs - 1) {
+    // All in a block
+    const SparseVoxelGrid::Block* block =
+        cache.find(SparseVoxelGrid::get_block_index(i0));
+    if (block == nullptr) {
+      return false;
+    }
+    const int id0 = SparseVoxelGrid::get_local_id(i0);
+    for (int k = 0; k < 8; k++) {
+      const TsdfVoxel& voxel = block->voxels[id0 + (k & 1) +
+                                             ((k >> 1) & 1) * bs +
+                                             ((k >> 2) & 1) * bs * bs];
+      if (voxel.weight == 0) {
+        return false;
+      }
+      v[k] = voxel.get_sdf();
+    }
+  } else {
+    for (int k = 0; k < 8; k++) {
+      const TsdfVoxel* voxel =
+          cache.get(i0 + Eigen::Vector3i(k & 1, (k >> 1) & 1, (k >> 2) & 1));
+      if (voxel == nullptr) {
+        return false;
+      }
+      v[k] = voxel->get_sdf();
+    }
+  }
+
+  const float x0 = 1.f - w.x(), y0 = 1.f - w.y(), z0 = 1.f - w.z();
+  const float v00 = v[0] * x0 + v[1] * w.x();
+  const float v10 = v[2] * x0 + v[3] * w.x();
+  const float v01 = v[4] * x0 + v[5] * w.x();
+  const float v11 = v[6] * x0 + v[7] * w.x();
+  *sdf = (v00 * y0 + v10 * w.y()) * z0 + (v01 * y0 + v11 * w.y()) * w.z();
+  if (grad != nullptr) {
+    grad->x() = (v[1] - v[0]) * y0 * z0 + (v[3] - v[2]) * w.y() * z0 +
+                (v[5] - v[4]) * y0 * w.z() + (v[7] - v[6]) * w.y() * w.z();
+    grad->y() = (v[2] - v[0]) * x0 * z0 + (v[3] - v[1]) * w.x() * z0 +
+                (v[6] - v[4]) * x0 * w.z() + (v[7] - v[5]) * w.x() * w.z();
+    grad->z() = (v[4] - v[0]) * x0 * y0 + (v[5] - v[1]) * w.x() * y0 +
+                (v[6] - v[2]) * x0 * w.y() + (v[7] - v[3]) * w.x() * w.y();
+  }
+  return true;
+}
+
+// Per-tile depth range of the allocated blocks projected to the image.
+// Empty tiles have min > max.
+std::vector<Eigen::Vector2f> ComputeRayRanges(const SparseVoxelGrid& voxel_grid,
+                                              const Camera& camera,
+                                              float min_depth, float max_depth,
+                                              int tile_x_num, int tile_y_num) {
+  const Eigen::Affine3f w2c = camera.w2c().cast<float>();
+  const float block_len =
+      voxel_grid.resolution() * static_cast<float>(SparseVoxelGrid::kBlockSize);
+  const size_t tile_num = static_cast<size_t>(tile_x_num * tile_y_num);
+  const Eigen::Vector2f empty(std::numeric_limits<float>::max(),
+                              std::numeric_limits<float>::lowest());
+
+  // Partial ranges per task are merged afterwards to avoid atomics
+  const size_t block_num = voxel_grid.block_num();
+  const size_t task_num =
+      std::max<size_t>(1, std::min<size_t>(GetNumThreads(), block_num));
+  const size_t task_size = (block_num + task_num - 1) / task_num;
+  std::vector<std::vector<Eigen::Vector2f>> task_ranges(
+      task_num, std::vector<Eigen::Vector2f>(tile_num, empty));
+  parallel_for(size_t(0), task_num, [&](size_t t) {
+    std::vector<Eigen::Vector2f>& ranges = task_ranges[t];
+    const size_t ed = std::min(block_num, (t + 1) * task_size);
+    for (size_t i = t * task_size; i < ed; i++) {
+      const Eigen::Vector3f lo =
+          (voxel_grid.get_block(static_cast<int>(i)).index.cast<float>() *
+               block_len)
+              .array() -
+          voxel_grid.resolution() * 0.5f;
+      float z_min = std::numeric_limits<float>::max();
+      float z_max = std::numeric_limits<float>::lowest();
+      std::array<Eigen::Vector3f, 8> corners;
+      for (int k = 0; k < 8; k++) {
+        const Eigen::Vector3i corner(k & 1, (k >> 1) & 1, (k >> 2) & 1);
+        corners[k] = w2c * (lo + corner.cast<float>() * block_len);
+        z_min = std::min(z_min, corners[k].z());
+        z_max = std::max(z_max, corners[k].z());
+      }
+      if (z_max < min_depth || max_depth < z_min) {
+        continue;
+      }
+
+      int x_min = 0, y_min = 0, x_max = tile_x_num - 1, y_max = tile_y_num - 1;
+      if (z_min > std::numeric_limits<float>::epsilon()) {
+        Eigen::Vector2f p_min = Eigen::Vector2f::Constant(
+            std::numeric_limits<float>::max());
+        Eigen::Vector2f p_max = -p_min;
+        for (const Eigen::Vector3f& c : corners) {
+          Eigen::Vector2f p;
+          camera.Project(c, &p);
+          p_min = p_min.cwiseMin(p);
+          p_max = p_max.cwiseMax(p);
+        }
+        if (p_max.x() < -1.f || p_max.y() < -1.f ||
+            static_cast<float>(camera.width()) < p_min.x() ||
+            static_cast<float>(camera.height()) < p_min.y()) {
+          continue;
+        }
+        // 1 pixel margin for rounding of pixel centers
+        x_min = std::max(0, static_cast<int>(p_min.x() - 1.f) / kRayTileSize);
+        y_min = std::max(0, static_cast<int>(p_min.y() - 1.f) / kRayTileSize);
+        x_max = std::min(tile_x_num - 1,
+                         static_cast<int>(p_max.x() + 1.f) / kRayTileSize);
+        y_max = std::min(tile_y_num - 1,
+                         static_cast<int>(p_max.y() + 1.f) / kRayTileSize);
+      }
+      z_min = std::max(z_min, min_depth);
+      z_max = std::min(z_max, max_depth);
+      for (int y = y_min; y <= y_max; y++) {
+        for (int x = x_min; x <= x_max; x++) {
+          Eigen::Vector2f& r = ranges[y * tile_x_num + x];
+          r[0] = std::min(r[0], z_min);
+          r[1] = std::max(r[1], z_max);
+        }
+      }
+    }
+  });
+
+  std::vector<Eigen::Vector2f> ranges(tile_num, empty);
+  for (const auto& partial : task_ranges) {
+    for (size_t i = 0; i < tile_num; i++) {
+      ranges[i][0] = std::min(ranges[i][0], partial[i][0]);
+      ranges[i][1] = std::max(ranges[i][1], partial[i][1]);
+    }
+  }
+  return ranges;
+}
+
+}  // namespace
+
+namespace ugu {
+
+SparseVoxelGrid::SparseVoxelGrid() {}
+
+SparseVoxelGrid::~SparseVoxelGrid() {
+  if (swap_file_.is_open()) {
+    swap_file_.close();
+    std::remove(swap_path_.c_str());
+  }
+}
+
+bool SparseVoxelGrid::Init(float resolution) {
+  if (resolution < std::numeric_limits<float>::min()) {
+    LOGE("resolution must be positive %f\n", resolution);
+    return false;
+  }
+  resolution_ = resolution;
+  inv_resolution_ = 1.f / resolution;
+  Clear();
+  return true;
+}
+
+float SparseVoxelGrid::resolution() const { return resolution_; }
+
+bool SparseVoxelGrid::initialized() const { return resolution_ > 0.f; }
+
+void SparseVoxelGrid::Clear() {
+  blocks_.clear();
+  block_table_.clear();
+  last_used_.clear();
+  epoch_ = 0;
+  paged_table_.clear();
+  free_slots_.clear();
+  slot_num_ = 0;
+  paging_stats_ = PagingStats();
+}
+
+Eigen::Vector3f SparseVoxelGrid::get_pos(const Eigen::Vector3i& index) const {
+  return index.cast<float>() * resolution_;
+}
+
+Eigen::Vector3i SparseVoxelGrid::get_index(const Eigen::Vector3f& p) const {
+  return (p * inv_resolution_).array().round().cast<int>();
+}
+
+Eigen::Vector3i SparseVoxelGrid::get_block_index(const Eigen::Vector3i& index) {
+  // Floor division
+  Eigen::Vector3i block_index;
+  for (int i = 0; i < 3; i++) {
+    block_index[i] =
+        index[i] >= 0 ? index[i] / kBlockSize
+                      : (index[i] - kBlockSize + 1) / kBlockSize;
+  }
+  return block_index;
+}
+
+int SparseVoxelGrid::get_local_id(const Eigen::Vector3i& index) {
+  constexpr int mask = kBlockSize - 1;
+  return ((index.z() & mask) * kBlockSize + (index.y() & mask)) * kBlockSize +
+         (index.x() & mask);
+}
+
+size_t SparseVoxelGrid::block_num() const { return blocks_.size(); }
+
+SparseVoxelGrid::Block& SparseVoxelGrid::get_block(int block_id) {
+  return blocks_[block_id];
+}
+
+const SparseVoxelGrid::Block& SparseVoxelGrid::get_block(int block_id) const {
+  return blocks_[block_id];
+}
+
+int SparseVoxelGrid::find_block(const Eigen::Vector3i& block_index) const {
+  auto it = block_table_.find(block_index);
+  return it == block_table_.end() ? -1 : it->second;
+}
+
+int SparseVoxelGrid::allocate_block(const Eigen::Vector3i& block_index) {
+  auto [it, inserted] =
+      block_table_.emplace(block_index, static_cast<int>(blocks_.size()));
+  if (inserted) {
+    blocks_.emplace_back();
+    blocks_.back().index = block_index;
+    if (paging()) {
+      last_used_.push_back(epoch_);
+      auto paged = paged_table_.find(block_index);
+      if (paged != paged_table_.end()) {
+        if (!ReadSlot(paged->second, &blocks_.back())) {
+          LOGE("Failed to page in block (%d, %d, %d)\n", block_index.x(),
+               block_index.y(), block_index.z());
+          // Keep the block in the swap file
+          blocks_.pop_back();
+          last_used_.pop_back();
+          block_table_.erase(it);
+          return -1;
+        }
+        free_slots_.push_back(paged->second);
+        paged_table_.erase(paged);
+        paging_stats_.page_in_num++;
+      }
+    }
+  } else if (paging()) {
+    last_used_[it->second] = epoch_;
+  }
+  return it->second;
+}
+
+const TsdfVoxel* SparseVoxelGrid::get(const Eigen::Vector3i& index) const {
+  const int block_id = find_block(get_block_index(index));
+  if (block_id < 0) {
+    return nullptr;
+  }
+  return &blocks_[block_id].voxels[get_local_id(index)];
+}
+
+TsdfVoxel* SparseVoxelGrid::get_ptr(const Eigen::Vector3i& index) {
+  const int block_id = find_block(get_block_index(index));
+  if (block_id < 0) {
+    return nullptr;
+  }
+  return &blocks_[block_id].voxels[get_local_id(index)];
+}
+
+size_t SparseVoxelGrid::memory_bytes() const {
+  // Approximation of the hash table: a node and a bucket per block
+  const size_t table_bytes =
+      block_table_.size() *
+          (sizeof(std::pair<const Eigen::Vector3i, int>) + sizeof(void*)) +
+      block_table_.bucket_count() * sizeof(void*);
+  const size_t paged_bytes =
+      paged_table_.size() *
+          (sizeof(std::pair<const Eigen::Vector3i, int64_t>) +
+           sizeof(void*)) +
+      paged_table_.bucket_count() * sizeof(void*) +
+      (last_used_.capacity() + free_slots_.capacity()) * sizeof(uint64_t);
+  return blocks_.capacity() * sizeof(Block) + table_bytes + paged_bytes;
+}
+
+bool SparseVoxelGrid::EnablePaging(const std::string& swap_path,
+                                   size_t max_resident_blocks) {
+  if (swap_file_.is_open()) {
+    // Bring back the blocks in the old file before switching
+    for (const Eigen::Vector3i& b : paged_block_indices()) {
+      if (allocate_block(b) < 0) {
+        return false;
+      }
+    }
+    swap_file_.close();
+    std::remove(swap_path_.c_str());
+  }
+  paged_table_.clear();
+  free_slots_.clear();
+  slot_num_ = 0;
+  last_used_.clear();
+  max_resident_blocks_ = 0;
+  if (max_resident_blocks == 0) {
+    return true;
+  }
+
+  swap_file_.open(swap_path, std::ios::in | std::ios::out | std::ios::binary |
+                                 std::ios::trunc);
+  if (!swap_file_.is_open()) {
+    LOGE("Failed to open swap file %s\n", swap_path.c_str());
+    return false;
+  }
+  swap_path_ = swap_path;
+  max_resident_blocks_ = max_resident_blocks;
+  last_used_.assign(blocks_.size(), epoch_);
+  return true;
+}
+
+bool SparseVoxelGrid::paging() const { return max_resident_blocks_ > 0; }
+
+bool SparseVoxelGrid::Evict() {
+  if (!paging()) {
+    return true;
+  }
+  const uint64_t cur = epoch_;
+  if (blocks_.size() <= max_resident_blocks_) {
+    epoch_++;
+    return true;
+  }
+
+  // Oldest first. Ties are broken by id to be deterministic.
+  std::vector<std::pair<uint64_t, int>> order;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    if (last_used_[i] < cur) {
+      order.emplace_back(last_used_[i], static_cast<int>(i));
+    }
+  }
+  size_t evict_num = blocks_.size() - max_resident_blocks_;
+  if (order.size() < evict_num) {
+    LOGW("%d blocks are in use over max_resident_blocks %d\n",
+         static_cast<int>(blocks_.size() - order.size()),
+         static_cast<int>(max_resident_blocks_));
+    evict_num = order.size();
+  }
+  std::nth_element(order.begin(), order.begin() + evict_num, order.end());
+
+  // Write all the victims before changing the tables so that a failure
+  // leaves the grid as it was. Free slots are reused from the back.
+  const size_t reused_num = std::min(evict_num, free_slots_.size());
+  std::vector<int64_t> slots(evict_num);
+  for (size_t i = 0; i < evict_num; i++) {
+    slots[i] = i < reused_num
+                   ? free_slots_[free_slots_.size() - 1 - i]
+                   : slot_num_ + static_cast<int64_t>(i - reused_num);
+    const Block& block = blocks_[order[i].second];
+    if (!WriteSlot(slots[i], block)) {
+      LOGE("Failed to page out block (%d, %d, %d)\n", block.index.x(),
+           block.index.y(), block.index.z());
+      return false;
+    }
+  }
+  free_slots_.resize(free_slots_.size() - reused_num);
+  slot_num_ += static_cast<int64_t>(evict_num - reused_num);
+  epoch_++;
+
+  std::vector<uint8_t> evicted(blocks_.size(), 0);
+  for (size_t i = 0; i < evict_num; i++) {
+    paged_table_[blocks_[order[i].second].index] = slots[i];
+    evicted[order[i].second] = 1;
+    paging_stats_.page_out_num++;
+  }
+
+  // Compact the resident blocks keeping their order
+  size_t n = 0;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    if (evicted[i]) {
+      block_table_.erase(blocks_[i].index);
+      continue;
+    }
+    if (n != i) {
+      blocks_[n] = blocks_[i];
+      last_used_[n] = last_used_[i];
+      block_table_[blocks_[n].index] = static_cast<int>(n);
+    }
+    n++;
+  }
+  blocks_.resize(n);
+  last_used_.resize(n);
+  // Release the memory after a frame over the limit
+  if (blocks_.capacity() > 2 * std::max(n, max_resident_blocks_)) {
+    blocks_.shrink_to_fit();
+  }
+  return true;
+}
+
+size_t SparseVoxelGrid::paged_block_num() const { return paged_table_.size(); }
+
+std::vector<Eigen::Vector3i> SparseVoxelGrid::paged_block_indices() const {
+  std::vector<Eigen::Vector3i> indices;
+  indices.reserve(paged_table_.size());
+  for (const auto& [index, slot] : paged_table_) {
+    indices.push_back(index);
+  }
+  return indices;
+}
+
+bool SparseVoxelGrid::read_block(const Eigen::Vector3i& block_index,
+                                 Block* block) const {
+  const int block_id = find_block(block_index);
+  if (block_id >= 0) {
+    *block = blocks_[block_id];
+    return true;
+  }
+  auto paged = paged_table_.find(block_index);
+  if (paged == paged_table_.end()) {
+    return false;
+  }
+  block->index = block_index;
+  return ReadSlot(paged->second, block);
+}
+
+const SparseVoxelGrid::PagingStats& SparseVoxelGrid::paging_stats() const {
+  return paging_stats_;
+}
+
+void SparseVoxelGrid::ResetPagingStats() { paging_stats_ = PagingStats(); }
+
+bool SparseVoxelGrid::ReadSlot(int64_t slot, Block* block) const {
+  constexpr std::streamsize size = sizeof(block->voxels);
+  std::lock_guard<std::mutex> lock(swap_mtx_);
+  swap_file_.seekg(static_cast<std::streamoff>(slot) * size);
+  swap_file_.read(reinterpret_cast<char*>(block->voxels.data()), size);
+  if (!swap_file_) {
+    swap_file_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool SparseVoxelGrid::WriteSlot(int64_t slot, const Block& block) {
+  constexpr std::streamsize size = sizeof(block.voxels);
+  std::lock_guard<std::mutex> lock(swap_mtx_);
+  swap_file_.seekp(static_cast<std::streamoff>(slot) * size);
+  swap_file_.write(reinterpret_cast<const char*>(block.voxels.data()), size);
+  if (!swap_file_) {
+    swap_file_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool FuseDepth(const Camera& camera, const Image1f& depth,
+               const VoxelUpdateOption& option, SparseVoxelGrid& voxel_grid,
+               const Image3b& color) {
+  if (!voxel_grid.initialized() || !ValidateOption(option)) {
+    return false;
+  }
+
+  const bool with_color = depth.cols == color.cols && depth.rows == color.rows;
+  const Eigen::Affine3f c2w = camera.c2w().cast<float>();
+  const Eigen::Affine3f w2c = camera.w2c().cast<float>();
+  const float band = option.truncation_band;
+
+  // Allocate the blocks crossed by the truncation band around each depth
+  // along its ray. Keys are collected per row block and then inserted in
+  // order so that the block order is deterministic.
+  const size_t task_num = (depth.rows + kRowBlock - 1) / kRowBlock;
+  std::vector<std::vector<Eigen::Vector3i>> task_blocks(task_num);
+  parallel_for(size_t(0), task_num, [&](size_t t) {
+    const Eigen::Vector3i invalid =
+        Eigen::Vector3i::Constant(std::numeric_limits<int>::min());
+    std::vector<Eigen::Vector3i> recent(kRecentBlockNum, invalid);
+    std::vector<Eigen::Vector3i>& blocks = task_blocks[t];
+    const int y_ed = std::min(depth.rows, static_cast<int>(t + 1) * kRowBlock);
+    for (int y = static_cast<int>(t) * kRowBlock; y < y_ed; y++) {
+      for (int x = 0; x < depth.cols; x++) {
+        const float d = depth.at<float>(y, x);
+        if (d < std::numeric_limits<float>::epsilon()) {
+          continue;
+        }
+        Eigen::Vector3f camera_p;
+        camera.Unproject({static_cast<float>(x), static_cast<float>(y)}, d,
+                         &camera_p);
+        const float len = camera_p.norm();
+        const Eigen::Vector3f ray = camera_p / len;
+        const Eigen::Vector3f s = c2w * (ray * std::max(0.f, len - band));
+        const Eigen::Vector3f e = c2w * (ray * (len + band));
+        TraverseBlocks(voxel_grid, s, e, [&](const Eigen::Vector3i& b) {
+          Eigen::Vector3i& slot = recent[RecentSlot(b)];
+          if (slot != b) {
+            slot = b;
+            blocks.push_back(b);
+          }
+        });
+      }
+    }
+  });
+
+  // Blocks failed to be paged in are not updated
+  bool paged_in = true;
+  std::vector<int> frame_blocks;
+  std::vector<bool> in_frame;
+  for (const auto& blocks : task_blocks) {
+    for (const Eigen::Vector3i& b : blocks) {
+      const int block_id = voxel_grid.allocate_block(b);
+      if (block_id < 0) {
+        paged_in = false;
+        continue;
+      }
+      if (in_frame.size() <= static_cast<size_t>(block_id)) {
+        in_frame.resize(voxel_grid.block_num(), false);
+      }
+      if (!in_frame[block_id]) {
+        in_frame[block_id] = true;
+        frame_blocks.push_back(block_id);
+      }
+    }
+  }
+
+  // Projective TSDF update of the voxels in the allocated blocks. Each block
+  // is updated by a single task.
+  parallel_for(size_t(0), frame_blocks.size(), [&](size_t i) {
+    constexpr int bs = SparseVoxelGrid::kBlockSize;
+    SparseVoxelGrid::Block& block = voxel_grid.get_block(frame_blocks[i]);
+    const Eigen::Vector3i base = block.index * bs;
+    for (int z = 0; z < bs; z++) {
+      for (int y = 0; y < bs; y++) {
+        for (int x = 0; x < bs; x++) {
+          TsdfVoxel& voxel = block.voxels[(z * bs + y) * bs + x];
+          if (voxel.weight > option.voxel_max_update_num) {
+            continue;
+          }
+
+          float dist;
+          Eigen::Vector2i pixel;
+          if (!ProjectiveTsdf(
+                  camera, depth, band,
+                  w2c * voxel_grid.get_pos(base + Eigen::Vector3i(x, y, z)),
+                  &dist, &pixel) ||
+              (!option.update_free_space && dist >= 1.f)) {
+            continue;
+          }
+
+          Eigen::Vector3f c = Eigen::Vector3f::Zero();
+          if (with_color) {
+            const Vec3b& col = color.at<Vec3b>(pixel.y(), pixel.x());
+            c = {static_cast<float>(col[0]), static_cast<float>(col[1]),
+                 static_cast<float>(col[2])};
+          }
+          UpdateTsdfVoxel(&voxel, option, dist, with_color, c);
+        }
+      }
+    }
+  });
+
+  return voxel_grid.Evict() && paged_in;
+}
+
+bool FusePoints(const std::vector<Eigen::Vector3f>& points,
+                const std::vector<Eigen::Vector3f>& normals,
+                const VoxelUpdateOption& option, SparseVoxelGrid& voxel_grid,
+                const std::vector<Eigen::Vector3f>& colors, int sample_num) {
+  if (!voxel_grid.initialized() || !ValidateOption(option)) {
+    return false;
+  }
+
+  const bool with_color = points.size() == colors.size();
+  const float band = option.truncation_band;
+
+  bool paged_in = true;
+  auto update = [&](const Eigen::Vector3i& voxel_idx, const Eigen::Vector3f& p,
+                    const Eigen::Vector3f& n, const Eigen::Vector3f& c) {
+    const Eigen::Vector3f diff = voxel_grid.get_pos(voxel_idx) - p;
+    const float sign = std::signbit(diff.dot(n)) ? -1.f : 1.f;
+    const float dist = diff.norm() * sign;
+    // Test the band first not to allocate blocks which are never updated
+    if (dist < -band) {
+      return;
+    }
+    const int block_id = voxel_grid.allocate_block(
+        SparseVoxelGrid::get_block_index(voxel_idx));
+    if (block_id < 0) {
+      paged_in = false;
+      return;
+    }
+    TsdfVoxel& voxel = voxel_grid.get_block(block_id)
+                           .voxels[SparseVoxelGrid::get_local_id(voxel_idx)];
+    UpdateTsdfVoxel(&voxel, option, std::min(1.0f, dist / band), with_color,
+                    c);
+  };
+
+  for (size_t i = 0; i < points.size(); i++) {
+    const Eigen::Vector3f& p = points[i];
+    const Eigen::Vector3f& n = normals[i];
+    const Eigen::Vector3f c =
+        with_color ? colors[i] : Eigen::Vector3f::Zero().eval();
+    if (sample_num < 1) {
+      // Splat to 26-neighbors
+      const Eigen::Vector3i voxel_idx = voxel_grid.get_index(p);
+      for (int z = -1; z <= 1; z++) {
+        for (int y = -1; y <= 1; y++) {
+          for (int x = -1; x <= 1; x++) {
+            update(voxel_idx + Eigen::Vector3i(x, y, z), p, n, c);
+          }
+        }
+      }
+    } else {
+      // Sample along with normal direction
+      const float step = voxel_grid.resolution();
+      for (int k = -sample_num; k < sample_num + 1; k++) {
+        update(voxel_grid.get_index(p + n * (k * step)), p, n, c);
+      }
+    }
+  }
+
+  return voxel_grid.Evict() && paged_in;
+}
+
+bool Raycast(const SparseVoxelGrid& voxel_grid, const Camera& camera,
+             float truncation_band, float min_depth, float max_depth,
+             Image1f* depth, Image3f* normal, Image3b* color) {
+  if (!voxel_grid.initialized()) {
+    return false;
+  }
+  if (truncation_band <= 0.f) {
+    LOGE("truncation_band must be positive %f\n", truncation_band);
+    return false;
+  }
+
+  const int w = camera.width();
+  const int h = camera.height();
+  *depth = Image1f::zeros(h, w);
+  if (normal != nullptr) {
+    *normal = Image3f::zeros(h, w);
+  }
+  if (color != nullptr) {
+    *color = Image3b::zeros(h, w);
+  }
+
+  const int tile_x_num = (w + kRayTileSize - 1) / kRayTileSize;
+  const int tile_y_num = (h + kRayTileSize - 1) / kRayTileSize;
+  const std::vector<Eigen::Vector2f> ranges = ComputeRayRanges(
+      voxel_grid, camera, min_depth, max_depth, tile_x_num, tile_y_num);
+
+  const Eigen::Matrix3f R = camera.c2w().rotation().cast<float>();
+  const Eigen::Vector3f org = camera.c2w().translation().cast<float>();
+  const float res = voxel_grid.resolution();
+  constexpr int bs = SparseVoxelGrid::kBlockSize;
+
+  parallel_for(0, h, [&](int y) {
+    BlockCache cache(voxel_grid);
+    for (int x = 0; x < w; x++) {
+      const Eigen::Vector2f& range =
+          ranges[(y / kRayTileSize) * tile_x_num + x / kRayTileSize];
+      if (range[0] > range[1]) {
+        continue;
+      }
+
+      // Marched by z. dir is the displacement per unit z.
+      Eigen::Vector3f dir_c;
+      camera.Unproject(
+          Eigen::Vector2f(static_cast<float>(x), static_cast<float>(y)), 1.f,
+          &dir_c);
+      const Eigen::Vector3f dir = R * dir_c;
+      const float inv_len = 1.f / dir_c.norm();
+
+      float z = range[0];
+      float prev_z = z;
+      float prev_sdf = -1.f;
+      float next_sdf = 0.f;
+      bool found = false;
+      while (z <= range[1]) {
+        const Eigen::Vector3f p = org + dir * z;
+        const Eigen::Vector3i index = voxel_grid.get_index(p);
+        const Eigen::Vector3i block_index =
+            SparseVoxelGrid::get_block_index(index);
+        const SparseVoxelGrid::Block* block = cache.find(block_index);
+        if (block == nullptr) {
+          // Skip to the exit of the block
+          const Eigen::Vector3f lo =
+              (block_index * bs).cast<float>() * res -
+              Eigen::Vector3f::Constant(res * 0.5f);
+          float t_exit = std::numeric_limits<float>::max();
+          for (int i = 0; i < 3; i++) {
+            if (dir[i] > 0.f) {
+              t_exit = std::min(t_exit, (lo[i] + res * bs - p[i]) / dir[i]);
+            } else if (dir[i] < 0.f) {
+              t_exit = std::min(t_exit, (lo[i] - p[i]) / dir[i]);
+            }
+          }
+          z += std::max(t_exit, 0.f) + res * 0.01f * inv_len;
+          prev_sdf = -1.f;
+          continue;
+        }
+
+        const TsdfVoxel& voxel =
+            block->voxels[SparseVoxelGrid::get_local_id(index)];
+        if (voxel.weight == 0) {
+          prev_sdf = -1.f;
+          z += res * inv_len;
+          continue;
+        }
+
+        const float sdf = voxel.get_sdf();
+        if (prev_sdf > 0.f && sdf <= 0.f) {
+          next_sdf = sdf;
+          found = true;
+          break;
+        }
+
+        prev_sdf = sdf;
+        prev_z = z;
+        z += std::max(res, sdf * truncation_band * kRayStepFactor) * inv_len;
+      }
+
+      if (!found) {
+        continue;
+      }
+
+      // Refine the crossing by trilinear sdf if available. The gradient at
+      // the sample behind the surface gives the normal.
+      float f0 = prev_sdf, f1 = next_sdf, tmp;
+      Eigen::Vector3f grad;
+      const bool interpolated =
+          InterpolateSdf(voxel_grid, cache, org + dir * z, &tmp, &grad) &&
+          grad.squaredNorm() > std::numeric_limits<float>::min();
+      if (interpolated &&
+          InterpolateSdf(voxel_grid, cache, org + dir * prev_z, &f0, nullptr) &&
+          f0 > tmp) {
+        f1 = tmp;
+      } else {
+        f0 = prev_sdf;
+      }
+      z = prev_z + (z - prev_z) * f0 / (f0 - f1);
+
+      depth->at<float>(y, x) = z;
+      const Eigen::Vector3f p = org + dir * z;
+      if (normal != nullptr && interpolated) {
+        const Eigen::Vector3f n = (R.transpose() * grad).normalized();
+        normal->at<Vec3f>(y, x) = {n.x(), n.y(), n.z()};
+      }
+      if (color != nullptr) {
+        const TsdfVoxel* voxel = cache.get(voxel_grid.get_index(p));
+        if (voxel != nullptr) {
+          color->at<Vec3b>(y, x) = {voxel->col[0], voxel->col[1],
+                                    voxel->col[2]};
+        }
+      }
+    }
+  });
+
+  return true;
+}
+
+}  // namespace ugu
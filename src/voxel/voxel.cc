@@ -16,6 +16,7 @@
 #include "ugu/timer.h"
 #include "ugu/util/image_util.h"
 #include "ugu/util/rgbd_util.h"
+#include "ugu/util/thread_util.h"
 
 namespace {
 using namespace ugu;
@@ -23,7 +24,7 @@ inline void UpdateVoxel(const Eigen::Vector3i& voxel_idx,
                         const VoxelUpdateOption& option,
                         const Eigen::Vector3f& p, const Eigen::Vector3f& n,
                         const Eigen::Vector3f& c, bool with_color,
-                        VoxelGrid& voxel_grid) {
+                        VoxelGrid& voxel_grid, DirtyBricks& dirty_bricks) {
   if (voxel_idx[0] < 0 || voxel_grid.voxel_num()[0] <= voxel_idx[0] ||
       voxel_idx[1] < 0 || voxel_grid.voxel_num()[1] <= voxel_idx[1] ||
       voxel_idx[2] < 0 || voxel_grid.voxel_num()[2] <= voxel_idx[2]) {
@@ -43,6 +44,8 @@ inline void UpdateVoxel(const Eigen::Vector3i& voxel_idx,
     }
   }
 
+  dirty_bricks.Mark(voxel_idx[0], voxel_idx[1], voxel_idx[2]);
+
   if (voxel->update_num < 1) {
     voxel->sdf = dist;
     voxel->col = c;
@@ -60,7 +63,8 @@ inline void UpdateVoxel(const Eigen::Vector3i& voxel_idx,
 inline void FusePointBase(const Eigen::Vector3f& p, const Eigen::Vector3f& n,
                           bool with_color, const Eigen::Vector3f& c,
                           const VoxelUpdateOption& option,
-                          VoxelGrid& voxel_grid, int sample_num) {
+                          VoxelGrid& voxel_grid, int sample_num,
+                          DirtyBricks& dirty_bricks) {
   const auto& voxel_idx = voxel_grid.get_index(p);
   if (voxel_idx[0] < 0 || voxel_grid.voxel_num()[0] <= voxel_idx[0] ||
       voxel_idx[1] < 0 || voxel_grid.voxel_num()[1] <= voxel_idx[1] ||
@@ -74,7 +78,7 @@ inline void FusePointBase(const Eigen::Vector3f& p, const Eigen::Vector3f& n,
       for (int y = -1; y <= 1; y++) {
         for (int x = -1; x <= 1; x++) {
           UpdateVoxel(voxel_idx + Eigen::Vector3i(x, y, z), option, p, n, c,
-                      with_color, voxel_grid);
+                      with_color, voxel_grid, dirty_bricks);
         }
       }
     }
@@ -118,6 +122,8 @@ inline void FusePointBase(const Eigen::Vector3f& p, const Eigen::Vector3f& n,
         }
       }
 
+      dirty_bricks.Mark(voxel_idx_[0], voxel_idx_[1], voxel_idx_[2]);
+
       if (voxel->update_num < 1) {
         voxel->sdf = dist;
         voxel->col = c;
@@ -134,10 +140,237 @@ inline void FusePointBase(const Eigen::Vector3f& p, const Eigen::Vector3f& n,
   }
 }
 
+void MakePosList(int num, float len, float bb_min, float offset,
+                 std::vector<float>* pos_list) {
+  pos_list->resize(num);
+  for (int i = 0; i < num; i++) {
+    (*pos_list)[i] =
+        len * (static_cast<float>(i) / static_cast<float>(num)) + bb_min +
+        offset;
+  }
+}
+
+// Index of the nearest position. -1 if p is out of range.
+int NearestPosIndex(const std::vector<float>& pos_list, float p) {
+  auto it = std::lower_bound(pos_list.begin(), pos_list.end(), p);
+  if (it == pos_list.end()) {
+    return -1;
+  }
+  if (it != pos_list.begin()) {
+    float d0 = std::abs(*it - p);
+    float d1 = std::abs(*(it - 1) - p);
+    if (d1 < d0) {
+      it--;
+    }
+  }
+  return static_cast<int>(std::distance(pos_list.begin(), it));
+}
+
+// Return -1 if any of xyz is out of range
+Eigen::Vector3i NearestIndex(const std::vector<float>& x_pos_list,
+                             const std::vector<float>& y_pos_list,
+                             const std::vector<float>& z_pos_list,
+                             const Eigen::Vector3f& p) {
+  Eigen::Vector3i index{-1, -1, -1};
+  const int x = NearestPosIndex(x_pos_list, p.x());
+  if (x < 0) {
+    return index;
+  }
+  const int y = NearestPosIndex(y_pos_list, p.y());
+  if (y < 0) {
+    return index;
+  }
+  const int z = NearestPosIndex(z_pos_list, p.z());
+  if (z < 0) {
+    return index;
+  }
+  index = {x, y, z};
+  return index;
+}
+
+// Bricks of dense grids to cull voxels in FuseDepth()
+constexpr int kBrickSize = DirtyBricks::kBrickSize;
+// Pixels per side of the tiles to bound depth of bricks
+constexpr int kDepthTileSize = 16;
+
+// Min and max valid depth per tile
+class DepthTiles {
+ public:
+  explicit DepthTiles(const Image1f& depth)
+      : cols_((depth.cols + kDepthTileSize - 1) / kDepthTileSize),
+        rows_((depth.rows + kDepthTileSize - 1) / kDepthTileSize),
+        min_d_(cols_ * rows_, std::numeric_limits<float>::max()),
+        max_d_(cols_ * rows_, 0.f) {
+    for (int y = 0; y < depth.rows; y++) {
+      for (int x = 0; x < depth.cols; x++) {
+        const float d = depth.at<float>(y, x);
+        if (d < std::numeric_limits<float>::epsilon()) {
+          continue;
+        }
+        const int t = (y / kDepthTileSize) * cols_ + x / kDepthTileSize;
+        min_d_[t] = std::min(min_d_[t], d);
+        max_d_[t] = std::max(max_d_[t], d);
+      }
+    }
+  }
+
+  // Depth range in the pixel rectangle. false if no valid depth.
+  bool Range(const Eigen::Vector2i& p_min, const Eigen::Vector2i& p_max,
+             float* min_d, float* max_d) const {
+    *min_d = std::numeric_limits<float>::max();
+    *max_d = 0.f;
+    for (int ty = p_min.y() / kDepthTileSize; ty <= p_max.y() / kDepthTileSize;
+         ty++) {
+      for (int tx = p_min.x() / kDepthTileSize;
+           tx <= p_max.x() / kDepthTileSize; tx++) {
+        *min_d = std::min(*min_d, min_d_[ty * cols_ + tx]);
+        *max_d = std::max(*max_d, max_d_[ty * cols_ + tx]);
+      }
+    }
+    return *max_d > 0.f;
+  }
+
+ private:
+  int cols_;
+  int rows_;
+  std::vector<float> min_d_;
+  std::vector<float> max_d_;
+};
+
+// Origins of the bricks which may be updated by FuseDepth(). Bricks are culled
+// conservatively by their bounding boxes, so the result is the same as
+// visiting all voxels.
+template <typename PosFunc>
+std::vector<Eigen::Vector3i> FindFusionBricks(const Camera& camera,
+                                              const Eigen::Affine3f& w2c,
+                                              const Image1f& depth,
+                                              const VoxelUpdateOption& option,
+                                              const Eigen::Vector3i& voxel_num,
+                                              PosFunc get_pos) {
+  const DepthTiles tiles(depth);
+  const Eigen::Vector3i brick_num =
+      (voxel_num.array() + kBrickSize - 1) / kBrickSize;
+  std::vector<std::vector<Eigen::Vector3i>> slices(brick_num.z());
+  parallel_for(0, brick_num.z(), [&](int bz) {
+    for (int by = 0; by < brick_num.y(); by++) {
+      for (int bx = 0; bx < brick_num.x(); bx++) {
+        const Eigen::Vector3i st = Eigen::Vector3i(bx, by, bz) * kBrickSize;
+        const Eigen::Vector3i last =
+            (st.array() + kBrickSize).min(voxel_num.array()) - 1;
+        const Eigen::Vector3f st_pos = get_pos(st[0], st[1], st[2]);
+        const Eigen::Vector3f last_pos = get_pos(last[0], last[1], last[2]);
+
+        float min_z = std::numeric_limits<float>::max();
+        float max_z = std::numeric_limits<float>::lowest();
+        Eigen::Vector2f p_min = Eigen::Vector2f::Constant(min_z);
+        Eigen::Vector2f p_max = Eigen::Vector2f::Constant(max_z);
+        for (int i = 0; i < 8; i++) {
+          const Eigen::Vector3f corner((i & 1) ? last_pos.x() : st_pos.x(),
+                                       (i & 2) ? last_pos.y() : st_pos.y(),
+                                       (i & 4) ? last_pos.z() : st_pos.z());
+          const Eigen::Vector3f corner_c = w2c * corner;
+          min_z = std::min(min_z, corner_c.z());
+          max_z = std::max(max_z, corner_c.z());
+          if (corner_c.z() > 0.f) {
+            Eigen::Vector2f image_p;
+            camera.Project(corner_c, &image_p);
+            p_min = p_min.cwiseMin(image_p);
+            p_max = p_max.cwiseMax(image_p);
+          }
+        }
+        // Behind the camera
+        if (max_z < 0.f) {
+          continue;
+        }
+        // The footprint is unbounded if a corner is behind the camera.
+        // Otherwise the projected box is inside the hull of its corners.
+        Eigen::Vector2i footprint_min(0, 0);
+        Eigen::Vector2i footprint_max(depth.cols - 1, depth.rows - 1);
+        if (min_z > 0.f) {
+          if (p_max.x() < 0.f || p_max.y() < 0.f ||
+              depth.cols - 1 < p_min.x() || depth.rows - 1 < p_min.y()) {
+            continue;
+          }
+          // One pixel margin for rounding in projection
+          footprint_min = footprint_min.cwiseMax(
+              (p_min.array().floor() - 1.f).cast<int>().matrix());
+          footprint_max = footprint_max.cwiseMin(
+              (p_max.array().ceil() + 1.f).cast<int>().matrix());
+        }
+        float min_d, max_d;
+        if (!tiles.Range(footprint_min, footprint_max, &min_d, &max_d)) {
+          continue;
+        }
+        // The distance along ray is not less than the depth difference
+        if (option.use_truncation && min_z - max_d > option.truncation_band) {
+          continue;
+        }
+        if (!option.update_free_space &&
+            min_d - max_z > option.truncation_band) {
+          continue;
+        }
+        slices[bz].push_back(st);
+      }
+    }
+  });
+
+  std::vector<Eigen::Vector3i> bricks;
+  for (const auto& slice : slices) {
+    bricks.insert(bricks.end(), slice.begin(), slice.end());
+  }
+  return bricks;
+}
+
 }  // namespace
 
 namespace ugu {
 
+void DirtyBricks::Init(const Eigen::Vector3i& voxel_num) {
+  brick_num_ = (voxel_num.array() + kBrickSize - 1) / kBrickSize;
+  flags_.assign(static_cast<size_t>(brick_num_.prod()), 0);
+}
+
+const Eigen::Vector3i& DirtyBricks::brick_num() const { return brick_num_; }
+
+void DirtyBricks::Mark(int x, int y, int z) {
+  MarkBrick(Eigen::Vector3i(x, y, z) / kBrickSize);
+}
+
+void DirtyBricks::MarkBrick(const Eigen::Vector3i& brick) {
+  flags_[(brick.z() * brick_num_.y() + brick.y()) * brick_num_.x() +
+         brick.x()] = 1;
+}
+
+void DirtyBricks::Merge(const DirtyBricks& other) {
+  for (size_t i = 0; i < flags_.size(); i++) {
+    flags_[i] |= other.flags_[i];
+  }
+}
+
+void DirtyBricks::MarkAll() { std::fill(flags_.begin(), flags_.end(), 1); }
+
+bool DirtyBricks::dirty(const Eigen::Vector3i& brick) const {
+  return flags_[(brick.z() * brick_num_.y() + brick.y()) * brick_num_.x() +
+                brick.x()] != 0;
+}
+
+std::vector<Eigen::Vector3i> DirtyBricks::Get() const {
+  std::vector<Eigen::Vector3i> bricks;
+  size_t i = 0;
+  for (int z = 0; z < brick_num_.z(); z++) {
+    for (int y = 0; y < brick_num_.y(); y++) {
+      for (int x = 0; x < brick_num_.x(); x++) {
+        if (flags_[i++] != 0) {
+          bricks.emplace_back(x, y, z);
+        }
+      }
+    }
+  }
+  return bricks;
+}
+
+void DirtyBricks::Clear() { std::fill(flags_.begin(), flags_.end(), 0); }
+
 Voxel::Voxel() {}
 Voxel::~Voxel() {}
 
@@ -224,6 +457,8 @@ bool VoxelGrid::Init(const Eigen::Vector3f& bb_max,
     }
   }
 
+  dirty_bricks_.Init(voxel_num_);
+
   return true;
 }
 
@@ -253,62 +488,104 @@ Eigen::Vector3i VoxelGrid::get_index(const Eigen::Vector3f& p) const {
   // TODO: Better way to handle voxel indices
   // Real-time 3D reconstruction at scale using voxel hashing
   // https://niessnerlab.org/papers/2013/4hashing/niessner2013hashing.pdf
+  return NearestIndex(x_pos_list, y_pos_list, z_pos_list, p);
+}
 
-  Eigen::Vector3i index{-1, -1, -1};
-
-  // Return -1 if any of xyz is out of range
-  auto x_it = std::lower_bound(x_pos_list.begin(), x_pos_list.end(), p.x());
-  if (x_it == x_pos_list.end()) {
-    return index;
+void VoxelGrid::Clear() {
+#if defined(_OPENMP) && defined(UGU_USE_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (int64_t i = 0; i < static_cast<int64_t>(voxels_.size()); i++) {
+    voxels_[i].sdf = InvalidSdf::kVal;
+    voxels_[i].update_num = 0;
   }
-  auto y_it = std::lower_bound(y_pos_list.begin(), y_pos_list.end(), p.y());
-  if (y_it == y_pos_list.end()) {
-    return index;
+  dirty_bricks_.MarkAll();
+}
+
+DirtyBricks& VoxelGrid::dirty_bricks() { return dirty_bricks_; }
+
+const DirtyBricks& VoxelGrid::dirty_bricks() const { return dirty_bricks_; }
+
+TsdfVoxelGrid::TsdfVoxelGrid() {}
+
+TsdfVoxelGrid::~TsdfVoxelGrid() {}
+
+bool TsdfVoxelGrid::Init(const Eigen::Vector3f& bb_max,
+                         const Eigen::Vector3f& bb_min, float resolution) {
+  if (resolution < std::numeric_limits<float>::min()) {
+    LOGE("resolution must be positive %f\n", resolution);
+    return false;
   }
-  auto z_it = std::lower_bound(z_pos_list.begin(), z_pos_list.end(), p.z());
-  if (z_it == z_pos_list.end()) {
-    return index;
+  if (bb_max.x() <= bb_min.x() || bb_max.y() <= bb_min.y() ||
+      bb_max.z() <= bb_min.z()) {
+    LOGE("input bounding box is invalid\n");
+    return false;
   }
 
-  if (x_it != x_pos_list.begin()) {
-    float x0 = std::abs(*x_it - p.x());
-    float x1 = std::abs(*(x_it - 1) - p.x());
-    if (x1 < x0) {
-      x_it--;
-    }
-  }
+  bb_max_ = bb_max;
+  bb_min_ = bb_min;
+  resolution_ = resolution;
 
-  if (y_it != y_pos_list.begin()) {
-    float y0 = std::abs(*y_it - p.y());
-    float y1 = std::abs(*(y_it - 1) - p.y());
-    if (y1 < y0) {
-      y_it--;
-    }
+  Eigen::Vector3f diff = bb_max_ - bb_min_;
+  for (int i = 0; i < 3; i++) {
+    voxel_num_[i] = static_cast<int>(diff[i] / resolution_);
   }
 
-  if (z_it != z_pos_list.begin()) {
-    float z0 = std::abs(*z_it - p.z());
-    float z1 = std::abs(*(z_it - 1) - p.z());
-    if (z1 < z0) {
-      z_it--;
-    }
+  if (static_cast<int64_t>(voxel_num_.x()) * voxel_num_.y() * voxel_num_.z() >
+      std::numeric_limits<int>::max()) {
+    LOGE("too many voxels\n");
+    return false;
   }
 
-  index.x() = static_cast<int>(std::distance(x_pos_list.begin(), x_it));
-  index.y() = static_cast<int>(std::distance(y_pos_list.begin(), y_it));
-  index.z() = static_cast<int>(std::distance(z_pos_list.begin(), z_it));
+  xy_slice_num_ = voxel_num_[0] * voxel_num_[1];
 
-  return index;
+  voxels_.clear();
+  voxels_.resize(voxel_num_.x() * voxel_num_.y() * voxel_num_.z());
+
+  // Same positions as VoxelGrid
+  float offset = resolution_ * 0.5f;
+  MakePosList(voxel_num_.x(), diff.x(), bb_min_.x(), offset, &x_pos_list);
+  MakePosList(voxel_num_.y(), diff.y(), bb_min_.y(), offset, &y_pos_list);
+  MakePosList(voxel_num_.z(), diff.z(), bb_min_.z(), offset, &z_pos_list);
+
+  dirty_bricks_.Init(voxel_num_);
+
+  return true;
 }
 
-void VoxelGrid::Clear() {
-#if defined(_OPENMP) && defined(UGU_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
-#endif
-  for (int64_t i = 0; i < static_cast<int64_t>(voxels_.size()); i++) {
-    voxels_[i].sdf = InvalidSdf::kVal;
-    voxels_[i].update_num = 0;
-  }
+const Eigen::Vector3i& TsdfVoxelGrid::voxel_num() const { return voxel_num_; }
+
+const TsdfVoxel& TsdfVoxelGrid::get(int x, int y, int z) const {
+  return voxels_[z * xy_slice_num_ + (y * voxel_num_.x() + x)];
+}
+
+TsdfVoxel* TsdfVoxelGrid::get_ptr(int x, int y, int z) {
+  return &voxels_[z * xy_slice_num_ + (y * voxel_num_.x() + x)];
+}
+
+std::vector<TsdfVoxel>& TsdfVoxelGrid::get_all() { return voxels_; }
+
+Eigen::Vector3f TsdfVoxelGrid::get_pos(int x, int y, int z) const {
+  return {x_pos_list[x], y_pos_list[y], z_pos_list[z]};
+}
+
+float TsdfVoxelGrid::resolution() const { return resolution_; }
+
+bool TsdfVoxelGrid::initialized() const { return !voxels_.empty(); }
+
+Eigen::Vector3i TsdfVoxelGrid::get_index(const Eigen::Vector3f& p) const {
+  return NearestIndex(x_pos_list, y_pos_list, z_pos_list, p);
+}
+
+void TsdfVoxelGrid::Clear() {
+  std::fill(voxels_.begin(), voxels_.end(), TsdfVoxel());
+  dirty_bricks_.MarkAll();
+}
+
+DirtyBricks& TsdfVoxelGrid::dirty_bricks() { return dirty_bricks_; }
+
+const DirtyBricks& TsdfVoxelGrid::dirty_bricks() const {
+  return dirty_bricks_;
 }
 
 VoxelUpdateOption GenFuseDepthDefaultOption(float resolution) {
@@ -332,76 +609,94 @@ bool FuseDepth(const Camera& camera, const Image1f& depth,
 
   Eigen::Affine3f w2c = camera.w2c().cast<float>();
 
+  // Visit only the bricks intersecting the frustum and the band around depth
+  const std::vector<Eigen::Vector3i> bricks = FindFusionBricks(
+      camera, w2c, depth, option, voxel_grid.voxel_num(),
+      [&](int x, int y, int z) { return voxel_grid.get(x, y, z).pos; });
+
   // https://www.microsoft.com/en-us/research/wp-content/uploads/2016/02/ismar2011.pdf
   // 3.3 Mapping as Surface Reconstruction
   // "Instead, we use a projective truncated signed distance function that is
   // readily computed and trivially parallelisable."
-#if defined(_OPENMP) && defined(UGU_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
-#endif
-  for (int z = 0; z < voxel_grid.voxel_num().z(); z++) {
-    for (int y = 0; y < voxel_grid.voxel_num().y(); y++) {
-      for (int x = 0; x < voxel_grid.voxel_num().x(); x++) {
-        Voxel* voxel = voxel_grid.get_ptr(x, y, z);
-
-        if (voxel->outside || voxel->update_num > option.voxel_max_update_num) {
-          continue;
-        }
+  parallel_for(size_t(0), bricks.size(), [&](size_t i) {
+    const Eigen::Vector3i& st = bricks[i];
+    const Eigen::Vector3i ed =
+        (st.array() + kBrickSize).min(voxel_grid.voxel_num().array());
+    bool updated = false;
+    for (int z = st.z(); z < ed.z(); z++) {
+      for (int y = st.y(); y < ed.y(); y++) {
+        for (int x = st.x(); x < ed.x(); x++) {
+          Voxel* voxel = voxel_grid.get_ptr(x, y, z);
+
+          if (voxel->outside ||
+              voxel->update_num > option.voxel_max_update_num) {
+            continue;
+          }
 
-        Eigen::Vector2f image_p_f;
-        Eigen::Vector3f voxel_pos_c = w2c * voxel->pos;
+          Eigen::Vector2f image_p_f;
+          Eigen::Vector3f voxel_pos_c = w2c * voxel->pos;
 
-        // skip if the voxel is in the back of the camera
-        if (voxel_pos_c.z() < 0) {
-          continue;
-        }
+          // skip if the voxel is in the back of the camera
+          if (voxel_pos_c.z() < 0) {
+            continue;
+          }
 
-        camera.Project(voxel_pos_c, &image_p_f);
+          camera.Project(voxel_pos_c, &image_p_f);
 
-        float dist = InvalidSdf::kVal;
-        float d = 0.f;
-        if (image_p_f.x() < 0 || image_p_f.y() < 0 ||
-            depth.cols - 1 < image_p_f.x() || depth.rows - 1 < image_p_f.y()) {
-          continue;
-        } else {
-          d = SdfInterpolationNn(image_p_f, depth, {0, 0},
-                                 {depth.cols - 1, depth.rows - 1});
-        }
+          float dist = InvalidSdf::kVal;
+          float d = 0.f;
+          if (image_p_f.x() < 0 || image_p_f.y() < 0 ||
+              depth.cols - 1 < image_p_f.x() ||
+              depth.rows - 1 < image_p_f.y()) {
+            continue;
+          } else {
+            d = SdfInterpolationNn(image_p_f, depth, {0, 0},
+                                   {depth.cols - 1, depth.rows - 1});
+          }
 
-        if (d < std::numeric_limits<float>::epsilon()) {
-          continue;
-        }
+          if (d < std::numeric_limits<float>::epsilon()) {
+            continue;
+          }
 
-        float sign = std::signbit(d - voxel_pos_c.z()) ? -1.f : 1.f;
+          float sign = std::signbit(d - voxel_pos_c.z()) ? -1.f : 1.f;
 #if 0
-        // Don't use depth difference as distance
-        dist = d - voxel_pos_c.z();
+          // Don't use depth difference as distance
+          dist = d - voxel_pos_c.z();
 #else
-        // Use distance along ray
-        Eigen::Vector3f camera_p;
-        camera.Unproject({image_p_f.x(), image_p_f.y(), d}, &camera_p);
-        dist = (voxel_pos_c - camera_p).norm() * sign;
+          // Use distance along ray
+          Eigen::Vector3f camera_p;
+          camera.Unproject({image_p_f.x(), image_p_f.y(), d}, &camera_p);
+          dist = (voxel_pos_c - camera_p).norm() * sign;
 #endif
 
-        // skip if dist is truncated
-        if (option.use_truncation) {
-          if (dist >= -option.truncation_band) {
-            dist = std::min(1.0f, dist / option.truncation_band);
-          } else {
+          // skip if dist is truncated
+          if (option.use_truncation) {
+            if (dist >= -option.truncation_band) {
+              if (!option.update_free_space && dist > option.truncation_band) {
+                continue;
+              }
+              dist = std::min(1.0f, dist / option.truncation_band);
+            } else {
+              continue;
+            }
+          }
+
+          updated = true;
+          if (voxel->update_num < 1) {
+            voxel->sdf = dist;
+            voxel->update_num++;
             continue;
           }
-        }
 
-        if (voxel->update_num < 1) {
-          voxel->sdf = dist;
-          voxel->update_num++;
-          continue;
+          UpdateVoxelWeightedAverage(voxel, option, dist);
         }
-
-        UpdateVoxelWeightedAverage(voxel, option, dist);
       }
     }
-  }
+    // Bricks are visited by one task each
+    if (updated) {
+      voxel_grid.dirty_bricks().MarkBrick(st / kBrickSize);
+    }
+  });
 
   return true;
 }
@@ -419,31 +714,44 @@ bool FuseDepth(const Camera& camera, const Image1f& depth,
   Eigen::Matrix3f c2w_R = c2w.rotation();
 
 #if defined(_OPENMP) && defined(UGU_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
+#pragma omp parallel
 #endif
-  for (int y = 0; y < camera.height(); y++) {
-    for (int x = 0; x < camera.width(); x++) {
-      const float& d = depth.at<float>(y, x);
-      if (d < std::numeric_limits<float>::min()) {
-        continue;
-      }
-      const auto& n = normal.at<Vec3f>(y, x);
-      if (std::abs(1.f - (n[0] * n[0] + n[1] * n[1] + n[2] * n[2])) > 0.01f) {
-        continue;
-      }
+  {
+    // Threads may touch the same brick. Mark per thread and merge afterwards
+    DirtyBricks dirty_bricks;
+    dirty_bricks.Init(voxel_grid.voxel_num());
+#if defined(_OPENMP) && defined(UGU_USE_OPENMP)
+#pragma omp for schedule(dynamic, 1)
+#endif
+    for (int y = 0; y < camera.height(); y++) {
+      for (int x = 0; x < camera.width(); x++) {
+        const float& d = depth.at<float>(y, x);
+        if (d < std::numeric_limits<float>::min()) {
+          continue;
+        }
+        const auto& n = normal.at<Vec3f>(y, x);
+        if (std::abs(1.f - (n[0] * n[0] + n[1] * n[1] + n[2] * n[2])) >
+            0.01f) {
+          continue;
+        }
 
-      Eigen::Vector2f img_p{static_cast<float>(x), static_cast<float>(y)};
-      Eigen::Vector3f camera_p;
-      camera.Unproject(img_p, d, &camera_p);
-      Eigen::Vector3f wld_p = c2w * camera_p;
+        Eigen::Vector2f img_p{static_cast<float>(x), static_cast<float>(y)};
+        Eigen::Vector3f camera_p;
+        camera.Unproject(img_p, d, &camera_p);
+        Eigen::Vector3f wld_p = c2w * camera_p;
 
-      Eigen::Vector3f camera_n{n[0], n[1], n[2]};
-      Eigen::Vector3f wld_n = c2w_R * camera_n;
+        Eigen::Vector3f camera_n{n[0], n[1], n[2]};
+        Eigen::Vector3f wld_n = c2w_R * camera_n;
 
-      Eigen::Vector3f c = Eigen::Vector3f::Zero();
-      FusePointBase(wld_p, wld_n, with_color, c, option, voxel_grid,
-                    sample_num);
+        Eigen::Vector3f c = Eigen::Vector3f::Zero();
+        FusePointBase(wld_p, wld_n, with_color, c, option, voxel_grid,
+                      sample_num, dirty_bricks);
+      }
     }
+#if defined(_OPENMP) && defined(UGU_USE_OPENMP)
+#pragma omp critical
+#endif
+    voxel_grid.dirty_bricks().Merge(dirty_bricks);
   }
   return true;
 }
@@ -477,7 +785,7 @@ bool FusePointCloudImage(const Eigen::Affine3f c2w, const Image3f& point_cloud,
 
       Eigen::Vector3f c = Eigen::Vector3f::Zero();
       FusePointBase(wld_p, wld_n, with_color, c, option, voxel_grid,
-                    sample_num);
+                    sample_num, voxel_grid.dirty_bricks());
     }
   }
   return true;
@@ -501,99 +809,214 @@ bool FusePoints(const std::vector<Eigen::Vector3f>& points,
     if (with_color) {
       c = colors[i];
     }
-    FusePointBase(p, n, with_color, c, option, voxel_grid, sample_num);
+    FusePointBase(p, n, with_color, c, option, voxel_grid, sample_num,
+                  voxel_grid.dirty_bricks());
   }
 
   return true;
 }
 
-float SdfInterpolationNn(const Eigen::Vector2f& image_p,
-                         const ugu::Image1f& sdf,
-                         const Eigen::Vector2i& roi_min,
-                         const Eigen::Vector2i& roi_max) {
-  Eigen::Vector2i image_p_i(static_cast<int>(std::round(image_p.x())),
-                            static_cast<int>(std::round(image_p.y())));
-
-  // really need these?
-  if (image_p_i.x() < roi_min.x()) {
-    image_p_i.x() = roi_min.x();
-  }
-  if (image_p_i.y() < roi_min.y()) {
-    image_p_i.y() = roi_min.y();
-  }
-  if (roi_max.x() < image_p_i.x()) {
-    image_p_i.x() = roi_max.x();
+bool FuseDepth(const Camera& camera, const Image1f& depth,
+               const VoxelUpdateOption& option, TsdfVoxelGrid& voxel_grid,
+               const Image3b& color) {
+  if (!voxel_grid.initialized()) {
+    return false;
   }
-  if (roi_max.y() < image_p_i.y()) {
-    image_p_i.y() = roi_max.y();
+  if (option.truncation_band <= 0.f) {
+    LOGE("truncation_band must be positive %f\n", option.truncation_band);
+    return false;
   }
 
-  return sdf.at<float>(image_p_i.y(), image_p_i.x());
-}
+  const bool with_color = depth.cols == color.cols && depth.rows == color.rows;
+  const Eigen::Affine3f w2c = camera.w2c().cast<float>();
+
+  const Eigen::Vector3f x_axis_c = w2c.linear().col(0);
+
+  // Visit only the bricks intersecting the frustum and the band around depth
+  const Eigen::Vector3i& voxel_num = voxel_grid.voxel_num();
+  const std::vector<Eigen::Vector3i> bricks = FindFusionBricks(
+      camera, w2c, depth, option, voxel_num,
+      [&](int x, int y, int z) { return voxel_grid.get_pos(x, y, z); });
+
+  parallel_for(size_t(0), bricks.size(), [&](size_t i) {
+    const Eigen::Vector3i& st = bricks[i];
+    const Eigen::Vector3i ed = (st.array() + kBrickSize).min(voxel_num.array());
+    bool updated = false;
+    for (int z = st.z(); z < ed.z(); z++) {
+      for (int y = st.y(); y < ed.y(); y++) {
+        // Positions are not stored. Step along x in the camera coordinate.
+        const Eigen::Vector3f row_pos = voxel_grid.get_pos(0, y, z);
+        const Eigen::Vector3f row_pos_c = w2c * row_pos;
+        for (int x = st.x(); x < ed.x(); x++) {
+          TsdfVoxel* voxel = voxel_grid.get_ptr(x, y, z);
+          if (voxel->weight > option.voxel_max_update_num) {
+            continue;
+          }
 
-float SdfInterpolationBiliner(const Eigen::Vector2f& image_p,
-                              const ugu::Image1f& sdf,
-                              const Eigen::Vector2i& roi_min,
-                              const Eigen::Vector2i& roi_max) {
-  std::array<int, 2> pos_min = {{0, 0}};
-  std::array<int, 2> pos_max = {{0, 0}};
-  pos_min[0] = static_cast<int>(std::floor(image_p[0]));
-  pos_min[1] = static_cast<int>(std::floor(image_p[1]));
-  pos_max[0] = pos_min[0] + 1;
-  pos_max[1] = pos_min[1] + 1;
+          const Eigen::Vector3f voxel_pos_c =
+              row_pos_c +
+              x_axis_c * (voxel_grid.get_pos(x, y, z).x() - row_pos.x());
+          float dist;
+          Eigen::Vector2i pixel;
+          if (!ProjectiveTsdf(camera, depth, option.truncation_band,
+                              voxel_pos_c, &dist, &pixel) ||
+              (!option.update_free_space && dist >= 1.f)) {
+            continue;
+          }
+
+          Eigen::Vector3f c = Eigen::Vector3f::Zero();
+          if (with_color) {
+            const Vec3b& col = color.at<Vec3b>(pixel.y(), pixel.x());
+            c = {static_cast<float>(col[0]), static_cast<float>(col[1]),
+                 static_cast<float>(col[2])};
+          }
+          UpdateTsdfVoxel(voxel, option, dist, with_color, c);
+          updated = true;
+        }
+      }
+    }
+    if (updated) {
+      voxel_grid.dirty_bricks().MarkBrick(st / kBrickSize);
+    }
+  });
 
-  // really need these?
-  if (pos_min[0] < roi_min.x()) {
-    pos_min[0] = roi_min.x();
+  return true;
+}
+
+bool FusePoints(const std::vector<Eigen::Vector3f>& points,
+                const std::vector<Eigen::Vector3f>& normals,
+                const VoxelUpdateOption& option, TsdfVoxelGrid& voxel_grid,
+                const std::vector<Eigen::Vector3f>& colors, int sample_num) {
+  if (!voxel_grid.initialized()) {
+    return false;
   }
-  if (pos_min[1] < roi_min.y()) {
-    pos_min[1] = roi_min.y();
+  if (option.truncation_band <= 0.f) {
+    LOGE("truncation_band must be positive %f\n", option.truncation_band);
+    return false;
   }
-  if (roi_max.x() < pos_max[0]) {
-    pos_max[0] = roi_max.x();
+
+  const bool with_color = points.size() == colors.size();
+  const float band = option.truncation_band;
+  const Eigen::Vector3i& voxel_num = voxel_grid.voxel_num();
+
+  auto update = [&](const Eigen::Vector3i& voxel_idx, const Eigen::Vector3f& p,
+                    const Eigen::Vector3f& n, const Eigen::Vector3f& c) {
+    if (voxel_idx[0] < 0 || voxel_num[0] <= voxel_idx[0] || voxel_idx[1] < 0 ||
+        voxel_num[1] <= voxel_idx[1] || voxel_idx[2] < 0 ||
+        voxel_num[2] <= voxel_idx[2]) {
+      return;
+    }
+    const Eigen::Vector3f diff =
+        voxel_grid.get_pos(voxel_idx[0], voxel_idx[1], voxel_idx[2]) - p;
+    const float sign = std::signbit(diff.dot(n)) ? -1.f : 1.f;
+    const float dist = diff.norm() * sign;
+    if (dist < -band) {
+      return;
+    }
+    TsdfVoxel* voxel =
+        voxel_grid.get_ptr(voxel_idx[0], voxel_idx[1], voxel_idx[2]);
+    UpdateTsdfVoxel(voxel, option, std::min(1.0f, dist / band), with_color, c);
+    voxel_grid.dirty_bricks().Mark(voxel_idx[0], voxel_idx[1], voxel_idx[2]);
+  };
+
+  for (size_t i = 0; i < points.size(); i++) {
+    const Eigen::Vector3f& p = points[i];
+    const Eigen::Vector3f& n = normals[i];
+    const Eigen::Vector3f c =
+        with_color ? colors[i] : Eigen::Vector3f::Zero().eval();
+    if (sample_num < 1) {
+      // Splat to 26-neighbors
+      const Eigen::Vector3i voxel_idx = voxel_grid.get_index(p);
+      if (voxel_idx[0] < 0) {
+        continue;
+      }
+      for (int z = -1; z <= 1; z++) {
+        for (int y = -1; y <= 1; y++) {
+          for (int x = -1; x <= 1; x++) {
+            update(voxel_idx + Eigen::Vector3i(x, y, z), p, n, c);
+          }
+        }
+      }
+    } else {
+      // Sample along with normal direction
+      const float step = voxel_grid.resolution();
+      for (int k = -sample_num; k < sample_num + 1; k++) {
+        update(voxel_grid.get_index(p + n * (k * step)), p, n, c);
+      }
+    }
   }
-  if (roi_max.y() < pos_max[1]) {
-    pos_max[1] = roi_max.y();
+
+  return true;
+}
+
+bool ProjectiveTsdf(const Camera& camera, const Image1f& depth,
+                    float truncation_band, const Eigen::Vector3f& pos_c,
+                    float* tsdf, Eigen::Vector2i* pixel) {
+  // skip if the voxel is in the back of the camera
+  if (pos_c.z() < 0) {
+    return false;
   }
 
-  float local_u = image_p[0] - pos_min[0];
-  float local_v = image_p[1] - pos_min[1];
+  Eigen::Vector2f image_p_f;
+  camera.Project(pos_c, &image_p_f);
+  if (image_p_f.x() < 0 || image_p_f.y() < 0 ||
+      depth.cols - 1 < image_p_f.x() || depth.rows - 1 < image_p_f.y()) {
+    return false;
+  }
+  pixel->x() = static_cast<int>(std::round(image_p_f.x()));
+  pixel->y() = static_cast<int>(std::round(image_p_f.y()));
+  const float d = depth.at<float>(pixel->y(), pixel->x());
+  if (d < std::numeric_limits<float>::epsilon()) {
+    return false;
+  }
 
-  // bilinear interpolation of sdf
-  float dist =
-      (1.0f - local_u) * (1.0f - local_v) *
-          sdf.at<float>(pos_min[1], pos_min[0]) +
-      local_u * (1.0f - local_v) * sdf.at<float>(pos_max[1], pos_min[0]) +
-      (1.0f - local_u) * local_v * sdf.at<float>(pos_min[1], pos_max[0]) +
-      local_u * local_v * sdf.at<float>(pos_max[1], pos_max[0]);
+  // The distance along ray is not less than the depth difference
+  if (pos_c.z() - d > truncation_band) {
+    return false;
+  }
 
-  return dist;
+  // Use distance along ray
+  const float sign = std::signbit(d - pos_c.z()) ? -1.f : 1.f;
+  Eigen::Vector3f camera_p;
+  camera.Unproject({image_p_f.x(), image_p_f.y(), d}, &camera_p);
+  const float dist = (pos_c - camera_p).norm() * sign;
+  if (dist < -truncation_band) {
+    return false;
+  }
+  *tsdf = std::min(1.0f, dist / truncation_band);
+  return true;
 }
 
-void UpdateVoxelMax(ugu::Voxel* voxel, const ugu::VoxelUpdateOption& option,
-                    float sdf, bool with_color, const Eigen::Vector3f& col) {
-  (void)option;
-  if (sdf > voxel->sdf) {
-    voxel->sdf = sdf;
+void UpdateTsdfVoxel(TsdfVoxel* voxel, const VoxelUpdateOption& option,
+                     float sdf, bool with_color, const Eigen::Vector3f& col) {
+  constexpr uint16_t max_weight = std::numeric_limits<uint16_t>::max();
+  if (voxel->weight < 1) {
+    voxel->set_sdf(sdf);
     if (with_color) {
-      voxel->col = col;
+      voxel->set_col(col);
     }
-    voxel->update_num++;
+    voxel->weight = 1;
+    return;
   }
-}
 
-void UpdateVoxelWeightedAverage(ugu::Voxel* voxel,
-                                const ugu::VoxelUpdateOption& option, float sdf,
-                                bool with_color, const Eigen::Vector3f& col) {
-  const float& w = option.voxel_update_weight;
-  const float inv_denom = 1.0f / (w * (voxel->update_num + 1));
-  voxel->sdf = (w * voxel->update_num * voxel->sdf + w * sdf) * inv_denom;
-
-  if (with_color) {
-    voxel->col = (w * voxel->update_num * voxel->col + w * col) * inv_denom;
+  if (option.voxel_update == VoxelUpdate::kMax) {
+    if (sdf > voxel->get_sdf()) {
+      voxel->set_sdf(sdf);
+      if (with_color) {
+        voxel->set_col(col);
+      }
+      voxel->weight += voxel->weight < max_weight ? 1 : 0;
+    }
+  } else if (option.voxel_update == VoxelUpdate::kWeightedAverage) {
+    // option.voxel_update_weight is constant and canceled out
+    const float n = static_cast<float>(voxel->weight);
+    const float inv_denom = 1.0f / (n + 1.f);
+    voxel->set_sdf((n * voxel->get_sdf() + sdf) * inv_denom);
+    if (with_color) {
+      voxel->set_col((n * voxel->get_col() + col) * inv_denom);
+    }
+    voxel->weight += voxel->weight < max_weight ? 1 : 0;
   }
-
-  voxel->update_num++;
 }
 
 }  // namespace ugu